@@ -0,0 +1,264 @@
+#include <eyebot.h>
+
+// Timed runs per benchmark. The host is fast enough for more repetitions,
+// and CAMGet() runs at the camera's frame rate.
+#ifdef ESP_PLATFORM
+#define RUNS 20
+#define CAM_RUNS 5
+#else
+#define RUNS 200
+#define CAM_RUNS 10
+#endif
+
+#define MAX_RUNS_PER_FRAME 2000
+#define MAX_BLOBS 16
+#define MAX_MARKERS 8
+#define MARKER_SIZE 48
+#define TEXT_Y 130
+// Centre colour of the ball in the synthetic frame, segmented as colour class 0
+#define BALL_COLOR 0xD2C81E
+// A recorded drive whose first frame is also timed, when the flash holds one
+#define REPLAY_FILE "/drive.rec"
+
+typedef struct {
+  const char *name;
+  void (*fn)(void *arg);
+} Benchmark;
+
+typedef struct {
+  BYTE *gray;
+  int xs, ys;
+} MarkerInput;
+
+COLOR gColImg[QQVGA_PIXELS];
+COLOR gColOut[QQVGA_PIXELS];// Doubles as the QVGA gray image of the marker benchmark
+BYTE gGrayImg[QQVGA_PIXELS];
+BYTE gGrayOut[QQVGA_PIXELS];
+BYTE gPacked[QQVGA_PIXELS/8];
+BYTE gH[QQVGA_PIXELS], gS[QQVGA_PIXELS], gI[QQVGA_PIXELS];
+int gHist[256], gHistR[256], gHistG[256], gHistB[256];
+IPRun gRuns[MAX_RUNS_PER_FRAME];
+IPBlob gBlobs[MAX_BLOBS];
+IPMarker gMarkers[MAX_MARKERS];
+int gRunCount = 0;
+int gBands = 1;
+unsigned gSeed = 1;
+
+void bench_laplace(void *arg) { IPLaplace(gGrayImg, gGrayOut); }
+void bench_sobel(void *arg) { IPSobel(gGrayImg, gGrayOut); }
+void bench_col2gray(void *arg) { IPCol2Gray((BYTE*)gColImg, gGrayOut); }
+void bench_gray2col(void *arg) { IPGray2Col(gGrayImg, (BYTE*)gColOut); }
+void bench_rgb2col(void *arg) { IPRGB2Col(gH, gS, gI, (BYTE*)gColOut); }
+void bench_col2hsi(void *arg) { IPCol2HSI((BYTE*)gColImg, gH, gS, gI); }
+void bench_overlay(void *arg) { IPOverlay((BYTE*)gColImg, (BYTE*)gColImg, (BYTE*)gColOut); }
+void bench_overlay_gray(void *arg) { IPOverlayGray(gGrayImg, gGrayImg, RED, (BYTE*)gColOut); }
+void bench_histogram(void *arg) { IPHistogram(gGrayImg, gHist); }
+void bench_histogram_rgb(void *arg) { IPHistogramRGB((BYTE*)gColImg, gHistR, gHistG, gHistB); }
+void bench_histogram_roi(void *arg) { IPHistogramROI(gGrayImg, NULL, 40, 30, 80, 60, gHist); }
+void bench_otsu(void *arg) { IPOtsu(gHist); }
+void bench_threshold(void *arg) { IPThreshold(gGrayImg, 128, gGrayOut); }
+void bench_threshold_adaptive(void *arg) { IPThresholdAdaptive(gGrayImg, 7, 5, gGrayOut); }
+void bench_color_class_runs(void *arg) { gRunCount = IPColorClassRuns((BYTE*)gColImg, gRuns, MAX_RUNS_PER_FRAME); }
+void bench_color_class_blobs(void *arg) { IPColorClassBlobs(gRuns, gRunCount, gBlobs, MAX_BLOBS); }
+void bench_lcd_image(void *arg) { LCDImage((BYTE*)gColImg); }
+void bench_lcd_image_async(void *arg) { LCDImageAsync((BYTE*)gColImg); }
+void bench_lcd_image_gray(void *arg) { LCDImageGray(gGrayImg); }
+void bench_lcd_image_binary(void *arg) { LCDImageBinary(gGrayOut); }
+void bench_lcd_image_heat(void *arg) { LCDImagePalette(gGrayImg, LCD_PALETTE_HEAT); }
+void bench_lcd_image_labels(void *arg) { LCDImagePalette(gGrayImg, LCD_PALETTE_LABELS); }
+void bench_lcd_image_packed(void *arg) { LCDImagePacked(gPacked, WHITE, BLACK); }
+void bench_cam_get(void *arg) { CAMGet((BYTE*)gColOut); }
+void bench_cam_get_gray(void *arg) { CAMGetGray(gGrayOut); }
+
+void bench_marker_detect(void *arg)
+{
+  MarkerInput *input = (MarkerInput*)arg;
+  IPMarkerDetect(input->gray, input->xs, input->ys, gMarkers, MAX_MARKERS);
+}
+
+/*
+The order matters where one benchmark's output is the next one's input:
+IPRGB2Col() reassembles the planes from IPCol2HSI(), IPOtsu() reads the
+last histogram, the colour class runs feed the blobs and LCDImageBinary()
+shows the result of IPThresholdAdaptive().
+*/
+const Benchmark pIPBenchmarks[] = {
+  {"IPLaplace", bench_laplace},
+  {"IPSobel", bench_sobel},
+  {"IPCol2Gray", bench_col2gray},
+  {"IPGray2Col", bench_gray2col},
+  {"IPCol2HSI", bench_col2hsi},
+  {"IPRGB2Col", bench_rgb2col},
+  {"IPOverlay", bench_overlay},
+  {"IPOverlayGray", bench_overlay_gray},
+  {"IPHistogramRGB", bench_histogram_rgb},
+  {"IPHistogramROI", bench_histogram_roi},
+  {"IPHistogram", bench_histogram},
+  {"IPOtsu", bench_otsu},
+  {"IPThreshold", bench_threshold},
+  {"IPThresholdAdaptive", bench_threshold_adaptive},
+  {"IPColorClassRuns", bench_color_class_runs},
+  {"IPColorClassBlobs", bench_color_class_blobs},
+  {"LCDImage", bench_lcd_image},
+  {"LCDImageAsync", bench_lcd_image_async},
+  {"LCDImageGray", bench_lcd_image_gray},
+  {"LCDImageBinary", bench_lcd_image_binary},
+  {"LCDImagePalette", bench_lcd_image_heat},
+  {"LCDImagePaletteLabels", bench_lcd_image_labels},
+  {"LCDImagePacked", bench_lcd_image_packed}
+};
+
+// The IP functions that IPParallelFor() runs in bands, timed again in every
+// number of bands beyond one
+const Benchmark pParallelBenchmarks[] = {
+  {"IPLaplace", bench_laplace},
+  {"IPSobel", bench_sobel},
+  {"IPCol2Gray", bench_col2gray},
+  {"IPCol2HSI", bench_col2hsi},
+  {"IPThresholdAdaptive", bench_threshold_adaptive}
+};
+
+int random_byte()
+{
+  gSeed = gSeed*1103515245 + 12345;
+  return (gSeed >> 16) & 0xFF;
+}
+
+/*
+The synthetic frame is the same on every run and every platform: a lit
+gradient floor with pixel noise, two white lane markings, a yellow ball for
+the colour classes and a fiducial marker. It is rebuilt before every suite, as
+the camera frame overwrites it.
+*/
+void make_synthetic_frame()
+{
+  gSeed = 1;
+
+  for (int y = 0; y < CAMHEIGHT; y++)
+  for (int x = 0; x < CAMWIDTH; x++)
+  {
+    int v = 40 + x/4 + y/3 + (random_byte() & 15);
+    int lane1 = 30 + (CAMHEIGHT - y)/3, lane2 = 130 - (CAMHEIGHT - y)/3;
+    BYTE r = v, g = v, b = v + 10;
+
+    if (y > 40 && ((x >= lane1 && x < lane1 + 4) || (x >= lane2 && x < lane2 + 4)))
+      r = g = b = 230;
+
+    int dx = x - 110, dy = y - 50;
+    if (dx*dx + dy*dy < 15*15)
+    {
+      r = 200 + (random_byte() & 31);
+      g = 180 + (random_byte() & 31);
+      b = 30;
+    }
+
+    gColImg[y*CAMWIDTH + x] = IPPRGB2Col(r, g, b);
+  }
+
+  IPMarkerDraw(5, gGrayOut, MARKER_SIZE);
+  for (int y = 0; y < MARKER_SIZE; y++)
+  for (int x = 0; x < MARKER_SIZE; x++)
+  {
+    BYTE v = gGrayOut[y*MARKER_SIZE + x];
+    gColImg[(y + 10)*CAMWIDTH + x + 20] = IPPRGB2Col(v, v, v);
+  }
+}
+
+void print_status(const char *text)
+{
+  LCDSetColor(WHITE, BLACK);
+  LCDSetPrintf(TEXT_Y, 0, "%-26s", text);
+}
+
+void run(const char *name, const char *input, const char *res, void (*fn)(void *arg), void *arg, int runs)
+{
+  char labels[96];
+  BENCHStats stats;
+
+  snprintf(labels, sizeof(labels), "bench=%s input=%s res=%s bands=%d", name, input, res, gBands);
+  print_status(name);
+
+  if (BENCHRun(fn, arg, runs, &stats) == 0)
+    BENCHPrint(labels, &stats);
+}
+
+/*
+Every IP and LCD benchmark is run on the image in gColImg, at QQVGA, the
+only resolution of the IP functions. IPMarkerDetect() takes any image size
+and is also run on the gray image scaled up to QVGA.
+*/
+void run_frame(const char *input)
+{
+  IPCol2Gray((BYTE*)gColImg, gGrayImg);
+
+  // The packed image of LCDImagePacked() is the gray image cut at 128
+  memset(gPacked, 0, sizeof(gPacked));
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    if (gGrayImg[i] >= 128)
+      gPacked[i/8] |= 0x80 >> (i%8);
+
+  BYTE hue, sat, inten;
+  IPPCol2HSI(BALL_COLOR, &hue, &sat, &inten);
+  IPColorClassClear(-1);
+  IPColorClassSetHSI(0, hue - 15, hue + 15, sat - 60, sat + 60, inten - 60, inten + 60);
+
+  for (unsigned i = 0; i < sizeof(pIPBenchmarks)/sizeof(Benchmark); i++)
+    run(pIPBenchmarks[i].name, input, "160x120", pIPBenchmarks[i].fn, NULL, RUNS);
+
+  MarkerInput qqvga = {gGrayImg, CAMWIDTH, CAMHEIGHT};
+  run("IPMarkerDetect", input, "160x120", bench_marker_detect, &qqvga, RUNS);
+
+  MarkerInput qvga = {(BYTE*)gColOut, 2*CAMWIDTH, 2*CAMHEIGHT};
+  for (int y = 0; y < qvga.ys; y++)
+  for (int x = 0; x < qvga.xs; x++)
+    qvga.gray[y*qvga.xs + x] = gGrayImg[(y/2)*CAMWIDTH + x/2];
+
+  run("IPMarkerDetect", input, "320x240", bench_marker_detect, &qvga, RUNS);
+
+  for (gBands = 2; gBands <= IP_MAX_BANDS; gBands++)
+  {
+    IPSetBands(gBands);
+    for (unsigned i = 0; i < sizeof(pParallelBenchmarks)/sizeof(Benchmark); i++)
+      run(pParallelBenchmarks[i].name, input, "160x120", pParallelBenchmarks[i].fn, NULL, RUNS);
+  }
+
+  gBands = 1;
+  IPSetBands(gBands);
+}
+
+void run_suite()
+{
+  LCDClear();
+  LCDImageStart(0, 0, CAMWIDTH, CAMHEIGHT);
+  LCDSetFontSize(1);
+
+  run("CAMGet", "camera", "160x120", bench_cam_get, NULL, CAM_RUNS);
+  run("CAMGetGray", "camera", "160x120", bench_cam_get_gray, NULL, CAM_RUNS);
+
+  make_synthetic_frame();
+  run_frame("synthetic");
+
+  CAMGet((BYTE*)gColImg);
+  run_frame("camera");
+
+  if (CAMSetSource(CAM_RECORDING, REPLAY_FILE, CAM_PACE_FAST) == 0)
+  {
+    CAMGet((BYTE*)gColImg);
+    CAMSetSource(CAM_LIVE, NULL, CAM_PACE_FAST);
+    run_frame("replay");
+  }
+
+  print_status("Done, KEY1 to rerun");
+}
+
+void setup()
+{
+  EYEBOTInit();
+  run_suite();
+}
+
+void loop()
+{
+  if (KEYRead() & KEY1)
+    run_suite();
+}
@@ -5,7 +5,6 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #define INPUT_DELAY_MS 100
 #define GRAY_THRESHOLD 35
-#define GRAY_COUNT_THRESHOLD 10
 #define LANE_PX_WIDTH 20
 #define LANE_X_RANGE 5
 #define NUM_LONGEST_SETS 3
@@ -31,7 +30,7 @@ typedef struct {
 COLOR pColImg[QQVGA_PIXELS];
 BYTE pGrayImg[QQVGA_PIXELS];
 BYTE pBinImg[QQVGA_PIXELS];
-u16 pGrayLevelCount[256];
+int pGrayLevelCount[256];
 
 LaneSet *pSets = NULL;
 int gSetsMaxLen = -1;
@@ -223,11 +222,8 @@ void testing_screen()
     LCDImageStart(5, 5, CAMWIDTH, HEIGHT);
     LCDImage((BYTE*)col_subimg);
 
-    memset(pGrayLevelCount, 0, sizeof(pGrayLevelCount));
     memset(bin_subimg, 0, HEIGHT*CAMWIDTH);
 
-    int gray_level_count_max_idx = 0;
-
     for (int y = 0; y < HEIGHT; y++)
     for (int x = 0; x < CAMWIDTH; x++)
     {
@@ -243,11 +239,6 @@ void testing_screen()
           abs(gi - bi) < GRAY_THRESHOLD &&
           abs(bi - ri) < GRAY_THRESHOLD)
       {
-        pGrayLevelCount[gray_val]++;
-
-        if (pGrayLevelCount[gray_val] > pGrayLevelCount[gray_level_count_max_idx])
-          gray_level_count_max_idx = gray_val;
-
         bin_subimg[i] = 0xFF;// possible road pixel
       }
       else
@@ -256,27 +247,12 @@ void testing_screen()
       }
     }
 
-    int threshold_head_idx = gray_level_count_max_idx, threshold_tail_idx = 0;
-
-    for (int i = 1; i < gray_level_count_max_idx; i++)
-    {
-      if (pGrayLevelCount[i - 1] <= GRAY_COUNT_THRESHOLD && 
-          pGrayLevelCount[i] > GRAY_COUNT_THRESHOLD)
-      {
-        threshold_tail_idx = i;
-      }
-    }
-
-    for (int i = gray_level_count_max_idx; i < 255; i++)
-    {
-      if (pGrayLevelCount[i] >= GRAY_COUNT_THRESHOLD && 
-          pGrayLevelCount[i + 1] < GRAY_COUNT_THRESHOLD)
-      {
-        threshold_head_idx = i;
-      }
-    }
-
-    int threshold = sqrtf((powf(threshold_head_idx, 2) + powf(threshold_tail_idx, 2))/2);
+    // Only the gray (possible road) pixels take part in choosing the threshold
+    IPHistogramROI(pGrayImg, pBinImg, 0, Y_OFFSET, CAMWIDTH, HEIGHT, pGrayLevelCount);
+    int threshold = IPOtsu(pGrayLevelCount);
+    // No gray pixels at all, so none can be a lane
+    if (threshold < 0)
+      threshold = 255;
 
     for (int y = 0; y < HEIGHT; y++)
     for (int x = 0; x < CAMWIDTH; x++)
@@ -8,10 +8,23 @@
 #define QQVGA_WIDTH 160
 #define QQVGA_HEIGHT 120
 
+// Maximum number of colour class runs segmented per image
+#define MAX_RUNS 2048
+// Maximum number of blobs extracted per image
+#define MAX_BLOBS 4
+// Maximum distance in pixels a target can move between frames and still be tracked
+#define TRACK_GATE 30
+// Number of frames a target can go undetected before it is dropped
+#define TRACK_MAX_MISSES 5
+// Number of frames a target must be tracked before only its window is segmented
+#define MIN_TRACK_HITS 3
+// Pixels added around the predicted window of the target
+#define TRACK_WINDOW_MARGIN 10
+
 static COLOR col_img[QQVGA_PIXELS];
 static BYTE gray_img[QQVGA_PIXELS];
-static uint16_t hori_hist[QQVGA_WIDTH];
-static uint16_t vert_hist[QQVGA_HEIGHT];
+static IPRun runs[MAX_RUNS];
+static IPBlob blobs[MAX_BLOBS];
 static int gLCDWidth, gLCDHeight;
 
 enum {
@@ -27,6 +40,33 @@ int hue_threshold = 10, sat_threshold = 10, int_threshold = 10;
 // Linear and angular speed of the EyeBot during the seeking phase
 int lin_speed = 260, ang_speed = 120;
 
+/*
+Rebuilds colour class 0 of the colour lookup table from the selected colour and
+its HSI thresholds, but only if either has changed since the last rebuild.
+*/
+void update_color_class()
+{
+  static COLOR last_color = 0;
+  static int last_hue = -1, last_sat = -1, last_int = -1;
+
+  if (selected_color == last_color && hue_threshold == last_hue && 
+      sat_threshold == last_sat && int_threshold == last_int)
+    return;
+
+  BYTE h, s, i;
+  IPPCol2HSI(selected_color, &h, &s, &i);
+
+  IPColorClassClear(0);
+  IPColorClassSetHSI(0, h - hue_threshold, h + hue_threshold,
+                        s - sat_threshold, s + sat_threshold,
+                        i - int_threshold, i + int_threshold);
+
+  last_color = selected_color;
+  last_hue = hue_threshold;
+  last_sat = sat_threshold;
+  last_int = int_threshold;
+}
+
 void setup() {
   Serial.begin(115200);
 
@@ -50,144 +90,38 @@ void loop() {
       "RESELECT" button, and can initiate the seeking phase by
       pressing "START".
       */
-      const int MINUS_X1 = 5,
-                MINUS_X2 = MINUS_X1 + 40,
-                PLUS_X1 = 125,
-                PLUS_X2 = PLUS_X1 + 40;
-
-      const int LIN_Y1 = 20,
-                LIN_Y2 = LIN_Y1 + 40;
-      
-      const int ANG_Y1 = 82,
-                ANG_Y2 = ANG_Y1 + 40;
-        
-      const int RESELECT_X1 = 50,
-                RESELECT_X2 = RESELECT_X1 + 115,
-                RESELECT_Y1 = 144,
-                RESELECT_Y2 = RESELECT_Y1 + 40;
-      
-      const int START_X1 = 5,
-                START_X2 = START_X1 + 160,
-                START_Y1 = 191,
-                START_Y2 = START_Y1 + 107;
-
       LCDClear();
 
-      // Linear Speed Widget
       LCDSetFontSize(1);
       LCDSetColor();
       LCDSetPrintf(5, 5, "Linear Speed (mm/s)");
-      // Decrease
-      LCDArea(MINUS_X1, LIN_Y1, MINUS_X2, LIN_Y2, WHITE);
-      LCDArea(MINUS_X1 + 10, LIN_Y1 + 18, MINUS_X1 + 30, LIN_Y1 + 23, BLACK);
-      // Increase
-      LCDArea(PLUS_X1, LIN_Y1, PLUS_X2, LIN_Y2, WHITE);
-      LCDArea(PLUS_X1 + 10, LIN_Y1 + 18, PLUS_X1 + 30, LIN_Y1 + 23, BLACK);
-      LCDArea(PLUS_X1 + 18, LIN_Y1 + 10, PLUS_X1 + 23, LIN_Y1 + 32, BLACK);
-
-      // Angular Speed Widget
-      LCDSetFontSize(1);
-      LCDSetColor();
+      int lin = UIStepper(5, 20, 160, 40, lin_speed, 0, 2000, 10, BLACK, WHITE);
+
       LCDSetPrintf(67, 5, "Angular Speed (deg./s)");
-      // Decrease
-      LCDArea(MINUS_X1, ANG_Y1, MINUS_X2, ANG_Y2, WHITE);
-      LCDArea(MINUS_X1 + 10, ANG_Y1 + 18, MINUS_X1 + 30, ANG_Y1 + 23, BLACK);
-      // Increase
-      LCDArea(PLUS_X1, ANG_Y1, PLUS_X2, ANG_Y2, WHITE);
-      LCDArea(PLUS_X1 + 10, ANG_Y1 + 18, PLUS_X1 + 30, ANG_Y1 + 23, BLACK);
-      LCDArea(PLUS_X1 + 18, ANG_Y1 + 10, PLUS_X1 + 23, ANG_Y1 + 32, BLACK);        
+      int ang = UIStepper(5, 82, 160, 40, ang_speed, 0, 720, 10, BLACK, WHITE);
 
       BYTE r, g, b;
       IPPCol2RGB(selected_color, &r, &g, &b);
       LCDSetPrintf(129, 5, "Selected Col. (%u,%u,%u)", r, g, b);
-      LCDArea(5, RESELECT_Y1, 45, RESELECT_Y2, selected_color);
-      LCDArea(RESELECT_X1, RESELECT_Y1, RESELECT_X2, RESELECT_Y2, WHITE);
-      LCDSetFontSize(2);
-      LCDSetColor(BLACK, WHITE);
-      LCDSetPrintf(157, 61, "RESELECT");
-
-      LCDArea(START_X1, START_Y1, START_X2, START_Y2, WHITE);
-      LCDSetFontSize(4);
-      LCDSetPrintf(START_Y1 + 37, START_X1 + 23, "START");
+      LCDArea(5, 144, 45, 184, selected_color);
+      int reselect = UIButton(50, 144, 115, 40, "RESELECT", BLACK, WHITE);
+      int start = UIButton(5, 191, 160, 107, "START", BLACK, WHITE);
 
+      // The widgets flash by themselves, so the loop never waits on a touch
       while (screen == SCREEN_SETTINGS_1)
       {
-        LCDSetFontSize(2);
-        LCDSetColor();
-        LCDSetPrintf(34, 50, "%d ", lin_speed);
-        LCDSetPrintf(96, 50, "%d ", ang_speed);
-
-        int t_x, t_y;
-        KEYReadXY(&t_x, &t_y);
-
-        if (t_x >= MINUS_X1 && t_x <= MINUS_X2)
-        {
-          if (t_y >= LIN_Y1 && t_y <= LIN_Y2)
-          {
-            lin_speed -= 10;
+        int touched = UIUpdate();
 
-            if (lin_speed < 0)
-              lin_speed = 0;
-            
-            LCDArea(MINUS_X1 + 10, LIN_Y1 + 18, MINUS_X1 + 30, LIN_Y1 + 23, RED);
-            delay(INPUT_DELAY_MS);
-            LCDArea(MINUS_X1 + 10, LIN_Y1 + 18, MINUS_X1 + 30, LIN_Y1 + 23, BLACK);
-          }
-          else if (t_y >= ANG_Y1 && t_y <= ANG_Y2)
-          {
-            ang_speed -= 10;
-
-            if (ang_speed < 0)
-              ang_speed = 0;
-            
-            LCDArea(MINUS_X1 + 10, ANG_Y1 + 18, MINUS_X1 + 30, ANG_Y1 + 23, RED);
-            delay(INPUT_DELAY_MS);
-            LCDArea(MINUS_X1 + 10, ANG_Y1 + 18, MINUS_X1 + 30, ANG_Y1 + 23, BLACK);
-          }
-        }
-        else if (t_x >= PLUS_X1 && t_x <= PLUS_X2)
-        {
-          if (t_y >= LIN_Y1 && t_y <= LIN_Y2)
-          {
-            lin_speed += 10;
-
-            LCDArea(PLUS_X1 + 10, LIN_Y1 + 18, PLUS_X1 + 30, LIN_Y1 + 23, RED);
-            LCDArea(PLUS_X1 + 18, LIN_Y1 + 10, PLUS_X1 + 23, LIN_Y1 + 32, RED);
-            delay(INPUT_DELAY_MS);
-            LCDArea(PLUS_X1 + 10, LIN_Y1 + 18, PLUS_X1 + 30, LIN_Y1 + 23, BLACK);
-            LCDArea(PLUS_X1 + 18, LIN_Y1 + 10, PLUS_X1 + 23, LIN_Y1 + 32, BLACK);
-          }
-          else if (t_y >= ANG_Y1 && t_y <= ANG_Y2)
-          {
-            ang_speed += 10;
-
-            LCDArea(PLUS_X1 + 10, ANG_Y1 + 18, PLUS_X1 + 30, ANG_Y1 + 23, RED);
-            LCDArea(PLUS_X1 + 18, ANG_Y1 + 10, PLUS_X1 + 23, ANG_Y1 + 32, RED); 
-            delay(INPUT_DELAY_MS);
-            LCDArea(PLUS_X1 + 10, ANG_Y1 + 18, PLUS_X1 + 30, ANG_Y1 + 23, BLACK);
-            LCDArea(PLUS_X1 + 18, ANG_Y1 + 10, PLUS_X1 + 23, ANG_Y1 + 32, BLACK); 
-          }
-        }
-        else if (t_x >= RESELECT_X1 && t_x <= RESELECT_X2 && t_y >= RESELECT_Y1 && t_y <= RESELECT_Y2)
-        {
+        if (touched == reselect)
           screen = SCREEN_SETTINGS_2;
-
-          LCDSetFontSize(2);
-          LCDSetColor(RED, WHITE);
-          LCDSetPrintf(157, 61, "RESELECT");
-          delay(INPUT_DELAY_MS);
-        }
-        else if (t_x >= START_X1 && t_x <= START_X2 && t_y >= START_Y1 && t_y <= START_Y2)
-        {
+        else if (touched == start)
           screen = SCREEN_RUNNING;
-
-          LCDSetFontSize(4);
-          LCDSetColor(RED, WHITE);
-          LCDSetPrintf(START_Y1 + 37, START_X1 + 23, "START");
-          delay(INPUT_DELAY_MS);
-        }
       }
 
+      lin_speed = UIGetValue(lin);
+      ang_speed = UIGetValue(ang);
+      UIClear();
+
       break;
     }
     case SCREEN_SETTINGS_2:
@@ -325,28 +259,12 @@ void loop() {
 
         if (show_overlay)
         {
-          BYTE h1, s1, i1;
-          IPPCol2HSI(selected_color, &h1, &s1, &i1);
-
-          for (int y = 0; y < CAMHEIGHT; y++)
-          {
-            for (int x = 0; x < CAMWIDTH; x++)
-            {
-              BYTE h2, s2, i2;
-              IPPCol2HSI(col_img[y*CAMWIDTH + x], &h2, &s2, &i2);
+          update_color_class();
+          int run_count = IPColorClassRuns((BYTE*)col_img, runs, MAX_RUNS);
 
-              if (h2 >= (h1 - hue_threshold) && h2 <= (h1 + hue_threshold) &&
-                  s2 >= (s1 - sat_threshold) && s2 <= (s1 + sat_threshold) &&
-                  i2 >= (i1 - int_threshold) && i2 <= (i1 + int_threshold))
-              {
-                gray_img[y*CAMWIDTH + x] = 0xFF;             
-              }
-              else
-              {
-                gray_img[y*CAMWIDTH + x] = 0;
-              }
-            }
-          }
+          memset(gray_img, 0, QQVGA_PIXELS);
+          for (int r = 0; r < run_count; r++)
+            memset(gray_img + runs[r].y*CAMWIDTH + runs[r].x1, 0xFF, runs[r].x2 - runs[r].x1 + 1);
 
           LCDImageBinary((BYTE*)gray_img);
         }
@@ -483,9 +401,9 @@ void loop() {
     case SCREEN_RUNNING:
     {
       /*
-      To drive towards the largest object of the specified colour, a colour histogram is created 
-      which records the row and column in the image which cotains the highest number of pixels 
-      that fall within the colour threshold. A crosshair is generated from this row and column,
+      To drive towards the largest object of the specified colour, the image is segmented into
+      runs of pixels that fall within the colour threshold, and the runs are merged into blobs.
+      A crosshair is generated from the centroid of the largest blob,
       and depending how far to the left or right of the image the crosshair falls, the EyeBot turns
       to have the crosshair fall into the horizontal centre region. The EyeBot continues to drive
       forward while the crosshair lies within the horizontal centre region, and stops if it detects
@@ -502,6 +420,12 @@ void loop() {
                 RESET_Y1 = 2 * gLCDHeight / 3,
                 RESET_Y2 = gLCDHeight - 5;
 
+      /*
+      The frame, crosshair and distance are drawn off-screen and shown
+      together by LCDRefresh(), so the crosshair never flickers over a
+      bare frame, and only the changed regions are sent to the display.
+      */
+      LCDSetMode(LCD_NOAUTOREFRESH);
       LCDClear();
 
       LCDArea(RESET_X1, RESET_Y1, RESET_X2, RESET_Y2, RED);
@@ -512,39 +436,39 @@ void loop() {
 
       phase = PHASE_SEEKING;
 
+      update_color_class();
+      IPTrackInit(IP_TRACK_CENTROID, TRACK_GATE, TRACK_MAX_MISSES);
+
+      // Current drive command, starting from an impossible one
+      int drive_lin = -1, drive_ang = -1;
+
       while (screen == SCREEN_RUNNING)
       {
         CAMGet((BYTE*)col_img);
 
-        memset(hori_hist, 0, QQVGA_WIDTH*sizeof(uint16_t));
-        memset(vert_hist, 0, QQVGA_HEIGHT*sizeof(uint16_t));
-
-        BYTE h1, s1, i1;
-        IPPCol2HSI(selected_color, &h1, &s1, &i1);
-
-        int hori_hist_max_idx = 0, vert_hist_max_idx = 0;
-
-        for (int y = 0; y < QQVGA_HEIGHT; y++)
+        /*
+        Once the target has been tracked for a few frames, only the window
+        it is predicted to move into is segmented.
+        */
+        IPTrackInfo track;
+        int win_x = 0, win_y = 0, win_width = CAMWIDTH, win_height = CAMHEIGHT;
+        if (IPTrackGet(&track, 1) > 0 && track.hits >= MIN_TRACK_HITS)
+          IPTrackWindow(track.id, TRACK_WINDOW_MARGIN, &win_x, &win_y, &win_width, &win_height);
+
+        int run_count = IPColorClassRunsROI((BYTE*)col_img, win_x, win_y, win_width, win_height, runs, MAX_RUNS);
+        int blob_count = IPColorClassBlobs(runs, run_count, blobs, MAX_BLOBS);
+
+        /*
+        Steering follows the tracked target rather than the raw detection, so a
+        target that flickers out for a frame or two doesn't jerk the EyeBot around.
+        With nothing in view, the target defaults to the top left corner.
+        */
+        int target_x = 0, target_y = 0;
+        IPTrack(blobs, blob_count);
+        if (IPTrackGet(&track, 1) > 0)
         {
-          for (int x = 0; x < QQVGA_WIDTH; x++)
-          {
-            BYTE h2, s2, i2;
-            IPPCol2HSI(col_img[y*QQVGA_WIDTH + x], &h2, &s2, &i2);
-
-            if (h2 >= (h1 - hue_threshold) && h2 <= (h1 + hue_threshold) &&
-                s2 >= (s1 - sat_threshold) && s2 <= (s1 + sat_threshold) &&
-                i2 >= (i1 - int_threshold) && i2 <= (i1 + int_threshold))
-            {
-              vert_hist[y]++;
-              hori_hist[x]++;
-            }
-
-            if (hori_hist[x] > hori_hist[hori_hist_max_idx])
-              hori_hist_max_idx = x;
-          }
-
-          if (vert_hist[y] > vert_hist[vert_hist_max_idx])
-            vert_hist_max_idx = y;
+          target_x = track.cx;
+          target_y = track.cy;
         }
 
         int dist = PSDGet(PSD_FRONT);
@@ -555,12 +479,22 @@ void loop() {
           {           
             if (dist > MIN_DIST)
             {
-              if (hori_hist_max_idx <= QQVGA_WIDTH / 4)// If in first horizontal quadrant
-                VWSetSpeed(0, -1*ang_speed);
-              else if (hori_hist_max_idx >= 3 * QQVGA_WIDTH / 4)// If in the last horizontal quadrant
-                VWSetSpeed(0, ang_speed);
+              int lin = 0, ang = 0;
+
+              if (target_x <= QQVGA_WIDTH / 4)// If in first horizontal quadrant
+                ang = -1*ang_speed;
+              else if (target_x >= 3 * QQVGA_WIDTH / 4)// If in the last horizontal quadrant
+                ang = ang_speed;
               else
-                VWSetSpeed(lin_speed, 0);
+                lin = lin_speed;
+
+              // VWSetSpeed() briefly stops the motors, so it is only called on a change
+              if (lin != drive_lin || ang != drive_ang)
+              {
+                VWSetSpeed(lin, ang);
+                drive_lin = lin;
+                drive_ang = ang;
+              }
             }
             else
               phase = PHASE_COLLISION;
@@ -583,14 +517,16 @@ void loop() {
           }
         }
 
+        // The crosshair is drawn into the image, in the same transfer
+        LCDOverlayArea(target_x, 0, target_x + 1, CAMHEIGHT, RED);
+        LCDOverlayArea(0, target_y, CAMWIDTH, target_y + 1, RED);
         LCDImageStart(5, 5, CAMWIDTH, CAMHEIGHT);
         LCDImage((BYTE*)col_img);
-        LCDArea(5 + hori_hist_max_idx, 5, 6 + hori_hist_max_idx, 5 + CAMHEIGHT, RED);
-        LCDArea(5, 5 + vert_hist_max_idx, 5 + CAMWIDTH, 6 + vert_hist_max_idx, RED);
 
         LCDSetFontSize(2);
         LCDSetColor();
         LCDSetPrintf(CAMHEIGHT + 10, 5, "DIST: %d mm ", dist);
+        LCDRefresh();
 
         int t_x, t_y;
         KEYReadXY(&t_x, &t_y);
@@ -605,10 +541,12 @@ void loop() {
 
           LCDSetPrintf(RESET_Y1 + 20, RESET_X1 + 23, "TOUCH");
           LCDSetPrintf(RESET_Y1 + 55, RESET_X1 + 23, "RESET");
+          LCDRefresh();
           delay(INPUT_DELAY_MS);
         }
       }
 
+      LCDSetMode(LCD_AUTOREFRESH);
       break;
     }
     default:
@@ -0,0 +1,67 @@
+#include <eyebot.h>
+
+#define IMG_X 5
+#define IMG_Y 5
+// Maximum number of markers detected and listed per image
+#define MAX_MARKERS 6
+// Height in pixels of a line of text at font size 2
+#define LINE_HEIGHT 20
+
+BYTE gGrayImg[QQVGA_PIXELS];
+IPMarker gMarkers[MAX_MARKERS];
+
+void setup() {
+  EYEBOTInit();
+  LCDClear();
+  LCDImageStart(IMG_X, IMG_Y, CAMWIDTH, CAMHEIGHT);
+}
+
+/*
+Each camera image is searched for fiducial markers, which are outlined over
+the image in red, with a green dot on each marker's top left corner. The ID
+and centre of each marker is listed beneath the image, along with the time
+taken by the detection itself.
+*/
+void loop() {
+  CAMGetGray(gGrayImg);
+
+  unsigned long start_us = micros();
+  int count = IPMarkerDetect(gGrayImg, CAMWIDTH, CAMHEIGHT, gMarkers, MAX_MARKERS);
+  unsigned long delta_us = micros() - start_us;
+
+  LCDImageGray(gGrayImg);
+
+  for (int i = 0; i < count; i++)
+  {
+    IPMarker *marker = &gMarkers[i];
+
+    for (int k = 0; k < 4; k++)
+    {
+      int next = (k + 1) % 4;
+      LCDLine(IMG_X + (int)marker->x[k], IMG_Y + (int)marker->y[k],
+              IMG_X + (int)marker->x[next], IMG_Y + (int)marker->y[next], RED);
+    }
+    LCDCircle(IMG_X + (int)marker->x[0], IMG_Y + (int)marker->y[0], 2, GREEN);
+  }
+
+  const int TEXT_Y = IMG_Y + CAMHEIGHT + 10;
+
+  LCDSetFontSize(2);
+  LCDSetColor(WHITE, BLACK);
+  LCDSetPrintf(TEXT_Y, IMG_X, "DETECT: %.1f ms ", delta_us / 1000.0f);
+
+  for (int i = 0; i < MAX_MARKERS; i++)
+  {
+    int row = TEXT_Y + (i + 1)*LINE_HEIGHT;
+
+    if (i < count)
+    {
+      IPMarker *marker = &gMarkers[i];
+      int cx = (int)((marker->x[0] + marker->x[1] + marker->x[2] + marker->x[3]) / 4);
+      int cy = (int)((marker->y[0] + marker->y[1] + marker->y[2] + marker->y[3]) / 4);
+      LCDSetPrintf(row, IMG_X, "ID %2d: %3d,%3d ", marker->id, cx, cy);
+    }
+    else
+      LCDSetPrintf(row, IMG_X, "              ");
+  }
+}
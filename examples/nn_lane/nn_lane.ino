@@ -0,0 +1,171 @@
+#include <eyebot.h>
+#include <FFat.h>
+#include <esp_heap_caps.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// Network file on the FATFS partition
+#define NETWORK_FILE "/lane.ebnn"
+#define IMG_X 5
+#define IMG_Y 5
+#define MAX_LIN_SPEED 150// mm/s
+#define MAX_ANG_SPEED 60// degrees/s
+// Number of speed steps on either side of driving straight
+#define STEERING_STEPS 10
+
+BYTE gGrayImg[QQVGA_PIXELS];
+BYTE gMask[QQVGA_PIXELS];
+NNModel gModel;
+bool gDriving = false;
+int gLastKeys = NOKEY;
+int gLinSpeed = 0, gAngSpeed = 0;
+
+static const char *layerName(int type)
+{
+  static const char *names[] = {"conv2d", "depthwise", "maxpool", "avgpool", "relu", "dense"};
+  return type >= 0 && type <= NN_DENSE ? names[type] : "unknown";
+}
+
+/*
+The whole network file is read into 16 byte aligned memory, so that the
+vectorised kernels can be used on its weights.
+*/
+static bool loadNetwork()
+{
+  if (!FFat.begin())
+    return false;
+
+  File file = FFat.open(NETWORK_FILE);
+  if (!file)
+    return false;
+
+  int size = file.size();
+  BYTE *data = (BYTE*)heap_caps_aligned_alloc(16, size, MALLOC_CAP_8BIT);
+  if (!data || (int)file.read(data, size) != size)
+  {
+    heap_caps_free(data);
+    file.close();
+    return false;
+  }
+  file.close();
+
+  // The model keeps using the file's memory once it is loaded
+  if (NNLoad(&gModel, data, size) != 0)
+  {
+    heap_caps_free(data);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+On the first image the vectorised kernels are checked against the reference
+kernels, and the time taken by each layer is written to the serial port.
+*/
+static void reportNetwork()
+{
+  NNRun(&gModel);
+
+  int outputs = gModel.outWidth*gModel.outHeight*gModel.outChannels;
+  int8_t *optimised = (int8_t*)malloc(outputs);
+  memcpy(optimised, gModel.output, outputs);
+  uint32_t layer_us[NN_MAX_LAYERS];
+  memcpy(layer_us, gModel.layerMicros, sizeof(layer_us));
+
+  NNRunReference(&gModel);
+  bool exact = memcmp(optimised, gModel.output, outputs) == 0;
+  free(optimised);
+
+  Serial.printf("bit_exact=%d simd=%d\n", exact, gModel.simd);
+  for (int i = 0; i < gModel.header->layerCount; i++)
+    Serial.printf("layer=%d type=%s us=%u us_reference=%u\n", i, layerName(gModel.layers[i].type),
+                  layer_us[i], gModel.layerMicros[i]);
+}
+
+void setup() {
+  Serial.begin(115200);
+  EYEBOTInit();
+  LCDClear();
+
+  if (!loadNetwork())
+  {
+    LCDSetFontSize(2);
+    LCDSetColor(RED, BLACK);
+    LCDSetPrintf(IMG_Y, IMG_X, "NO NETWORK");
+    LCDSetPrintf(IMG_Y + 20, IMG_X, NETWORK_FILE);
+    while (true)
+      delay(1000);
+  }
+
+  CAMGetGray(gGrayImg);
+  NNInputGray(&gModel, gGrayImg, CAMWIDTH, CAMHEIGHT);
+  reportNetwork();
+}
+
+/*
+A network ending in a dense layer gives a steering value that drives the EyeBot,
+with its steering value shown as a bar beneath the camera image. Any other
+network is treated as lane segmentation, and its mask is shown instead of
+the camera image. The left button starts and stops driving.
+*/
+void loop() {
+  CAMGetGray(gGrayImg);
+
+  unsigned long start_us = micros();
+  NNInputGray(&gModel, gGrayImg, CAMWIDTH, CAMHEIGHT);
+  NNRun(&gModel);
+  unsigned long delta_us = micros() - start_us;
+
+  bool segmentation = gModel.outWidth > 1 || gModel.outHeight > 1;
+  const int TEXT_Y = IMG_Y + CAMHEIGHT + 30;
+
+  if (segmentation)
+  {
+    NNMask(&gModel, gMask);
+    LCDImageStart(IMG_X, IMG_Y, gModel.outWidth, gModel.outHeight);
+    if (gModel.outChannels == 1)
+      LCDImageGray(gMask);
+    else
+    {
+      // Spread the class indices over the gray range
+      for (int i = 0; i < gModel.outWidth*gModel.outHeight; i++)
+        gMask[i] = gMask[i]*255 / (gModel.outChannels - 1);
+      LCDImageGray(gMask);
+    }
+  }
+  else
+  {
+    float steering = NNSteering(&gModel);
+    int bar_x = IMG_X + CAMWIDTH/2 + (int)(steering*CAMWIDTH/2);
+
+    LCDImageStart(IMG_X, IMG_Y, CAMWIDTH, CAMHEIGHT);
+    LCDImageGray(gGrayImg);
+    LCDArea(IMG_X, IMG_Y + CAMHEIGHT + 5, IMG_X + CAMWIDTH, IMG_Y + CAMHEIGHT + 20, BLACK);
+    LCDArea(MIN(bar_x, IMG_X + CAMWIDTH/2), IMG_Y + CAMHEIGHT + 5,
+            MAX(bar_x, IMG_X + CAMWIDTH/2), IMG_Y + CAMHEIGHT + 20, GREEN);
+
+    int keys = KEYRead();
+    if ((keys & KEY1) && !(gLastKeys & KEY1))
+      gDriving = !gDriving;
+    gLastKeys = keys;
+
+    int step = (int)roundf(steering*STEERING_STEPS);
+    int lin = gDriving ? MAX_LIN_SPEED*(STEERING_STEPS - abs(step)) / STEERING_STEPS : 0;
+    int ang = gDriving ? MAX_ANG_SPEED*step / STEERING_STEPS : 0;
+
+    // VWSetSpeed() briefly stops the motors, so it is only called on a change
+    if (lin != gLinSpeed || ang != gAngSpeed)
+    {
+      VWSetSpeed(lin, ang);
+      gLinSpeed = lin;
+      gAngSpeed = ang;
+    }
+  }
+
+  LCDSetFontSize(2);
+  LCDSetColor(WHITE, BLACK);
+  LCDSetPrintf(TEXT_Y, IMG_X, "NN: %.1f ms ", delta_us / 1000.0f);
+  LCDSetPrintf(TEXT_Y + 20, IMG_X, gDriving ? "DRIVING " : "STOPPED ");
+}
@@ -0,0 +1,120 @@
+#include <eyebot.h>
+
+#define FRAMES 3
+#define QUEUE_SIZE 1
+#define STATS_MS 1000
+#define INPUT_DELAY_MS 20
+#define TEXT_Y 130
+#define LINE_HEIGHT 10
+
+typedef struct {
+  COLOR image[QQVGA_PIXELS];
+  BYTE gray[QQVGA_PIXELS];
+  BYTE edges[QQVGA_PIXELS];
+  unsigned long captured_us;
+} Frame;
+
+const char *pStageNames[] = {"capture", "process", "display"};
+int gPolicy = PIPE_DROP_OLDEST;
+unsigned long gLastStats = 0;
+unsigned long gLastDisplay = 0;
+int gLastFrames[3];
+
+int capture_stage(void *frame, void *arg)
+{
+  Frame *f = (Frame*)frame;
+  CAMGet((BYTE*)f->image);
+  f->captured_us = micros();
+  return 0;
+}
+
+int process_stage(void *frame, void *arg)
+{
+  Frame *f = (Frame*)frame;
+  IPCol2Gray((BYTE*)f->image, f->gray);
+  IPSobel(f->gray, f->edges);
+  return 0;
+}
+
+/*
+The display stage is the only one that touches the LCD, as the LCD
+functions keep their cursor and colours in shared state. The latency is the
+time from the end of the capture to the frame being shown.
+*/
+int display_stage(void *frame, void *arg)
+{
+  Frame *f = (Frame*)frame;
+  unsigned long now = micros();
+
+  LCDImageGray(f->edges);
+
+  float fps = gLastDisplay ? 1e6f / (now - gLastDisplay) : 0;
+  gLastDisplay = now;
+
+  LCDSetFontSize(1);
+  LCDSetColor(WHITE, BLACK);
+  LCDSetPrintf(TEXT_Y, 0, "%-12s %5.1f fps    ", gPolicy == PIPE_BLOCK ? "BLOCK" : "DROP OLDEST", fps);
+  LCDSetPrintf(TEXT_Y + LINE_HEIGHT, 0, "latency %6.1f ms    ", (now - f->captured_us) / 1000.0f);
+  LCDSetPrintf(TEXT_Y + 3*LINE_HEIGHT, 0, "KEY1 switches policy");
+  return 0;
+}
+
+/*
+Capturing and displaying share core 0, as both mostly wait for the camera
+and the SPI transfers, which leaves core 1 to the image processing.
+*/
+void start_pipeline()
+{
+  PIPEInit(FRAMES, sizeof(Frame), QUEUE_SIZE, gPolicy);
+  PIPEAddStage(pStageNames[0], capture_stage, NULL, 0);
+  PIPEAddStage(pStageNames[1], process_stage, NULL, 1);
+  PIPEAddStage(pStageNames[2], display_stage, NULL, 0);
+
+  gLastDisplay = 0;
+  memset(gLastFrames, 0, sizeof(gLastFrames));
+  PIPEStart();
+}
+
+void print_stats()
+{
+  int frames, drops;
+
+  for (int i = 0; i < 3; i++)
+  {
+    PIPEGetStats(i, &frames, &drops);
+    Serial.printf("stage=%s policy=%s frames=%d drops=%d fps=%.1f\n", pStageNames[i],
+                  gPolicy == PIPE_BLOCK ? "block" : "drop_oldest", frames, drops,
+                  (frames - gLastFrames[i])*1000.0f / STATS_MS);
+    gLastFrames[i] = frames;
+  }
+}
+
+void setup()
+{
+  EYEBOTInit();
+  LCDClear();
+  LCDImageStart(0, 0, CAMWIDTH, CAMHEIGHT);
+  start_pipeline();
+  gLastStats = millis();
+}
+
+void loop()
+{
+  if (KEYRead() & KEY1)
+  {
+    PIPEStop();
+    gPolicy = gPolicy == PIPE_BLOCK ? PIPE_DROP_OLDEST : PIPE_BLOCK;
+    start_pipeline();
+
+    while (KEYRead() & KEY1)
+      delay(INPUT_DELAY_MS);
+  }
+
+  if (millis() - gLastStats >= STATS_MS)
+  {
+    gLastStats += STATS_MS;
+    print_stats();
+  }
+
+  delay(INPUT_DELAY_MS);
+}
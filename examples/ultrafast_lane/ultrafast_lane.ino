@@ -7,6 +7,17 @@
 // This defines how many pixels a line should consist before it
 // will be considered as being part of a lane marking.
 #define MIN_LINE_LEN 6
+// The navigation screen prints its profile to the serial console every this many frames
+#define PROFILE_PRINT_FRAMES 100
+// The events of the last drive are written to this file on the flash file system
+#define TRACE_FILE "/trace.bin"
+// The gray frames of the last drive are recorded to this file, with the pose of each
+#define RECORD_FILE "/drive.rec"
+// Bands of rows the blur and Sobel gradients are split into, one per core
+#define PIPELINE_BANDS 2
+// Per-frame scratch in internal SRAM: the blur's transposed image, the
+// gradient magnitudes and directions, and the matched line patterns
+#define ARENA_SRAM_SIZE (4*QQVGA_PIXELS + 4*ARENA_ALIGN)
 
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -47,7 +58,7 @@ typedef struct {
 } Line;
 
 u8 *pPatternBins = NULL;
-u8 pBuffer[QQVGA_SIZE];//General purpose buffer
+u8 pBuffer[QQVGA_SIZE];//Lines found in a frame
 COLOR pColImg[QQVGA_PIXELS];
 BYTE pGrayImg[QQVGA_PIXELS];
 BYTE pEdgeImg[QQVGA_PIXELS];
@@ -308,10 +319,11 @@ accomodates RGB images.
 //! \param[in] in           source buffer
 //! \param[in,out] out      target buffer
 //! \param[in] w            image width
-//! \param[in] h            image height
+//! \param[in] first        first row to blur
+//! \param[in] last         row after the last to blur
 //! \param[in] r            box dimension
 //!
-void horizontal_blur(BYTE in[], BYTE out[], int w, int h, int r)
+void horizontal_blur_rows(BYTE in[], BYTE out[], int w, int first, int last, int r)
 {
   Kernel kernel = kSmall;
 
@@ -320,7 +332,7 @@ void horizontal_blur(BYTE in[], BYTE out[], int w, int h, int r)
   else kernel = kLarge;
 
   const float iarr = 1.f/(r+r+1);
-  for (int i = 0; i < h; i++)
+  for (int i = first; i < last; i++)
   {
     const int begin = i*w;
     const int end = begin+w; 
@@ -433,6 +445,27 @@ void horizontal_blur(BYTE in[], BYTE out[], int w, int h, int r)
   }
 }
 
+typedef struct {
+  BYTE *in, *out;
+  int w, r;
+} BlurBand;
+
+void horizontal_blur_band(int first, int last, void *arg)
+{
+  BlurBand *band = (BlurBand*)arg;
+  horizontal_blur_rows(band->in, band->out, band->w, first, last, band->r);
+}
+
+/*
+Rows are blurred independently of each other, so the image is split into
+bands of rows on both cores by IPParallelFor(), without any halo.
+*/
+void horizontal_blur(BYTE in[], BYTE out[], int w, int h, int r)
+{
+  BlurBand band = {in, out, w, r};
+  IPParallelFor(h, 0, horizontal_blur_band, &band);
+}
+
 /*
 This function was adapted from https://github.com/bfraboni/FastGaussianBlur
 */ 
@@ -478,11 +511,14 @@ This function was adapted from https://github.com/bfraboni/FastGaussianBlur
 */ 
 void gaussian_blur(BYTE in[], BYTE out[], int width, int height, float sigma)
 {
+  PROF_SCOPE("blur");
+
   // compute box kernel sizes
   int boxes[3];
   sigma_to_box_radius(boxes, sigma, 3);
 
-  u8 *tmp = pBuffer;
+  u8 *tmp = (u8*)ARENAAlloc(width*height, ARENA_SRAM);
+  assert(tmp);
 
   // Perform 3 horizontal blur passes, since the original author of the
   // Fast Gaussian Blur algorithm stated that 3 should be sufficient for
@@ -515,7 +551,7 @@ although possibly imperfectly.
 The out paramter dir_out[] contains effectively enums for the 4 possible general directions of a
 gradient found in the corresponding index in the other out parameter magniture_out[].
 */
-void sobel_gradients(BYTE in[], int width, int height, BYTE magnitude_out[], BYTE dir_out[])
+void sobel_gradients_rows(BYTE in[], int width, int first, int last, BYTE magnitude_out[], BYTE dir_out[])
 {
   // X Gradient Kernel
   const int KX[3][3] = {
@@ -536,7 +572,7 @@ void sobel_gradients(BYTE in[], int width, int height, BYTE magnitude_out[], BYT
               angle_2 = angle_1 + M_PI / 4,
               angle_3 = angle_2 + M_PI / 4;
 
-  for (int y = 0; y < height - 2; y++)
+  for (int y = first; y < last; y++)
   for (int x = 0; x < width - 2; x++)
   {
     int hori_sum = 0, vert_sum = 0;
@@ -570,6 +606,24 @@ void sobel_gradients(BYTE in[], int width, int height, BYTE magnitude_out[], BYT
   }
 }
 
+typedef struct {
+  BYTE *in, *magnitude_out, *dir_out;
+  int width;
+} SobelBand;
+
+void sobel_gradients_band(int first, int last, void *arg)
+{
+  SobelBand *band = (SobelBand*)arg;
+  sobel_gradients_rows(band->in, band->width, first, last, band->magnitude_out, band->dir_out);
+}
+
+// Each output row reads the two input rows below it as well
+void sobel_gradients(BYTE in[], int width, int height, BYTE magnitude_out[], BYTE dir_out[])
+{
+  SobelBand band = {in, magnitude_out, dir_out, width};
+  IPParallelFor(height - 2, 2, sobel_gradients_band, &band);
+}
+
 /*
 This Canny Edge Detector was implemented based on the information in
 https://docs.opencv.org/4.x/da/d22/tutorial_py_canny.html and
@@ -581,13 +635,16 @@ Line Detector.
 */
 void canny_edge_detector(BYTE gray_in[], BYTE gray_out[], int width, int height)
 {
+  PROF_SCOPE("canny");
+
   //1. Denoise image (Gaussian blur)
   gaussian_blur(gray_in, gray_out, width, height, gDenoiseSigma);
   //memcpy(gray_out, gray_in, width*height);
 
   //2. Find intensity gradients (Sobel)
-  BYTE *grad_magns = pBuffer;
-  BYTE *grad_dirs = pBuffer + width*height;
+  BYTE *grad_magns = (BYTE*)ARENAAlloc(width*height, ARENA_SRAM);
+  BYTE *grad_dirs = (BYTE*)ARENAAlloc(width*height, ARENA_SRAM);
+  assert(grad_magns && grad_dirs);
   sobel_gradients(gray_out, width, height, grad_magns, grad_dirs);
 
   //3. Non-maximum Suppression
@@ -880,8 +937,11 @@ are detected within the edge image.
 */
 int ultrafast_line_detector(int width, int height, int max_line_count, Line lines[])
 {
+  PROF_SCOPE("lines");
+
   int lineCount = 0;
-  u8 *matchedPatterns = (u8*)pGrayImg;// Reuse the memory from the gray image
+  u8 *matchedPatterns = (u8*)ARENAAlloc(width*height, ARENA_SRAM);
+  assert(matchedPatterns);
 
   for (int y = 0; y < height; y += 4)
   for (int x = 0; x < width; x += 4)
@@ -1109,6 +1169,67 @@ void settings_screen()
   }
 }
 
+/*
+The stages of the line detection pipeline depend on this program's buffers
+and settings, so they are benchmarked here rather than by the benchmarks
+example. Each stage is timed on the current region-of-interest of the
+camera image with BENCHRun(), and printed to the serial console as one line
+of key=value pairs. The line detector runs last, on the edges of the last
+Canny run. Every run is a frame of its own for the scratch arena.
+*/
+#define BENCH_RUNS 20
+
+typedef struct {
+  BYTE *gray;
+  int width, height;
+} BenchInput;
+
+void bench_gaussian_blur(void *arg)
+{
+  BenchInput *in = (BenchInput*)arg;
+  ARENAReset();
+  gaussian_blur(in->gray, pEdgeImg, in->width, in->height, gDenoiseSigma);
+}
+
+void bench_canny_edge_detector(void *arg)
+{
+  BenchInput *in = (BenchInput*)arg;
+  ARENAReset();
+  canny_edge_detector(in->gray, pEdgeImg, in->width, in->height);
+}
+
+void bench_ultrafast_line_detector(void *arg)
+{
+  BenchInput *in = (BenchInput*)arg;
+  ARENAReset();
+  ultrafast_line_detector(in->width, in->height, sizeof(pBuffer)/sizeof(Line), (Line*)pBuffer);
+}
+
+void benchmark_pipeline(BYTE *gray, int width, int height)
+{
+  BenchInput input = {gray, width, height};
+  BENCHStats stats;
+  char labels[80];
+
+  const char *names[] = {"gaussian_blur", "canny_edge_detector", "ultrafast_line_detector"};
+  void (*stages[])(void *arg) = {bench_gaussian_blur, bench_canny_edge_detector, bench_ultrafast_line_detector};
+
+  // The blur and the Sobel gradients run in bands, so those stages are
+  // timed in one band as well as in the bands used while driving
+  for (int i = 0; i < 3; i++)
+  for (int bands = 1; bands <= (i < 2 ? PIPELINE_BANDS : 1); bands++)
+  {
+    IPSetBands(bands);
+    if (BENCHRun(stages[i], &input, BENCH_RUNS, &stats) != 0)
+      continue;
+
+    snprintf(labels, sizeof(labels), "bench=%s input=camera res=%dx%d bands=%d", names[i], width, height, bands);
+    BENCHPrint(labels, &stats);
+  }
+
+  IPSetBands(PIPELINE_BANDS);
+}
+
 void testing_screen()
 {
   bool screen_initd = false, quit = false;
@@ -1193,6 +1314,7 @@ void testing_screen()
       screen_initd = true;
     }
 
+    ARENAReset();
     CAMGet((BYTE*)pColImg);
     IPCol2Gray((BYTE*)pColImg, pGrayImg);
     BYTE* graySubImage = pGrayImg + y_row_offset*CAMWIDTH;
@@ -1201,7 +1323,6 @@ void testing_screen()
     //Detect lines
     Line *lines = (Line*)pBuffer;
     int MAX_LINE_COUNT = sizeof(pBuffer)/sizeof(Line);
-    u8 *matchedPatterns = (u8*)pGrayImg;
 
     int lineCount = ultrafast_line_detector(CAMWIDTH, CAMHEIGHT - y_row_offset, MAX_LINE_COUNT, lines);
 
@@ -1211,12 +1332,13 @@ void testing_screen()
     LCDImageStart(CANNY_X, CANNY_Y, CAMWIDTH, CAMHEIGHT - y_row_offset);
     //LCDImageBinary(pEdgeImg);
     LCDImageGray(pEdgeImg);
-    LCDArea(LINES_X, LINES_Y, LINES_X + CAMWIDTH, LINES_Y + CAMHEIGHT - y_row_offset, BLACK);
     for (int i = 0; i < lineCount; i++)
     {
       if (lines[i].len >= MIN_LINE_LEN)
-        LCDLine(lines[i].x1 + LINES_X, lines[i].y1 + LINES_Y, lines[i].x2 + LINES_X, lines[i].y2 + LINES_Y, RED);
+        LCDOverlayLine(lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2, RED);
     }
+    LCDImageStart(LINES_X, LINES_Y, CAMWIDTH, CAMHEIGHT - y_row_offset);
+    LCDOverlayDraw(BLACK);
 
     const int VAL_X = 2, 
               VAL_Y = 7;
@@ -1237,6 +1359,13 @@ void testing_screen()
       delay(INPUT_DELAY_MS);
       continue;
     }
+    else if (button & KEY2)
+    {
+      IPCol2Gray((BYTE*)pColImg, pGrayImg);
+      benchmark_pipeline(graySubImage, CAMWIDTH, CAMHEIGHT - y_row_offset);
+      delay(INPUT_DELAY_MS);
+      continue;
+    }
 
     int t_x, t_y;
     KEYReadXY(&t_x, &t_y);
@@ -1312,6 +1441,8 @@ void testing_screen()
 void navigation_screen()
 {
   bool quit = false, collision = false;
+  bool show_profile = false, reset_drawn = false;
+  int frames = 0;
 
   const int MIN_DIST = 100;
 
@@ -1346,21 +1477,30 @@ void navigation_screen()
   LCDArea(CANNY_X - 1, CANNY_Y - 1, CANNY_X + width + 1, CANNY_Y + height + 1, WHITE, 0);
   LCDArea(LINES_X - 1, LINES_Y - 1, LINES_X + width + 1, LINES_Y + height + 1, WHITE, 0);
 
-  LCDArea(RESET_X1, RESET_Y1, RESET_X2, RESET_Y2, RED);
-  LCDSetFontSize(3);
-  LCDSetColor(WHITE, RED);
-  LCDSetPrintf(RESET_Y1 + 30, RESET_X1 + 37, "TOUCH");
-  LCDSetPrintf(RESET_Y1 + 60, RESET_X1 + 37, "RESET");
-
   VWSetSpeed(300, 0);
+  PROFReset();
+  TRACEStart();
+  RECStart(RECORD_FILE, REC_GRAY);
 
   while (!quit)
   {
-    //unsigned long start_ms = millis();
+    PROF_BEGIN("frame");
+
+    if (!reset_drawn)
+    {
+      LCDArea(RESET_X1, RESET_Y1, RESET_X2, RESET_Y2, RED);
+      LCDSetFontSize(3);
+      LCDSetColor(WHITE, RED);
+      LCDSetPrintf(RESET_Y1 + 30, RESET_X1 + 37, "TOUCH");
+      LCDSetPrintf(RESET_Y1 + 60, RESET_X1 + 37, "RESET");
+      reset_drawn = true;
+    }
 
+    ARENAReset();
     CAMGet((BYTE*)pColImg);
 
     IPCol2Gray((BYTE*)pColImg, pGrayImg);
+    RECFrame(pGrayImg);
     BYTE* graySubImage = pGrayImg + y_row_offset*width;
 
     canny_edge_detector(graySubImage, pEdgeImg, width, height);
@@ -1378,9 +1518,18 @@ void navigation_screen()
     {
       quit = true;
       delay(INPUT_DELAY_MS);
+      PROF_END("frame");
       continue;
     }
 
+    if (KEYRead() & KEY2)
+    {
+      show_profile = !show_profile;
+      LCDArea(RESET_X1, RESET_Y1, RESET_X2, RESET_Y2, BLACK);
+      reset_drawn = show_profile;
+      delay(INPUT_DELAY_MS);
+    }
+
     int left_lane_idx = -1, right_lane_idx = -1;
 
     if (!collision)
@@ -1558,32 +1707,45 @@ void navigation_screen()
     // Drawing to the display
     LCDImageStart(COLOR_X, COLOR_Y, width, height);
     COLOR* colorSubImage = pColImg + y_row_offset*width;
-    LCDImage((BYTE*)colorSubImage);
+    // Drawn in the background while the edge image is converted
+    LCDImageAsync((BYTE*)colorSubImage);
 
     LCDImageStart(CANNY_X, CANNY_Y, width, height);
     LCDImageGray(pEdgeImg);
 
-    LCDArea(LINES_X, LINES_Y, LINES_X + width, LINES_Y + height, BLACK);
+    // The lines panel is rasterised whole and pushed in one transfer
     for (int i = 0; i < lineCount; i++)
     {
       if (i == left_lane_idx || i == right_lane_idx)
       {
-        LCDLine(lines[i].x1 + LINES_X, lines[i].y1 + LINES_Y, lines[i].x2 + LINES_X, lines[i].y2 + LINES_Y, GREEN);
+        LCDOverlayLine(lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2, GREEN);
       }
       else if (lines[i].len >= MIN_LINE_LEN)
       {
-        LCDLine(lines[i].x1 + LINES_X, lines[i].y1 + LINES_Y, lines[i].x2 + LINES_X, lines[i].y2 + LINES_Y, RED);
+        LCDOverlayLine(lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2, RED);
       }
     }
+    LCDImageStart(LINES_X, LINES_Y, width, height);
+    LCDOverlayDraw(BLACK);
+
+    PROF_END("frame");
+
+    if (show_profile)
+      PROFOverlay(0, RESET_Y1);
 
-    // float delta_ms = 1.0f/((millis() - start_ms)/1000.0f);
-    // LCDSetColor(WHITE, BLACK);
-    // LCDSetFontSize(2);
-    // LCDSetPrintf(MSG_Y, MSG_X, "FPS: %.1f", delta_ms);
+    if (++frames % PROFILE_PRINT_FRAMES == 0)
+    {
+      PROFPrint();
+      ARENAPrint();
+    }
   }
 
   gPhase = PHASE_SETTINGS;
   VWSetSpeed(0, 0);
+
+  RECStop();
+  TRACEStop();
+  TRACEWrite(TRACE_FILE);
 }
 
 void setup() 
@@ -1712,6 +1874,11 @@ void setup()
   int err = EYEBOTInit();
   assert(!err);
 
+  err = ARENAInit(ARENA_SRAM_SIZE, 0);
+  assert(!err);
+
+  IPSetBands(PIPELINE_BANDS);
+
   LCDGetSize(&gLCDWidth, &gLCDHeight);
 
   VWSetOffsets(0, 0);
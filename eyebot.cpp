@@ -1,50 +1,20 @@
-#define TOUCH_MODULES_CST_SELF // Essential for the touchscreen
+// The library's own stage markers follow EYEBOT_PROFILE_LIBRARY rather than a
+// sketch's EYEBOT_PROFILE, and stay compiled in unless it is defined as 0
+#ifndef EYEBOT_PROFILE_LIBRARY
+#define EYEBOT_PROFILE_LIBRARY 1
+#endif
+#undef EYEBOT_PROFILE
+#define EYEBOT_PROFILE EYEBOT_PROFILE_LIBRARY
 #include "eyebot.h"
-#include <Arduino.h>
+#include "eyebot_hal.h"
 #include <math.h>
-#include <driver/spi_master.h>
-#include <driver/timer.h>
-#include <TFT_eSPI.h>
-#include <TouchLib.h>
-#include <Wire.h>
-
-// ESP32-CAM connection pins
-#define PIN_SPI_MISO 43
-#define PIN_SPI_CS 44
-#define PIN_SPI_SCLK 1
-#define PIN_CAM_SIGNAL 2
-
-// Physical button pins
-#define PIN_LEFT_BUTTON 0
-#define PIN_RIGHT_BUTTON 14
-
-// Makerverse 2 channel motor driver connection pins
-#define PIN_LEFT_MOTOR_DIR 3
-#define PIN_LEFT_MOTOR_PWM 10
-#define PIN_RIGHT_MOTOR_DIR 11
-#define PIN_RIGHT_MOTOR_PWM 12
-
-// PSD analogue distance input pin
-#define PIN_DIST_SENSOR 13
-
-// Touchscreen pins
-#define PIN_IIC_SCL                  17
-#define PIN_IIC_SDA                  18
-#define PIN_TOUCH_INT                16 // No interrupts are currently attached to this pin
-#define PIN_TOUCH_RES                21
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
 
 typedef uint32_t u32;
 typedef uint64_t u64;
-// The pixels received from the camera and passed through to the
-// TFT_eSPI display library are in 16-bit RGB565 format
-typedef uint16_t RGB565;
-
-// Due to a maximum data size for individual SPI transactions,
-// whose value or origin is unknown, a QQVGA image is delivered
-// from the ESP32-CAM in eight individual SPI transactions of 
-// size 4800 bytes.
-#define CAM_NUM_IMAGE_SEGMENTS 8
-#define MAX_RX_SEGMENT_SIZE 4800
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
@@ -56,16 +26,63 @@ typedef uint16_t RGB565;
 // from the distance sensor to approximate distances in mm.
 #define RAW_DISTANCE_PAIR_COUNT 25
 
-#define LCD_WIDTH 170
-#define LCD_HEIGHT 320
-
 #define QQVGA_WIDTH 160
 #define QQVGA_HEIGHT 120
+#define LCD_TEXT_SIZE ((LCD_WIDTH/6)*(LCD_HEIGHT/8) + 1)
+// Frame period of paced PNM files and synthetic frames, 30 frames per second
+#define CAM_SOURCE_FRAME_US 33333
+#define CAM_SOURCE_NAME_SIZE 64
+// Regions of the frame buffer kept apart until LCDRefresh(), and the pixels
+// that starting another transfer costs as much time as, with its window
+#define LCD_DIRTY_MAX 32
+#define LCD_DIRTY_TRANSFER_COST 64
+// Fonts and sizes whose glyphs are kept rasterised, the least recently used
+// making way for a new one
+#define LCD_FACES 4
+#define LCD_TEXT_BOX_MAX_SIZE 3
+// Printable ASCII; anything else prints as '?'
+#define LCD_FONT_FIRST 32
+#define LCD_FONT_LAST 126
+#define LCD_GLYPHS (LCD_FONT_LAST - LCD_FONT_FIRST + 1)
+// Bytes of text, terminators included, of the annotations of one image
+#define LCD_OVERLAY_TEXT_SIZE 1024
+// Events of each input queued for KEYReadEvent(), a power of two; later ones are dropped
+#define KEY_EVENTS 32
+
+// A display region from x1, y1 up to but not including x2, y2
+struct LCDRect
+{
+  int x1, y1, x2, y2;
+};
+
+// Shapes of the annotations of LCDOverlay*()
+enum LCDOverlayShape
+{
+  LCD_OVERLAY_LINE,
+  LCD_OVERLAY_AREA,
+  LCD_OVERLAY_CIRCLE,
+  LCD_OVERLAY_TEXT
+};
+
+// An annotation in window pixels; a circle keeps its radius in x2, and text
+// its font and size in x2 and y2 and its offset into the text in fill
+struct LCDOverlay
+{
+  int shape;
+  int x1, y1, x2, y2;
+  RGB565 hue;
+  int fill;
+};
 
-// If one of the eight individual SPI transactions expected
-// from the ESP32-CAM is not delivered within 500 ms, then
-// we return an entirely blank image to the user.
-#define CAM_TIMEOUT_MS 500 
+// Rasterised glyphs of a font and size, each loaded on first use
+struct LCDFace
+{
+  int font, size;// HAL_FONT_* and text size
+  int height;// 0 for an unused face
+  unsigned used;// gLCDFaceClock when last printed in
+  int width[LCD_GLYPHS];
+  BYTE *mask[LCD_GLYPHS];// width x height bytes, 1 in the foreground
+};
 
 struct RawDistancePair
 {
@@ -88,18 +105,77 @@ int CAMHEIGHT = QQVGA_HEIGHT;
 int CAMPIXELS = QQVGA_PIXELS;
 int CAMSIZE = QQVGA_PIXELS * sizeof(COLOR);
 
-static TFT_eSPI gTFT = TFT_eSPI(LCD_WIDTH, LCD_HEIGHT);
-static spi_device_handle_t gCamSPIHandle;
-static TouchLib gTouch(Wire, PIN_IIC_SDA, PIN_IIC_SCL, CTS820_SLAVE_ADDRESS, PIN_TOUCH_RES);
 static bool gTouchEnabled = true;
 
+// Input events, each queue written only by the task of halTouchStart() or
+// halButtonStart() and read only by the program, so the indices need no lock
+struct KEYQueue
+{
+  KEYEvent events[KEY_EVENTS];
+  std::atomic<uint32_t> head, tail;
+};
+
+// The latest touch reading is a single word, x in the high half and y in the
+// low, or -1 when nothing touches
+static bool gTouchQueued = false;
+static KEYQueue gTouchEvents;
+static std::atomic<int32_t> gTouchState(-1);
+
+// The buttons held down as KEY1 and KEY2, and the presses of each so far
+static bool gButtonsQueued = false;
+static KEYQueue gButtonEvents;
+static std::atomic<int> gKeyState(NOKEY);
+static std::atomic<uint32_t> gKeyPresses[2];
+
 static RGB565 *pLCDBuffer = NULL;
+// The camera has a receive buffer of its own, so that capturing on one core
+// and drawing on the other do not share a buffer
+static RGB565 *pCamBuffer = NULL;
+// Palettes of LCDImagePalette() in the display's big-endian RGB565
+static RGB565 gLCDPalettes[LCD_PALETTES][256];
+// Black for 0 and white for anything else, for LCDImageBinary()
+static RGB565 gLCDBinary[256];
+
+// Display buffers of LCDImageAsync(), one converted into while the other is drawn
+static RGB565 *pLCDAsync[2] = {NULL, NULL};
+static int gLCDAsyncSize = 0, gLCDAsyncNext = 0;
+
+// Drawing of LCD_NOAUTOREFRESH goes to the frame buffer, and the regions it
+// changed reach the display at LCDRefresh()
+static bool gLCDBuffered = false;
+static LCDRect gLCDDirty[LCD_DIRTY_MAX];
+static int gLCDDirtyCount = 0;
+
+// Text of LCDPrintf(), composed a line at a time from the glyphs of the
+// current face in the display's byte order, and pushed in one block
+static LCDFace gLCDFaces[LCD_FACES];
+static unsigned gLCDFaceClock = 0;
+static int gLCDTextFont = HAL_FONT_GLCD, gLCDTextSize = 1;
+static COLOR gLCDTextFg = WHITE, gLCDTextBg = WHITE;
+static RGB565 gLCDTextHues[2] = {0, 0xFFFF};// background, foreground
+static bool gLCDTextTransparent = true;
+static RGB565 *pLCDTextLine = NULL;
+static int gLCDTextLineSize = 0;
+// Formatted text of LCDPrintf() and LCDSetPrintf(), a screenful at font size 1
+static char gLCDText[LCD_TEXT_SIZE];
+
+// Annotations drawn into the next image before it is pushed
+static LCDOverlay gLCDOverlays[LCD_OVERLAY_MAX];
+static int gLCDOverlayCount = 0;
+static char gLCDOverlayText[LCD_OVERLAY_TEXT_SIZE];
+static int gLCDOverlayTextSize = 0;
+
+// Source of CAMGet() and CAMGetGray() other than the camera, see CAMSetSource()
+static int gCamSource = CAM_LIVE;
+static int gCamPacing = CAM_PACE_FAST;
+static char gCamSourceName[CAM_SOURCE_NAME_SIZE];
+static int gCamSourceFormat = REC_COLOR;
+static int gCamSourceFrame = 0;
+static uint32_t gCamSourceDue = 0, gCamSourceTime = 0;
+static COLOR *pCamSourceImg = NULL;
 
 static volatile VWOperation gCurrentVWOp = VW_OP_UNDEFINED;
 
-static timer_group_t gTimerGroup = TIMER_GROUP_0;
-static timer_idx_t gMotorTimerIdx = TIMER_0;
-
 static int gLeftMotorOffset;
 static int gRightMotorOffset;
 static int gLeftMotorPWM;
@@ -117,26 +193,151 @@ static unsigned long gOpTotalTime = 0, gOpStartTime = 0;// Records the total len
 
 static int gImgXStart = 0;
 static int gImgYStart = 0;
-static int gImgWidth = QQVGA_WIDTH;
+static int gImgWidth = QQVGA_WIDTH;// Size of the window on the display, cut to fit
 static int gImgHeight = QQVGA_HEIGHT;
+static int gImgXSize = QQVGA_WIDTH;// Size the source is scaled to, of which the window may show part
+static int gImgYSize = QQVGA_HEIGHT;
+static int gImgSrcWidth = QQVGA_WIDTH;// Source image geometry, in pixels
+static int gImgSrcHeight = QQVGA_HEIGHT;
+static int gImgStride = QQVGA_WIDTH;
+static int gImgRotation = LCD_ROTATE_0;
+// Source offset of every column and row of the window, added for a pixel, and
+// the same in bits for the packed images of LCDImagePacked()
+static int gImgCol[LCD_WIDTH], gImgRow[LCD_HEIGHT];
+static int gImgBitCol[LCD_WIDTH], gImgBitRow[LCD_HEIGHT];
+static bool gImgDirect = true;// Columns map one to one, so rows are copied in order
+
+// Partial histograms used by the IPHistogram*() functions. Six are needed
+// so that IPHistogramRGB() can give each channel two of its own. These are
+// used when the arena cannot supply them, by one caller at a time.
+#define HIST_PARTIAL_COUNT 6
+typedef u32 HistPartial[256];
+static HistPartial gHistPartials[HIST_PARTIAL_COUNT];
+static std::atomic_flag gHistPartialsTaken = ATOMIC_FLAG_INIT;
+
+// Images and parameters of an IP function run in bands by IPParallelFor()
+typedef struct {
+  BYTE *in;
+  BYTE *out[3];
+  int radius, offset;
+} IPBandArgs;
+
+// Tracker state for IPTrack(). Positions, sizes and velocities are kept in
+// 1/256 pixel fixed point, so that slow objects still build up a velocity.
+#define TRACK_FRAC_BITS 8
+#define TRACK_ONE (1 << TRACK_FRAC_BITS)
+// Only the first detections of a frame are considered for association
+#define TRACK_MAX_DETECTIONS 16
+
+struct Track
+{
+  int id;// 0 marks a free slot
+  int cls;
+  int bx, by;// Box centre
+  int w, h;
+  int vx, vy;// Per frame
+  int ox, oy;// Offset of the centroid from the box centre
+  int hits, misses;
+};
+
+static Track gTracks[IP_MAX_TRACKS];
+static int gTrackMode = IP_TRACK_IOU;
+static int gTrackGate = 20;
+static int gTrackMaxMisses = 5;
+static int gTrackNextId = 1;
+
+// Maps every RGB565 colour to a bitmask of the colour classes it belongs to.
+// Allocated on first use, since most programs never need its 64 KB.
+#define COLOR_CLASS_LUT_SIZE (1 << 16)
+static BYTE *pColorClassLUT = NULL;
 
 static RGB565 rgb888To565(COLOR col)
 {
-  return gTFT.color24to16(col);
+  return ((col >> 8) & 0xF800) | ((col >> 5) & 0x07E0) | ((col >> 3) & 0x001F);
 }
 
+// The low bits of each channel are filled from its high bits, so that
+// white stays white
 static COLOR rgb565To888(RGB565 col)
 {
-  return gTFT.color16to24(col);
+  u32 r = (col >> 8) & 0xF8; r |= r >> 5;
+  u32 g = (col >> 3) & 0xFC; g |= g >> 6;
+  u32 b = (col << 3) & 0xF8; b |= b >> 5;
+  return (r << 16) | (g << 8) | b;
+}
+
+// Queues an event, unless the queue is full; called only by its input task
+static void keyPush(KEYQueue &queue, int type, int key, int x, int y)
+{
+  uint32_t head = queue.head.load(std::memory_order_relaxed);
+  if (head - queue.tail.load(std::memory_order_acquire) == KEY_EVENTS)
+    return;
+
+  KEYEvent &event = queue.events[head % KEY_EVENTS];
+  event.type = type;
+  event.key = key;
+  event.x = x;
+  event.y = y;
+  event.time = halMillis();
+  queue.head.store(head + 1, std::memory_order_release);
+}
+
+// The oldest event of a queue, or NULL if it is empty
+static const KEYEvent* keyPeek(KEYQueue &queue)
+{
+  uint32_t tail = queue.tail.load(std::memory_order_relaxed);
+  if (tail == queue.head.load(std::memory_order_acquire))
+    return NULL;
+
+  return &queue.events[tail % KEY_EVENTS];
+}
+
+// Called by the touch task with each changed reading
+static void touchReport(int x, int y, int touched)
+{
+  int32_t state = touched ? (int32_t)(x << 16 | (y & 0xFFFF)) : -1;
+  int32_t last = gTouchState.load(std::memory_order_relaxed);
+  if (state == last)
+    return;
+
+  gTouchState.store(state, std::memory_order_release);
+
+  // A lift happens where the finger last was
+  if (!touched)
+    keyPush(gTouchEvents, KEY_TOUCH_UP, NOKEY, last >> 16, (int16_t)(last & 0xFFFF));
+  else
+    keyPush(gTouchEvents, last < 0 ? KEY_TOUCH_DOWN : KEY_TOUCH_MOVE, NOKEY, x, y);
+}
+
+// Called by the button task with each debounced change
+static void buttonReport(int button, int state)
+{
+  int key = button == HAL_BUTTON_LEFT ? KEY1 : KEY2;
+
+  if (state == HAL_BUTTON_PRESSED)
+  {
+    gKeyState.fetch_or(key, std::memory_order_release);
+    gKeyPresses[button].fetch_add(1, std::memory_order_release);
+    keyPush(gButtonEvents, KEY_PRESS, key, -1, -1);
+  }
+  else if (state == HAL_BUTTON_RELEASED)
+  {
+    gKeyState.fetch_and(~key, std::memory_order_release);
+    keyPush(gButtonEvents, KEY_RELEASE, key, -1, -1);
+  }
+  else
+    keyPush(gButtonEvents, KEY_LONG_PRESS, key, -1, -1);
 }
 
 // An interrupt that's invoked when the time runs out for a finite VW operation.
 // If this function is too long or invokes a user-defined function, it causes
 // the T-Display-S3 to crash due to undefined behaviour.
-static bool motorKillTimerCB(void *arg)
+static void motorKillTimerCB(void)
 {
-  analogWrite(PIN_LEFT_MOTOR_PWM, 0);
-  analogWrite(PIN_RIGHT_MOTOR_PWM, 0);
+  TRACEEvent(TRACE_BEGIN, "motorKillTimerCB");
+
+  halMotorPWM(HAL_MOTOR_LEFT, 0);
+  halMotorPWM(HAL_MOTOR_RIGHT, 0);
 
   gXPos = gFinalXPos;
   gYPos = gFinalYPos;
@@ -146,7 +347,7 @@ static bool motorKillTimerCB(void *arg)
   gLinSpeed = 0;
   gAngSpeed = 0;
 
-  return true;
+  TRACEEvent(TRACE_END, "motorKillTimerCB");
 }
 
 // The TFT_eSPI display library expects all the RGB565 pixels
@@ -161,30 +362,6 @@ static void rgb565SwapEndianess(RGB565 *hue)
   *hue |= lower;
 }
 
-// Sets the timer until the above motorKillTimerCB() function is invoked as
-// an interrupt.
-static bool setMotorKillTimer(u64 time_ms)
-{
-  esp_err_t err;
-  if (err = timer_pause(gTimerGroup, gMotorTimerIdx))
-    return false;
-
-  if (err = timer_set_counter_value(gTimerGroup, gMotorTimerIdx, 0))
-    return false;
-
-  //Assumes 2000 increments of the timer counter per s
-  if (err = timer_set_alarm_value(gTimerGroup, gMotorTimerIdx, 2*(u64)time_ms))
-    return false;
-
-  if (err = timer_set_alarm(gTimerGroup, gMotorTimerIdx, TIMER_ALARM_EN))
-    return false;
-
-  if (err = timer_start(gTimerGroup, gMotorTimerIdx))
-    return false;
-
-  return true;
-}
-
 // This calculates the change in position and orientation over a period of time
 // as defined by the EyeBot's linear and angular speed.
 // Due to the lack of encoders in the ESP32 EyeBot's motors, major trigonometric
@@ -253,116 +430,369 @@ static void calcDeltaPosition(int delta_ms, int *dx, int *dy, int *dphi)
   }
 }
 
-int EYEBOTInit()
+// Internal RAM where there is room for size bytes, the heap otherwise
+static void* allocInternal(size_t size)
 {
-  /////////////
-  //Motor init
-  /////////////
-
-  analogWrite(PIN_LEFT_MOTOR_PWM, 0);
-  analogWrite(PIN_RIGHT_MOTOR_PWM, 0);
-
-  pinMode(PIN_LEFT_MOTOR_DIR, OUTPUT);
-  pinMode(PIN_RIGHT_MOTOR_DIR, OUTPUT);
-  // The directional controls of the left and right motors for
-  // the Makerverse 2 channel motor driver are inverted.
-  digitalWrite(PIN_LEFT_MOTOR_DIR, HIGH);
-  digitalWrite(PIN_RIGHT_MOTOR_DIR, LOW);
-
-  /////////////////////////////////////////////
-  // Enable being powered from the power rail,
-  // as opposed to USB port.
-  /////////////////////////////////////////////
-
-  //pinMode(PIN_BATTERY_POWER, OUTPUT);
-  //digitalWrite(PIN_BATTERY_POWER, HIGH);
-
-  //////////////////////
-  //Initialise T-Display
-  //////////////////////
-  gTFT.init();
-  gTFT.fillScreen(TFT_BLACK);
-  
-  ////////////////////////////////////////////////////////////
-  //SPI Initialisation for communication with the ESP32-Camera
-  ////////////////////////////////////////////////////////////
-
-  //Configuration for the SPI bus
-  spi_bus_config_t buscfg = {
-    .mosi_io_num = -1,
-    .miso_io_num = PIN_SPI_MISO,
-    .sclk_io_num = PIN_SPI_SCLK,
-    .quadwp_io_num = -1,
-    .quadhd_io_num = -1,
-    .max_transfer_sz = MAX_RX_SEGMENT_SIZE 
-  };
+  void *mem = halAllocInternal(size);
 
-  //Configuration for the SPI device on the other side of the bus
-  spi_device_interface_config_t devcfg = {
-    .command_bits = 0,
-    .address_bits = 0,
-    .dummy_bits = 0,
-    .mode = 0,
-    .duty_cycle_pos = 0,    //50% duty cycle
-    .cs_ena_posttrans = 3,  //Keep the CS low 3 cycles after transaction, to stop slave from missing the last bit when CS has less propagation delay than CLK
-    .clock_speed_hz = SPI_MASTER_FREQ_10M, // SPI cannot operate above 10 MHz for ESP32
-    .spics_io_num = PIN_SPI_CS,
-    .queue_size = 1
-  };
+  return mem ? mem : calloc(size, 1);
+}
+
+// A colour converted for the display, as the entries of palettes are
+static RGB565 lcdColor(COLOR col)
+{
+  RGB565 hue = rgb888To565(col);
+  rgb565SwapEndianess(&hue);
 
-  pinMode(PIN_SPI_SCLK, OUTPUT);
-  pinMode(PIN_SPI_CS, OUTPUT);
-  // The ESP32-CAM drops the voltage on this pin when it wants to signal that it has a new image segment to deliver.
-  pinMode(PIN_CAM_SIGNAL, INPUT_PULLUP);
+  return hue;
+}
 
-  //Initialize the SPI bus and add the ESP32-Camera as a device
-  esp_err_t err = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
-  assert(err == ESP_OK);
-  err = spi_bus_add_device(SPI2_HOST, &devcfg, &gCamSPIHandle);
-  assert(err == ESP_OK);
-  
-  ///////////////////
-  //Initialise timer
-  ///////////////////
-
-  // This just initialises one of the multiple number of timers available on the
-  // ESP32-S3
-
-  timer_config_t timer_config = {};
-  timer_config.alarm_en = TIMER_ALARM_DIS;
-  timer_config.counter_en = TIMER_PAUSE;
-  timer_config.intr_type = TIMER_INTR_LEVEL;
-  timer_config.counter_dir = TIMER_COUNT_UP;
-  timer_config.auto_reload = TIMER_AUTORELOAD_DIS;
-  // Divider value cannot be higher than 2^16.
-  // Increments 80 MHz/40000 = 2000 times a second
-  timer_config.divider = 40000;
-
-  err = timer_init(gTimerGroup, gMotorTimerIdx, &timer_config);
-  assert(err == ESP_OK);
-
-  err = timer_isr_callback_add(gTimerGroup, gMotorTimerIdx, motorKillTimerCB, NULL, 0);
-  assert(err == ESP_OK);
-
-  //////////////////////////
-  //Initialise touch screen
-  //////////////////////////
-
-  gpio_hold_dis((gpio_num_t)PIN_TOUCH_RES);
-  pinMode(PIN_TOUCH_RES, OUTPUT);
-  digitalWrite(PIN_TOUCH_RES, LOW);
-  delay(100);
-  digitalWrite(PIN_TOUCH_RES, HIGH);
-  Wire.begin(PIN_IIC_SDA, PIN_IIC_SCL);
-
-  if (!gTouch.init())
+/*
+The heat palette runs through black, blue, red, yellow and white in four
+equal steps. Labels take hues 137.5 degrees apart, the golden angle, so
+that neighbouring label numbers never look alike.
+*/
+static void lcdPaletteInit(void)
+{
+  for (int v = 0; v < 256; v++)
+  {
+    gLCDPalettes[LCD_PALETTE_GRAY][v] = lcdColor(IPPRGB2Col(v, v, v));
+    gLCDPalettes[LCD_PALETTE_USER][v] = gLCDPalettes[LCD_PALETTE_GRAY][v];
+
+    static const COLOR heat[5] = {0x000000, 0x0000FF, 0xFF0000, 0xFFFF00, 0xFFFFFF};
+    int step = v / 64, part = v % 64;
+    BYTE rgb[3];
+    for (int c = 0; c < 3; c++)
+    {
+      int from = heat[step] >> (16 - 8*c) & 0xFF, to = heat[step + 1] >> (16 - 8*c) & 0xFF;
+      rgb[c] = from + (to - from)*part/64;
+    }
+    gLCDPalettes[LCD_PALETTE_HEAT][v] = lcdColor(IPPRGB2Col(rgb[0], rgb[1], rgb[2]));
+
+    // Fully saturated, with one channel at full, one rising or falling and one off
+    int hue = (v*1375/10) % 360, f = hue % 60*255/60;
+    const int sectors[6][3] = {{255, f, 0}, {255 - f, 255, 0}, {0, 255, f}, {0, 255 - f, 255}, {f, 0, 255}, {255, 0, 255 - f}};
+    const int *label = sectors[hue / 60];
+    gLCDPalettes[LCD_PALETTE_LABELS][v] = v ? lcdColor(IPPRGB2Col(label[0], label[1], label[2])) : 0;
+
+    gLCDBinary[v] = v ? 0xFFFF : 0;
+  }
+}
+
+/*
+The window pixel (x, y) shows the source pixel at col[x] + row[y]. Turned
+a quarter, a window column walks down a source column, so the column
+offsets step by whole rows and the row offsets by pixels.
+*/
+static void lcdImageTables(int stride, int *col, int *row)
+{
+  bool turned = gImgRotation == LCD_ROTATE_90 || gImgRotation == LCD_ROTATE_270;
+  int width = turned ? gImgSrcHeight : gImgSrcWidth;
+  int height = turned ? gImgSrcWidth : gImgSrcHeight;
+
+  for (int x = 0; x < gImgWidth; x++)
+  {
+    int u = x*width / gImgXSize;
+
+    switch (gImgRotation)
+    {
+      case LCD_ROTATE_0: col[x] = u; break;
+      case LCD_ROTATE_90: col[x] = (gImgSrcHeight - 1 - u)*stride; break;
+      case LCD_ROTATE_180: col[x] = gImgSrcWidth - 1 - u; break;
+      default: col[x] = u*stride; break;
+    }
+  }
+
+  for (int y = 0; y < gImgHeight; y++)
+  {
+    int v = y*height / gImgYSize;
+
+    switch (gImgRotation)
+    {
+      case LCD_ROTATE_0: row[y] = v*stride; break;
+      case LCD_ROTATE_90: row[y] = v; break;
+      case LCD_ROTATE_180: row[y] = (gImgSrcHeight - 1 - v)*stride; break;
+      default: row[y] = gImgSrcWidth - 1 - v; break;
+    }
+  }
+}
+
+static void lcdImageInit(void)
+{
+  lcdImageTables(gImgStride, gImgCol, gImgRow);
+  // Rows of packed images start on a byte
+  lcdImageTables((gImgStride + 7) / 8 * 8, gImgBitCol, gImgBitRow);
+
+  gImgDirect = gImgRotation == LCD_ROTATE_0 && gImgSrcWidth == gImgXSize;
+}
+
+static LCDRect lcdRectUnion(const LCDRect &a, const LCDRect &b)
+{
+  return {MIN(a.x1, b.x1), MIN(a.y1, b.y1), MAX(a.x2, b.x2), MAX(a.y2, b.y2)};
+}
+
+static int lcdRectArea(const LCDRect &r)
+{
+  return (r.x2 - r.x1)*(r.y2 - r.y1);
+}
+
+// Pixels pushed in one transfer of both regions beyond those of two transfers
+static int lcdRectGrowth(const LCDRect &a, const LCDRect &b)
+{
+  return lcdRectArea(lcdRectUnion(a, b)) - lcdRectArea(a) - lcdRectArea(b);
+}
+
+// Takes every dirty region cheaper to push along with r out of the list and into r
+static LCDRect lcdDirtyAbsorb(LCDRect r)
+{
+  for (int i = 0; i < gLCDDirtyCount;)
+  {
+    if (lcdRectGrowth(r, gLCDDirty[i]) <= LCD_DIRTY_TRANSFER_COST)
+    {
+      r = lcdRectUnion(r, gLCDDirty[i]);
+      gLCDDirty[i] = gLCDDirty[--gLCDDirtyCount];
+      i = 0;
+    }
+    else
+      i++;
+  }
+
+  return r;
+}
+
+/*
+A new region swallows every region that overlaps it or lies so close that
+the pixels between them push faster than another transfer starts, which
+may bring it close to others. With the list full it joins the region that
+grows least, so that scattered drawing ends as a bounded number of
+transfers of somewhat more pixels.
+*/
+static void lcdDirty(int x1, int y1, int x2, int y2)
+{
+  if (!gLCDBuffered)
+    return;
+
+  LCDRect r = {MAX(x1, 0), MAX(y1, 0), MIN(x2, LCD_WIDTH), MIN(y2, LCD_HEIGHT)};
+  if (r.x2 <= r.x1 || r.y2 <= r.y1)
+    return;
+
+  r = lcdDirtyAbsorb(r);
+
+  while (gLCDDirtyCount == LCD_DIRTY_MAX)
+  {
+    int best = 0, bestGrowth = 0;
+
+    for (int i = 0; i < gLCDDirtyCount; i++)
+    {
+      int growth = lcdRectGrowth(r, gLCDDirty[i]);
+      if (i == 0 || growth < bestGrowth)
+      {
+        best = i;
+        bestGrowth = growth;
+      }
+    }
+
+    r = lcdRectUnion(r, gLCDDirty[best]);
+    gLCDDirty[best] = gLCDDirty[--gLCDDirtyCount];
+    // The joined region may now take in others
+    r = lcdDirtyAbsorb(r);
+  }
+
+  gLCDDirty[gLCDDirtyCount++] = r;
+}
+
+// Marks the text just printed from x, y to the cursor, whole lines once it wraps
+static void lcdDirtyText(int x, int y)
+{
+  int xEnd, yEnd, height = halLCDFontHeight();
+  halLCDGetCursor(&xEnd, &yEnd);
+
+  if (yEnd == y)
+    lcdDirty(x, y, xEnd, y + height);
+  else
+    lcdDirty(0, MIN(y, yEnd), LCD_WIDTH, MAX(y, yEnd) + height);
+}
+
+// The face of the current font and size, rasterised afresh if it is not kept
+static LCDFace* lcdFace(void)
+{
+  LCDFace *oldest = &gLCDFaces[0];
+  gLCDFaceClock++;
+
+  for (int i = 0; i < LCD_FACES; i++)
+  {
+    LCDFace *face = &gLCDFaces[i];
+
+    if (face->height && face->font == gLCDTextFont && face->size == gLCDTextSize)
+    {
+      face->used = gLCDFaceClock;
+      return face;
+    }
+
+    if (face->used < oldest->used)
+      oldest = face;
+  }
+
+  for (int k = 0; k < LCD_GLYPHS; k++)
+  {
+    free(oldest->mask[k]);
+    oldest->mask[k] = NULL;
+  }
+
+  int width;
+  halLCDGlyphSize(' ', &width, &oldest->height);
+  oldest->font = gLCDTextFont;
+  oldest->size = gLCDTextSize;
+  oldest->used = gLCDFaceClock;
+
+  return oldest;
+}
+
+// The mask of a glyph of the face and its width, NULL without memory for it
+static const BYTE* lcdGlyph(LCDFace *face, char c, int *width)
+{
+  if (c < LCD_FONT_FIRST || c > LCD_FONT_LAST)
+    c = '?';
+  int k = c - LCD_FONT_FIRST;
+
+  if (!face->mask[k])
+  {
+    int w, h;
+    halLCDGlyphSize(c, &w, &h);
+
+    BYTE *mask = (BYTE*)malloc(MAX(w*h, 1));
+    if (!mask)
+      return NULL;
+
+    halLCDGlyph(c, mask);
+    face->width[k] = h == face->height ? w : 0;
+    face->mask[k] = mask;
+  }
+
+  *width = face->width[k];
+  return face->mask[k];
+}
+
+/*
+Text wraps as TFT_eSPI wraps it, before a glyph that would cross the right
+edge and at newlines, so each line of a string is one run of glyphs,
+composed side by side and pushed as one block. A transparent background
+needs the pixels beneath, so such text is printed by the HAL instead.
+*/
+static void lcdPrint(const char *str)
+{
+  static const BYTE *masks[LCD_WIDTH];
+  static int widths[LCD_WIDTH], shown[LCD_WIDTH];
+
+  if (gLCDTextTransparent)
+  {
+    halLCDPrint(str);
+    return;
+  }
+
+  LCDFace *face = lcdFace();
+  int height = face->height;
+
+  if (LCD_WIDTH*height > gLCDTextLineSize)
+  {
+    free(pLCDTextLine);
+    pLCDTextLine = (RGB565*)allocInternal(LCD_WIDTH*height*sizeof(RGB565));
+    gLCDTextLineSize = pLCDTextLine ? LCD_WIDTH*height : 0;
+
+    if (!pLCDTextLine)
+    {
+      halLCDPrint(str);
+      return;
+    }
+  }
+
+  int x, y;
+  halLCDGetCursor(&x, &y);
+
+  while (*str)
+  {
+    if (*str == '\n')
+    {
+      x = 0;
+      y += height;
+      str++;
+      continue;
+    }
+
+    int count = 0, width = 0;
+    for (; *str && *str != '\n'; str++)
+    {
+      int w;
+      const BYTE *mask = *str == '\r' ? NULL : lcdGlyph(face, *str, &w);
+      if (!mask || w == 0)
+        continue;
+
+      if (x + width + w > LCD_WIDTH && (width > 0 || x > 0))
+        break;
+
+      // A glyph wider than the display, alone on its line, loses its right columns
+      masks[count] = mask;
+      widths[count] = w;
+      shown[count] = MIN(w, LCD_WIDTH - x - width);
+      width += shown[count++];
+    }
+
+    if (width > 0)
+    {
+      for (int row = 0; row < height; row++)
+      {
+        RGB565 *out = pLCDTextLine + row*width;
+
+        for (int k = 0; k < count; k++)
+        {
+          const BYTE *bits = masks[k] + row*widths[k];
+          for (int i = 0; i < shown[k]; i++)
+            *out++ = gLCDTextHues[bits[i]];
+        }
+      }
+
+      halLCDPushRect(x, y, width, height, pLCDTextLine);
+      x += width;
+    }
+
+    // Stopped at the right edge
+    if (*str && *str != '\n')
+    {
+      x = 0;
+      y += height;
+    }
+  }
+
+  halLCDSetCursor(x, y);
+}
+
+int EYEBOTInit()
+{
+  halMotorInit();
+  halLCDInit();
+  halCamInit();
+  halMotorTimerInit(motorKillTimerCB);
+
+  if (halTouchInit() != 0)
     gTouchEnabled = false;
+  else
+    gTouchQueued = halTouchStart(touchReport) == 0;
 
-  // Allocate a buffer for image presentation operations to the display
-  pLCDBuffer = (RGB565*)calloc(LCD_WIDTH*LCD_HEIGHT, sizeof(RGB565));
+  gButtonsQueued = halButtonStart(buttonReport, KEY_LONG_PRESS_MS) == 0;
+
+  // Both buffers are DMA sources or targets of the SPI transfers, so they
+  // belong in internal RAM rather than wherever calloc() would put them
+  pLCDBuffer = (RGB565*)allocInternal(LCD_WIDTH*LCD_HEIGHT*sizeof(RGB565));
   if (!pLCDBuffer)
     return -1;
 
+  pCamBuffer = (RGB565*)allocInternal(QQVGA_WIDTH*QQVGA_HEIGHT*sizeof(RGB565));
+  if (!pCamBuffer)
+    return -1;
+
+  lcdPaletteInit();
+  lcdImageInit();
+
   return 0;
 }
 
@@ -373,11 +803,14 @@ int LCDPrintf(const char* format, ...)
 
   va_list arg_ptr;
   va_start(arg_ptr, format);
-  char *str_buf = (char*)pLCDBuffer;
+  vsnprintf(gLCDText, sizeof(gLCDText), format, arg_ptr);
+  va_end(arg_ptr);
 
-  vsnprintf(str_buf, LCD_WIDTH*LCD_HEIGHT*sizeof(RGB565), format, arg_ptr);
-
-  gTFT.print(str_buf);
+  int x, y;
+  halLCDGetCursor(&x, &y);
+  lcdPrint(gLCDText);
+  if (gLCDBuffered)
+    lcdDirtyText(x, y);
 
   return 0;
 }
@@ -387,29 +820,33 @@ int LCDSetPrintf(int row, int column, const char *format, ...)
   if (!format)
     return -1;
   
-  gTFT.setCursor(column, row);
+  halLCDSetCursor(column, row);
 
   va_list arg_ptr;
   va_start(arg_ptr, format);
-  char *str_buf = (char*)pLCDBuffer;
-
-  vsnprintf(str_buf, LCD_WIDTH*LCD_HEIGHT*sizeof(RGB565), format, arg_ptr);
+  vsnprintf(gLCDText, sizeof(gLCDText), format, arg_ptr);
+  va_end(arg_ptr);
 
-  gTFT.print(str_buf);
+  int x, y;
+  halLCDGetCursor(&x, &y);
+  lcdPrint(gLCDText);
+  if (gLCDBuffered)
+    lcdDirtyText(x, y);
 
   return 0;
 }
 
 int LCDClear()
 {
-  gTFT.fillScreen(TFT_BLACK);
+  halLCDFill(0);
+  lcdDirty(0, 0, LCD_WIDTH, LCD_HEIGHT);
 
   return 0;
 }
 
 int LCDSetPos(int row, int column)
 {
-  gTFT.setCursor(column, row);
+  halLCDSetCursor(column, row);
 
   return 0;
 }
@@ -419,8 +856,7 @@ int LCDGetPos(int *row, int *column)
   if (!row || !column)
     return -1;
 
-  *column = gTFT.getCursorX();
-  *row = gTFT.getCursorY();
+  halLCDGetCursor(column, row);
 
   return 0;
 }
@@ -429,16 +865,27 @@ int LCDSetColor(COLOR fg, COLOR bg)
 {
   RGB565 fg_hue = rgb888To565(fg);
   RGB565 bg_hue = rgb888To565(bg);
-  gTFT.setTextColor(fg_hue, bg_hue);
+  halLCDSetTextColor(fg_hue, bg_hue);
+
+  gLCDTextFg = fg;
+  gLCDTextBg = bg;
+  gLCDTextHues[0] = lcdColor(bg);
+  gLCDTextHues[1] = lcdColor(fg);
+  gLCDTextTransparent = fg == bg;
  
   return 0;
 }
 
-// BEN: I do not know the index numbers for the
-// fonts available through TFT_eSPI.
+// Courier is the fixed-width font every display starts with
 int LCDSetFont(int font, int variation)
 {
-  gTFT.setTextFont(font);
+  static const int fonts[] = {HAL_FONT_SANS, HAL_FONT_SERIF, HAL_FONT_GLCD};// HELVETICA, TIMES, COURIER
+
+  if (font < HELVETICA || font > COURIER || variation < NORMAL || variation > BOLD)
+    return -1;
+
+  gLCDTextFont = fonts[font] + variation;
+  halLCDSetTextFont(gLCDTextFont);
 
   return 0;
 }
@@ -447,25 +894,44 @@ int LCDSetFont(int font, int variation)
 // times 10 in TFT_eSPI.
 int LCDSetFontSize(int fontsize)
 {
-  gTFT.setTextSize(fontsize);
+  gLCDTextSize = MAX(fontsize, 1);
+  halLCDSetTextSize(gLCDTextSize);
 
   return 0;
 }
 
+/*
+Only the refresh modes are implemented. The frame buffer starts black
+rather than as the display was, so the first LCDRefresh() pushes all of it:
+pushing only what was drawn would, once regions are merged across the gaps
+between them, blank some of the earlier content and leave the rest.
+Leaving LCD_NOAUTOREFRESH shows what was drawn since the last LCDRefresh()
+before drawing goes back to the display.
+*/
 int LCDSetMode(int mode)
 {
-  return -1;
-}
+  if (mode == LCD_NOAUTOREFRESH)
+  {
+    if (gLCDBuffered)
+      return 0;
 
-// BEN: Since there does not exist a menu function that binds function pointers
-// to these menu items, I don't know how to implement this.
-int LCDMenu(char *st1, char *st2, char *st3, char *st4)
-{
-  return -1;
-}
+    if (halLCDSetBuffered(1) != 0)
+      return -1;
+
+    gLCDBuffered = true;
+    gLCDDirtyCount = 0;
+    lcdDirty(0, 0, LCD_WIDTH, LCD_HEIGHT);
+    return 0;
+  }
+
+  if (mode == LCD_AUTOREFRESH)
+  {
+    LCDRefresh();
+    halLCDSetBuffered(0);
+    gLCDBuffered = false;
+    return 0;
+  }
 
-int LCDMenuI(int pos, char *string, COLOR fg, COLOR bg)
-{
   return -1;
 }
 
@@ -483,7 +949,8 @@ int LCDGetSize(int *x, int *y)
 int LCDPixel(int x, int y, COLOR col)
 {
   RGB565 fg_hue = rgb888To565(col);
-  gTFT.drawPixel(x, y, col);
+  halLCDPixel(x, y, fg_hue);
+  lcdDirty(x, y, x + 1, y + 1);
 
   return 0;
 }
@@ -491,7 +958,7 @@ int LCDPixel(int x, int y, COLOR col)
 // BEN: This function does not seem to work as intended, but returns only black pixels.
 COLOR LCDGetPixel(int x, int y)
 {
-  RGB565 col = gTFT.readPixel(x, y);
+  RGB565 col = halLCDReadPixel(x, y);
   return rgb565To888(col);
 }
 
@@ -502,19 +969,21 @@ int LCDLine(int x1, int y1, int x2, int y2, COLOR col)
   if (x1 - x2 == 0)
   {
     if (y1 < y2)
-      gTFT.drawFastVLine(x1, y1, y2-y1, hue);
+      halLCDVLine(x1, y1, y2-y1, hue);
     else
-      gTFT.drawFastVLine(x1, y2, y1-y2, hue);
+      halLCDVLine(x1, y2, y1-y2, hue);
   }
   else if (y1 - y2 == 0)
   {
     if (x1 < x2)
-      gTFT.drawFastHLine(x1, y1, x2-x1, hue);
+      halLCDHLine(x1, y1, x2-x1, hue);
     else
-      gTFT.drawFastHLine(x2, y1, x1-x2, hue);
+      halLCDHLine(x2, y1, x1-x2, hue);
   }
   else
-    gTFT.drawLine(x1, y1, x2, y2, hue);
+    halLCDLine(x1, y1, x2, y2, hue);
+
+  lcdDirty(MIN(x1, x2), MIN(y1, y2), MAX(x1, x2) + 1, MAX(y1, y2) + 1);
  
   return 0;
 }
@@ -537,10 +1006,8 @@ int LCDArea(int x1, int y1, int x2, int y2, COLOR col, int fill)
     y1 = tmp;
   }
 
-  if (fill)
-    gTFT.fillRect(x1, y1, x2 - x1, y2 - y1, hue);
-  else
-    gTFT.drawRect(x1, y1, x2 - x1, y2 - y1, hue);
+  halLCDRect(x1, y1, x2 - x1, y2 - y1, hue, fill);
+  lcdDirty(x1, y1, x2, y2);
 
   return 0;
 }
@@ -549,10 +1016,62 @@ int LCDCircle(int x1, int y1, int radius, COLOR col, int fill)
 {
   RGB565 hue = rgb888To565(col);
 
-  if (fill)
-    gTFT.fillCircle(x1, y1, radius, hue);
-  else 
-    gTFT.drawCircle(x1, y1, radius, hue);
+  halLCDCircle(x1, y1, radius, hue, fill);
+  lcdDirty(x1 - radius, y1 - radius, x1 + radius + 1, y1 + radius + 1);
+
+  return 0;
+}
+
+/*
+The text takes the largest size up to LCD_TEXT_BOX_MAX_SIZE at which it
+fits the box, and is cut short if it does not fit at size 1. The colours,
+size and cursor of LCDPrintf() are put back afterwards.
+*/
+int LCDTextBox(int x, int y, int w, int h, const char *text, COLOR fg, COLOR bg)
+{
+  if (!text || w <= 0 || h <= 0)
+    return -1;
+
+  LCDArea(x, y, x + w, y + h, bg);
+
+  COLOR fgOld = gLCDTextFg, bgOld = gLCDTextBg;
+  int sizeOld = gLCDTextSize, xOld, yOld;
+  halLCDGetCursor(&xOld, &yOld);
+
+  char line[LCD_WIDTH + 1];
+  int width = 0, height = 0, count = 0;
+
+  for (int size = LCD_TEXT_BOX_MAX_SIZE; size >= 1; size--)
+  {
+    gLCDTextSize = size;
+    halLCDSetTextSize(size);
+    LCDFace *face = lcdFace();
+
+    width = count = 0;
+    height = face->height;
+    for (const char *c = text; *c && *c != '\n' && count < LCD_WIDTH; c++)
+    {
+      int glyph;
+      if (!lcdGlyph(face, *c, &glyph) || width + glyph > w)
+        break;
+      line[count++] = *c;
+      width += glyph;
+    }
+
+    if ((!text[count] || text[count] == '\n') && height <= h)
+      break;
+  }
+  line[count] = 0;
+
+  LCDSetColor(fg, bg);
+  halLCDSetCursor(x + (w - width)/2, y + (h - height)/2);
+  lcdPrint(line);
+  lcdDirty(x + (w - width)/2, y + (h - height)/2, x + (w + width)/2 + 1, y + (h + height)/2 + 1);
+
+  LCDSetColor(fgOld, bgOld);
+  gLCDTextSize = sizeOld;
+  halLCDSetTextSize(sizeOld);
+  halLCDSetCursor(xOld, yOld);
 
   return 0;
 }
@@ -566,437 +1085,2259 @@ int LCDImageSize(int t)
 
 // BEN: The user is technically able to allocate a pixel buffer as large as the
 // display and present it to the screen.
-int LCDImageStart(int x, int y, int xs, int ys)
+int LCDImageStart(int x, int y, int xs, int ys, int sxs, int sys, int stride, int rotation)
 {
+  xs = xs < 0 ? LCD_WIDTH : xs;
+  ys = ys < 0 ? LCD_HEIGHT : ys;
+  sxs = sxs > 0 ? sxs : xs;
+  sys = sys > 0 ? sys : ys;
+  stride = stride > 0 ? stride : sxs;
+
+  if (xs == 0 || ys == 0 || stride < sxs || rotation < LCD_ROTATE_0 || rotation > LCD_ROTATE_270)
+    return -1;
+
   gImgXStart = x;
   gImgYStart = y;
-  gImgWidth = xs < 0 || xs > LCD_WIDTH ? LCD_WIDTH : xs;
-  gImgHeight = ys < 0 || ys > LCD_HEIGHT ? LCD_HEIGHT : ys;
+  gImgXSize = xs;
+  gImgYSize = ys;
+  gImgWidth = xs > LCD_WIDTH ? LCD_WIDTH : xs;
+  gImgHeight = ys > LCD_HEIGHT ? LCD_HEIGHT : ys;
+  gImgSrcWidth = sxs;
+  gImgSrcHeight = sys;
+  gImgStride = stride;
+  gImgRotation = rotation;
+  lcdImageInit();
 
   return 0;
 }
 
-int LCDImage(BYTE *img)
+static void overlayPixel(RGB565 *out, int x, int y, RGB565 hue)
 {
-  if (!img)
-    return -1;
-  
-  COLOR *col_img = (COLOR*)img;
+  if (x >= 0 && x < gImgWidth && y >= 0 && y < gImgHeight)
+    out[y*gImgWidth + x] = hue;
+}
 
-  for (int y = 0; y < gImgHeight; y++)
-  for (int x = 0; x < gImgWidth; x++)
-  {
-    int i = y*gImgWidth + x;
+static void overlaySpan(RGB565 *out, int x, int y, int w, RGB565 hue)
+{
+  if (y < 0 || y >= gImgHeight)
+    return;
 
-    pLCDBuffer[i] = rgb888To565(col_img[i]);
-    rgb565SwapEndianess(&pLCDBuffer[i]);
-  }
+  for (int i = MAX(x, 0); i < MIN(x + w, gImgWidth); i++)
+    out[y*gImgWidth + i] = hue;
+}
+
+// The same Bresenham line as the HAL draws
+static void overlayLine(RGB565 *out, int x1, int y1, int x2, int y2, RGB565 hue)
+{
+  int dx = abs(x2 - x1), dy = -abs(y2 - y1);
+  int sx = x1 < x2 ? 1 : -1, sy = y1 < y2 ? 1 : -1;
+  int err = dx + dy;
+
+  while (true)
+  {
+    overlayPixel(out, x1, y1, hue);
+    if (x1 == x2 && y1 == y2)
+      break;
+
+    int e2 = 2*err;
+    if (e2 >= dy)
+    {
+      err += dy;
+      x1 += sx;
+    }
+    if (e2 <= dx)
+    {
+      err += dx;
+      y1 += sy;
+    }
+  }
+}
+
+// The same midpoint circle as the HAL draws
+static void overlayCircle(RGB565 *out, int x, int y, int r, RGB565 hue, int fill)
+{
+  int dx = 0, dy = r, err = 1 - r;
+
+  while (dx <= dy)
+  {
+    if (fill)
+    {
+      overlaySpan(out, x - dy, y + dx, 2*dy + 1, hue);
+      overlaySpan(out, x - dy, y - dx, 2*dy + 1, hue);
+      overlaySpan(out, x - dx, y + dy, 2*dx + 1, hue);
+      overlaySpan(out, x - dx, y - dy, 2*dx + 1, hue);
+    }
+    else
+    {
+      const int points[8][2] = {{dx, dy}, {-dx, dy}, {dx, -dy}, {-dx, -dy},
+                                {dy, dx}, {-dy, dx}, {dy, -dx}, {-dy, -dx}};
+      for (int i = 0; i < 8; i++)
+        overlayPixel(out, x + points[i][0], y + points[i][1], hue);
+    }
+
+    dx++;
+    if (err < 0)
+      err += 2*dx + 1;
+    else
+    {
+      dy--;
+      err += 2*(dx - dy) + 1;
+    }
+  }
+}
+
+// Text in the glyphs of its own face, switched to for the call, without wrapping
+static void overlayText(RGB565 *out, const LCDOverlay &overlay)
+{
+  int font = gLCDTextFont, size = gLCDTextSize;
+  if (overlay.x2 != font || overlay.y2 != size)
+  {
+    gLCDTextFont = overlay.x2;
+    gLCDTextSize = overlay.y2;
+    halLCDSetTextFont(gLCDTextFont);
+    halLCDSetTextSize(gLCDTextSize);
+  }
+
+  LCDFace *face = lcdFace();
+  int x = overlay.x1, y = overlay.y1;
+
+  for (const char *c = gLCDOverlayText + overlay.fill; *c; c++)
+  {
+    if (*c == '\n')
+    {
+      x = overlay.x1;
+      y += face->height;
+      continue;
+    }
+
+    int w;
+    const BYTE *mask = *c == '\r' ? NULL : lcdGlyph(face, *c, &w);
+    if (!mask)
+      continue;
+
+    for (int j = MAX(-y, 0); j < MIN(face->height, gImgHeight - y); j++)
+    for (int i = MAX(-x, 0); i < MIN(w, gImgWidth - x); i++)
+      if (mask[j*w + i])
+        out[(y + j)*gImgWidth + x + i] = overlay.hue;
+
+    x += w;
+  }
+
+  if (overlay.x2 != font || overlay.y2 != size)
+  {
+    gLCDTextFont = font;
+    gLCDTextSize = size;
+    halLCDSetTextFont(font);
+    halLCDSetTextSize(size);
+  }
+}
+
+/*
+The annotations are drawn in order into the converted window, so they
+reach the display in the same transfer as the image, and are used up.
+*/
+static void lcdOverlay(RGB565 *out)
+{
+  for (int k = 0; k < gLCDOverlayCount; k++)
+  {
+    const LCDOverlay &overlay = gLCDOverlays[k];
+
+    switch (overlay.shape)
+    {
+      case LCD_OVERLAY_LINE:
+        // As LCDLine(), straight lines stop short of their end
+        if (overlay.y1 == overlay.y2)
+          overlaySpan(out, MIN(overlay.x1, overlay.x2), overlay.y1, abs(overlay.x2 - overlay.x1), overlay.hue);
+        else if (overlay.x1 == overlay.x2)
+        {
+          for (int y = MIN(overlay.y1, overlay.y2); y < MAX(overlay.y1, overlay.y2); y++)
+            overlayPixel(out, overlay.x1, y, overlay.hue);
+        }
+        else
+          overlayLine(out, overlay.x1, overlay.y1, overlay.x2, overlay.y2, overlay.hue);
+        break;
+      case LCD_OVERLAY_AREA:
+        if (overlay.fill)
+        {
+          for (int y = overlay.y1; y < overlay.y2; y++)
+            overlaySpan(out, overlay.x1, y, overlay.x2 - overlay.x1, overlay.hue);
+        }
+        else if (overlay.x2 > overlay.x1 && overlay.y2 > overlay.y1)
+        {
+          overlaySpan(out, overlay.x1, overlay.y1, overlay.x2 - overlay.x1, overlay.hue);
+          overlaySpan(out, overlay.x1, overlay.y2 - 1, overlay.x2 - overlay.x1, overlay.hue);
+          overlayLine(out, overlay.x1, overlay.y1, overlay.x1, overlay.y2 - 1, overlay.hue);
+          overlayLine(out, overlay.x2 - 1, overlay.y1, overlay.x2 - 1, overlay.y2 - 1, overlay.hue);
+        }
+        break;
+      case LCD_OVERLAY_CIRCLE:
+        overlayCircle(out, overlay.x1, overlay.y1, overlay.x2, overlay.hue, overlay.fill);
+        break;
+      default:
+        overlayText(out, overlay);
+        break;
+    }
+  }
+
+  gLCDOverlayCount = 0;
+  gLCDOverlayTextSize = 0;
+}
+
+// Converts a color image to the display's big-endian RGB565 in the image window
+static void colorToLCD(const COLOR *col_img, RGB565 *out)
+{
+  for (int y = 0; y < gImgHeight; y++)
+  {
+    const COLOR *src = col_img + gImgRow[y];
+    RGB565 *dst = out + y*gImgWidth;
+
+    if (gImgDirect)
+      for (int x = 0; x < gImgWidth; x++)
+        dst[x] = lcdColor(src[x]);
+    else
+      for (int x = 0; x < gImgWidth; x++)
+        dst[x] = lcdColor(src[gImgCol[x]]);
+  }
+}
+
+int LCDImage(BYTE *img)
+{
+  PROF_SCOPE("LCDImage");
+
+  if (!img)
+    return -1;
+
+  colorToLCD((COLOR*)img, pLCDBuffer);
+  lcdOverlay(pLCDBuffer);
+  halLCDPushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
+  lcdDirty(gImgXStart, gImgYStart, gImgXStart + gImgWidth, gImgYStart + gImgHeight);
+
+  return 0;
+}
+
+/*
+The image is converted into the buffer that was drawn two calls ago, which
+the display finished with before the last call could start, so only the
+start of drawing waits, for the previous image. Processing between two
+calls thus overlaps the drawing of the previous frame.
+*/
+int LCDImageAsync(BYTE *img)
+{
+  PROF_SCOPE("LCDImageAsync");
+
+  if (!img)
+    return -1;
+
+  int size = gImgWidth*gImgHeight;
+  if (size > gLCDAsyncSize)
+  {
+    halLCDWait();
+
+    for (int k = 0; k < 2; k++)
+    {
+      free(pLCDAsync[k]);
+      pLCDAsync[k] = (RGB565*)allocInternal(size*sizeof(RGB565));
+    }
+
+    if (!pLCDAsync[0] || !pLCDAsync[1])
+    {
+      gLCDAsyncSize = 0;
+      return -1;
+    }
+
+    gLCDAsyncSize = size;
+  }
+
+  RGB565 *buffer = pLCDAsync[gLCDAsyncNext];
+  colorToLCD((COLOR*)img, buffer);
+  lcdOverlay(buffer);
+  halLCDPushRectAsync(gImgXStart, gImgYStart, gImgWidth, gImgHeight, buffer);
+  lcdDirty(gImgXStart, gImgYStart, gImgXStart + gImgWidth, gImgYStart + gImgHeight);
+  gLCDAsyncNext ^= 1;
+
+  return 0;
+}
+
+int LCDImageWait(void)
+{
+  halLCDWait();
+
+  return 0;
+}
 
-  gTFT.pushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
+int LCDSetPalette(int palette, const COLOR* colors)
+{
+  if (palette < 0 || palette >= LCD_PALETTES || !colors)
+    return -1;
+
+  for (int v = 0; v < 256; v++)
+    gLCDPalettes[palette][v] = lcdColor(colors[v]);
+
+  return 0;
+}
+
+// One table lookup per pixel, the palette being converted already
+static int lcdImagePalette(BYTE *img, const RGB565 *palette)
+{
+  for (int y = 0; y < gImgHeight; y++)
+  {
+    const BYTE *src = img + gImgRow[y];
+    RGB565 *dst = pLCDBuffer + y*gImgWidth;
+
+    if (gImgDirect)
+      for (int x = 0; x < gImgWidth; x++)
+        dst[x] = palette[src[x]];
+    else
+      for (int x = 0; x < gImgWidth; x++)
+        dst[x] = palette[src[gImgCol[x]]];
+  }
+
+  lcdOverlay(pLCDBuffer);
+  halLCDPushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
+  lcdDirty(gImgXStart, gImgYStart, gImgXStart + gImgWidth, gImgYStart + gImgHeight);
 
   return 0;
 }
 
 int LCDImageGray(BYTE *g)
 {
+  PROF_SCOPE("LCDImageGray");
+
   if (!g)
     return -1;
 
+  return lcdImagePalette(g, gLCDPalettes[LCD_PALETTE_GRAY]);
+}
+
+int LCDImagePalette(BYTE *img, int palette)
+{
+  PROF_SCOPE("LCDImagePalette");
+
+  if (!img || palette < 0 || palette >= LCD_PALETTES)
+    return -1;
+
+  return lcdImagePalette(img, gLCDPalettes[palette]);
+}
+
+int LCDImagePacked(BYTE *bits, COLOR fg, COLOR bg)
+{
+  PROF_SCOPE("LCDImagePacked");
+
+  if (!bits)
+    return -1;
+
+  const RGB565 hues[2] = {lcdColor(bg), lcdColor(fg)};
+
   for (int y = 0; y < gImgHeight; y++)
-  for (int x = 0; x < gImgWidth; x++)
   {
-    int i = y*gImgWidth + x;
-
-    COLOR col = IPPRGB2Col(g[i], g[i], g[i]);
+    RGB565 *out = pLCDBuffer + y*gImgWidth;
 
-    pLCDBuffer[i] = rgb888To565(col);
-    rgb565SwapEndianess(&pLCDBuffer[i]);
+    for (int x = 0; x < gImgWidth; x++)
+    {
+      int bit = gImgBitRow[y] + gImgBitCol[x];
+      out[x] = hues[(bits[bit >> 3] >> (7 - (bit & 7))) & 1];
+    }
   }
 
-  gTFT.pushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
- 
+  lcdOverlay(pLCDBuffer);
+  halLCDPushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
+  lcdDirty(gImgXStart, gImgYStart, gImgXStart + gImgWidth, gImgYStart + gImgHeight);
+
   return 0;
 }
 
 int LCDImageBinary(BYTE *b)
 {
+  PROF_SCOPE("LCDImageBinary");
+
   if (!b)
     return -1;
 
-  for (int y = 0; y < gImgHeight; y++)
-  for (int x = 0; x < gImgWidth; x++)
-  {
-    int i = y*gImgWidth + x;
-    pLCDBuffer[i] = b[i] ? 0xFFFF : 0;
-  }
+  return lcdImagePalette(b, gLCDBinary);
+}
+
+static LCDOverlay* lcdOverlayAdd(int shape, int x1, int y1, int x2, int y2, COLOR col, int fill)
+{
+  if (gLCDOverlayCount == LCD_OVERLAY_MAX)
+    return NULL;
+
+  LCDOverlay *overlay = &gLCDOverlays[gLCDOverlayCount++];
+  *overlay = {shape, x1, y1, x2, y2, lcdColor(col), fill};
+
+  return overlay;
+}
+
+int LCDOverlayLine(int x1, int y1, int x2, int y2, COLOR col)
+{
+  return lcdOverlayAdd(LCD_OVERLAY_LINE, x1, y1, x2, y2, col, 0) ? 0 : -1;
+}
+
+int LCDOverlayArea(int x1, int y1, int x2, int y2, COLOR col, int fill)
+{
+  return lcdOverlayAdd(LCD_OVERLAY_AREA, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2), col, fill) ? 0 : -1;
+}
+
+int LCDOverlayCircle(int x1, int y1, int radius, COLOR col, int fill)
+{
+  return lcdOverlayAdd(LCD_OVERLAY_CIRCLE, x1, y1, radius, 0, col, fill) ? 0 : -1;
+}
+
+int LCDOverlayPrintf(int row, int column, COLOR col, const char *format, ...)
+{
+  int room = LCD_OVERLAY_TEXT_SIZE - gLCDOverlayTextSize;
+  if (!format || room <= 1)
+    return -1;
+
+  char *text = gLCDOverlayText + gLCDOverlayTextSize;
+  va_list arg_ptr;
+  va_start(arg_ptr, format);
+  int length = vsnprintf(text, room, format, arg_ptr);
+  va_end(arg_ptr);
+
+  if (length < 0 || !lcdOverlayAdd(LCD_OVERLAY_TEXT, column, row, gLCDTextFont, gLCDTextSize, col, gLCDOverlayTextSize))
+    return -1;
+
+  // Text cut at the end of the buffer is still drawn
+  gLCDOverlayTextSize += MIN(length + 1, room);
 
-  gTFT.pushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
- 
   return 0;
 }
 
-// The TFT_eSPI automatically refreshes as a background interrupt
+int LCDOverlayClear(void)
+{
+  gLCDOverlayCount = 0;
+  gLCDOverlayTextSize = 0;
+
+  return 0;
+}
+
+int LCDOverlayDraw(COLOR bg)
+{
+  PROF_SCOPE("LCDOverlayDraw");
+
+  RGB565 hue = lcdColor(bg);
+  for (int i = 0; i < gImgWidth*gImgHeight; i++)
+    pLCDBuffer[i] = hue;
+
+  lcdOverlay(pLCDBuffer);
+  halLCDPushRect(gImgXStart, gImgYStart, gImgWidth, gImgHeight, pLCDBuffer);
+  lcdDirty(gImgXStart, gImgYStart, gImgXStart + gImgWidth, gImgYStart + gImgHeight);
+
+  return 0;
+}
+
+// Each dirty region is one transfer; without LCD_NOAUTOREFRESH everything is on the display already
 int LCDRefresh(void)
 {
+  PROF_SCOPE("LCDRefresh");
+
+  for (int i = 0; i < gLCDDirtyCount; i++)
+  {
+    const LCDRect &r = gLCDDirty[i];
+    halLCDFlush(r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+  }
+  gLCDDirtyCount = 0;
+
   return 0;
 }
 
-int KEYGet(void)
+/*
+Buttons pressed since the counts in presses were taken, updating them. Without
+the button task, the buttons held now but not in held, which is updated too.
+*/
+static int keyPressed(uint32_t *presses, int *held)
 {
   int key = NOKEY;
 
-  while (!key)
-    key = KEYRead();
+  if (gButtonsQueued)
+  {
+    for (int button = HAL_BUTTON_LEFT; button <= HAL_BUTTON_RIGHT; button++)
+    {
+      uint32_t count = gKeyPresses[button].load(std::memory_order_acquire);
+      if (count != presses[button])
+        key |= KEY1 << button;
+      presses[button] = count;
+    }
+    return key;
+  }
+
+  int now = (halButton(HAL_BUTTON_LEFT) ? KEY1 : NOKEY) | (halButton(HAL_BUTTON_RIGHT) ? KEY2 : NOKEY);
+  key = now & ~*held;
+  *held = now;
 
   return key;
 }
 
+/*
+Only a press that begins during the call counts, so a key still held from the
+last call is not read twice. With the input tasks running this sleeps until
+one of them reports; otherwise the buttons or the touch screen are read again
+every millisecond.
+*/
+int KEYGet(int ms)
+{
+  uint32_t start = halMillis(), presses[2] = {0, 0};
+  int held = NOKEY;
+  keyPressed(presses, &held);
+
+  while (true)
+  {
+    int key = UIMenuGet() | keyPressed(presses, &held);
+    if (key)
+      return key;
+
+    uint32_t waited = halMillis() - start;
+    if (ms >= 0 && waited >= (uint32_t)ms)
+      return NOKEY;
+
+    int wait = ms < 0 ? -1 : ms - (int)waited;
+    if (!gButtonsQueued || (gTouchEnabled && !gTouchQueued))
+      wait = 1;
+    halInputWait(wait);
+  }
+}
+
 // BEN: Absent the LCDMenu functions, I implemented this to interpret
 // the T-Display-S3's physical buttons as keys instead. It's possible
 // for more than one button to be pressed at a time, so it's up to the
 // user to interpret the key enums as bit-flags in the value returned.
+// The entries of an LCDMenu menu are keys as well, held as UIUpdate last saw
+// them. With the button task running, the buttons are the word it keeps
+// rather than the pins.
 int KEYRead(void)
 {
-  int key = NOKEY;
+  int key = UIMenuRead();
 
-  if (!digitalRead(PIN_LEFT_BUTTON))
+  if (gButtonsQueued)
+  {
+    halInputPeek();
+    return key | gKeyState.load(std::memory_order_acquire);
+  }
+
+  if (halButton(HAL_BUTTON_LEFT))
     key |= KEY1;
 
-  if (!digitalRead(PIN_RIGHT_BUTTON))
+  if (halButton(HAL_BUTTON_RIGHT))
     key |= KEY2;
 
   return key;
 }
 
-int KEYWait(int key)
+int KEYWait(int key, int ms)
 {
   if (!key)
     return 0;
-  
-  int pressed = NOKEY;
-  while (!pressed)
+
+  uint32_t start = halMillis();
+
+  while (true)
+  {
+    int left = ms < 0 ? -1 : ms - (int)(halMillis() - start);
+    if (ms >= 0 && left <= 0)
+      return -1;
+
+    if (KEYGet(left) & key)
+      return 0;
+  }
+}
+
+/*
+With the touch task running this sleeps until the next reading rather than
+reading the controller over and over.
+*/
+int KEYGetXY (int *x, int *y)
+{
+  if (KEYReadXY(x, y) != 0)
+    return -1;
+
+  while (*x < 0 || *y < 0)
   {
-    pressed = KEYGet();
-    pressed &= key;
+    if (gTouchQueued)
+      halInputWait(-1);
+    KEYReadXY(x, y);
   }
 
   return 0;
-}        
+}
 
-int KEYGetXY (int *x, int *y)
+// The latest reading of the touch task, without going to the controller
+int KEYReadXY(int *x, int *y)
 {
   *x = -1;
   *y = -1;
 
-  if (!gTouchEnabled)
-    return -1;
+  if (!gTouchEnabled)
+    return -1;
+
+  if (gTouchQueued)
+  {
+    halInputPeek();
+    int32_t state = gTouchState.load(std::memory_order_acquire);
+    if (state >= 0)
+    {
+      *x = state >> 16;
+      *y = (int16_t)(state & 0xFFFF);
+    }
+    return 0;
+  }
+
+  TRACEEvent(TRACE_BEGIN, "KEYReadXY");
+  halTouchRead(x, y);
+  TRACEEvent(TRACE_END, "KEYReadXY");
+
+  return 0;
+}
+
+// The two queues are merged by time, the older event first
+int KEYReadEvent(KEYEvent *event)
+{
+  if (!event)
+    return -1;
+
+  const KEYEvent *touch = gTouchQueued ? keyPeek(gTouchEvents) : NULL;
+  const KEYEvent *button = gButtonsQueued ? keyPeek(gButtonEvents) : NULL;
+  if (!touch && !button)
+    return -1;
+
+  bool older = touch && (!button || (int32_t)(touch->time - button->time) <= 0);
+  *event = older ? *touch : *button;
+  (older ? gTouchEvents : gButtonEvents).tail.fetch_add(1, std::memory_order_release);
+
+  return 0;
+}
+
+int KEYGetEvent(KEYEvent *event)
+{
+  if (!event || (!gTouchQueued && !gButtonsQueued))
+    return -1;
+
+  while (KEYReadEvent(event) != 0)
+    halInputWait(-1);
+
+  return 0;
+}
+
+// Widens a gray image read into the start of img to color, in place from the end
+static void grayToColor(COLOR *img)
+{
+  BYTE *gray = (BYTE*)img;
+
+  for (int i = QQVGA_PIXELS - 1; i >= 0; i--)
+    img[i] = gray[i] * 0x010101;
+}
+
+/*
+A lane scene of two white markings on a textured floor below a plain sky,
+drifting from side to side over three seconds of frames. It depends only on
+the frame number, so every board sees the same sequence.
+*/
+static void syntheticFrame(COLOR *img, int frame)
+{
+  const int horizon = 30;
+  int shift = 30*sinf(frame*(2*M_PI/90));
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  {
+    int depth = y - horizon;
+    int centre = QQVGA_WIDTH/2 + shift*depth/(QQVGA_HEIGHT - horizon);
+    int half = 10 + 60*depth/(QQVGA_HEIGHT - horizon);
+    int width = 1 + depth/30;
+
+    for (int x = 0; x < QQVGA_WIDTH; x++)
+    {
+      COLOR col;
+
+      if (depth < 0)
+        col = 0x8090A0;
+      else if (abs(abs(x - centre) - half) < width)
+        col = 0xF0F0F0;
+      else
+        col = (0x40 + ((x*7 + y*13 + frame) & 7)) * 0x010101;
+
+      img[y*QQVGA_WIDTH + x] = col;
+    }
+  }
+}
+
+// Reads the next frame of the source into img, and its time after the previous frame in microseconds into period
+static int sourceFrame(COLOR *img, uint32_t *period)
+{
+  *period = gCamSourceFrame > 0 ? CAM_SOURCE_FRAME_US : 0;
+
+  switch (gCamSource)
+  {
+    case CAM_FILES:
+    {
+      char path[CAM_SOURCE_NAME_SIZE + 16];
+      snprintf(path, sizeof(path), gCamSourceName, gCamSourceFrame);
+
+      int type = IPReadFile(path, (BYTE*)img);
+      if (type < 0 && gCamSourceFrame > 0)
+      {
+        gCamSourceFrame = 0;
+        snprintf(path, sizeof(path), gCamSourceName, gCamSourceFrame);
+        type = IPReadFile(path, (BYTE*)img);
+      }
+
+      if (type < 0)
+        return -1;
+      if (type != 3)
+        grayToColor(img);
+      break;
+    }
+    case CAM_RECORDING:
+    {
+      RECInfo info;
+
+      if (RECRead((BYTE*)img, &info) != 0)
+      {
+        gCamSourceFrame = 0;
+        if (RECOpen(gCamSourceName) != gCamSourceFormat || RECRead((BYTE*)img, &info) != 0)
+          return -1;
+      }
+
+      if (gCamSourceFormat == REC_GRAY)
+        grayToColor(img);
+
+      *period = gCamSourceFrame > 0 ? info.time - gCamSourceTime : 0;
+      gCamSourceTime = info.time;
+      break;
+    }
+    default:
+      syntheticFrame(img, gCamSourceFrame);
+      break;
+  }
+
+  gCamSourceFrame++;
+
+  return 0;
+}
+
+// Reads the next frame of the source into img, at its time when paced in real time
+static int sourceGet(COLOR *img)
+{
+  uint32_t period;
+
+  if (sourceFrame(img, &period) != 0)
+    return -1;
+
+  if (gCamPacing == CAM_PACE_REALTIME)
+  {
+    uint32_t due = gCamSourceDue + period;
+    int32_t wait = due - halMicros();
+
+    if (wait >= 1000)
+      halDelay(wait / 1000);
+    while ((int32_t)(due - halMicros()) > 0)
+      halIdle();
+
+    // A frame asked for late is delivered at once, and the next follow it
+    gCamSourceDue = wait > 0 ? due : halMicros();
+  }
+
+  return 0;
+}
+
+/*
+The pattern of CAM_FILES is a printf format given the frame number, so it
+must hold exactly one integer conversion, with flags, width and precision
+but no '*' or length, besides any "%%". Anything else would read arguments
+that are not there.
+*/
+static bool camPatternValid(const char *pattern)
+{
+  int conversions = 0;
+
+  for (const char *p = pattern; *p; p++)
+  {
+    if (*p != '%')
+      continue;
+
+    if (*++p == '%')
+      continue;
+
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p == '.')
+      p += 1 + strspn(p + 1, "0123456789");
+
+    if (!*p || !strchr("diouxX", *p))
+      return false;
+
+    conversions++;
+  }
+
+  return conversions == 1;
+}
+
+int CAMSetSource(int source, const char* name, int pacing)
+{
+  if (source < CAM_LIVE || source > CAM_SYNTHETIC || (pacing != CAM_PACE_FAST && pacing != CAM_PACE_REALTIME))
+    return -1;
+
+  if ((source == CAM_FILES || source == CAM_RECORDING) && (!name || strlen(name) >= CAM_SOURCE_NAME_SIZE))
+    return -1;
+
+  if (source == CAM_FILES && !camPatternValid(name))
+    return -1;
+
+  if (gCamSource == CAM_RECORDING)
+    RECClose();
+
+  gCamSource = CAM_LIVE;
+
+  if (source == CAM_LIVE)
+    return 0;
+
+  if (!pCamSourceImg)
+    pCamSourceImg = (COLOR*)halAllocExternal(QQVGA_PIXELS*sizeof(COLOR));
+
+  if (!pCamSourceImg)
+    return -1;
+
+  if (source == CAM_FILES)
+  {
+    // The sequence has to have a first file
+    char path[CAM_SOURCE_NAME_SIZE + 16];
+    snprintf(path, sizeof(path), name, 0);
+    if (IPReadFile(path, (BYTE*)pCamSourceImg) < 0)
+      return -1;
+  }
+  else if (source == CAM_RECORDING)
+  {
+    gCamSourceFormat = RECOpen(name);
+    if (gCamSourceFormat < 0)
+      return -1;
+  }
+
+  strcpy(gCamSourceName, name ? name : "");
+  gCamSource = source;
+  gCamPacing = pacing;
+  gCamSourceFrame = 0;
+  gCamSourceDue = halMicros();
+
+  return 0;
+}
+
+// The ESP32-CAM is already initialised after EYEBOTInit() is invoked.
+int CAMInit(int resolution)
+{
+  return 0;
+}
+
+// The ESP32-CAM cannot be released.
+int CAMRelease(void)
+{
+  return 0; 
+}
+
+int CAMGet(BYTE *buf)
+{  
+  PROF_SCOPE("CAMGet");
+
+  if (!buf)
+    return -1;
+
+  if (gCamSource != CAM_LIVE)
+    return sourceGet((COLOR*)buf);
+
+  RGB565 *pixels = pCamBuffer;
+
+  // If the camera does not deliver a frame in time,
+  // an entirely blank image is returned to the user.
+  bool timed_out = halCamRead(pixels) != 0;
+  COLOR *img = (COLOR*)buf;
+
+  if (timed_out)
+  {
+    // Return a blank image
+    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    {
+      img[i] = RED;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    {
+      img[i] = rgb565To888(pixels[i]);
+    }
+  }
+
+  return 0;
+}
+
+int CAMGetGray(BYTE *buf)
+{
+  PROF_SCOPE("CAMGetGray");
+
+  if (!buf)
+    return -1;
+
+  float divisor = 1.0f/3.0f;
+
+  if (gCamSource != CAM_LIVE)
+  {
+    if (sourceGet(pCamSourceImg) != 0)
+      return -1;
+
+    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    {
+      BYTE r, g, b;
+      IPPCol2RGB(pCamSourceImg[i], &r, &g, &b);
+
+      buf[i] = (r + g + b)*divisor;
+    }
+
+    return 0;
+  }
+
+  RGB565 *pixels = pCamBuffer;
+
+  // If the camera does not deliver a frame in time,
+  // an entirely blank image is returned to the user.
+  bool timed_out = halCamRead(pixels) != 0;
+
+  if (timed_out)
+  {
+    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    {
+      buf[i] = 0xFF;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    {
+      COLOR col = rgb565To888(pixels[i]);
+
+      BYTE r, g, b;
+      IPPCol2RGB(col, &r, &g, &b);
+
+      buf[i] = (r + g + b)*divisor;
+    }
+  }
+
+  return 0;
+}
+
+// The only image processing resolution available is QQVGA
+int IPSetSize(int resolution)
+{
+  return -1;
+}
+
+// Buffered reading of a PNM file through the HAL
+typedef struct {
+  void *file;
+  BYTE buf[256];
+  int pos, len;
+} PNMReader;
+
+static int pnmByte(PNMReader *reader)
+{
+  if (reader->pos == reader->len)
+  {
+    reader->len = halFileRead(reader->file, reader->buf, sizeof(reader->buf));
+    reader->pos = 0;
+    if (reader->len <= 0)
+    {
+      reader->len = 0;
+      return -1;
+    }
+  }
+
+  return reader->buf[reader->pos++];
+}
+
+// Next number of the header, skipping white space and comments; -1 on error
+static int pnmNumber(PNMReader *reader)
+{
+  int c = pnmByte(reader);
+
+  while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n')
+  {
+    if (c == '#')
+    {
+      while (c >= 0 && c != '\n')
+        c = pnmByte(reader);
+    }
+    c = pnmByte(reader);
+  }
+
+  if (c < '0' || c > '9')
+    return -1;
+
+  int value = 0;
+  while (c >= '0' && c <= '9' && value < 100000)
+  {
+    value = 10*value + c - '0';
+    c = pnmByte(reader);
+  }
+
+  // The single white space character after the number is consumed with it
+  return value;
+}
+
+/*
+Binary PBM, PGM and PPM files with 8-bit samples are read. Colour files
+fill a color image and gray or black and white ones a gray image. Pixels
+outside the file are filled with black, and those beyond QQVGA are cropped.
+*/
+int IPReadFile(char *filename, BYTE* img)
+{
+  if (!filename || !img)
+    return -1;
+
+  PNMReader reader = {halFileOpen(filename, "r"), {}, 0, 0};
+  if (!reader.file)
+    return -1;
+
+  int type = -1;
+  if (pnmByte(&reader) == 'P')
+    type = pnmByte(&reader) - '0';
+
+  int width = pnmNumber(&reader);
+  int height = pnmNumber(&reader);
+  int maxval = type == 4 ? 1 : pnmNumber(&reader);
+
+  if ((type != 4 && type != 5 && type != 6) || width <= 0 || height <= 0 || maxval <= 0 || maxval > 255)
+  {
+    halFileClose(reader.file);
+    return -1;
+  }
+
+  int channels = type == 6 ? 3 : 1;
+  COLOR *col = (COLOR*)img;
+  memset(img, 0, QQVGA_PIXELS*(type == 6 ? sizeof(COLOR) : 1));
+
+  bool complete = true;
+  for (int y = 0; y < height && complete; y++)
+  {
+    int bits = 0, c = 0;
+
+    for (int x = 0; x < width; x++)
+    {
+      BYTE v[3];
+
+      if (type == 4)
+      {
+        if (bits == 0)
+        {
+          c = pnmByte(&reader);
+          bits = 8;
+        }
+        bits--;
+        v[0] = (c >> bits) & 1 ? 0 : 0xFF;
+      }
+      else
+      {
+        for (int k = 0; k < channels; k++)
+        {
+          c = pnmByte(&reader);
+          v[k] = c*255 / maxval;
+        }
+      }
+
+      if (c < 0)
+      {
+        complete = false;
+        break;
+      }
+
+      if (x >= QQVGA_WIDTH || y >= QQVGA_HEIGHT)
+        continue;
+
+      if (type == 6)
+        col[y*QQVGA_WIDTH + x] = IPPRGB2Col(v[0], v[1], v[2]);
+      else
+        img[y*QQVGA_WIDTH + x] = v[0];
+    }
+  }
+
+  halFileClose(reader.file);
+
+  if (!complete)
+    return -1;
+
+  return type == 6 ? 3 : type == 5 ? 2 : 1;
+}
+
+static int pnmWrite(char *filename, BYTE *img, int type)
+{
+  if (!filename || !img)
+    return -1;
+
+  void *file = halFileOpen(filename, "w");
+  if (!file)
+    return -1;
+
+  char header[32];
+  int len = snprintf(header, sizeof(header), "P%d\n%d %d\n255\n", type, QQVGA_WIDTH, QQVGA_HEIGHT);
+  bool ok = halFileWrite(file, header, len) == len;
+
+  BYTE row[3*QQVGA_WIDTH];
+  int row_size = type == 6 ? 3*QQVGA_WIDTH : QQVGA_WIDTH;
+  COLOR *col = (COLOR*)img;
+
+  for (int y = 0; y < QQVGA_HEIGHT && ok; y++)
+  {
+    if (type == 6)
+    {
+      for (int x = 0; x < QQVGA_WIDTH; x++)
+        IPPCol2RGB(col[y*QQVGA_WIDTH + x], &row[3*x], &row[3*x + 1], &row[3*x + 2]);
+    }
+    else
+      memcpy(row, img + y*QQVGA_WIDTH, QQVGA_WIDTH);
+
+    ok = halFileWrite(file, row, row_size) == row_size;
+  }
+
+  halFileClose(file);
+
+  return ok ? 0 : -1;
+}
+
+int IPWriteFile(char *filename, BYTE* img)
+{
+  return pnmWrite(filename, img, 6);
+}
+
+int IPWriteFileGray(char *filename, BYTE* gray)
+{
+  return pnmWrite(filename, gray, 5);
+}
+
+static void laplaceBand(int first, int last, void *arg)
+{
+  IPBandArgs *args = (IPBandArgs*)arg;
+  BYTE *grayIn = args->in, *grayOut = args->out[0];
+
+  for (int y = MAX(first, 1); y < MIN(last, QQVGA_HEIGHT - 1); y++)
+  for (int x = 1; x < QQVGA_WIDTH - 1; x++)
+  {
+    int i = y*QQVGA_WIDTH + x;
+
+    int delta = abs(4*grayIn[i] - grayIn[i-1] - grayIn[i+1] - grayIn[i-QQVGA_WIDTH] - grayIn[i+QQVGA_WIDTH]);
+
+    if (delta > 0xFF) 
+      delta = 0xFF;
+
+    grayOut[i] = (BYTE)delta;
+  }
+}
+
+void IPLaplace(BYTE* grayIn, BYTE* grayOut)
+{ 
+  if (!grayIn || !grayOut)
+    return;
+
+  IPBandArgs args = {grayIn, {grayOut}, 0, 0};
+  IPParallelFor(QQVGA_HEIGHT, 1, laplaceBand, &args);
+}
+
+// BEN: Based on my research, this appears to be a Pseudo-Sobel implementation, and not true Sobel.
+// I copied this straight from the EyeBot 8 code.
+static void sobelBand(int first, int last, void *arg)
+{
+  IPBandArgs *args = (IPBandArgs*)arg;
+  BYTE *grayIn = args->in, *grayOut = args->out[0];
+
+  for (int y = MAX(first, 1); y < MIN(last, QQVGA_HEIGHT-1); y++)
+  for (int x = 1; x < QQVGA_WIDTH-1; x++)
+  {
+    int i = y*QQVGA_WIDTH + x;
+
+    int deltaX = 2*grayIn[i+1] + grayIn[i-QQVGA_WIDTH+1] + grayIn[i+QQVGA_WIDTH+1] - 2*grayIn[i-1] - grayIn[i-QQVGA_WIDTH-1] - grayIn[i+QQVGA_WIDTH-1];
+    int deltaY = grayIn[i-QQVGA_WIDTH-1] + 2*grayIn[i-QQVGA_WIDTH] + grayIn[i-QQVGA_WIDTH+1] - grayIn[i+QQVGA_WIDTH-1] - 2*grayIn[i+QQVGA_WIDTH] - grayIn[i+QQVGA_WIDTH+1];
+
+    int grad = (abs(deltaX) + abs(deltaY)) / 3;
+    if (grad > 255) 
+      grad = 255;
+
+    grayOut[i] = (BYTE)grad;
+  }
+}
+
+void IPSobel(BYTE* grayIn, BYTE* grayOut)
+{
+  if (!grayIn || !grayOut)
+    return;
+
+  memset(grayOut, 0, QQVGA_WIDTH); // clear first row
+
+  IPBandArgs args = {grayIn, {grayOut}, 0, 0};
+  IPParallelFor(QQVGA_HEIGHT, 1, sobelBand, &args);
+
+  memset(grayOut + (QQVGA_HEIGHT-1)*(QQVGA_WIDTH), 0, QQVGA_WIDTH);// clear final row 
+}
+
+static void col2GrayBand(int first, int last, void *arg)
+{
+  IPBandArgs *args = (IPBandArgs*)arg;
+  COLOR *img = (COLOR*)args->in;
+  BYTE *grayOut = args->out[0];
+  float divisor = 1.0f/3.0f;
+
+  for (int y = first; y < last; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int i = y * QQVGA_WIDTH + x;
+
+    BYTE r, g, b;
+    IPPCol2RGB(img[i], &r, &g, &b);
+
+    grayOut[i] = (r + g + b)*divisor;
+  }
+}
+
+void IPCol2Gray(BYTE* imgIn, BYTE* grayOut)
+{
+  if (!imgIn || !grayOut)
+    return;
+
+  IPBandArgs args = {imgIn, {grayOut}, 0, 0};
+  IPParallelFor(QQVGA_HEIGHT, 0, col2GrayBand, &args);
+}
+
+void IPGray2Col(BYTE* imgIn, BYTE* colOut)
+{
+  if (!imgIn || !colOut)
+    return;
+  
+  COLOR *col = (COLOR*)colOut;
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int i = y * QQVGA_WIDTH + x;
+    col[i] = IPPRGB2Col(imgIn[i], imgIn[i], imgIn[i]);
+  }
+}
+
+void IPRGB2Col(BYTE* r, BYTE* g, BYTE* b, BYTE* imgOut)
+{
+  COLOR *img = (COLOR*)imgOut;
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int i = y * QQVGA_WIDTH + x;
+
+    img[i] = IPPRGB2Col(r[i], g[i], b[i]);
+  }
+}
+
+static void col2HSIBand(int first, int last, void *arg)
+{
+  IPBandArgs *args = (IPBandArgs*)arg;
+  COLOR *col = (COLOR*)args->in;
+  BYTE *h = args->out[0], *s = args->out[1], *i = args->out[2];
+
+  for (int y = first; y < last; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int idx = y * QQVGA_WIDTH + x;
+
+    IPPCol2HSI(col[idx], &h[idx], &s[idx], &i[idx]);
+  }
+}
+
+void IPCol2HSI(BYTE* img, BYTE* h, BYTE* s, BYTE* i)
+{
+  if (!h || !s || !i)
+    return;
+
+  IPBandArgs args = {img, {h, s, i}, 0, 0};
+  IPParallelFor(QQVGA_HEIGHT, 0, col2HSIBand, &args);
+}
+
+// A black colour pixel in c2 is interpreted as transparency
+void IPOverlay(BYTE* c1, BYTE* c2, BYTE* cOut)
+{
+  if (!c1 || !c2 || !cOut)
+    return;
+
+  COLOR *out = (COLOR*)cOut;
+  COLOR *img1 = (COLOR*)c1;
+  COLOR *img2 = (COLOR*)c2;
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int i = y*QQVGA_WIDTH + x;
+    out[i] = img2[i] ? img2[i] : img1[i];
+  }
+}
+
+// A black pixel in g2 is interpreted as transparency
+void IPOverlayGray(BYTE* g1, BYTE* g2, COLOR col, BYTE* cOut)
+{
+  if (!g1 || !g2 || !cOut)
+    return;
+  
+  COLOR *out = (COLOR*)cOut;
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    int i = y*QQVGA_WIDTH + x;
+    out[i] = g2[i] ? col : IPPRGB2Col(g1[i], g1[i], g1[i]);
+  }
+}
+
+/*
+Count cleared partial histograms: from the arena in the task that owns it,
+else the shared ones, or the heap while another caller holds those, so that
+the IPHistogram*() functions are safe in any task and in the bands of
+IPParallelFor(). NULL if the heap has no room either.
+*/
+static HistPartial* histogramPartials(int count, bool *heap)
+{
+  *heap = false;
+
+  HistPartial *partials = (HistPartial*)ARENAAlloc(count*sizeof(HistPartial), ARENA_SRAM);
+  if (partials)
+    return partials;
+
+  if (!gHistPartialsTaken.test_and_set(std::memory_order_acquire))
+    partials = gHistPartials;
+  else
+  {
+    partials = (HistPartial*)malloc(count*sizeof(HistPartial));
+    *heap = true;
+  }
+
+  if (partials)
+    memset(partials, 0, count*sizeof(HistPartial));
+
+  return partials;
+}
+
+// Gives back partials of histogramPartials(); the arena's go at ARENAReset()
+static void histogramRelease(HistPartial *partials, bool heap)
+{
+  if (partials == gHistPartials)
+    gHistPartialsTaken.clear(std::memory_order_release);
+  else if (heap)
+    free(partials);
+}
+
+// Incrementing a single histogram stalls whenever neighbouring pixels share a
+// gray level, since each increment has to wait on the store of the one before.
+// Spreading consecutive pixels across four of the HIST_PARTIAL_COUNT partial
+// histograms breaks that dependency chain, and the partials are only summed
+// once at the end.
+static void histogramAccumulate(HistPartial *partials, const BYTE *px, const BYTE *mask, int n)
+{
+  u32 *h0 = partials[0];
+  u32 *h1 = partials[1];
+  u32 *h2 = partials[2];
+  u32 *h3 = partials[3];
+  int i = 0;
+
+  if (mask)
+  {
+    // Branchless, so that the masked case keeps the same four chains
+    for (; i + 4 <= n; i += 4)
+    {
+      h0[px[i]] += mask[i] != 0;
+      h1[px[i+1]] += mask[i+1] != 0;
+      h2[px[i+2]] += mask[i+2] != 0;
+      h3[px[i+3]] += mask[i+3] != 0;
+    }
+
+    for (; i < n; i++)
+      h0[px[i]] += mask[i] != 0;
+  }
+  else
+  {
+    for (; i + 4 <= n; i += 4)
+    {
+      h0[px[i]]++;
+      h1[px[i+1]]++;
+      h2[px[i+2]]++;
+      h3[px[i+3]]++;
+    }
+
+    for (; i < n; i++)
+      h0[px[i]]++;
+  }
+}
+
+// Sums the partial histograms [first, first + count) into hist
+static void histogramReduce(const HistPartial *partials, int first, int count, int hist[256])
+{
+  for (int v = 0; v < 256; v++)
+  {
+    u32 sum = 0;
+    for (int p = first; p < first + count; p++)
+      sum += partials[p][v];
+
+    hist[v] = sum;
+  }
+}
+
+void IPHistogram(BYTE* gray, int hist[256])
+{
+  if (!gray || !hist)
+    return;
+
+  bool heap;
+  HistPartial *partials = histogramPartials(4, &heap);
+  if (!partials)
+    return;
+
+  histogramAccumulate(partials, gray, NULL, QQVGA_WIDTH*QQVGA_HEIGHT);
+  histogramReduce(partials, 0, 4, hist);
+  histogramRelease(partials, heap);
+}
+
+void IPHistogramRGB(BYTE* img, int r[256], int g[256], int b[256])
+{
+  if (!img || !r || !g || !b)
+    return;
+
+  const COLOR *col = (COLOR*)img;
+  const int n = QQVGA_WIDTH*QQVGA_HEIGHT;
+
+  bool heap;
+  HistPartial *partials = histogramPartials(6, &heap);
+  if (!partials)
+    return;
+
+  // Each channel already has its own histogram, so two pixels per iteration
+  // are enough to give every channel two independent chains.
+  u32 *r0 = partials[0], *r1 = partials[1];
+  u32 *g0 = partials[2], *g1 = partials[3];
+  u32 *b0 = partials[4], *b1 = partials[5];
+
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+  {
+    COLOR c0 = col[i];
+    COLOR c1 = col[i+1];
+
+    r0[(c0 >> 16) & 0xFF]++;
+    g0[(c0 >> 8) & 0xFF]++;
+    b0[c0 & 0xFF]++;
+    r1[(c1 >> 16) & 0xFF]++;
+    g1[(c1 >> 8) & 0xFF]++;
+    b1[c1 & 0xFF]++;
+  }
+
+  for (; i < n; i++)
+  {
+    r0[(col[i] >> 16) & 0xFF]++;
+    g0[(col[i] >> 8) & 0xFF]++;
+    b0[col[i] & 0xFF]++;
+  }
+
+  histogramReduce(partials, 0, 2, r);
+  histogramReduce(partials, 2, 2, g);
+  histogramReduce(partials, 4, 2, b);
+  histogramRelease(partials, heap);
+}
+
+// The region is clipped to the image. Returns the number of pixels counted,
+// or -1 on invalid arguments.
+int IPHistogramROI(BYTE* gray, BYTE* mask, int x, int y, int xs, int ys, int hist[256])
+{
+  if (!gray || !hist)
+    return -1;
+
+  int x1 = MAX(x, 0), y1 = MAX(y, 0);
+  int x2 = MIN(x + xs, QQVGA_WIDTH), y2 = MIN(y + ys, QQVGA_HEIGHT);
+
+  bool heap;
+  HistPartial *partials = histogramPartials(4, &heap);
+  if (!partials)
+    return -1;
+
+  for (int row = y1; row < y2 && x1 < x2; row++)
+  {
+    int i = row*QQVGA_WIDTH + x1;
+    histogramAccumulate(partials, gray + i, mask ? mask + i : NULL, x2 - x1);
+  }
+
+  histogramReduce(partials, 0, 4, hist);
+  histogramRelease(partials, heap);
+
+  int total = 0;
+  for (int v = 0; v < 256; v++)
+    total += hist[v];
+
+  return total;
+}
+
+// Picks the threshold that maximises the between-class variance of the
+// two gray level classes either side of it.
+int IPOtsu(int hist[256])
+{
+  if (!hist)
+    return -1;
+
+  int64_t total = 0, sum = 0;
+  for (int v = 0; v < 256; v++)
+  {
+    total += hist[v];
+    sum += (int64_t)v*hist[v];
+  }
+
+  if (total == 0)
+    return -1;
+
+  int64_t weight_bg = 0, sum_bg = 0;
+  float max_variance = -1.0f;
+  int threshold = 0;
+
+  for (int t = 0; t < 256; t++)
+  {
+    weight_bg += hist[t];
+    if (weight_bg == 0)
+      continue;
+
+    int64_t weight_fg = total - weight_bg;
+    if (weight_fg == 0)
+      break;
+
+    sum_bg += (int64_t)t*hist[t];
+
+    float mean_bg = sum_bg / (float)weight_bg;
+    float mean_fg = (sum - sum_bg) / (float)weight_fg;
+    float delta = mean_bg - mean_fg;
+    float variance = (float)weight_bg * (float)weight_fg * delta * delta;
+
+    if (variance > max_variance)
+    {
+      max_variance = variance;
+      threshold = t;
+    }
+  }
+
+  return threshold;
+}
+
+void IPThreshold(BYTE* grayIn, int threshold, BYTE* binOut)
+{
+  if (!grayIn || !binOut)
+    return;
+
+  for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    binOut[i] = grayIn[i] > threshold ? 0xFF : 0;
+}
+
+// The local mean is kept as a sliding box sum: every column holds the sum of
+// the rows currently inside the window, and each output row slides a running
+// sum across those columns. Windows are clipped at the image border, and the
+// comparison is done as (pixel + offset)*area > sum to avoid a division.
+// Each band keeps column sums of its own, on the stack.
+static void thresholdAdaptiveBand(int first, int last, void *arg)
+{
+  IPBandArgs *args = (IPBandArgs*)arg;
+  BYTE *grayIn = args->in, *binOut = args->out[0];
+  int radius = args->radius, offset = args->offset;
+
+  u32 col_sums[QQVGA_WIDTH];
+  memset(col_sums, 0, sizeof(col_sums));
+
+  // Prime the column sums with rows [first - radius - 1, first + radius),
+  // as the first row of the band removes the one above its window
+  for (int row = MAX(first - radius - 1, 0); row < MIN(first + radius, QQVGA_HEIGHT); row++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+    col_sums[x] += grayIn[row*QQVGA_WIDTH + x];
+
+  for (int y = first; y < last; y++)
+  {
+    int add_row = y + radius;
+    int sub_row = y - radius - 1;
+
+    if (add_row < QQVGA_HEIGHT)
+    {
+      const BYTE *in = grayIn + add_row*QQVGA_WIDTH;
+      for (int x = 0; x < QQVGA_WIDTH; x++)
+        col_sums[x] += in[x];
+    }
+
+    if (sub_row >= 0)
+    {
+      const BYTE *in = grayIn + sub_row*QQVGA_WIDTH;
+      for (int x = 0; x < QQVGA_WIDTH; x++)
+        col_sums[x] -= in[x];
+    }
+
+    int rows = MIN(y + radius, QQVGA_HEIGHT - 1) - MAX(y - radius, 0) + 1;
+
+    u32 sum = 0;
+    for (int x = 0; x < MIN(radius, QQVGA_WIDTH); x++)
+      sum += col_sums[x];
+
+    const BYTE *in = grayIn + y*QQVGA_WIDTH;
+    BYTE *out = binOut + y*QQVGA_WIDTH;
+
+    for (int x = 0; x < QQVGA_WIDTH; x++)
+    {
+      int add_col = x + radius;
+      int sub_col = x - radius - 1;
+
+      if (add_col < QQVGA_WIDTH)
+        sum += col_sums[add_col];
+      if (sub_col >= 0)
+        sum -= col_sums[sub_col];
+
+      int cols = MIN(x + radius, QQVGA_WIDTH - 1) - MAX(x - radius, 0) + 1;
+      int64_t area = rows*cols;
+
+      out[x] = (in[x] + offset)*area > (int64_t)sum ? 0xFF : 0;
+    }
+  }
+}
+
+void IPThresholdAdaptive(BYTE* grayIn, int radius, int offset, BYTE* binOut)
+{
+  if (!grayIn || !binOut || radius < 0)
+    return;
+
+  IPBandArgs args = {grayIn, {binOut}, radius, offset};
+  IPParallelFor(QQVGA_HEIGHT, radius, thresholdAdaptiveBand, &args);
+}
+
+// The table is looked up once per pixel, so it is kept in internal SRAM
+// where possible rather than wherever calloc() would place it.
+static bool colorClassAlloc()
+{
+  if (pColorClassLUT)
+    return true;
+
+  pColorClassLUT = (BYTE*)allocInternal(COLOR_CLASS_LUT_SIZE);
+
+  return pColorClassLUT != NULL;
+}
+
+// Index into the colour class table for an RGB888 colour
+static inline u32 colorClassIndex(COLOR col)
+{
+  return ((col >> 8) & 0xF800) | ((col >> 5) & 0x07E0) | ((col >> 3) & 0x001F);
+}
+
+int IPColorClassClear(int cls)
+{
+  if (cls < -1 || cls >= IP_MAX_COLOR_CLASSES)
+    return -1;
+
+  if (!colorClassAlloc())
+    return -1;
+
+  if (cls < 0)
+  {
+    memset(pColorClassLUT, 0, COLOR_CLASS_LUT_SIZE);
+    return 0;
+  }
+
+  BYTE keep = ~(1 << cls);
+  for (int i = 0; i < COLOR_CLASS_LUT_SIZE; i++)
+    pColorClassLUT[i] &= keep;
+
+  return 0;
+}
+
+// Every RGB565 colour is expanded to RGB888 exactly as CAMGet() does, so a
+// camera pixel is classified the same as IPPCol2HSI() would classify it.
+int IPColorClassSetHSI(int cls, int hMin, int hMax, int sMin, int sMax, int iMin, int iMax)
+{
+  if (cls < 0 || cls >= IP_MAX_COLOR_CLASSES)
+    return -1;
+
+  if (!colorClassAlloc())
+    return -1;
+
+  BYTE bit = 1 << cls;
+
+  for (int i = 0; i < COLOR_CLASS_LUT_SIZE; i++)
+  {
+    BYTE h, s, v;
+    IPPCol2HSI(rgb565To888(i), &h, &s, &v);
+
+    // Past 255 hues wrap around to 1, skipping the 0 of gray
+    bool hue = hMin <= hMax ? h >= hMin && h <= hMax : h >= hMin || (h != 0 && h <= hMax);
+
+    if (hue &&
+        s >= sMin && s <= sMax &&
+        v >= iMin && v <= iMax)
+    {
+      pColorClassLUT[i] |= bit;
+    }
+  }
+
+  return 0;
+}
+
+/*
+Hue 0 stands for gray, so gray pixels only set the hue range of a patch that
+has no others. The hues 1..255 of the others lie on a circle, magenta on
+either side of 255, and the range learned is the circle less the widest gap
+between hues seen, which wraps around when that gap does not.
+*/
+int IPColorClassLearn(int cls, BYTE* img, int x, int y, int xs, int ys, int margin)
+{
+  if (!img || cls < 0 || cls >= IP_MAX_COLOR_CLASSES)
+    return -1;
+
+  int x1 = MAX(x, 0), y1 = MAX(y, 0);
+  int x2 = MIN(x + xs, QQVGA_WIDTH), y2 = MIN(y + ys, QQVGA_HEIGHT);
+
+  if (x1 >= x2 || y1 >= y2)
+    return -1;
+
+  COLOR *col = (COLOR*)img;
+  bool hues[256] = {false};
+  int s_min = 255, i_min = 255;
+  int s_max = 0, i_max = 0;
+
+  for (int row = y1; row < y2; row++)
+  for (int column = x1; column < x2; column++)
+  {
+    BYTE h, s, v;
+    IPPCol2HSI(col[row*QQVGA_WIDTH + column], &h, &s, &v);
+
+    hues[h] = true;
+    s_min = MIN(s_min, s);
+    s_max = MAX(s_max, s);
+    i_min = MIN(i_min, v);
+    i_max = MAX(i_max, v);
+  }
+
+  int first = 0, last = 0;
+  for (int h = 1; h < 256; h++)
+  {
+    if (!hues[h])
+      continue;
+    if (!first)
+      first = h;
+    last = h;
+  }
+
+  int h_min = -margin, h_max = margin;
+
+  if (first)
+  {
+    // The gap across 255 to 1 first, then each between hues seen
+    int gap = first + 255 - last, start = first, end = last;
+    for (int h = first + 1, prev = first; h <= last; h++)
+    {
+      if (!hues[h])
+        continue;
+      if (h - prev > gap)
+      {
+        gap = h - prev;
+        start = h;
+        end = prev;
+      }
+      prev = h;
+    }
+
+    if (255 - gap + 2*margin >= 254)
+    {
+      h_min = 1;
+      h_max = 255;
+    }
+    else
+    {
+      h_min = (start - margin - 1 + 255) % 255 + 1;
+      h_max = (end + margin - 1 + 255) % 255 + 1;
+    }
+  }
+
+  return IPColorClassSetHSI(cls, h_min, h_max, 
+                                 s_min - margin, s_max + margin, 
+                                 i_min - margin, i_max + margin);
+}
+
+// Runs are split wherever the class bitmask changes, and each run takes the
+// lowest class in its bitmask. Adjacent runs that end up with the same class
+// are joined back together, so a row never holds two touching runs of one class.
+int IPColorClassRunsROI(BYTE* img, int x, int y, int xs, int ys, IPRun* runs, int maxRuns)
+{
+  if (!img || !runs || maxRuns <= 0 || !pColorClassLUT)
+    return -1;
+
+  int x1 = MAX(x, 0), y1 = MAX(y, 0);
+  int x2 = MIN(x + xs, QQVGA_WIDTH), y2 = MIN(y + ys, QQVGA_HEIGHT);
+
+  const COLOR *col = (COLOR*)img;
+  const BYTE *lut = pColorClassLUT;
+  int count = 0;
+
+  for (int row_idx = y1; row_idx < y2 && x1 < x2; row_idx++)
+  {
+    const COLOR *row = col + row_idx*QQVGA_WIDTH;
+    BYTE prev = 0;
+    int start = x1;
+
+    for (int column = x1; column <= x2; column++)
+    {
+      BYTE mask = column < x2 ? lut[colorClassIndex(row[column])] : 0;
+
+      if (mask == prev)
+        continue;
+
+      if (prev)
+      {
+        BYTE cls = __builtin_ctz(prev);
+        IPRun *last = count ? &runs[count - 1] : NULL;
+
+        if (last && last->y == row_idx && last->x2 == start - 1 && last->cls == cls)
+        {
+          last->x2 = column - 1;
+        }
+        else
+        {
+          if (count == maxRuns)
+            return count;
+
+          runs[count].x1 = start;
+          runs[count].x2 = column - 1;
+          runs[count].y = row_idx;
+          runs[count].cls = cls;
+          runs[count].parent = count;
+          count++;
+        }
+      }
+
+      prev = mask;
+      start = column;
+    }
+  }
 
-  while (x < 0 || y < 0)
-    KEYReadXY(x, y);
-  
-  return 0;
-}  
+  return count;
+}
 
-int KEYReadXY(int *x, int *y)
+int IPColorClassRuns(BYTE* img, IPRun* runs, int maxRuns)
 {
-  *x = -1;
-  *y = -1;
-
-  if (!gTouchEnabled)
-    return -1;
+  return IPColorClassRunsROI(img, 0, 0, QQVGA_WIDTH, QQVGA_HEIGHT, runs, maxRuns);
+}
 
-  if (gTouch.read())
+static int runFind(IPRun *runs, int i)
+{
+  while (runs[i].parent != i)
   {
-    TP_Point t = gTouch.getPoint(0);
-    *x = t.x;
-    *y = t.y;
+    runs[i].parent = runs[runs[i].parent].parent;
+    i = runs[i].parent;
   }
 
-  return 0;
+  return i;
 }
 
-// The ESP32-CAM is already initialised after EYEBOTInit() is invoked.
-int CAMInit(int resolution)
+// The root of every set is kept as its lowest run index, which means a root
+// is always visited before any of the runs that belong to it.
+static void runUnion(IPRun *runs, int a, int b)
 {
-  return 0;
-}
+  a = runFind(runs, a);
+  b = runFind(runs, b);
 
-// The ESP32-CAM cannot be released.
-int CAMRelease(void)
-{
-  return 0; 
+  if (a < b)
+    runs[b].parent = a;
+  else if (b < a)
+    runs[a].parent = b;
 }
 
-int CAMGet(BYTE *buf)
-{  
-  if (!buf)
+// Based on the run merging and region extraction of CMVision. Runs of the
+// same class that overlap between consecutive rows are merged with a
+// union-find, the area of every region is tallied into its root run, and
+// only the maxBlobs largest regions have their statistics gathered.
+// The parent fields of the runs are overwritten in the process.
+int IPColorClassBlobs(IPRun* runs, int runCount, IPBlob* blobs, int maxBlobs)
+{
+  if (!runs || !blobs || runCount < 0 || maxBlobs <= 0)
     return -1;
 
-  BYTE *rx_buf = (BYTE*)pLCDBuffer;
+  for (int i = 0; i < runCount; i++)
+    runs[i].parent = i;
 
-  unsigned long start_time = millis();
-  bool timed_out = false;
+  // 1. Connect overlapping runs of consecutive rows
+  int prev_start = 0, prev_end = 0;
+  int cur_start = 0;
 
-  for (int i = 0; i < CAM_NUM_IMAGE_SEGMENTS; i++)
+  while (cur_start < runCount)
   {
-    spi_transaction_t t = {};
-    t.length = MAX_RX_SEGMENT_SIZE*8;//bit length
-    t.tx_buffer = NULL;
-    t.rx_buffer = rx_buf + i*MAX_RX_SEGMENT_SIZE;
-
-    while ((millis() - start_time < CAM_TIMEOUT_MS) && digitalRead(PIN_CAM_SIGNAL));
+    int y = runs[cur_start].y;
+    int cur_end = cur_start;
+    while (cur_end < runCount && runs[cur_end].y == y)
+      cur_end++;
 
-    if (digitalRead(PIN_CAM_SIGNAL))
+    if (prev_end > prev_start && runs[prev_start].y == y - 1)
     {
-      timed_out = true;
-      break;
-    }
+      int i = prev_start, j = cur_start;
 
-    esp_err_t err = spi_device_transmit(gCamSPIHandle, &t);
-    assert(err == ESP_OK);
-  }
+      while (i < prev_end && j < cur_end)
+      {
+        IPRun *a = &runs[i], *b = &runs[j];
 
-  RGB565 *pixels = (RGB565*)rx_buf;
-  COLOR *img = (COLOR*)buf;
+        if (a->cls == b->cls && a->x1 <= b->x2 && b->x1 <= a->x2)
+          runUnion(runs, i, j);
 
-  if (timed_out)
-  {
-    // Return a blank image
-    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
-    {
-      img[i] = RED;
+        if (a->x2 < b->x2)
+          i++;
+        else
+          j++;
+      }
     }
+
+    prev_start = cur_start;
+    prev_end = cur_end;
+    cur_start = cur_end;
   }
-  else
+
+  // 2. Point every run straight at its root, and tally the area of each
+  // region into its root as a negative parent. Parents never have a higher
+  // index than their children, so the parent of run i is already resolved.
+  for (int i = 0; i < runCount; i++)
   {
-    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+    int len = runs[i].x2 - runs[i].x1 + 1;
+    int p = runs[i].parent;
+
+    if (p == i)
+      runs[i].parent = -len;
+    else
     {
-      img[i] = rgb565To888(pixels[i]);
+      int root = runs[p].parent < 0 ? p : runs[p].parent;
+      runs[i].parent = root;
+      runs[root].parent -= len;
     }
   }
 
-  return 0;
-}
-
-int CAMGetGray(BYTE *buf)
-{
-  if (!buf)
-    return -1;
-
-  BYTE *rx_buf = (BYTE*)pLCDBuffer;
-
-  unsigned long start_time = millis();
-  bool timed_out = false;
-
-  for (int i = 0; i < CAM_NUM_IMAGE_SEGMENTS; i++)
+  // 3. Keep the largest regions, sorted by area
+  int count = 0;
+  for (int i = 0; i < runCount; i++)
   {
-    spi_transaction_t t = {};
-    t.length = MAX_RX_SEGMENT_SIZE*8;//bit length
-    t.tx_buffer = NULL;
-    t.rx_buffer = rx_buf + i*MAX_RX_SEGMENT_SIZE;
+    if (runs[i].parent >= 0)
+      continue;
 
-    while ((millis() - start_time < CAM_TIMEOUT_MS) && digitalRead(PIN_CAM_SIGNAL));
+    int area = -runs[i].parent;
+    if (count == maxBlobs && area <= blobs[count - 1].area)
+      continue;
 
-    if (digitalRead(PIN_CAM_SIGNAL))
+    int k = count < maxBlobs ? count++ : count - 1;
+    while (k > 0 && blobs[k - 1].area < area)
     {
-      timed_out = true;
-      break;
+      blobs[k] = blobs[k - 1];
+      k--;
     }
 
-    esp_err_t err = spi_device_transmit(gCamSPIHandle, &t);
-    assert(err == ESP_OK);
+    blobs[k].area = area;
+    blobs[k].cls = runs[i].cls;
+    blobs[k].cx = i;// Root run, until the statistics are gathered
   }
 
-  RGB565 *pixels = (RGB565*)rx_buf;
-
-  if (timed_out)
+  // 4. Gather the bounding box and centroid of each kept region. Roots now
+  // hold -1 - blob index, with dropped regions past the last blob.
+  for (int i = 0; i < runCount; i++)
   {
-    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
-    {
-      buf[i] = 0xFF;
-    }
+    if (runs[i].parent < 0)
+      runs[i].parent = -1 - maxBlobs;
   }
-  else
-  {
-    float divisor = 1.0f/3.0f;
 
-    for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
-    {
-      COLOR col = rgb565To888(pixels[i]);
+  for (int k = 0; k < count; k++)
+  {
+    runs[blobs[k].cx].parent = -1 - k;
+    blobs[k].x1 = QQVGA_WIDTH;
+    blobs[k].y1 = QQVGA_HEIGHT;
+    blobs[k].x2 = -1;
+    blobs[k].y2 = -1;
+    blobs[k].cx = 0;
+    blobs[k].cy = 0;
+  }
 
-      BYTE r, g, b;
-      IPPCol2RGB(col, &r, &g, &b);
+  for (int i = 0; i < runCount; i++)
+  {
+    int code = runs[i].parent < 0 ? runs[i].parent : runs[runs[i].parent].parent;
+    int k = -1 - code;
+    if (k >= count)
+      continue;
+
+    IPRun *run = &runs[i];
+    IPBlob *blob = &blobs[k];
+    int len = run->x2 - run->x1 + 1;
+
+    blob->x1 = MIN(blob->x1, run->x1);
+    blob->x2 = MAX(blob->x2, run->x2);
+    blob->y1 = MIN(blob->y1, run->y);
+    blob->y2 = MAX(blob->y2, run->y);
+
+    // Summed as 2x, since the midpoint of a run is (x1 + x2)/2
+    blob->cx += (run->x1 + run->x2)*len;
+    blob->cy += run->y*len;
+  }
 
-      buf[i] = (r + g + b)*divisor;
-    }
+  for (int k = 0; k < count; k++)
+  {
+    blobs[k].cx /= 2*blobs[k].area;
+    blobs[k].cy /= blobs[k].area;
   }
 
-  return 0;
+  return count;
 }
 
-// The only image processing resolution available is QQVGA
-int IPSetSize(int resolution)
+int IPTrackInit(int mode, int gate, int maxMisses)
 {
-  return -1;
-}
+  if ((mode != IP_TRACK_IOU && mode != IP_TRACK_CENTROID) || gate < 0 || maxMisses < 0)
+    return -1;
 
-int IPReadFile(char *filename, BYTE* img)
-{
-  return -1;
-}
+  gTrackMode = mode;
+  gTrackGate = gate;
+  gTrackMaxMisses = maxMisses;
+  gTrackNextId = 1;
+  memset(gTracks, 0, sizeof(gTracks));
 
-int IPWriteFile(char *filename, BYTE* img)
-{
-  return -1;
+  return 0;
 }
 
-int IPWriteFileGray(char *filename, BYTE* gray)
+static inline int trackToPixel(int v)
 {
-  return -1;
+  return (v + TRACK_ONE/2) >> TRACK_FRAC_BITS;
 }
 
-void IPLaplace(BYTE* grayIn, BYTE* grayOut)
-{ 
-  if (!grayIn || !grayOut)
-    return;
+// Higher scores are better matches, and 0 means the pair is gated out
+static int trackScore(const Track *t, const IPBlob *d)
+{
+  if (t->cls != d->cls)
+    return 0;
 
-  for (int y = 1; y < QQVGA_HEIGHT - 1; y++)
-  for (int x = 1; x < QQVGA_WIDTH - 1; x++)
+  if (gTrackMode == IP_TRACK_CENTROID)
   {
-    int i = y*QQVGA_WIDTH + x;
+    int dx = ((t->bx + t->ox) >> TRACK_FRAC_BITS) - d->cx;
+    int dy = ((t->by + t->oy) >> TRACK_FRAC_BITS) - d->cy;
+    int dist_sq = dx*dx + dy*dy;
+    int gate_sq = gTrackGate*gTrackGate;
 
-    int delta = abs(4*grayIn[i] - grayIn[i-1] - grayIn[i+1] - grayIn[i-QQVGA_WIDTH] - grayIn[i+QQVGA_WIDTH]);
+    return dist_sq <= gate_sq ? gate_sq - dist_sq + 1 : 0;
+  }
 
-    if (delta > 0xFF) 
-      delta = 0xFF;
+  int tx1 = trackToPixel(t->bx - t->w/2), tx2 = tx1 + trackToPixel(t->w) - 1;
+  int ty1 = trackToPixel(t->by - t->h/2), ty2 = ty1 + trackToPixel(t->h) - 1;
 
-    grayOut[i] = (BYTE)delta;
-  }
+  int ix = MIN(tx2, d->x2) - MAX(tx1, d->x1) + 1;
+  int iy = MIN(ty2, d->y2) - MAX(ty1, d->y1) + 1;
+  if (ix <= 0 || iy <= 0)
+    return 0;
+
+  int inter = ix*iy;
+  int area_t = (tx2 - tx1 + 1)*(ty2 - ty1 + 1);
+  int area_d = (d->x2 - d->x1 + 1)*(d->y2 - d->y1 + 1);
+  int uni = area_t + area_d - inter;
+
+  // IoU in 1/1000, passing the gate if it is at least gate percent
+  int iou = 1000*inter/uni;
+  return iou >= 10*gTrackGate ? iou + 1 : 0;
 }
 
-// BEN: Based on my research, this appears to be a Pseudo-Sobel implementation, and not true Sobel.
-// I copied this straight from the EyeBot 8 code.
-void IPSobel(BYTE* grayIn, BYTE* grayOut)
+// Each frame the tracks are first advanced by their velocity, then greedily
+// paired with the detections in order of best score, and finally corrected
+// towards their paired detection with an alpha-beta filter (alpha = 1/2,
+// beta = 1/8). Unpaired tracks coast until they have missed too many frames,
+// and unpaired detections start new tracks in any free slots.
+int IPTrack(IPBlob* detections, int count)
 {
-  if (!grayIn || !grayOut)
-    return;
+  if (count < 0 || (count > 0 && !detections))
+    return -1;
 
-  memset(grayOut, 0, QQVGA_WIDTH); // clear first row
+  count = MIN(count, TRACK_MAX_DETECTIONS);
 
-  for (int y = 1; y < QQVGA_HEIGHT-1; y++)
-  for (int x = 1; x < QQVGA_WIDTH-1; x++)
+  // 1. Predict
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
   {
-    int i = y*QQVGA_WIDTH + x;
+    if (!gTracks[t].id)
+      continue;
 
-    int deltaX = 2*grayIn[i+1] + grayIn[i-QQVGA_WIDTH+1] + grayIn[i+QQVGA_WIDTH+1] - 2*grayIn[i-1] - grayIn[i-QQVGA_WIDTH-1] - grayIn[i+QQVGA_WIDTH-1];
-    int deltaY = grayIn[i-QQVGA_WIDTH-1] + 2*grayIn[i-QQVGA_WIDTH] + grayIn[i-QQVGA_WIDTH+1] - grayIn[i+QQVGA_WIDTH-1] - 2*grayIn[i+QQVGA_WIDTH] - grayIn[i+QQVGA_WIDTH+1];
+    gTracks[t].bx += gTracks[t].vx;
+    gTracks[t].by += gTracks[t].vy;
+  }
 
-    int grad = (abs(deltaX) + abs(deltaY)) / 3;
-    if (grad > 255) 
-      grad = 255;
+  // 2. Associate
+  int scores[IP_MAX_TRACKS][TRACK_MAX_DETECTIONS];
+  int track_match[IP_MAX_TRACKS];
+  bool det_matched[TRACK_MAX_DETECTIONS] = {};
 
-    grayOut[i] = (BYTE)grad;
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
+  {
+    track_match[t] = -1;
+    for (int d = 0; d < count; d++)
+      scores[t][d] = gTracks[t].id ? trackScore(&gTracks[t], &detections[d]) : 0;
   }
 
-  memset(grayOut + (QQVGA_HEIGHT-1)*(QQVGA_WIDTH), 0, QQVGA_WIDTH);// clear final row 
-}
+  for (;;)
+  {
+    int best = 0, best_t = -1, best_d = -1;
 
-void IPCol2Gray(BYTE* imgIn, BYTE* grayOut)
-{
-  if (!imgIn || !grayOut)
-    return;
-  
-  COLOR *img = (COLOR*)imgIn;
-  float divisor = 1.0f/3.0f;
+    for (int t = 0; t < IP_MAX_TRACKS; t++)
+    {
+      if (track_match[t] >= 0)
+        continue;
 
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
-  {
-    int i = y * QQVGA_WIDTH + x;
+      for (int d = 0; d < count; d++)
+      {
+        if (!det_matched[d] && scores[t][d] > best)
+        {
+          best = scores[t][d];
+          best_t = t;
+          best_d = d;
+        }
+      }
+    }
 
-    BYTE r, g, b;
-    IPPCol2RGB(img[i], &r, &g, &b);
+    if (best_t < 0)
+      break;
 
-    grayOut[i] = (r + g + b)*divisor;
+    track_match[best_t] = best_d;
+    det_matched[best_d] = true;
   }
-}
 
-void IPGray2Col(BYTE* imgIn, BYTE* colOut)
-{
-  if (!imgIn || !colOut)
-    return;
-  
-  COLOR *col = (COLOR*)colOut;
-
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
+  // 3. Correct, or coast
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
   {
-    int i = y * QQVGA_WIDTH + x;
-    col[i] = IPPRGB2Col(imgIn[i], imgIn[i], imgIn[i]);
-  }
-}
+    Track *track = &gTracks[t];
+    if (!track->id)
+      continue;
 
-void IPRGB2Col(BYTE* r, BYTE* g, BYTE* b, BYTE* imgOut)
-{
-  COLOR *img = (COLOR*)imgOut;
+    if (track_match[t] < 0)
+    {
+      if (++track->misses > gTrackMaxMisses)
+        track->id = 0;
 
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
-  {
-    int i = y * QQVGA_WIDTH + x;
+      continue;
+    }
 
-    img[i] = IPPRGB2Col(r[i], g[i], b[i]);
+    const IPBlob *d = &detections[track_match[t]];
+    int bx = (d->x1 + d->x2 + 1)*TRACK_ONE/2;
+    int by = (d->y1 + d->y2 + 1)*TRACK_ONE/2;
+    int rx = bx - track->bx;
+    int ry = by - track->by;
+
+    track->bx += rx/2;
+    track->by += ry/2;
+    track->vx += rx/8;
+    track->vy += ry/8;
+    track->w += ((d->x2 - d->x1 + 1)*TRACK_ONE - track->w)/2;
+    track->h += ((d->y2 - d->y1 + 1)*TRACK_ONE - track->h)/2;
+    track->ox += (d->cx*TRACK_ONE + TRACK_ONE/2 - bx - track->ox)/2;
+    track->oy += (d->cy*TRACK_ONE + TRACK_ONE/2 - by - track->oy)/2;
+    track->hits++;
+    track->misses = 0;
   }
-}
 
-void IPCol2HSI(BYTE* img, BYTE* h, BYTE* s, BYTE* i)
-{
-  if (!h || !s || !i)
-    return;
+  // 4. Start new tracks
+  for (int d = 0; d < count; d++)
+  {
+    if (det_matched[d])
+      continue;
 
-  COLOR *col = (COLOR*)img;
+    int t = 0;
+    while (t < IP_MAX_TRACKS && gTracks[t].id)
+      t++;
 
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
-  {
-    int idx = y * QQVGA_WIDTH + x;
+    if (t == IP_MAX_TRACKS)
+      break;
 
-    IPPCol2HSI(col[idx], &h[idx], &s[idx], &i[idx]);
+    const IPBlob *det = &detections[d];
+    Track *track = &gTracks[t];
+
+    track->id = gTrackNextId++;
+    track->cls = det->cls;
+    track->bx = (det->x1 + det->x2 + 1)*TRACK_ONE/2;
+    track->by = (det->y1 + det->y2 + 1)*TRACK_ONE/2;
+    track->w = (det->x2 - det->x1 + 1)*TRACK_ONE;
+    track->h = (det->y2 - det->y1 + 1)*TRACK_ONE;
+    track->vx = 0;
+    track->vy = 0;
+    track->ox = det->cx*TRACK_ONE + TRACK_ONE/2 - track->bx;
+    track->oy = det->cy*TRACK_ONE + TRACK_ONE/2 - track->by;
+    track->hits = 1;
+    track->misses = 0;
   }
+
+  int active = 0;
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
+  {
+    if (gTracks[t].id)
+      active++;
+  }
+
+  return active;
 }
 
-// A black colour pixel in c2 is interpreted as transparency
-void IPOverlay(BYTE* c1, BYTE* c2, BYTE* cOut)
+int IPTrackGet(IPTrackInfo* tracks, int maxTracks)
 {
-  if (!c1 || !c2 || !cOut)
-    return;
+  if (!tracks || maxTracks <= 0)
+    return -1;
 
-  COLOR *out = (COLOR*)cOut;
-  COLOR *img1 = (COLOR*)c1;
-  COLOR *img2 = (COLOR*)c2;
+  int count = 0;
 
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
   {
-    int i = y*QQVGA_WIDTH + x;
-    out[i] = img2[i] ? img2[i] : img1[i];
+    const Track *track = &gTracks[t];
+    if (!track->id)
+      continue;
+
+    if (count == maxTracks && track->hits <= tracks[count - 1].hits)
+      continue;
+
+    int k = count < maxTracks ? count++ : count - 1;
+    while (k > 0 && tracks[k - 1].hits < track->hits)
+    {
+      tracks[k] = tracks[k - 1];
+      k--;
+    }
+
+    IPTrackInfo *info = &tracks[k];
+    info->id = track->id;
+    info->cls = track->cls;
+    info->x1 = trackToPixel(track->bx - track->w/2);
+    info->y1 = trackToPixel(track->by - track->h/2);
+    info->x2 = info->x1 + trackToPixel(track->w) - 1;
+    info->y2 = info->y1 + trackToPixel(track->h) - 1;
+    info->cx = (track->bx + track->ox) >> TRACK_FRAC_BITS;
+    info->cy = (track->by + track->oy) >> TRACK_FRAC_BITS;
+    info->vx = track->vx / (float)TRACK_ONE;
+    info->vy = track->vy / (float)TRACK_ONE;
+    info->hits = track->hits;
+    info->misses = track->misses;
   }
+
+  return count;
 }
 
-// A black pixel in g2 is interpreted as transparency
-void IPOverlayGray(BYTE* g1, BYTE* g2, COLOR col, BYTE* cOut)
+// The window covers the predicted box, grown by the distance the track moves
+// in a frame plus margin, and clipped to the image.
+int IPTrackWindow(int id, int margin, int *x, int *y, int *xs, int *ys)
 {
-  if (!g1 || !g2 || !cOut)
-    return;
-  
-  COLOR *out = (COLOR*)cOut;
+  if (!x || !y || !xs || !ys || id <= 0)
+    return -1;
 
-  for (int y = 0; y < QQVGA_HEIGHT; y++)
-  for (int x = 0; x < QQVGA_WIDTH; x++)
+  for (int t = 0; t < IP_MAX_TRACKS; t++)
   {
-    int i = y*QQVGA_WIDTH + x;
-    out[i] = g2[i] ? col : IPPRGB2Col(g1[i], g1[i], g1[i]);
+    const Track *track = &gTracks[t];
+    if (track->id != id)
+      continue;
+
+    int half_w = track->w/2 + abs(track->vx) + margin*TRACK_ONE;
+    int half_h = track->h/2 + abs(track->vy) + margin*TRACK_ONE;
+    int bx = track->bx + track->vx;
+    int by = track->by + track->vy;
+
+    int x1 = MAX(trackToPixel(bx - half_w), 0);
+    int y1 = MAX(trackToPixel(by - half_h), 0);
+    int x2 = MIN(trackToPixel(bx + half_w), QQVGA_WIDTH);
+    int y2 = MIN(trackToPixel(by + half_h), QQVGA_HEIGHT);
+
+    *x = x1;
+    *y = y1;
+    *xs = MAX(x2 - x1, 0);
+    *ys = MAX(y2 - y1, 0);
+
+    return 0;
   }
+
+  return -1;
 }
 
 // Not all RGB888 pixel colours are representable on the T-Display-S3,
@@ -1004,7 +3345,7 @@ void IPOverlayGray(BYTE* g1, BYTE* g2, COLOR col, BYTE* cOut)
 // RGB565 to RGB888.
 COLOR IPPRGB2Col(BYTE r, BYTE g, BYTE b)
 {
-  RGB565 col = gTFT.color565(r, g, b);
+  RGB565 col = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
   return rgb565To888(col);
 }
 
@@ -1020,7 +3361,7 @@ void IPPCol2RGB(COLOR col, BYTE* r, BYTE* g, BYTE* b)
 
 void IPPCol2HSI(COLOR col, BYTE *h, BYTE *s, BYTE *i)
 {
-  if (!h || !s || !s)
+  if (!h || !s || !i)
     return;
 
   BYTE r, g, b;
@@ -1028,6 +3369,14 @@ void IPPCol2HSI(COLOR col, BYTE *h, BYTE *s, BYTE *i)
   IPPRGB2HSI(r, g, b, h, s, i);
 }
 
+BYTE IPPColorClass(COLOR col)
+{
+  if (!pColorClassLUT)
+    return 0;
+
+  return pColorClassLUT[colorClassIndex(col)];
+}
+
 BYTE IPPRGB2Hue(BYTE r, BYTE g, BYTE b)
 {
   BYTE max   = MAX(r, MAX(g, b));
@@ -1055,7 +3404,7 @@ BYTE IPPRGB2Hue(BYTE r, BYTE g, BYTE b)
 
 void IPPRGB2HSI(BYTE r, BYTE g, BYTE b, BYTE* h, BYTE* s, BYTE* i)
 {
-  if (!h || !s || !s)
+  if (!h || !s || !i)
     return;
 
   BYTE max   = MAX(r, MAX(g, b));
@@ -1117,31 +3466,6 @@ int OSMachineID(void)
   return -1;
 }
 
-int OSWait(int n)
-{
-  return -1;
-}
-
-TIMER OSAttachTimer(int scale, void (*fct)(void))
-{
-  return -1;
-}
-
-int OSDetachTimer(TIMER t)
-{
-  return -1;
-}
-
-int OSGetTime(int *hrs,int *mins,int *secs,int *ticks)
-{
-  return -1;
-}
-
-int OSGetCount(void)
-{
-  return -1;
-}
-
 int SERInit(int interface, int baud,int handshake)
 {
   return -1;
@@ -1199,6 +3523,8 @@ int AUMicrophone(void)
 
 int PSDGet(int psd)
 {
+  PROF_SCOPE("PSDGet");
+
   if (psd != PSD_FRONT)
     return -1;
   
@@ -1247,7 +3573,7 @@ int PSDGetRaw(int psd)
   if (psd != PSD_FRONT)
     return -1;
 
-  return analogRead(PIN_DIST_SENSOR);
+  return halPSDRaw();
 }
 
 int LIDARGet(int distance[])
@@ -1324,13 +3650,13 @@ int VWSetSpeed(int lin_speed, int ang_speed)
   {
     //There is still a background timer for
     //an ongoing drive op that must be stopped
-    timer_pause(gTimerGroup, gMotorTimerIdx);
+    halMotorTimerStop();
   }
 
   // Makerverse 2 Channel motor driver trips out if the
   // direction of the motors is changed while the PWM is non-zero.
-  analogWrite(PIN_LEFT_MOTOR_PWM, 0);
-  analogWrite(PIN_RIGHT_MOTOR_PWM, 0);
+  halMotorPWM(HAL_MOTOR_LEFT, 0);
+  halMotorPWM(HAL_MOTOR_RIGHT, 0);
 
   // Reset the current eyebot starting position from its last
   // estimated postion based off the current linear and angular speed.
@@ -1384,17 +3710,17 @@ int VWSetSpeed(int lin_speed, int ang_speed)
 
     if (reverse)
     {
-      digitalWrite(PIN_LEFT_MOTOR_DIR, LOW);
-      analogWrite(PIN_LEFT_MOTOR_PWM, gLeftMotorPWM);
-      digitalWrite(PIN_RIGHT_MOTOR_DIR, HIGH);
-      analogWrite(PIN_RIGHT_MOTOR_PWM, gRightMotorPWM);
+      halMotorDir(HAL_MOTOR_LEFT, 0);
+      halMotorPWM(HAL_MOTOR_LEFT, gLeftMotorPWM);
+      halMotorDir(HAL_MOTOR_RIGHT, 1);
+      halMotorPWM(HAL_MOTOR_RIGHT, gRightMotorPWM);
     }
     else
     {
-      digitalWrite(PIN_LEFT_MOTOR_DIR, HIGH);
-      analogWrite(PIN_LEFT_MOTOR_PWM, gLeftMotorPWM);
-      digitalWrite(PIN_RIGHT_MOTOR_DIR, LOW);
-      analogWrite(PIN_RIGHT_MOTOR_PWM, gRightMotorPWM);
+      halMotorDir(HAL_MOTOR_LEFT, 1);
+      halMotorPWM(HAL_MOTOR_LEFT, gLeftMotorPWM);
+      halMotorDir(HAL_MOTOR_RIGHT, 0);
+      halMotorPWM(HAL_MOTOR_RIGHT, gRightMotorPWM);
     }
   }
   else
@@ -1404,21 +3730,21 @@ int VWSetSpeed(int lin_speed, int ang_speed)
 
     if (clockwise)
     {
-      digitalWrite(PIN_LEFT_MOTOR_DIR, HIGH);
-      analogWrite(PIN_LEFT_MOTOR_PWM, 255 * ang_speed_percentage);
-      digitalWrite(PIN_RIGHT_MOTOR_DIR, HIGH);
-      analogWrite(PIN_RIGHT_MOTOR_PWM, 255 * ang_speed_percentage);
+      halMotorDir(HAL_MOTOR_LEFT, 1);
+      halMotorPWM(HAL_MOTOR_LEFT, 255 * ang_speed_percentage);
+      halMotorDir(HAL_MOTOR_RIGHT, 1);
+      halMotorPWM(HAL_MOTOR_RIGHT, 255 * ang_speed_percentage);
     }
     else
     {
-      digitalWrite(PIN_LEFT_MOTOR_DIR, LOW);
-      analogWrite(PIN_LEFT_MOTOR_PWM, 255 * ang_speed_percentage);
-      digitalWrite(PIN_RIGHT_MOTOR_DIR, LOW);
-      analogWrite(PIN_RIGHT_MOTOR_PWM, 255 * ang_speed_percentage);
+      halMotorDir(HAL_MOTOR_LEFT, 0);
+      halMotorPWM(HAL_MOTOR_LEFT, 255 * ang_speed_percentage);
+      halMotorDir(HAL_MOTOR_RIGHT, 0);
+      halMotorPWM(HAL_MOTOR_RIGHT, 255 * ang_speed_percentage);
     }
   }
 
-  gOpStartTime = millis();
+  gOpStartTime = halMillis();
   gOpTotalTime = 0;// By default indefinite
 
   return 0;
@@ -1449,7 +3775,7 @@ int VWGetPosition(int *x, int *y, int *phi)
   if (!x || !y || !phi)
     return -1;
   
-  unsigned long delta = millis() - gOpStartTime;
+  unsigned long delta = halMillis() - gOpStartTime;
   int dx, dy, dphi;
   calcDeltaPosition(delta, &dx, &dy, &dphi);
 
@@ -1481,7 +3807,7 @@ int VWStraight(int dist, int lin_speed)
   //ms
   float time_taken = (dist / (float)lin_speed) * 1000;
 
-  if (!setMotorKillTimer((u64)time_taken))
+  if (halMotorTimerStart((u64)time_taken) != 0)
     return -1;
   
   gOpTotalTime = time_taken;
@@ -1518,7 +3844,7 @@ int VWTurn(int angle, int ang_speed)
   // Therefore the time taken is halved.
   float time_taken = (angle / (float)ang_speed) * 1000 / 2;
 
-  if (!setMotorKillTimer((u64)time_taken))
+  if (halMotorTimerStart((u64)time_taken) != 0)
     return -1;
 
   gOpTotalTime = time_taken;
@@ -1557,7 +3883,7 @@ int VWCurve(int dist, int angle, int lin_speed)
   
   time_taken *= 1000;
 
-  if (!setMotorKillTimer((u64)time_taken))
+  if (halMotorTimerStart((u64)time_taken) != 0)
     return -1;
 
   gOpTotalTime = time_taken;
@@ -1624,7 +3950,7 @@ int VWRemain(void)
     case VW_OP_STRAIGHT:
     case VW_OP_CURVE:
     {
-      unsigned long op_time_delta = millis() - gOpStartTime;
+      unsigned long op_time_delta = halMillis() - gOpStartTime;
       int total_dist = gOpTotalTime * abs(gLinSpeed) / 1000;
       dist = total_dist - (op_time_delta * abs(gLinSpeed) / 1000);
       break;
@@ -1651,7 +3977,8 @@ int VWDone(void)
 
 int VWWait(void)
 {  
-  while (gCurrentVWOp != VW_OP_UNDEFINED){}
+  while (gCurrentVWOp != VW_OP_UNDEFINED)
+    halIdle();
 
   return 0;
 }
@@ -82,22 +82,20 @@ int LCDGetPos(int *row, int *column);
 // Set color for subsequent printf
 int LCDSetColor(COLOR fg = WHITE, COLOR bg = BLACK);
 
-// Set font for subsequent print operation
+// Set font for subsequent print operation: HELVETICA, TIMES or COURIER, the fixed-width default, NORMAL or BOLD
 int LCDSetFont(int font, int variation);
 
 // Set font-size for subsequent print operation
 int LCDSetFontSize(int fontsize);
 
-// Set LCD Mode (0=default)
-// NOT IMPLEMENTED
+// Set LCD Mode (0=default); only LCD_AUTOREFRESH and LCD_NOAUTOREFRESH, which draws into a frame buffer, starting
+// black and shown whole at the first LCDRefresh
 int LCDSetMode(int mode);
 
-// Set menu entries for soft buttons
-// NOT IMPLEMENTED
+// Set menu entries for soft buttons along the bottom of the display, read as KEY1..KEY4 by KEYRead; "" for none
 int LCDMenu(char *st1, char *st2, char *st3, char *st4);
 
 // Set menu for i-th entry with color [1..4]
-// NOT IMPLEMENTED
 int LCDMenuI(int pos, char *string, COLOR fg, COLOR bg);
 
 // Get LCD resolution in pixels
@@ -118,12 +116,24 @@ int LCDArea(int x1, int y1, int x2, int y2, COLOR col, int fill = 1);
 // Draw filled/hollow circle
 int LCDCircle(int x1, int y1, int radius, COLOR col, int fill = 1);
 
+// Draw text centred in a filled box, as large as fits, without changing the colours, size or position of LCDPrintf
+int LCDTextBox(int x, int y, int w, int h, const char *text, COLOR fg, COLOR bg);
+
 // Define image type for LCD
 // NOT IMPLEMENTED
 int LCDImageSize(int t);
 
-// Define image start position and size
-int LCDImageStart(int x = 0, int y = 0, int xs = 160, int ys = 120);
+// Rotations of the source image of LCDImageStart, clockwise
+enum {
+  LCD_ROTATE_0,
+  LCD_ROTATE_90,// The top row of the source becomes the right column, for landscape frames on the portrait display
+  LCD_ROTATE_180,
+  LCD_ROTATE_270
+};
+
+// Define image start position and size on the display; the source image of sxs x sys pixels, stride pixels to a row,
+// is rotated and scaled to xs x ys by nearest neighbour, and defaults to xs x ys, unscaled
+int LCDImageStart(int x = 0, int y = 0, int xs = 160, int ys = 120, int sxs = 0, int sys = 0, int stride = 0, int rotation = LCD_ROTATE_0);
 
 // Print color image at image start position and size
 int LCDImage(BYTE *img);
@@ -134,8 +144,52 @@ int LCDImageGray(BYTE *g);
 // Print binary image [0...1] black/white
 int LCDImageBinary(BYTE *b);
 
-// Refresh LCD output
-// NOT IMPLEMENTED
+// Palettes of LCDImagePalette
+enum {
+  LCD_PALETTE_GRAY,// Black to white, as LCDImageGray
+  LCD_PALETTE_HEAT,// Black through blue, red and yellow to white, for magnitudes
+  LCD_PALETTE_LABELS,// Black for 0 and a distinct colour for each label 1..255
+  LCD_PALETTE_USER,// Gray until set with LCDSetPalette
+  LCD_PALETTES
+};
+
+// Set the 256 colours of a palette
+int LCDSetPalette(int palette, const COLOR* colors);
+
+// Print 8-bit image through a palette at image start position and size
+int LCDImagePalette(BYTE *img, int palette);
+
+// Print binary image of 8 pixels per byte, most significant bit first and each row starting on a byte, in fg and bg
+int LCDImagePacked(BYTE *bits, COLOR fg, COLOR bg);
+
+// Print color image in the background from one of two display buffers, returning once it is converted
+int LCDImageAsync(BYTE *img);
+
+// Wait until the image of LCDImageAsync is on the display; other drawing waits for it anyway
+int LCDImageWait(void);
+
+// Annotations queued by the LCDOverlay functions, drawn into the window of the next image before it is pushed
+#define LCD_OVERLAY_MAX 128
+
+// Queue a line over the next image, in pixels from the top left of its window
+int LCDOverlayLine(int x1, int y1, int x2, int y2, COLOR col);
+
+// Queue a filled/hollow rectangle over the next image
+int LCDOverlayArea(int x1, int y1, int x2, int y2, COLOR col, int fill = 1);
+
+// Queue a filled/hollow circle over the next image
+int LCDOverlayCircle(int x1, int y1, int radius, COLOR col, int fill = 1);
+
+// Queue text over the next image in the current font and size, on a transparent background and without wrapping
+int LCDOverlayPrintf(int row, int column, COLOR col, const char *format, ...);
+
+// Discard the queued annotations
+int LCDOverlayClear(void);
+
+// Draw the queued annotations alone on bg in the image window, in one transfer
+int LCDOverlayDraw(COLOR bg);
+
+// Refresh LCD output with the regions of the frame buffer drawn since the last refresh, in LCD_NOAUTOREFRESH mode
 int LCDRefresh(void);
 
 enum {
@@ -147,14 +201,14 @@ enum {
   ANYKEY = ~0
 };
 
-// Blocking read (and wait) for key press (returns KEY1...KEY4 as a bitmask)
-int KEYGet(void);            
+// Blocking read (and wait) for key press begun during the call (returns KEY1...KEY4 as a bitmask, or NOKEY after ms unless ms is -1)
+int KEYGet(int ms = -1);            
 
 // Non-blocking read of key press (returns NOKEY=0 if no key)
 int KEYRead(void);           
 
-// Wait until specified key has been pressed (use ANYKEY for any key)
-int KEYWait(int key);        
+// Wait until specified key has been pressed (use ANYKEY for any key), returns -1 after ms unless ms is -1
+int KEYWait(int key, int ms = -1);        
 
 // Blocking read for touch at any position, returns coordinates
 int KEYGetXY (int *x, int *y);  
@@ -162,6 +216,33 @@ int KEYGetXY (int *x, int *y);
 // Non-blocking read for touch at any position, returns coordinates
 int KEYReadXY(int *x, int *y);  
 
+// Kinds of touch screen and button events
+enum {
+  KEY_TOUCH_DOWN,// A finger has touched the screen
+  KEY_TOUCH_MOVE,// The finger has moved
+  KEY_TOUCH_UP,// The finger has lifted, where it last was
+  KEY_PRESS,// A button has gone down
+  KEY_RELEASE,// A button has come up
+  KEY_LONG_PRESS// A button has been held for KEY_LONG_PRESS_MS
+};
+
+// Milliseconds a button is held for a KEY_LONG_PRESS event
+#define KEY_LONG_PRESS_MS 800
+
+// A touch screen or button event, queued by the touch or button task as it happens
+typedef struct {
+  int type;// KEY_TOUCH_*, KEY_PRESS, KEY_RELEASE or KEY_LONG_PRESS
+  int key;// KEY1 or KEY2 for a button, else NOKEY
+  int x, y;// -1 for a button
+  uint32_t time;// ms
+} KEYEvent;
+
+// Non-blocking read of the oldest touch or button event, returns -1 if there is none
+int KEYReadEvent(KEYEvent *event);
+
+// Blocking read of the oldest touch or button event
+int KEYGetEvent(KEYEvent *event);
+
 typedef BYTE QQVGAcol [120][160][sizeof(COLOR)];    
 typedef BYTE QVGAcol [240][320][sizeof(COLOR)];    
 typedef BYTE VGAcol [480][640][sizeof(COLOR)];    
@@ -207,20 +288,34 @@ int CAMGet(BYTE *buf);
 // Read gray scale camera image
 int CAMGetGray(BYTE *buf);      
 
+// Sources of the images of CAMGet and CAMGetGray
+enum {
+  CAM_LIVE,// The camera, the default
+  CAM_FILES,// PNM files numbered from 0, named by a printf pattern with one integer conversion such as "/run/f%04d.ppm"
+  CAM_RECORDING,// A recording of RECStart
+  CAM_SYNTHETIC// A generated lane scene, the same on every board
+};
+
+// Pacing of sources other than CAM_LIVE
+enum {
+  CAM_PACE_FAST,// Each frame as soon as it is asked for
+  CAM_PACE_REALTIME// Each frame at its recorded time, or at the camera's frame rate
+};
+
+// Take camera images from source instead, restarting sequences at their end; name is NULL for CAM_LIVE and CAM_SYNTHETIC
+int CAMSetSource(int source, const char* name, int pacing);
+
 // Set IP resolution using CAM constants (also automatically set by CAMInit)
 // NOT IMPLEMENTED
 int IPSetSize(int resolution);                                
 
-// Read PNM file, fill/crop if req.; return 3:color, 2:gray, 1:b/w, -1:error
-// NOT IMPLEMENTED
+// Read binary PNM file from the flash file system into a color (P6) or gray (P5, P4) image, fill/crop if req.; return 3:color, 2:gray, 1:b/w, -1:error
 int IPReadFile(char *filename, BYTE* img);                    
 
-// Write color PNM file
-// NOT IMPLEMENTED
+// Write color image as binary PPM file to the flash file system
 int IPWriteFile(char *filename, BYTE* img);                   
 
-// Write gray scale PGM file
-// NOT IMPLEMENTED
+// Write gray scale image as binary PGM file to the flash file system
 int IPWriteFileGray(char *filename, BYTE* gray);              
 
 // Laplace edge detection on gray image
@@ -245,7 +340,117 @@ void IPCol2HSI (BYTE* img, BYTE* h, BYTE* s, BYTE* i);
 void IPOverlay(BYTE* c1, BYTE* c2, BYTE* cOut);                
 
 // Overlay gray image g2 onto g1, using col
-void IPOverlayGray(BYTE* g1, BYTE* g2, COLOR col, BYTE* cOut); 
+void IPOverlayGray(BYTE* g1, BYTE* g2, COLOR col, BYTE* cOut);
+
+// Gray level histogram [0..255] of gray image
+void IPHistogram(BYTE* gray, int hist[256]);
+
+// Per-channel histograms [0..255] of color image
+void IPHistogramRGB(BYTE* img, int r[256], int g[256], int b[256]);
+
+// Gray level histogram of region x, y, xs, ys; only pixels with mask != 0 are counted (mask may be NULL)
+int IPHistogramROI(BYTE* gray, BYTE* mask, int x, int y, int xs, int ys, int hist[256]);
+
+// Otsu threshold [0..255] from histogram; returns -1 if histogram is empty
+int IPOtsu(int hist[256]);
+
+// Binarise gray image, gray > threshold becomes 0xFF, otherwise 0
+void IPThreshold(BYTE* grayIn, int threshold, BYTE* binOut);
+
+// Binarise gray image against the local mean of a (2*radius+1)^2 window minus offset
+void IPThresholdAdaptive(BYTE* grayIn, int radius, int offset, BYTE* binOut);
+
+#define IP_MAX_BANDS 4
+
+// Work on the image rows [first, last) of one band
+typedef void (*IPBandFn)(int first, int last, void* arg);
+
+// Run fn over rows [0, rows) split into bands on both cores, and wait for all of them; halo is the rows a band reads beyond its own
+int IPParallelFor(int rows, int halo, IPBandFn fn, void* arg);
+
+// Set the bands [1..IP_MAX_BANDS] of IPParallelFor and of the IP functions built on it (1: serial, the default)
+int IPSetBands(int bands);
+
+#define IP_MAX_COLOR_CLASSES 8
+
+// Horizontal run of pixels of one colour class in row y, from x1 to x2 inclusive
+typedef struct {
+  short x1, x2, y;
+  BYTE cls;
+  int parent;
+} IPRun;
+
+// Connected region of one colour class, with bounding box and centroid
+typedef struct {
+  int cls;
+  int area;
+  int x1, y1, x2, y2;
+  int cx, cy;
+} IPBlob;
+
+// Remove colour class [0..7] from the colour lookup table (-1 for all classes)
+int IPColorClassClear(int cls);
+
+// Add all colours within the HSI ranges to colour class [0..7]; a hue range with hMin > hMax wraps from 255 to 1
+int IPColorClassSetHSI(int cls, int hMin, int hMax, int sMin, int sMax, int iMin, int iMax);
+
+// Learn colour class [0..7] from the HSI range of region x, y, xs, ys of color image, widened by margin; gray pixels only count if there are no others
+int IPColorClassLearn(int cls, BYTE* img, int x, int y, int xs, int ys, int margin);
+
+// Segment color image into run-length encoded colour class runs; returns number of runs
+int IPColorClassRuns(BYTE* img, IPRun* runs, int maxRuns);
+
+// Segment region x, y, xs, ys of color image into colour class runs; returns number of runs
+int IPColorClassRunsROI(BYTE* img, int x, int y, int xs, int ys, IPRun* runs, int maxRuns);
+
+// Merge connected runs into blobs, largest first; returns number of blobs
+int IPColorClassBlobs(IPRun* runs, int runCount, IPBlob* blobs, int maxBlobs);
+
+#define IP_MAX_TRACKS 8
+
+// Tracker association modes
+enum {
+  IP_TRACK_IOU,
+  IP_TRACK_CENTROID
+};
+
+// Tracked object, with its box and centroid estimated by constant-velocity prediction
+typedef struct {
+  int id;
+  int cls;
+  int x1, y1, x2, y2;
+  int cx, cy;
+  float vx, vy;// pixels per frame
+  int hits;// frames with a matching detection
+  int misses;// consecutive frames without one
+} IPTrackInfo;
+
+// Reset tracker; gate is the minimum IoU in percent (IP_TRACK_IOU) or maximum distance in pixels (IP_TRACK_CENTROID)
+int IPTrackInit(int mode, int gate, int maxMisses);
+
+// Update tracks with the detections of one frame; returns number of active tracks
+int IPTrack(IPBlob* detections, int count);
+
+// Read active tracks, longest tracked first; returns number of tracks
+int IPTrackGet(IPTrackInfo* tracks, int maxTracks);
+
+// Predicted search window of track id for the next frame, grown by margin
+int IPTrackWindow(int id, int margin, int *x, int *y, int *xs, int *ys);
+
+// Number of markers in the fiducial marker dictionary
+#define IP_MARKER_COUNT 32
+
+typedef struct {
+  int id;
+  float x[4], y[4];// Corner pixels, clockwise from the marker's top left
+  int errors;// Number of corrected bits
+} IPMarker;
+
+// Detect fiducial markers in gray image of size xs*ys, returns number of markers found
+int IPMarkerDetect(BYTE* gray, int xs, int ys, IPMarker* markers, int maxMarkers);
+
+// Draw marker id with its white margin into gray image of size*size pixels
+int IPMarkerDraw(int id, BYTE* gray, int size);
 
 // PIXEL: RGB to color
 COLOR IPPRGB2Col(BYTE r, BYTE g, BYTE b);                       
@@ -254,7 +459,10 @@ COLOR IPPRGB2Col(BYTE r, BYTE g, BYTE b);
 void IPPCol2RGB(COLOR col, BYTE* r, BYTE* g, BYTE* b);         
 
 // PIXEL: RGB to HSI for pixel
-void IPPCol2HSI(COLOR c, BYTE* h, BYTE* s, BYTE* i);           
+void IPPCol2HSI(COLOR c, BYTE* h, BYTE* s, BYTE* i);
+
+// PIXEL: Colour class bitmask of color (bit n set for class n)
+BYTE IPPColorClass(COLOR col);
 
 // PIXEL: Convert RGB to hue (0 for gray values)
 BYTE IPPRGB2Hue(BYTE r, BYTE g, BYTE b);                       
@@ -262,6 +470,321 @@ BYTE IPPRGB2Hue(BYTE r, BYTE g, BYTE b);
 // PIXEL: Convert RGB to hue, sat, int; hue=0 for gray values
 void IPPRGB2HSI(BYTE r, BYTE g, BYTE b, BYTE* h, BYTE* s, BYTE* i); 
 
+// Neural network layer types
+enum {
+  NN_CONV2D,
+  NN_DEPTHWISE,
+  NN_MAXPOOL,
+  NN_AVGPOOL,
+  NN_RELU,
+  NN_DENSE
+};
+
+#define NN_VERSION 1
+#define NN_MAX_LAYERS 32
+
+// Header of a network file, followed by its layer records. All values are
+// little-endian, and offsets are in bytes from the start of the file.
+typedef struct {
+  char magic[4];// "EBNN"
+  uint16_t version;// NN_VERSION
+  uint16_t layerCount;
+  uint16_t width, height, channels;// Input tensor
+  uint16_t reserved;
+} NNHeader;
+
+typedef struct {
+  uint8_t type;// NN_CONV2D ... NN_DENSE
+  uint8_t relu;// Non-zero to clamp the output at 0
+  uint8_t kernel;// Kernel width and height
+  uint8_t stride;
+  uint8_t padding;// Zero padding on each side
+  uint8_t shift;// Right shift applied after the multiplier
+  uint16_t channels;// Output channels of NN_CONV2D, outputs of NN_DENSE
+  int32_t multiplier;// Requantisation multiplier of the int32 accumulator
+  uint32_t weights;// Offset of the int8 weights, 16 byte aligned
+  uint32_t bias;// Offset of the int32 biases
+} NNLayer;
+
+typedef struct {
+  const NNHeader* header;
+  const NNLayer* layers;
+  int width, height, channels;// Input tensor
+  int outWidth, outHeight, outChannels;// Output tensor
+  int8_t* input;// Input tensor, filled by NNInput*()
+  int8_t* output;// Output tensor of the last run
+  uint32_t layerMicros[NN_MAX_LAYERS];// Time taken by each layer in the last run
+  int simd;// 1 if the vector kernels passed their check against the scalar ones and are used
+  void* arena;
+  int8_t* buffers[2];
+  int32_t* scratch;
+} NNModel;
+
+// Load network from file contents in memory, which must stay valid and unchanged
+int NNLoad(NNModel* model, const BYTE* data, int size);
+
+// Free the buffers of a loaded network
+int NNRelease(NNModel* model);
+
+// Scale gray image of size xs*ys into the network input
+int NNInputGray(NNModel* model, BYTE* gray, int xs, int ys);
+
+// Scale color image of size xs*ys into the network input
+int NNInputColor(NNModel* model, BYTE* img, int xs, int ys);
+
+// Scale RGB565 image of size xs*ys into the network input
+int NNInputRGB565(NNModel* model, uint16_t* img, int xs, int ys);
+
+// Run network on its input
+int NNRun(NNModel* model);
+
+// Run network on its input with the portable reference kernels
+int NNRunReference(NNModel* model);
+
+// Steering value [-1..1] from the output of the last run
+float NNSteering(NNModel* model);
+
+// Segmentation mask of size outWidth*outHeight from the output of the last run
+int NNMask(NNModel* model, BYTE* mask);
+
+#define BENCH_MAX_RUNS 1000
+
+// Timing statistics of repeated runs in microseconds
+typedef struct {
+  int runs;
+  float min, median, mean, p90, p99, max, stddev;
+  uint32_t cycles;// Median in CPU cycles, nanoseconds on a host
+} BENCHStats;
+
+// Time fn(arg) over runs repetitions [1..BENCH_MAX_RUNS] after one warm-up run
+int BENCHRun(void (*fn)(void* arg), void* arg, int runs, BENCHStats* stats);
+
+// Print stats to the serial console as one line of key=value pairs following labels
+int BENCHPrint(const char* labels, BENCHStats* stats);
+
+// Profiler markers are compiled in unless EYEBOT_PROFILE is defined as 0 before including eyebot.h;
+// the library's own markers are removed by building it with EYEBOT_PROFILE_LIBRARY defined as 0
+#ifndef EYEBOT_PROFILE
+#define EYEBOT_PROFILE 1
+#endif
+
+#define PROF_MAX_STAGES 16
+#define PROF_RING_SIZE 512
+
+// Timing statistics of the runs of one stage held in the ring buffer, in microseconds
+typedef struct {
+  const char* name;
+  int count;
+  float min, avg, p99;
+} PROFStats;
+
+// Stage number of a named stage, registered on first use; name must stay valid (-1 if all stages are in use)
+int PROFStage(const char* name);
+
+// Mark the start of a run of stage; runs in more than 16 tasks with stages open at once are not recorded
+void PROFBegin(int stage);
+
+// Mark the end of a run of stage, recording it in the ring buffer
+void PROFEnd(int stage);
+
+// Statistics of stage [0..PROF_MAX_STAGES-1] over the runs in the ring buffer
+int PROFGet(int stage, PROFStats* stats);
+
+// Discard all recorded runs, keeping the stages
+int PROFReset(void);
+
+// Print the statistics of every stage to the serial console, one line of key=value pairs each
+int PROFPrint(void);
+
+// Draw a table of every stage's min/avg/p99 in milliseconds with its top left at x, y
+int PROFOverlay(int x, int y);
+
+struct PROFScope {
+  int stage;
+  PROFScope(int s) : stage(s) { PROFBegin(s); }
+  ~PROFScope() { PROFEnd(stage); }
+};
+
+#define PROF_CONCAT2(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT2(a, b)
+
+#if EYEBOT_PROFILE
+// Time the rest of the enclosing scope as stage name
+#define PROF_SCOPE(name) \
+  static int PROF_CONCAT(prof_stage_, __LINE__) = PROFStage(name); \
+  PROFScope PROF_CONCAT(prof_scope_, __LINE__)(PROF_CONCAT(prof_stage_, __LINE__))
+// Start timing stage name, until the matching PROF_END(name)
+#define PROF_BEGIN(name) do { static int prof_stage_ = PROFStage(name); PROFBegin(prof_stage_); } while (0)
+#define PROF_END(name) do { static int prof_stage_ = PROFStage(name); PROFEnd(prof_stage_); } while (0)
+#else
+#define PROF_SCOPE(name)
+#define PROF_BEGIN(name) do {} while (0)
+#define PROF_END(name) do {} while (0)
+#endif
+
+#define TRACE_BUFFER_EVENTS 1024
+
+// Trace event types
+enum {
+  TRACE_BEGIN,
+  TRACE_END,
+  TRACE_INSTANT
+};
+
+// Start recording trace events into the ring buffer, discarding earlier ones
+int TRACEStart(void);
+
+// Stop recording trace events
+int TRACEStop(void);
+
+// Record an event with name (which must stay valid) on the calling core; safe in interrupt handlers
+void TRACEEvent(int type, const char* name);
+
+// Write the last TRACE_BUFFER_EVENTS events in binary to a file on the flash file system
+int TRACEWrite(const char* filename);
+
+// Write the last TRACE_BUFFER_EVENTS events in binary to the serial console
+int TRACEStream(void);
+
+#define PIPE_MAX_STAGES 6
+#define PIPE_MAX_FRAMES 32
+
+// What a stage does when the queue to the next stage is full
+enum {
+  PIPE_DROP_OLDEST,// Discard the oldest queued frame
+  PIPE_BLOCK// Wait for the next stage
+};
+
+// Stage function, called with each frame in turn; returns 0 to pass the frame on, -1 to drop it
+typedef int (*PIPEStageFn)(void* frame, void* arg);
+
+// Allocate frames [2..PIPE_MAX_FRAMES] buffers of frameSize bytes, with queues of queueSize frames between stages
+int PIPEInit(int frames, int frameSize, int queueSize, int policy);
+
+// Append a stage running fn(frame, arg) on core [0..1]; the first stage fills free frames; returns stage number
+int PIPEAddStage(const char* name, PIPEStageFn fn, void* arg, int core);
+
+// Start every stage as a task of its own
+int PIPEStart(void);
+
+// Stop every stage after its current frame and recycle all frames
+int PIPEStop(void);
+
+// Frames completed and frames dropped from its output queue by a stage since PIPEStart
+int PIPEGetStats(int stage, int* frames, int* drops);
+
+// Default alignment of arena allocations, enough for DMA and 128-bit SIMD loads
+#define ARENA_ALIGN 16
+
+// Arena pools, also used as placement hints
+enum {
+  ARENA_SRAM,// Internal SRAM: fast, for buffers touched per pixel
+  ARENA_PSRAM// External PSRAM: large, for buffers touched rarely
+};
+
+// Reserve the scratch arena, sramSize bytes of internal SRAM and psramSize bytes of PSRAM (heap memory where the board has none)
+int ARENAInit(int sramSize, int psramSize);
+
+// Zeroed scratch memory of size bytes from the hinted pool, else the other, aligned to align (0: ARENA_ALIGN); NULL if neither
+// has room or the caller is not the task that called ARENAInit. IPHistogram*() and IPMarkerDetect() take their scratch here too.
+void* ARENAAlloc(int size, int pool, int align = 0);
+
+// Release all scratch memory of both pools, at the start of every frame
+int ARENAReset(void);
+
+// Bytes reserved for pool, in use since ARENAReset, and in use at most since ARENAInit
+int ARENAGetUsage(int pool, int* size, int* used, int* peak);
+
+// Print the usage of both pools to the serial console as one line of key=value pairs each
+int ARENAPrint(void);
+
+// Frames the recorder holds while earlier ones are written
+#define REC_BUFFERS 2
+
+// Recording formats, the same as the return values of IPReadFile
+enum {
+  REC_GRAY = 2,
+  REC_COLOR = 3
+};
+
+// Capture time in microseconds and VW pose of a recorded frame
+typedef struct {
+  uint32_t time;
+  int x, y, phi;
+} RECInfo;
+
+// Start recording QQVGA images of format REC_GRAY or REC_COLOR to a file on the flash file system
+int RECStart(const char* filename, int format);
+
+// Queue an image for recording with the current time and pose; returns -1 and drops it if all buffers are still being written
+int RECFrame(BYTE* img);
+
+// Write the queued frames and close the recording
+int RECStop(void);
+
+// Frames recorded, frames dropped and bytes written since RECStart
+int RECGetStats(int* frames, int* drops, int* bytes);
+
+// Open a recording for reading; returns its format, or -1 on error
+int RECOpen(const char* filename);
+
+// Read the next frame of the open recording and its info (may be NULL); returns -1 at the end
+int RECRead(BYTE* img, RECInfo* info);
+
+// Close the recording opened by RECOpen
+int RECClose(void);
+
+// Widgets of the UI functions, each at most UI_MAX_WIDGETS including the entries of LCDMenu
+#define UI_MAX_WIDGETS 32
+// Milliseconds a touched widget stays highlighted, ended by a later UIUpdate
+#define UI_FLASH_MS 100
+// Milliseconds a stepper is held before it steps again, and between its further steps
+#define UI_REPEAT_DELAY_MS 400
+#define UI_REPEAT_MS 100
+
+// Called by UIUpdate with the id and new value of a widget that was touched
+typedef void (*UIEventFn)(int id, int value, void* arg);
+
+// Add a button whose value counts its touches; returns its id, or -1 if all are in use
+int UIButton(int x, int y, int w, int h, const char* text, COLOR fg, COLOR bg);
+
+// Add a stepper showing value, lowered or raised by step within [min..max] by touching its left or right third
+int UIStepper(int x, int y, int w, int h, int value, int min, int max, int step, COLOR fg, COLOR bg);
+
+// Add a label, which ignores touches
+int UILabel(int x, int y, int w, int h, const char* text, COLOR fg, COLOR bg);
+
+// Change the text of a button or label, redrawn by the next UIUpdate if it differs
+int UISetText(int id, const char* text);
+
+// Set the value of a widget, within its range for a stepper
+int UISetValue(int id, int value);
+
+// Value of a widget, 0 for an unknown id
+int UIGetValue(int id);
+
+// Call fn whenever the widget is touched
+int UISetCallback(int id, UIEventFn fn, void* arg);
+
+// Remove a widget, leaving it on the display
+int UIRemove(int id);
+
+// Remove all widgets, including the menu
+int UIClear(void);
+
+// Draw all widgets again, as after clearing the display
+int UIRedraw(void);
+
+// Read the touch screen once without waiting, act on a new touch or a held stepper and redraw what changed; returns
+// the id touched, or -1
+int UIUpdate(void);
+
+// KEY1..KEY4 of the menu entry of LCDMenu held down at the last UIUpdate, or NOKEY; reads nothing itself
+int UIMenuRead(void);
+
+// UIUpdate while a menu of LCDMenu is shown, returning KEY1..KEY4 for an entry touched now, or NOKEY
+int UIMenuGet(void);
+
 // Execute Linux program in background
 // NOT IMPLEMENTED
 char* OSExecute(char* command);
@@ -292,24 +815,33 @@ int OSMachineID(void);
 
 typedef int TIMER;
 
+// Timers of OSAttachTimer at once
+#define OS_MAX_TIMERS 16
+
+// Statistics of a timer of OSAttachTimer since it was attached, times in microseconds
+typedef struct {
+  int calls;
+  int overruns;// Calls lost because the timer fell a whole period behind
+  float jitter_mean, jitter_max;// How late calls started after their tick
+  float run_max;// Longest call
+} OSTimerStats;
+
 // Wait for n/1000 sec
-// NOT IMPLEMENTED
 int OSWait(int n);
 
-// Add fct to 1000Hz/scale timer
-// NOT IMPLEMENTED
+// Add fct to 1000Hz/scale timer, called from a task above the program; returns -1 if all OS_MAX_TIMERS are in use
 TIMER OSAttachTimer(int scale, void (*fct)(void));
 
 // Remove fct from 1000Hz/scale timer
-// NOT IMPLEMENTED
 int OSDetachTimer(TIMER t);
 
+// Get the call statistics of a timer of OSAttachTimer
+int OSGetTimerStats(TIMER t, OSTimerStats *stats);
+
 // Get system time (ticks in 1/1000 sec)
-// NOT IMPLEMENTED
 int OSGetTime(int *hrs,int *mins,int *secs,int *ticks); 
 
 // Count in 1/1000 sec since system start
-// NOT IMPLEMENTED
 int OSGetCount(void);
 
 // Init communication (see parameters below), interface number as in HDT file
@@ -0,0 +1,144 @@
+/*
+Frame-scoped scratch memory for the ARENA*() functions.
+
+Each pool is one block reserved by ARENAInit(), handed out by bumping an
+offset and released as a whole by ARENAReset(), so an allocation costs an
+addition and a memset and memory never fragments. A program resets the
+arena at the start of every frame and takes its per-frame buffers from it,
+instead of aliasing one buffer for several purposes by hand.
+
+The internal SRAM pool is for buffers that are read or written per pixel,
+the PSRAM pool for large ones that are not. An allocation tries the hinted
+pool first and falls back to the other, so programs run unchanged on boards
+without PSRAM, only slower. The high-water mark of each pool shows how much
+of it a program really needs.
+
+The arena belongs to the task that called ARENAInit(): allocations are
+not synchronised, so any other task is refused. This lets the library's own
+kernels take their scratch from the arena when they run in that task, and
+fall back to buffers of their own in any other, such as the bands of
+IPParallelFor().
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  BYTE *base;
+  int size, used, peak;
+} ArenaPool;
+
+static ArenaPool gArenaPools[2];
+static uint32_t gArenaTask = 0;// halTaskID() of the owner
+
+static void* poolAlloc(ArenaPool *pool, int size, int align)
+{
+  if (!pool->base)
+    return NULL;
+
+  uintptr_t start = (uintptr_t)pool->base + pool->used;
+  uintptr_t aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+  uintptr_t pad = aligned - start;
+
+  // Compared with the room left, so that no size or alignment can overflow
+  if (pad > (uintptr_t)(pool->size - pool->used) || size > pool->size - pool->used - (int)pad)
+    return NULL;
+
+  int end = pool->used + (int)pad + size;
+  pool->used = end;
+  if (end > pool->peak)
+    pool->peak = end;
+
+  memset((void*)aligned, 0, size);
+
+  return (void*)aligned;
+}
+
+int ARENAInit(int sramSize, int psramSize)
+{
+  if (sramSize < 0 || psramSize < 0)
+    return -1;
+
+  free(gArenaPools[ARENA_SRAM].base);
+  free(gArenaPools[ARENA_PSRAM].base);
+  memset(gArenaPools, 0, sizeof(gArenaPools));
+  gArenaTask = halTaskID();
+
+  if (sramSize > 0)
+  {
+    gArenaPools[ARENA_SRAM].base = (BYTE*)halAllocInternal(sramSize);
+    if (!gArenaPools[ARENA_SRAM].base)
+      return -1;
+    gArenaPools[ARENA_SRAM].size = sramSize;
+  }
+
+  if (psramSize > 0)
+  {
+    gArenaPools[ARENA_PSRAM].base = (BYTE*)halAllocExternal(psramSize);
+    if (!gArenaPools[ARENA_PSRAM].base)
+    {
+      free(gArenaPools[ARENA_SRAM].base);
+      memset(gArenaPools, 0, sizeof(gArenaPools));
+      return -1;
+    }
+    gArenaPools[ARENA_PSRAM].size = psramSize;
+  }
+
+  return 0;
+}
+
+void* ARENAAlloc(int size, int pool, int align)
+{
+  if (size < 0 || (pool != ARENA_SRAM && pool != ARENA_PSRAM) || align < 0 || (align & (align - 1)) ||
+      halTaskID() != gArenaTask)
+    return NULL;
+
+  if (align == 0)
+    align = ARENA_ALIGN;
+
+  void *mem = poolAlloc(&gArenaPools[pool], size, align);
+  if (!mem)
+    mem = poolAlloc(&gArenaPools[1 - pool], size, align);
+
+  return mem;
+}
+
+int ARENAReset(void)
+{
+  gArenaPools[ARENA_SRAM].used = 0;
+  gArenaPools[ARENA_PSRAM].used = 0;
+
+  return 0;
+}
+
+int ARENAGetUsage(int pool, int* size, int* used, int* peak)
+{
+  if (pool != ARENA_SRAM && pool != ARENA_PSRAM)
+    return -1;
+
+  if (size)
+    *size = gArenaPools[pool].size;
+  if (used)
+    *used = gArenaPools[pool].used;
+  if (peak)
+    *peak = gArenaPools[pool].peak;
+
+  return 0;
+}
+
+int ARENAPrint(void)
+{
+  const char *names[] = {"sram", "psram"};
+  char line[96];
+
+  for (int pool = ARENA_SRAM; pool <= ARENA_PSRAM; pool++)
+  {
+    ArenaPool *p = &gArenaPools[pool];
+    snprintf(line, sizeof(line), "arena=%s size=%d used=%d peak=%d\n", names[pool], p->size, p->used, p->peak);
+    halConsole(line);
+  }
+
+  return 0;
+}
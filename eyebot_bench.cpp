@@ -0,0 +1,87 @@
+/*
+Benchmark timing for the BENCH*() functions.
+
+Every run is timed on its own with the HAL's cycle counter, which counts CPU
+cycles on the EyeBot and nanoseconds on a host, so that the spread of the
+runs can be reported as well as their average. Percentiles are taken by
+nearest rank from the sorted runs.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+static uint32_t gBenchCycles[BENCH_MAX_RUNS];
+
+static int compareCycles(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(int runs, int p)
+{
+  int rank = (p*runs + 99) / 100;
+  return gBenchCycles[MAX(rank, 1) - 1];
+}
+
+/*
+The warm-up run fills the caches and takes any allocations made on first
+use, such as the colour class table, out of the timed runs.
+*/
+int BENCHRun(void (*fn)(void* arg), void* arg, int runs, BENCHStats* stats)
+{
+  if (!fn || !stats || runs < 1 || runs > BENCH_MAX_RUNS)
+    return -1;
+
+  fn(arg);
+
+  for (int i = 0; i < runs; i++)
+  {
+    uint32_t start = halCycles();
+    fn(arg);
+    gBenchCycles[i] = halCycles() - start;
+  }
+
+  qsort(gBenchCycles, runs, sizeof(uint32_t), compareCycles);
+
+  double sum = 0, sum_sq = 0;
+  for (int i = 0; i < runs; i++)
+  {
+    sum += gBenchCycles[i];
+    sum_sq += (double)gBenchCycles[i]*gBenchCycles[i];
+  }
+
+  float us = 1.0f / halCyclesPerMicro();
+  double mean = sum / runs;
+
+  stats->runs = runs;
+  stats->min = gBenchCycles[0]*us;
+  stats->median = percentile(runs, 50)*us;
+  stats->mean = mean*us;
+  stats->p90 = percentile(runs, 90)*us;
+  stats->p99 = percentile(runs, 99)*us;
+  stats->max = gBenchCycles[runs - 1]*us;
+  stats->stddev = sqrt(MAX(sum_sq / runs - mean*mean, 0.0))*us;
+  stats->cycles = percentile(runs, 50);
+
+  return 0;
+}
+
+int BENCHPrint(const char* labels, BENCHStats* stats)
+{
+  if (!labels || !stats)
+    return -1;
+
+  char line[256];
+  snprintf(line, sizeof(line),
+           "%s%sruns=%d us_min=%.1f us_median=%.1f us_mean=%.1f us_p90=%.1f us_p99=%.1f us_max=%.1f us_stddev=%.1f cycles=%u\n",
+           labels, labels[0] ? " " : "", stats->runs, stats->min, stats->median, stats->mean,
+           stats->p90, stats->p99, stats->max, stats->stddev, (unsigned)stats->cycles);
+  halConsole(line);
+
+  return 0;
+}
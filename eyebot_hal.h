@@ -0,0 +1,239 @@
+#ifndef EYEBOT_HAL_H
+#define EYEBOT_HAL_H
+
+/*
+Hardware abstraction layer beneath eyebot.cpp.
+
+Everything the EyeBot library needs from the board goes through these
+functions, so that the library itself is plain C++. eyebot_hal_esp32.cpp
+implements them on the T-Display-S3 with TFT_eSPI, TouchLib, the SPI master
+driver and a timer group, and host/hal_linux.cpp implements them on a Linux
+host with a simulated board for tests and benchmarks.
+
+The HAL works in device terms: RGB565 pixels, raw motor direction pin levels,
+raw ADC values and milliseconds since start-up.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The pixels received from the camera and passed through to the
+// display are in 16-bit RGB565 format
+typedef uint16_t RGB565;
+
+#define LCD_WIDTH 170
+#define LCD_HEIGHT 320
+
+// Motors of the Makerverse 2 channel motor driver
+enum {
+  HAL_MOTOR_LEFT,
+  HAL_MOTOR_RIGHT
+};
+
+// Fonts of halLCDSetTextFont
+enum {
+  HAL_FONT_GLCD,// The 6x8 cells of the default font, times the text size
+  HAL_FONT_GLCD_BOLD,
+  HAL_FONT_SANS,
+  HAL_FONT_SANS_BOLD,
+  HAL_FONT_SERIF,
+  HAL_FONT_SERIF_BOLD
+};
+
+// Physical buttons of the T-Display-S3
+enum {
+  HAL_BUTTON_LEFT,
+  HAL_BUTTON_RIGHT
+};
+
+// States of a button reported by the task of halButtonStart
+enum {
+  HAL_BUTTON_RELEASED,
+  HAL_BUTTON_PRESSED,
+  HAL_BUTTON_HELD// Still pressed after the hold time of halButtonStart
+};
+
+// Milliseconds since start-up
+uint32_t halMillis(void);
+
+// Microseconds since start-up
+uint32_t halMicros(void);
+
+// Waits for ms milliseconds
+void halDelay(uint32_t ms);
+
+// Called from the library's busy-wait loops, so the backend can run pending work
+void halIdle(void);
+
+// Allocates zeroed memory, from internal RAM where the board has it
+void* halAllocInternal(size_t size);
+
+// Allocates zeroed memory, from external PSRAM where the board has it
+void* halAllocExternal(size_t size);
+
+// Free-running counter for timing code: CPU cycles on the board, nanoseconds on a host
+uint32_t halCycles(void);
+
+// Counts of halCycles() per microsecond
+uint32_t halCyclesPerMicro(void);
+
+// Writes a string to the serial console
+void halConsole(const char *str);
+
+// Writes size bytes of binary data to the serial console
+void halConsoleWrite(const void *data, int size);
+
+// Number of the CPU core running the caller
+int halCoreID(void);
+
+// Identifies the task running the caller, never 0
+uint32_t halTaskID(void);
+
+// Starts fn(arg) as a task of its own on CPU core [0..1], which ends when fn returns; returns 0 on success
+int halTaskCreate(void (*fn)(void *arg), void *arg, int core, const char *name);
+
+// Lets other tasks run while the caller waits for one of them
+void halYield(void);
+
+// Creates a counting semaphore, initially taken, for tasks to wait on each other; NULL on failure
+void* halSemCreate(void);
+
+// Signals a semaphore, waking one task waiting on it
+void halSemGive(void *sem);
+
+// Waits until a semaphore is signalled
+void halSemTake(void *sem);
+
+// Opens a file on the flash file system with mode "r", "w" or "a", NULL on failure
+void* halFileOpen(const char *path, const char *mode);
+
+// Reads up to size bytes, returns the number read
+int halFileRead(void *file, void *data, int size);
+
+// Writes size bytes, returns the number written
+int halFileWrite(void *file, const void *data, int size);
+
+// Closes a file from halFileOpen()
+void halFileClose(void *file);
+
+// Stops both motors and sets their direction pins to forward
+int halMotorInit(void);
+
+// Sets the raw level of a motor's direction pin
+void halMotorDir(int motor, int level);
+
+// Sets a motor's 8-bit PWM duty cycle
+void halMotorPWM(int motor, int duty);
+
+// Prepares the one-shot motor timer, which calls callback in interrupt context
+int halMotorTimerInit(void (*callback)(void));
+
+// Starts the one-shot motor timer, stopping it first if it is running
+int halMotorTimerStart(uint64_t ms);
+
+// Stops the one-shot motor timer without calling its callback
+void halMotorTimerStop(void);
+
+// Starts a periodic timer calling tick every us microseconds from a task above all others, one call for ticks missed meanwhile; -1 if it cannot
+int halTickStart(uint32_t us, void (*tick)(void));
+
+// Returns whether a physical button is held down
+int halButton(int button);
+
+// Services the buttons from their pin interrupts, calling report from a task with every debounced change, and once a button has been held for hold_ms; -1 if it cannot
+int halButtonStart(void (*report)(int button, int state), uint32_t hold_ms);
+
+// Raw ADC value of the PSD distance sensor
+int halPSDRaw(void);
+
+// Initialises the touch screen, returns 0 if it responds
+int halTouchInit(void);
+
+// Reads the first touch point, returns 1 if the screen is touched
+int halTouchRead(int *x, int *y);
+
+// Services the touch screen from its interrupt line, calling report with every changed reading from a task; -1 if it cannot
+int halTouchStart(void (*report)(int x, int y, int touched));
+
+// Blocks until a task of halTouchStart or halButtonStart has reported, or for at most ms unless ms is -1; for a moment of the clock at most on a host
+void halInputWait(int ms);
+
+// Called for each read of what an input task last reported, which costs the board nothing, so the backend can account for it
+void halInputPeek(void);
+
+// Prepares the camera link
+int halCamInit(void);
+
+// Receives one QQVGA RGB565 frame into buf, returns -1 on a timeout
+int halCamRead(RGB565 *buf);
+
+// Initialises the display and clears it to black
+int halLCDInit(void);
+
+// Fills the whole display
+void halLCDFill(RGB565 col);
+
+// Draws a pixel
+void halLCDPixel(int x, int y, RGB565 col);
+
+// Reads a pixel back from the display
+RGB565 halLCDReadPixel(int x, int y);
+
+// Draws a horizontal line of w pixels
+void halLCDHLine(int x, int y, int w, RGB565 col);
+
+// Draws a vertical line of h pixels
+void halLCDVLine(int x, int y, int h, RGB565 col);
+
+// Draws a line between two points
+void halLCDLine(int x1, int y1, int x2, int y2, RGB565 col);
+
+// Draws a filled or outlined rectangle
+void halLCDRect(int x, int y, int w, int h, RGB565 col, int fill);
+
+// Draws a filled or outlined circle
+void halLCDCircle(int x, int y, int r, RGB565 col, int fill);
+
+// Copies a block of big-endian RGB565 pixels to the display
+void halLCDPushRect(int x, int y, int w, int h, const RGB565 *data);
+
+// Starts copying a block of big-endian RGB565 pixels to the display in the background; data must not change until halLCDWait
+void halLCDPushRectAsync(int x, int y, int w, int h, const RGB565 *data);
+
+// Waits until the block of halLCDPushRectAsync is on the display; every other drawing function does so first
+void halLCDWait(void);
+
+// Draws into an off-screen frame buffer instead of the display while on, starting black; -1 without memory for it
+int halLCDSetBuffered(int on);
+
+// Copies a region of the frame buffer to the display in one transfer
+void halLCDFlush(int x, int y, int w, int h);
+
+// Moves the text cursor
+void halLCDSetCursor(int x, int y);
+
+// Reads the text cursor
+void halLCDGetCursor(int *x, int *y);
+
+// Sets the text foreground and background colours
+void halLCDSetTextColor(RGB565 fg, RGB565 bg);
+
+// Selects a display font of HAL_FONT_*
+void halLCDSetTextFont(int font);
+
+// Sets the text magnification
+void halLCDSetTextSize(int size);
+
+// Prints a string at the text cursor and advances it
+void halLCDPrint(const char *str);
+
+// Height of a line of text in the current font and size
+int halLCDFontHeight(void);
+
+// Width of a glyph of the current font and size, up to the next one, and the height of its line
+void halLCDGlyphSize(char c, int *w, int *h);
+
+// Rasterises a glyph of the current font and size into w x h bytes of halLCDGlyphSize, non-zero in the foreground
+void halLCDGlyph(char c, uint8_t *mask);
+
+#endif
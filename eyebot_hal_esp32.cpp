@@ -0,0 +1,966 @@
+/*
+T-Display-S3 implementation of eyebot_hal.h.
+
+The display and touch screen are driven by the custom TFT_eSPI and TouchLib
+libraries, images arrive from the ESP32-CAM over SPI, and finite VW
+operations are ended by a timer group interrupt. The touch controller is
+read by a task woken from its interrupt line.
+*/
+#define TOUCH_MODULES_CST_SELF // Essential for the touchscreen
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <Arduino.h>
+#include <driver/spi_master.h>
+#include <driver/timer.h>
+#include <esp_heap_caps.h>
+#include <FFat.h>
+#include <TFT_eSPI.h>
+#include <TouchLib.h>
+#include <Wire.h>
+
+// ESP32-CAM connection pins
+#define PIN_SPI_MISO 43
+#define PIN_SPI_CS 44
+#define PIN_SPI_SCLK 1
+#define PIN_CAM_SIGNAL 2
+
+// Physical button pins
+#define PIN_LEFT_BUTTON 0
+#define PIN_RIGHT_BUTTON 14
+
+// Makerverse 2 channel motor driver connection pins
+#define PIN_LEFT_MOTOR_DIR 3
+#define PIN_LEFT_MOTOR_PWM 10
+#define PIN_RIGHT_MOTOR_DIR 11
+#define PIN_RIGHT_MOTOR_PWM 12
+
+// PSD analogue distance input pin
+#define PIN_DIST_SENSOR 13
+
+// Touchscreen pins
+#define PIN_IIC_SCL                  17
+#define PIN_IIC_SDA                  18
+#define PIN_TOUCH_INT                16
+#define PIN_TOUCH_RES                21
+
+// Due to a maximum data size for individual SPI transactions,
+// whose value or origin is unknown, a QQVGA image is delivered
+// from the ESP32-CAM in eight individual SPI transactions of
+// size 4800 bytes.
+#define CAM_NUM_IMAGE_SEGMENTS 8
+#define MAX_RX_SEGMENT_SIZE 4800
+
+// If one of the eight individual SPI transactions expected
+// from the ESP32-CAM is not delivered within 500 ms, then
+// the frame is abandoned.
+#define CAM_TIMEOUT_MS 500
+
+// Tasks started by halTaskCreate() run at the priority of the Arduino loop task
+#define TASK_STACK_SIZE 8192
+#define TASK_PRIORITY 1
+#define SEM_MAX_COUNT 255
+
+// Blocks of halLCDPushRectAsync() are pushed by a task on this core
+#define LCD_PUSH_CORE 0
+
+// The touch task runs beside the drawing task, above the Arduino loop task,
+// and takes a touch to have ended when the controller stops interrupting
+#define TOUCH_TASK_STACK_SIZE 4096
+#define TOUCH_TASK_PRIORITY 2
+#define TOUCH_RELEASE_MS 50
+
+// The button task runs like the touch task, and takes a button to have
+// settled once its pins have not changed for BUTTON_DEBOUNCE_MS
+#define BUTTON_TASK_STACK_SIZE 2048
+#define BUTTON_TASK_PRIORITY TOUCH_TASK_PRIORITY
+#define BUTTON_DEBOUNCE_MS 20
+
+// The tick task runs above every task of the library and of Arduino, and
+// below only those of the system
+#define TICK_TASK_STACK_SIZE 4096
+#define TICK_TASK_PRIORITY (configMAX_PRIORITIES - 3)
+
+static TFT_eSPI gTFT = TFT_eSPI(LCD_WIDTH, LCD_HEIGHT);
+// Frame buffer of halLCDSetBuffered(), in PSRAM where TFT_eSPI finds it
+static TFT_eSprite gSprite = TFT_eSprite(&gTFT);
+static bool gLCDBuffered = false;
+// Text settings, for a sprite created after they were made
+static RGB565 gTextFg = 0xFFFF, gTextBg = 0xFFFF;
+static int gTextFont = HAL_FONT_GLCD, gTextSize = 1;
+// Glyphs of halLCDGlyph() are drawn into this and read back
+static TFT_eSprite gGlyphSprite = TFT_eSprite(&gTFT);
+
+// Drawing goes to the frame buffer while it is on
+#define LCD_TARGET(call) (gLCDBuffered ? gSprite.call : gTFT.call)
+static spi_device_handle_t gCamSPIHandle;
+static TouchLib gTouch(Wire, PIN_IIC_SDA, PIN_IIC_SCL, CTS820_SLAVE_ADDRESS, PIN_TOUCH_RES);
+static void (*gTouchReport)(int x, int y, int touched) = NULL;
+static SemaphoreHandle_t gTouchIRQ = NULL;
+static void (*gButtonReport)(int button, int state) = NULL;
+static SemaphoreHandle_t gButtonIRQ = NULL;
+static uint32_t gButtonHoldMs = 0;
+// Given by the input tasks after they report, for halInputWait()
+static SemaphoreHandle_t gInputReported = NULL;
+
+static timer_group_t gTimerGroup = TIMER_GROUP_0;
+static timer_idx_t gMotorTimerIdx = TIMER_0;
+static void (*gMotorTimerCallback)(void) = NULL;
+static timer_idx_t gTickTimerIdx = TIMER_1;
+static void (*gTickCallback)(void) = NULL;
+static SemaphoreHandle_t gTickIRQ = NULL;
+
+// The block being pushed in the background, and whether the caller has yet
+// to wait for it. Only the drawing task touches gLCDPushPending.
+typedef struct {
+  int x, y, w, h;
+  const RGB565 *data;
+} LCDPush;
+
+static LCDPush gLCDPush;
+static void *pLCDPushStart = NULL, *pLCDPushDone = NULL;
+static bool gLCDPushPending = false;
+
+static const int gMotorPWMPins[] = {PIN_LEFT_MOTOR_PWM, PIN_RIGHT_MOTOR_PWM};
+static const int gMotorDirPins[] = {PIN_LEFT_MOTOR_DIR, PIN_RIGHT_MOTOR_DIR};
+
+// If this function is too long or invokes a user-defined function, it causes
+// the T-Display-S3 to crash due to undefined behaviour.
+static bool motorTimerISR(void *arg)
+{
+  if (gMotorTimerCallback)
+    gMotorTimerCallback();
+
+  return true;
+}
+
+uint32_t halMillis(void)
+{
+  return millis();
+}
+
+uint32_t halMicros(void)
+{
+  return micros();
+}
+
+void halDelay(uint32_t ms)
+{
+  delay(ms);
+}
+
+void halIdle(void)
+{
+}
+
+void* halAllocInternal(size_t size)
+{
+  return heap_caps_calloc(size, 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void* halAllocExternal(size_t size)
+{
+  void *mem = heap_caps_calloc(size, 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+
+  return mem ? mem : calloc(size, 1);
+}
+
+uint32_t halCycles(void)
+{
+  return ESP.getCycleCount();
+}
+
+uint32_t halCyclesPerMicro(void)
+{
+  return ESP.getCpuFreqMHz();
+}
+
+void halConsole(const char *str)
+{
+  Serial.print(str);
+}
+
+void halConsoleWrite(const void *data, int size)
+{
+  Serial.write((const uint8_t*)data, size);
+}
+
+int halCoreID(void)
+{
+  return xPortGetCoreID();
+}
+
+uint32_t halTaskID(void)
+{
+  return (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+}
+
+typedef struct {
+  void (*fn)(void *arg);
+  void *arg;
+} TaskStart;
+
+// FreeRTOS tasks must not return, so each one deletes itself once fn returns
+static void taskMain(void *arg)
+{
+  TaskStart start = *(TaskStart*)arg;
+  delete (TaskStart*)arg;
+
+  start.fn(start.arg);
+  vTaskDelete(NULL);
+}
+
+int halTaskCreate(void (*fn)(void *arg), void *arg, int core, const char *name)
+{
+  TaskStart *start = new TaskStart{fn, arg};
+  BaseType_t result = xTaskCreatePinnedToCore(taskMain, name, TASK_STACK_SIZE, start, TASK_PRIORITY, NULL, core);
+
+  if (result != pdPASS)
+  {
+    delete start;
+    return -1;
+  }
+
+  return 0;
+}
+
+// A tick of delay rather than taskYIELD(), so that the idle task of the
+// core is not starved and the task watchdog stays quiet
+void halYield(void)
+{
+  vTaskDelay(1);
+}
+
+void* halSemCreate(void)
+{
+  return xSemaphoreCreateCounting(SEM_MAX_COUNT, 0);
+}
+
+void halSemGive(void *sem)
+{
+  xSemaphoreGive((SemaphoreHandle_t)sem);
+}
+
+void halSemTake(void *sem)
+{
+  xSemaphoreTake((SemaphoreHandle_t)sem, portMAX_DELAY);
+}
+
+// The file system is mounted on first use
+void* halFileOpen(const char *path, const char *mode)
+{
+  static bool mounted = false;
+
+  if (!mounted && !(mounted = FFat.begin()))
+    return NULL;
+
+  File file = FFat.open(path, mode);
+  if (!file)
+    return NULL;
+
+  return new File(file);
+}
+
+int halFileRead(void *file, void *data, int size)
+{
+  return ((File*)file)->read((uint8_t*)data, size);
+}
+
+int halFileWrite(void *file, const void *data, int size)
+{
+  return ((File*)file)->write((const uint8_t*)data, size);
+}
+
+void halFileClose(void *file)
+{
+  ((File*)file)->close();
+  delete (File*)file;
+}
+
+int halMotorInit(void)
+{
+  analogWrite(PIN_LEFT_MOTOR_PWM, 0);
+  analogWrite(PIN_RIGHT_MOTOR_PWM, 0);
+
+  pinMode(PIN_LEFT_MOTOR_DIR, OUTPUT);
+  pinMode(PIN_RIGHT_MOTOR_DIR, OUTPUT);
+  // The directional controls of the left and right motors for
+  // the Makerverse 2 channel motor driver are inverted.
+  digitalWrite(PIN_LEFT_MOTOR_DIR, HIGH);
+  digitalWrite(PIN_RIGHT_MOTOR_DIR, LOW);
+
+  /////////////////////////////////////////////
+  // Enable being powered from the power rail,
+  // as opposed to USB port.
+  /////////////////////////////////////////////
+
+  //pinMode(PIN_BATTERY_POWER, OUTPUT);
+  //digitalWrite(PIN_BATTERY_POWER, HIGH);
+
+  return 0;
+}
+
+void halMotorDir(int motor, int level)
+{
+  digitalWrite(gMotorDirPins[motor], level ? HIGH : LOW);
+}
+
+void halMotorPWM(int motor, int duty)
+{
+  analogWrite(gMotorPWMPins[motor], duty);
+}
+
+int halMotorTimerInit(void (*callback)(void))
+{
+  // This just initialises one of the multiple number of timers available on the
+  // ESP32-S3
+
+  timer_config_t timer_config = {};
+  timer_config.alarm_en = TIMER_ALARM_DIS;
+  timer_config.counter_en = TIMER_PAUSE;
+  timer_config.intr_type = TIMER_INTR_LEVEL;
+  timer_config.counter_dir = TIMER_COUNT_UP;
+  timer_config.auto_reload = TIMER_AUTORELOAD_DIS;
+  // Divider value cannot be higher than 2^16.
+  // Increments 80 MHz/40000 = 2000 times a second
+  timer_config.divider = 40000;
+
+  gMotorTimerCallback = callback;
+
+  esp_err_t err = timer_init(gTimerGroup, gMotorTimerIdx, &timer_config);
+  assert(err == ESP_OK);
+
+  err = timer_isr_callback_add(gTimerGroup, gMotorTimerIdx, motorTimerISR, NULL, 0);
+  assert(err == ESP_OK);
+
+  return 0;
+}
+
+int halMotorTimerStart(uint64_t ms)
+{
+  esp_err_t err;
+  if (err = timer_pause(gTimerGroup, gMotorTimerIdx))
+    return -1;
+
+  if (err = timer_set_counter_value(gTimerGroup, gMotorTimerIdx, 0))
+    return -1;
+
+  //Assumes 2000 increments of the timer counter per s
+  if (err = timer_set_alarm_value(gTimerGroup, gMotorTimerIdx, 2*ms))
+    return -1;
+
+  if (err = timer_set_alarm(gTimerGroup, gMotorTimerIdx, TIMER_ALARM_EN))
+    return -1;
+
+  if (err = timer_start(gTimerGroup, gMotorTimerIdx))
+    return -1;
+
+  return 0;
+}
+
+void halMotorTimerStop(void)
+{
+  timer_pause(gTimerGroup, gMotorTimerIdx);
+}
+
+static bool tickTimerISR(void *arg)
+{
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(gTickIRQ, &woken);
+
+  return woken;
+}
+
+// A binary semaphore, so ticks given while the callback runs wake it once
+static void tickTask(void *arg)
+{
+  while (true)
+  {
+    xSemaphoreTake(gTickIRQ, portMAX_DELAY);
+    gTickCallback();
+  }
+}
+
+/*
+Whatever was set up is taken down again on failure, so that a later call
+can try again without leaving a task behind.
+*/
+int halTickStart(uint32_t us, void (*tick)(void))
+{
+  // The second timer of the motor timer's group reloads itself at each alarm
+  timer_config_t timer_config = {};
+  timer_config.alarm_en = TIMER_ALARM_EN;
+  timer_config.counter_en = TIMER_PAUSE;
+  timer_config.intr_type = TIMER_INTR_LEVEL;
+  timer_config.counter_dir = TIMER_COUNT_UP;
+  timer_config.auto_reload = TIMER_AUTORELOAD_EN;
+  // Increments 80 MHz/80 = 1000000 times a second
+  timer_config.divider = 80;
+
+  if (timer_init(gTimerGroup, gTickTimerIdx, &timer_config) != ESP_OK)
+    return -1;
+
+  TaskHandle_t task = NULL;
+  gTickIRQ = xSemaphoreCreateBinary();
+  gTickCallback = tick;
+
+  if (gTickIRQ &&
+      xTaskCreatePinnedToCore(tickTask, "tick", TICK_TASK_STACK_SIZE, NULL, TICK_TASK_PRIORITY, &task, LCD_PUSH_CORE) == pdPASS &&
+      timer_set_counter_value(gTimerGroup, gTickTimerIdx, 0) == ESP_OK &&
+      timer_set_alarm_value(gTimerGroup, gTickTimerIdx, us) == ESP_OK &&
+      timer_isr_callback_add(gTimerGroup, gTickTimerIdx, tickTimerISR, NULL, 0) == ESP_OK)
+  {
+    if (timer_start(gTimerGroup, gTickTimerIdx) == ESP_OK)
+      return 0;
+
+    timer_isr_callback_remove(gTimerGroup, gTickTimerIdx);
+  }
+
+  // The task waits on the semaphore, so it goes first
+  if (task)
+    vTaskDelete(task);
+  if (gTickIRQ)
+    vSemaphoreDelete(gTickIRQ);
+  gTickIRQ = NULL;
+  gTickCallback = NULL;
+  timer_deinit(gTimerGroup, gTickTimerIdx);
+
+  return -1;
+}
+
+int halButton(int button)
+{
+  return !digitalRead(button == HAL_BUTTON_LEFT ? PIN_LEFT_BUTTON : PIN_RIGHT_BUTTON);
+}
+
+int halPSDRaw(void)
+{
+  return analogRead(PIN_DIST_SENSOR);
+}
+
+int halTouchInit(void)
+{
+  gpio_hold_dis((gpio_num_t)PIN_TOUCH_RES);
+  pinMode(PIN_TOUCH_RES, OUTPUT);
+  digitalWrite(PIN_TOUCH_RES, LOW);
+  delay(100);
+  digitalWrite(PIN_TOUCH_RES, HIGH);
+  Wire.begin(PIN_IIC_SDA, PIN_IIC_SCL);
+
+  return gTouch.init() ? 0 : -1;
+}
+
+int halTouchRead(int *x, int *y)
+{
+  if (!gTouch.read())
+    return 0;
+
+  TP_Point t = gTouch.getPoint(0);
+  *x = t.x;
+  *y = t.y;
+
+  return 1;
+}
+
+static void IRAM_ATTR touchISR(void)
+{
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(gTouchIRQ, &woken);
+
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+/*
+The controller pulls its interrupt line low for each new reading while it is
+touched, but not reliably when the finger lifts, so a touch with no reading
+for TOUCH_RELEASE_MS is read again to see whether it is still there. Only
+this task talks to the controller once it runs.
+*/
+static void touchTask(void *arg)
+{
+  bool touched = false;
+
+  while (true)
+  {
+    xSemaphoreTake(gTouchIRQ, touched ? pdMS_TO_TICKS(TOUCH_RELEASE_MS) : portMAX_DELAY);
+
+    int x = -1, y = -1;
+    bool now = halTouchRead(&x, &y) == 1;
+    if (!now && !touched)
+      continue;
+
+    touched = now;
+    gTouchReport(x, y, touched);
+    xSemaphoreGive(gInputReported);
+  }
+}
+
+// Created by whichever input task starts first
+static bool inputReportedInit(void)
+{
+  if (!gInputReported)
+    gInputReported = xSemaphoreCreateBinary();
+
+  return gInputReported != NULL;
+}
+
+int halTouchStart(void (*report)(int x, int y, int touched))
+{
+  gTouchIRQ = xSemaphoreCreateBinary();
+  if (!gTouchIRQ || !inputReportedInit())
+    return -1;
+
+  gTouchReport = report;
+  if (xTaskCreatePinnedToCore(touchTask, "touch", TOUCH_TASK_STACK_SIZE, NULL, TOUCH_TASK_PRIORITY, NULL, LCD_PUSH_CORE) != pdPASS)
+    return -1;
+
+  pinMode(PIN_TOUCH_INT, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(PIN_TOUCH_INT), touchISR, FALLING);
+
+  return 0;
+}
+
+static void IRAM_ATTR buttonISR(void)
+{
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(gButtonIRQ, &woken);
+
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+/*
+The contacts bounce for a few milliseconds at each press and release, so
+after an edge the pins are read only once BUTTON_DEBOUNCE_MS have passed
+without another. While a button is held the wait for the next edge ends
+when it has been held for gButtonHoldMs, to report that once.
+*/
+static void buttonTask(void *arg)
+{
+  int state[2] = {HAL_BUTTON_RELEASED, HAL_BUTTON_RELEASED};
+  uint32_t pressed[2] = {0, 0};
+
+  while (true)
+  {
+    TickType_t wait = portMAX_DELAY;
+    uint32_t now = millis();
+
+    for (int button = HAL_BUTTON_LEFT; button <= HAL_BUTTON_RIGHT; button++)
+    {
+      if (state[button] != HAL_BUTTON_PRESSED)
+        continue;
+
+      uint32_t held = now - pressed[button];
+      TickType_t left = pdMS_TO_TICKS(held >= gButtonHoldMs ? 0 : gButtonHoldMs - held);
+      wait = left < wait ? left : wait;
+    }
+
+    if (xSemaphoreTake(gButtonIRQ, wait) == pdTRUE)
+      while (xSemaphoreTake(gButtonIRQ, pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS)) == pdTRUE)
+        ;
+
+    now = millis();
+    bool reported = false;
+
+    for (int button = HAL_BUTTON_LEFT; button <= HAL_BUTTON_RIGHT; button++)
+    {
+      int next = state[button];
+
+      if (!halButton(button))
+        next = HAL_BUTTON_RELEASED;
+      else if (state[button] == HAL_BUTTON_RELEASED)
+      {
+        next = HAL_BUTTON_PRESSED;
+        pressed[button] = now;
+      }
+      else if (state[button] == HAL_BUTTON_PRESSED && now - pressed[button] >= gButtonHoldMs)
+        next = HAL_BUTTON_HELD;
+
+      if (next == state[button])
+        continue;
+
+      state[button] = next;
+      gButtonReport(button, next);
+      reported = true;
+    }
+
+    if (reported)
+      xSemaphoreGive(gInputReported);
+  }
+}
+
+int halButtonStart(void (*report)(int button, int state), uint32_t hold_ms)
+{
+  gButtonIRQ = xSemaphoreCreateBinary();
+  if (!gButtonIRQ || !inputReportedInit())
+    return -1;
+
+  gButtonReport = report;
+  gButtonHoldMs = hold_ms;
+  if (xTaskCreatePinnedToCore(buttonTask, "buttons", BUTTON_TASK_STACK_SIZE, NULL, BUTTON_TASK_PRIORITY, NULL, LCD_PUSH_CORE) != pdPASS)
+    return -1;
+
+  const int pins[2] = {PIN_LEFT_BUTTON, PIN_RIGHT_BUTTON};
+  for (int k = 0; k < 2; k++)
+  {
+    pinMode(pins[k], INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(pins[k]), buttonISR, CHANGE);
+  }
+
+  return 0;
+}
+
+// A binary semaphore, so a report made before the wait ends it at once;
+// with no input task running there is nothing to wait for but a tick
+void halInputWait(int ms)
+{
+  if (!gInputReported)
+  {
+    vTaskDelay(1);
+    return;
+  }
+
+  xSemaphoreTake(gInputReported, ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(ms));
+}
+
+void halInputPeek(void)
+{
+}
+
+int halCamInit(void)
+{
+  //Configuration for the SPI bus
+  spi_bus_config_t buscfg = {
+    .mosi_io_num = -1,
+    .miso_io_num = PIN_SPI_MISO,
+    .sclk_io_num = PIN_SPI_SCLK,
+    .quadwp_io_num = -1,
+    .quadhd_io_num = -1,
+    .max_transfer_sz = MAX_RX_SEGMENT_SIZE
+  };
+
+  //Configuration for the SPI device on the other side of the bus
+  spi_device_interface_config_t devcfg = {
+    .command_bits = 0,
+    .address_bits = 0,
+    .dummy_bits = 0,
+    .mode = 0,
+    .duty_cycle_pos = 0,    //50% duty cycle
+    .cs_ena_posttrans = 3,  //Keep the CS low 3 cycles after transaction, to stop slave from missing the last bit when CS has less propagation delay than CLK
+    .clock_speed_hz = SPI_MASTER_FREQ_10M, // SPI cannot operate above 10 MHz for ESP32
+    .spics_io_num = PIN_SPI_CS,
+    .queue_size = 1
+  };
+
+  pinMode(PIN_SPI_SCLK, OUTPUT);
+  pinMode(PIN_SPI_CS, OUTPUT);
+  // The ESP32-CAM drops the voltage on this pin when it wants to signal that it has a new image segment to deliver.
+  pinMode(PIN_CAM_SIGNAL, INPUT_PULLUP);
+
+  //Initialize the SPI bus and add the ESP32-Camera as a device
+  esp_err_t err = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
+  assert(err == ESP_OK);
+  err = spi_bus_add_device(SPI2_HOST, &devcfg, &gCamSPIHandle);
+  assert(err == ESP_OK);
+
+  return 0;
+}
+
+int halCamRead(RGB565 *buf)
+{
+  uint8_t *rx_buf = (uint8_t*)buf;
+  unsigned long start_time = millis();
+
+  for (int i = 0; i < CAM_NUM_IMAGE_SEGMENTS; i++)
+  {
+    spi_transaction_t t = {};
+    t.length = MAX_RX_SEGMENT_SIZE*8;//bit length
+    t.tx_buffer = NULL;
+    t.rx_buffer = rx_buf + i*MAX_RX_SEGMENT_SIZE;
+
+    while ((millis() - start_time < CAM_TIMEOUT_MS) && digitalRead(PIN_CAM_SIGNAL));
+
+    if (digitalRead(PIN_CAM_SIGNAL))
+      return -1;
+
+    esp_err_t err = spi_device_transmit(gCamSPIHandle, &t);
+    assert(err == ESP_OK);
+
+    TRACEEvent(TRACE_INSTANT, "CAM segment");
+  }
+
+  return 0;
+}
+
+int halLCDInit(void)
+{
+  gTFT.init();
+  gTFT.fillScreen(TFT_BLACK);
+
+  return 0;
+}
+
+void halLCDFill(RGB565 col)
+{
+  halLCDWait();
+  LCD_TARGET(fillScreen(col));
+}
+
+void halLCDPixel(int x, int y, RGB565 col)
+{
+  halLCDWait();
+  LCD_TARGET(drawPixel(x, y, col));
+}
+
+RGB565 halLCDReadPixel(int x, int y)
+{
+  halLCDWait();
+  return LCD_TARGET(readPixel(x, y));
+}
+
+void halLCDHLine(int x, int y, int w, RGB565 col)
+{
+  halLCDWait();
+  LCD_TARGET(drawFastHLine(x, y, w, col));
+}
+
+void halLCDVLine(int x, int y, int h, RGB565 col)
+{
+  halLCDWait();
+  LCD_TARGET(drawFastVLine(x, y, h, col));
+}
+
+void halLCDLine(int x1, int y1, int x2, int y2, RGB565 col)
+{
+  halLCDWait();
+  LCD_TARGET(drawLine(x1, y1, x2, y2, col));
+}
+
+void halLCDRect(int x, int y, int w, int h, RGB565 col, int fill)
+{
+  halLCDWait();
+  if (fill)
+    LCD_TARGET(fillRect(x, y, w, h, col));
+  else
+    LCD_TARGET(drawRect(x, y, w, h, col));
+}
+
+void halLCDCircle(int x, int y, int r, RGB565 col, int fill)
+{
+  halLCDWait();
+  if (fill)
+    LCD_TARGET(fillCircle(x, y, r, col));
+  else
+    LCD_TARGET(drawCircle(x, y, r, col));
+}
+
+// The sprite keeps its pixels big-endian, as the data already is
+void halLCDPushRect(int x, int y, int w, int h, const RGB565 *data)
+{
+  halLCDWait();
+  if (gLCDBuffered)
+    gSprite.pushImage(x, y, w, h, (uint16_t*)data);
+  else
+    gTFT.pushRect(x, y, w, h, (uint16_t*)data);
+}
+
+static void lcdPushTask(void *arg)
+{
+  for (;;)
+  {
+    halSemTake(pLCDPushStart);
+    gTFT.pushRect(gLCDPush.x, gLCDPush.y, gLCDPush.w, gLCDPush.h, (uint16_t*)gLCDPush.data);
+    halSemGive(pLCDPushDone);
+  }
+}
+
+/*
+The panel is on the 8-bit parallel bus, for which TFT_eSPI has no DMA
+transfers, so the block is pushed by a task on the other core instead,
+which frees the caller just the same. Every other drawing function waits
+for it first, as the bus takes one transfer at a time.
+*/
+void halLCDPushRectAsync(int x, int y, int w, int h, const RGB565 *data)
+{
+  halLCDWait();
+
+  // A block for the frame buffer is only a copy in memory
+  if (gLCDBuffered)
+  {
+    gSprite.pushImage(x, y, w, h, (uint16_t*)data);
+    return;
+  }
+
+  if (!pLCDPushStart)
+  {
+    pLCDPushStart = halSemCreate();
+    pLCDPushDone = halSemCreate();
+
+    if (!pLCDPushStart || !pLCDPushDone || halTaskCreate(lcdPushTask, NULL, LCD_PUSH_CORE, "LCDPush") != 0)
+    {
+      pLCDPushStart = NULL;
+      gTFT.pushRect(x, y, w, h, (uint16_t*)data);
+      return;
+    }
+  }
+
+  gLCDPush = {x, y, w, h, data};
+  gLCDPushPending = true;
+  halSemGive(pLCDPushStart);
+}
+
+void halLCDWait(void)
+{
+  if (!gLCDPushPending)
+    return;
+
+  halSemTake(pLCDPushDone);
+  gLCDPushPending = false;
+}
+
+// Sans and serif fonts are the 9 point free fonts, where TFT_eSPI has them loaded
+static void setFont(TFT_eSPI &tft, int font)
+{
+#ifdef LOAD_GFXFF
+  static const GFXfont *const faces[] = {NULL, NULL, &FreeSans9pt7b, &FreeSansBold9pt7b, &FreeSerif9pt7b, &FreeSerifBold9pt7b};
+
+  if (font >= 0 && font < (int)(sizeof(faces)/sizeof(faces[0])) && faces[font])
+  {
+    tft.setFreeFont(faces[font]);
+    return;
+  }
+#endif
+
+  tft.setTextFont(1);
+}
+
+/*
+The sprite is made on first use, as it takes 109 KB, and follows the text
+settings of the display. The cursor moves over between the two.
+*/
+int halLCDSetBuffered(int on)
+{
+  halLCDWait();
+
+  if (on && !gLCDBuffered)
+  {
+    if (!gSprite.created())
+    {
+      if (!gSprite.createSprite(LCD_WIDTH, LCD_HEIGHT))
+        return -1;
+
+      gSprite.setTextColor(gTextFg, gTextBg);
+      setFont(gSprite, gTextFont);
+      gSprite.setTextSize(gTextSize);
+    }
+
+    gSprite.fillSprite(TFT_BLACK);
+    gSprite.setCursor(gTFT.getCursorX(), gTFT.getCursorY());
+  }
+  else if (!on && gLCDBuffered)
+    gTFT.setCursor(gSprite.getCursorX(), gSprite.getCursorY());
+
+  gLCDBuffered = on;
+
+  return 0;
+}
+
+void halLCDFlush(int x, int y, int w, int h)
+{
+  if (!gLCDBuffered)
+    return;
+
+  halLCDWait();
+  gSprite.pushSprite(x, y, x, y, w, h);
+}
+
+void halLCDSetCursor(int x, int y)
+{
+  LCD_TARGET(setCursor(x, y));
+}
+
+void halLCDGetCursor(int *x, int *y)
+{
+  *x = LCD_TARGET(getCursorX());
+  *y = LCD_TARGET(getCursorY());
+}
+
+void halLCDSetTextColor(RGB565 fg, RGB565 bg)
+{
+  gTextFg = fg;
+  gTextBg = bg;
+  gTFT.setTextColor(fg, bg);
+  if (gSprite.created())
+    gSprite.setTextColor(fg, bg);
+}
+
+void halLCDSetTextFont(int font)
+{
+  gTextFont = font;
+  setFont(gTFT, font);
+  if (gSprite.created())
+    setFont(gSprite, font);
+}
+
+void halLCDSetTextSize(int size)
+{
+  gTextSize = size;
+  gTFT.setTextSize(size);
+  if (gSprite.created())
+    gSprite.setTextSize(size);
+}
+
+void halLCDPrint(const char *str)
+{
+  halLCDWait();
+  LCD_TARGET(print(str));
+}
+
+int halLCDFontHeight(void)
+{
+  return LCD_TARGET(fontHeight());
+}
+
+void halLCDGlyphSize(char c, int *w, int *h)
+{
+  const char str[2] = {c, 0};
+
+  *w = gTFT.textWidth(str);
+  *h = gTFT.fontHeight();
+}
+
+/*
+The glyph is drawn by TFT_eSPI into a sprite of its own cell, with the top
+left datum so that free fonts sit on their baseline within it. Bold GLCD
+glyphs are struck a second time one text pixel to the right.
+*/
+void halLCDGlyph(char c, uint8_t *mask)
+{
+  const char str[2] = {c, 0};
+  int w, h;
+
+  halLCDGlyphSize(c, &w, &h);
+  memset(mask, 0, w*h);
+
+  gGlyphSprite.setColorDepth(8);
+  if (!gGlyphSprite.createSprite(w, h))
+    return;
+
+  setFont(gGlyphSprite, gTextFont);
+  gGlyphSprite.setTextSize(gTextSize);
+  gGlyphSprite.setTextColor(TFT_WHITE, TFT_BLACK);
+  gGlyphSprite.setTextDatum(TL_DATUM);
+  gGlyphSprite.fillSprite(TFT_BLACK);
+  gGlyphSprite.drawString(str, 0, 0);
+
+  for (int y = 0; y < h; y++)
+  for (int x = 0; x < w; x++)
+    mask[y*w + x] = gGlyphSprite.readPixel(x, y) != TFT_BLACK;
+
+  gGlyphSprite.deleteSprite();
+
+  if (gTextFont == HAL_FONT_GLCD_BOLD)
+    for (int y = 0; y < h; y++)
+    for (int x = w - 1; x >= gTextSize; x--)
+      mask[y*w + x] |= mask[y*w + x - gTextSize];
+}
@@ -0,0 +1,705 @@
+/*
+Fiducial marker detection for the IPMarker*() functions.
+
+Markers are squares of 6x6 cells: a black border one cell wide around a
+4x4 grid of data bits, printed with at least one cell of white around them.
+Detection runs in four steps:
+
+1. The gray image is binarised with a local mean threshold, so dark
+   pixels stay dark under uneven lighting.
+2. The outer contours of the dark regions are traced, and each long enough
+   contour is tested for being a quadrilateral. The corners of each side are
+   refined by fitting a line through the side's contour points.
+3. The 6x6 cell grid is sampled from the gray image through the homography
+   of the unit square onto the quadrilateral.
+4. The 16 data bits are looked up in a hash table holding every rotation of
+   every dictionary code, along with all codes one bit error away.
+
+This file has no Arduino dependencies, so that it can be built and
+benchmarked on a host machine as well (see host/marker_bench.cpp).
+*/
+#include "eyebot.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// Cells across a marker, including its black border
+#define MARKER_CELLS 6
+// Data bits across a marker
+#define MARKER_BITS 4
+
+// The threshold window is IMAGE_WIDTH / MARKER_WINDOW_DIVISOR pixels in radius,
+// and a pixel must be this much darker than its window's mean to be dark.
+#define MARKER_WINDOW_DIVISOR 20
+#define MARKER_THRESHOLD_OFFSET 7
+
+// Smallest marker side in pixels, so that each cell is at least two pixels wide
+#define MARKER_MIN_SIDE 12
+// Minimum difference in gray value between the darkest and brightest cell
+#define MARKER_MIN_CONTRAST 30
+// Number of border cells allowed to be read as white
+#define MARKER_MAX_BORDER_ERRORS 2
+
+/*
+The dictionary was chosen greedily from pseudo-random 16-bit codes with
+between 5 and 11 white cells. Any two codes, in any of their rotations, and
+each code against its own rotations, differ in at least 4 bits, so a single
+bit error is corrected and two bit errors are never misread as another marker.
+Bit 15 is the top left data cell, read row by row, and a set bit is a white cell.
+*/
+static const u16 pMarkerCodes[IP_MARKER_COUNT] = {
+  0xC67E, 0x7EB0, 0x81E4, 0x6B9B, 0xFB74, 0x54BC, 0xF6D5, 0x1CF0,
+  0x87EB, 0x01DD, 0x319A, 0xDECD, 0x5678, 0x7284, 0x4797, 0x66F4,
+  0x3C24, 0xEA48, 0x133C, 0xD2DE, 0xD8BD, 0x5536, 0x37AD, 0xAE88,
+  0x652F, 0x98A6, 0x761E, 0x5F06, 0x3615, 0x4D4C, 0xE4F9, 0xDC69
+};
+
+/*
+Open addressing hash table from codes as read to dictionary entries. Each
+entry holds the code in its upper 16 bits, and the marker ID, number of
+corrected bits and rotation as (id << 3) | (errors << 2) | rotation in its
+lower 16 bits. There are IP_MARKER_COUNT * 4 * 17 entries, keeping the table
+just over half full.
+*/
+#define MARKER_HASH_BITS 12
+#define MARKER_HASH_SIZE (1 << MARKER_HASH_BITS)
+#define MARKER_HASH_EMPTY 0xFFFFFFFF
+static u32 pMarkerHash[MARKER_HASH_SIZE];
+static bool gMarkerHashBuilt = false;
+
+// Working buffers of the current call, taken from the arena where it has room
+static BYTE *pMarkerBin = NULL;// Binary image with a one pixel border of background
+static u16 *pMarkerColSums = NULL;
+static short *pMarkerContour = NULL;// x, y pairs
+static int gMarkerBinSize = 0;
+// Heap buffers in place of the arena's, grown to fit the largest image seen so far
+static BYTE *pMarkerHeapBin = NULL;
+static u16 *pMarkerHeapColSums = NULL;
+static short *pMarkerHeapContour = NULL;
+static int gMarkerHeapBinSize = 0, gMarkerHeapColSumsSize = 0, gMarkerHeapContourSize = 0;
+
+// Offsets of the eight neighbours in the padded binary image, clockwise from east
+static int pMarkerNeighbours[8];
+static const int pMarkerDX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int pMarkerDY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+// Rotate a 4x4 bit grid by 90 degrees clockwise
+static u16 markerRotate(u16 code)
+{
+  u16 rotated = 0;
+
+  for (int row = 0; row < MARKER_BITS; row++)
+  for (int column = 0; column < MARKER_BITS; column++)
+  {
+    int bit = (code >> (15 - ((MARKER_BITS - 1 - column)*MARKER_BITS + row))) & 1;
+    rotated |= bit << (15 - (row*MARKER_BITS + column));
+  }
+
+  return rotated;
+}
+
+static inline u32 markerHash(u16 code)
+{
+  return ((u32)code * 2654435761u) >> (32 - MARKER_HASH_BITS);
+}
+
+static void markerHashInsert(u16 code, u16 value)
+{
+  u32 i = markerHash(code);
+
+  while (pMarkerHash[i] != MARKER_HASH_EMPTY)
+    i = (i + 1) & (MARKER_HASH_SIZE - 1);
+
+  pMarkerHash[i] = ((u32)code << 16) | value;
+}
+
+static void markerHashBuild()
+{
+  memset(pMarkerHash, 0xFF, sizeof(pMarkerHash));
+
+  for (int id = 0; id < IP_MARKER_COUNT; id++)
+  {
+    u16 code = pMarkerCodes[id];
+
+    for (int rotation = 0; rotation < 4; rotation++)
+    {
+      markerHashInsert(code, (id << 3) | rotation);
+
+      for (int bit = 0; bit < 16; bit++)
+        markerHashInsert(code ^ (1 << bit), (id << 3) | (1 << 2) | rotation);
+
+      code = markerRotate(code);
+    }
+  }
+
+  gMarkerHashBuilt = true;
+}
+
+// Returns the entry value for a code, or -1 if it isn't in the dictionary
+static int markerHashFind(u16 code)
+{
+  u32 i = markerHash(code);
+
+  while (pMarkerHash[i] != MARKER_HASH_EMPTY)
+  {
+    if ((pMarkerHash[i] >> 16) == code)
+      return pMarkerHash[i] & 0xFFFF;
+
+    i = (i + 1) & (MARKER_HASH_SIZE - 1);
+  }
+
+  return -1;
+}
+
+static bool markerGrow(void **buf, int *size, int needed, int elementSize)
+{
+  if (*size >= needed)
+    return true;
+
+  void *grown = realloc(*buf, (size_t)needed * elementSize);
+  if (!grown)
+    return false;
+
+  *buf = grown;
+  *size = needed;
+  return true;
+}
+
+/*
+The buffers come from the arena when all three fit, so a program that
+resets it every frame needs no memory of the detector's beyond that, and
+otherwise from the heap buffers, which are kept.
+*/
+static bool markerBuffers(int binSize, int colSums, int contour)
+{
+  gMarkerBinSize = binSize;
+
+  pMarkerBin = (BYTE*)ARENAAlloc(binSize, ARENA_SRAM);
+  pMarkerColSums = (u16*)ARENAAlloc(colSums*sizeof(u16), ARENA_SRAM);
+  pMarkerContour = (short*)ARENAAlloc(contour*sizeof(short), ARENA_SRAM);
+  if (pMarkerBin && pMarkerColSums && pMarkerContour)
+    return true;
+
+  if (!markerGrow((void**)&pMarkerHeapBin, &gMarkerHeapBinSize, binSize, sizeof(BYTE)) ||
+      !markerGrow((void**)&pMarkerHeapColSums, &gMarkerHeapColSumsSize, colSums, sizeof(u16)) ||
+      !markerGrow((void**)&pMarkerHeapContour, &gMarkerHeapContourSize, contour, sizeof(short)))
+    return false;
+
+  pMarkerBin = pMarkerHeapBin;
+  pMarkerColSums = pMarkerHeapColSums;
+  pMarkerContour = pMarkerHeapContour;
+  return true;
+}
+
+/*
+Binarises gray into pMarkerBin, with dark pixels set to 1. Like
+IPThresholdAdaptive(), the box sums are kept as running column sums that
+are slid down the image one row at a time.
+*/
+static void markerThreshold(BYTE *gray, int xs, int ys, int radius)
+{
+  int stride = xs + 2;
+
+  memset(pMarkerBin, 0, (size_t)stride*(ys + 2));
+
+  for (int x = 0; x < xs; x++)
+  {
+    int sum = 0;
+    for (int y = 0; y <= MIN(radius, ys - 1); y++)
+      sum += gray[y*xs + x];
+    pMarkerColSums[x] = sum;
+  }
+
+  for (int y = 0; y < ys; y++)
+  {
+    int y1 = MAX(y - radius, 0), y2 = MIN(y + radius, ys - 1);
+    int rows = y2 - y1 + 1;
+
+    // Box sum of the first window of the row
+    int sum = 0;
+    for (int x = 0; x <= MIN(radius, xs - 1); x++)
+      sum += pMarkerColSums[x];
+
+    BYTE *in = gray + y*xs;
+    BYTE *out = pMarkerBin + (y + 1)*stride + 1;
+
+    for (int x = 0; x < xs; x++)
+    {
+      int x1 = MAX(x - radius, 0), x2 = MIN(x + radius, xs - 1);
+      int area = (x2 - x1 + 1)*rows;
+
+      out[x] = (in[x] + MARKER_THRESHOLD_OFFSET)*area <= sum;
+
+      if (x + radius + 1 < xs)
+        sum += pMarkerColSums[x + radius + 1];
+      if (x - radius >= 0)
+        sum -= pMarkerColSums[x - radius];
+    }
+
+    // Slide the column sums down to the next row
+    if (y + radius + 1 < ys)
+    {
+      BYTE *add = gray + (y + radius + 1)*xs;
+      for (int x = 0; x < xs; x++)
+        pMarkerColSums[x] += add[x];
+    }
+    if (y - radius >= 0)
+    {
+      BYTE *sub = gray + (y - radius)*xs;
+      for (int x = 0; x < xs; x++)
+        pMarkerColSums[x] -= sub[x];
+    }
+  }
+}
+
+/*
+Traces the contour starting at pixel start of pMarkerBin, whose west
+neighbour is background, with Moore neighbour tracing. Every contour pixel
+is marked as visited (2), and up to maxPoints points are stored in
+pMarkerContour. Returns the contour length, which may exceed maxPoints.
+*/
+static int markerTrace(int start, int stride, int maxPoints)
+{
+  int p = start;
+  int back = 4;// Direction of the last background pixel checked, initially west
+  int first = -1;
+  int length = 0;
+
+  for (;;)
+  {
+    if (length < maxPoints)
+    {
+      pMarkerContour[2*length] = p % stride - 1;
+      pMarkerContour[2*length + 1] = p / stride - 1;
+    }
+    length++;
+    pMarkerBin[p] = 2;
+
+    // Guards against tracing forever, as no contour can be this long
+    if (length > gMarkerBinSize)
+      return length;
+
+    // Search clockwise from the pixel after the last background pixel
+    int dir = -1;
+    for (int i = 1; i <= 8; i++)
+    {
+      int d = (back + i) & 7;
+      if (pMarkerBin[p + pMarkerNeighbours[d]])
+      {
+        dir = d;
+        break;
+      }
+    }
+
+    // Isolated pixel
+    if (dir < 0)
+      return length;
+
+    // Back at the start and about to repeat the first step
+    if (p == start && dir == first)
+      return length - 1;
+
+    if (first < 0)
+      first = dir;
+
+    p += pMarkerNeighbours[dir];
+    // The background pixel checked before dir, seen from the new pixel
+    back = (dir + 6 - (dir & 1)) & 7;
+  }
+}
+
+// Index of the contour point furthest from (x, y), searching count points from first
+static int markerFurthest(int n, int first, int count, float x, float y)
+{
+  int best = first;
+  float bestDist = -1;
+
+  for (int k = 0; k < count; k++)
+  {
+    int i = (first + k) % n;
+    float dx = pMarkerContour[2*i] - x, dy = pMarkerContour[2*i + 1] - y;
+    float dist = dx*dx + dy*dy;
+    if (dist > bestDist)
+    {
+      bestDist = dist;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+// Index of the contour point furthest from the line a-b, searching from a to b
+static int markerFurthestFromLine(int n, int a, int b, float *distance)
+{
+  float ax = pMarkerContour[2*a], ay = pMarkerContour[2*a + 1];
+  float nx = ay - pMarkerContour[2*b + 1], ny = pMarkerContour[2*b] - ax;
+  float len = sqrtf(nx*nx + ny*ny);
+  int count = (b - a + n) % n;
+  int best = a;
+  float bestDist = -1;
+
+  for (int k = 1; k < count; k++)
+  {
+    int i = (a + k) % n;
+    float dist = fabsf((pMarkerContour[2*i] - ax)*nx + (pMarkerContour[2*i + 1] - ay)*ny);
+    if (dist > bestDist)
+    {
+      bestDist = dist;
+      best = i;
+    }
+  }
+
+  *distance = len > 0 ? bestDist / len : 0;
+  return best;
+}
+
+/*
+Fits a line through the contour points from corner a to corner b, leaving
+out the points near either corner. The line is returned as a point and a
+unit direction. Returns false if the points don't lie close to a line.
+*/
+static bool markerFitSide(int n, int a, int b, float *px, float *py, float *dx, float *dy)
+{
+  int count = (b - a + n) % n;
+  int trim = count / 8;
+  float sx = 0, sy = 0;
+  int used = 0;
+
+  for (int k = trim; k <= count - trim; k++)
+  {
+    int i = (a + k) % n;
+    sx += pMarkerContour[2*i];
+    sy += pMarkerContour[2*i + 1];
+    used++;
+  }
+  if (used < 2)
+    return false;
+
+  float mx = sx / used, my = sy / used;
+  float sxx = 0, sxy = 0, syy = 0;
+
+  for (int k = trim; k <= count - trim; k++)
+  {
+    int i = (a + k) % n;
+    float ex = pMarkerContour[2*i] - mx, ey = pMarkerContour[2*i + 1] - my;
+    sxx += ex*ex;
+    sxy += ex*ey;
+    syy += ey*ey;
+  }
+
+  // Principal axis of the points
+  float angle = 0.5f*atan2f(2*sxy, sxx - syy);
+  float ux = cosf(angle), uy = sinf(angle);
+
+  // The whole side, corners included, must be close to the line
+  float tolerance = MAX(1.5f, 0.06f*count);
+  for (int k = 0; k <= count; k++)
+  {
+    int i = (a + k) % n;
+    float dist = fabsf((pMarkerContour[2*i] - mx)*uy - (pMarkerContour[2*i + 1] - my)*ux);
+    if (dist > tolerance)
+      return false;
+  }
+
+  // Point the line from a to b
+  if (ux*(pMarkerContour[2*b] - pMarkerContour[2*a]) + uy*(pMarkerContour[2*b + 1] - pMarkerContour[2*a + 1]) < 0)
+  {
+    ux = -ux;
+    uy = -uy;
+  }
+
+  // The contour runs through the centres of the outermost dark pixels, so the
+  // edge itself lies half a pixel further out, to the left of the clockwise contour
+  *px = mx + 0.5f*uy;
+  *py = my - 0.5f*ux;
+  *dx = ux;
+  *dy = uy;
+  return true;
+}
+
+/*
+Finds the four corners of a contour of n points, clockwise in the image.
+The first corner is the furthest point from an arbitrary point, the
+opposite corner is the furthest point from the first, and the remaining
+two are the furthest points from the diagonal on either side of it.
+*/
+static bool markerQuad(int n, float *x, float *y)
+{
+  int a = markerFurthest(n, 0, n, pMarkerContour[0], pMarkerContour[1]);
+  int c = markerFurthest(n, 0, n, pMarkerContour[2*a], pMarkerContour[2*a + 1]);
+  float distB, distD;
+  int b = markerFurthestFromLine(n, a, c, &distB);
+  int d = markerFurthestFromLine(n, c, a, &distD);
+
+  if (distB < MARKER_MIN_SIDE / 2 || distD < MARKER_MIN_SIDE / 2)
+    return false;
+
+  int corners[4] = {a, b, c, d};
+  float px[4], py[4], dx[4], dy[4];
+
+  for (int k = 0; k < 4; k++)
+  {
+    int from = corners[k], to = corners[(k + 1) & 3];
+    float sx = pMarkerContour[2*to] - pMarkerContour[2*from];
+    float sy = pMarkerContour[2*to + 1] - pMarkerContour[2*from + 1];
+    if (sx*sx + sy*sy < MARKER_MIN_SIDE*MARKER_MIN_SIDE)
+      return false;
+
+    if (!markerFitSide(n, from, to, &px[k], &py[k], &dx[k], &dy[k]))
+      return false;
+  }
+
+  // Each corner is where its two sides' lines meet
+  for (int k = 0; k < 4; k++)
+  {
+    int prev = (k + 3) & 3;
+    float det = dx[prev]*dy[k] - dy[prev]*dx[k];
+
+    if (fabsf(det) < 0.1f)
+    {
+      x[k] = pMarkerContour[2*corners[k]];
+      y[k] = pMarkerContour[2*corners[k] + 1];
+      continue;
+    }
+
+    float t = ((px[k] - px[prev])*dy[k] - (py[k] - py[prev])*dx[k]) / det;
+    x[k] = px[prev] + t*dx[prev];
+    y[k] = py[prev] + t*dy[prev];
+  }
+
+  return true;
+}
+
+/*
+Samples the cell grid of the quadrilateral and looks it up in the
+dictionary. The projective mapping of the unit square onto the
+quadrilateral follows Heckbert, "Fundamentals of Texture Mapping and
+Image Warping" (1989).
+*/
+static int markerDecode(BYTE *gray, int xs, int ys, float *x, float *y, int *rotation, int *errors)
+{
+  float dx1 = x[1] - x[2], dx2 = x[3] - x[2], dx3 = x[0] - x[1] + x[2] - x[3];
+  float dy1 = y[1] - y[2], dy2 = y[3] - y[2], dy3 = y[0] - y[1] + y[2] - y[3];
+  float det = dx1*dy2 - dx2*dy1;
+
+  if (fabsf(det) < 1e-6f)
+    return -1;
+
+  float g = (dx3*dy2 - dx2*dy3) / det;
+  float h = (dx1*dy3 - dx3*dy1) / det;
+  float a = x[1] - x[0] + g*x[1], b = x[3] - x[0] + h*x[3], c = x[0];
+  float d = y[1] - y[0] + g*y[1], e = y[3] - y[0] + h*y[3], f = y[0];
+
+  int cells[MARKER_CELLS*MARKER_CELLS];
+  int lo = 255*4, hi = 0;
+
+  for (int row = 0; row < MARKER_CELLS; row++)
+  for (int column = 0; column < MARKER_CELLS; column++)
+  {
+    // Four samples around the centre of the cell
+    int sum = 0;
+    for (int s = 0; s < 4; s++)
+    {
+      float u = (column + 0.3f + 0.4f*(s & 1)) / MARKER_CELLS;
+      float v = (row + 0.3f + 0.4f*(s >> 1)) / MARKER_CELLS;
+      float w = g*u + h*v + 1;
+      int sx = (int)((a*u + b*v + c) / w + 0.5f);
+      int sy = (int)((d*u + e*v + f) / w + 0.5f);
+
+      if (sx < 0 || sx >= xs || sy < 0 || sy >= ys)
+        return -1;
+      sum += gray[sy*xs + sx];
+    }
+
+    cells[row*MARKER_CELLS + column] = sum;
+    lo = MIN(lo, sum);
+    hi = MAX(hi, sum);
+  }
+
+  if (hi - lo < 4*MARKER_MIN_CONTRAST)
+    return -1;
+
+  int threshold = (lo + hi) / 2;
+  int borderErrors = 0;
+  u16 code = 0;
+
+  for (int row = 0; row < MARKER_CELLS; row++)
+  for (int column = 0; column < MARKER_CELLS; column++)
+  {
+    bool white = cells[row*MARKER_CELLS + column] > threshold;
+
+    if (row == 0 || column == 0 || row == MARKER_CELLS - 1 || column == MARKER_CELLS - 1)
+      borderErrors += white;
+    else
+      code = (code << 1) | white;
+  }
+
+  if (borderErrors > MARKER_MAX_BORDER_ERRORS)
+    return -1;
+
+  int entry = markerHashFind(code);
+  if (entry < 0)
+    return -1;
+
+  *rotation = entry & 3;
+  *errors = (entry >> 2) & 1;
+  return entry >> 3;
+}
+
+static float markerArea(const float *x, const float *y)
+{
+  return 0.5f*fabsf((x[2] - x[0])*(y[3] - y[1]) - (x[3] - x[1])*(y[2] - y[0]));
+}
+
+// Index of a marker whose bounding box holds the centre of the quad or the other way round, or -1
+static int markerOverlapping(IPMarker *markers, int count, const float *x, const float *y)
+{
+  float cx = (x[0] + x[1] + x[2] + x[3]) / 4, cy = (y[0] + y[1] + y[2] + y[3]) / 4;
+  float x1 = MIN(MIN(x[0], x[1]), MIN(x[2], x[3])), x2 = MAX(MAX(x[0], x[1]), MAX(x[2], x[3]));
+  float y1 = MIN(MIN(y[0], y[1]), MIN(y[2], y[3])), y2 = MAX(MAX(y[0], y[1]), MAX(y[2], y[3]));
+
+  for (int i = 0; i < count; i++)
+  {
+    const float *mx = markers[i].x, *my = markers[i].y;
+    float mcx = (mx[0] + mx[1] + mx[2] + mx[3]) / 4, mcy = (my[0] + my[1] + my[2] + my[3]) / 4;
+
+    if (mcx >= x1 && mcx <= x2 && mcy >= y1 && mcy <= y2)
+      return i;
+
+    if (cx >= MIN(MIN(mx[0], mx[1]), MIN(mx[2], mx[3])) && cx <= MAX(MAX(mx[0], mx[1]), MAX(mx[2], mx[3])) &&
+        cy >= MIN(MIN(my[0], my[1]), MIN(my[2], my[3])) && cy <= MAX(MAX(my[0], my[1]), MAX(my[2], my[3])))
+      return i;
+  }
+
+  return -1;
+}
+
+int IPMarkerDetect(BYTE* gray, int xs, int ys, IPMarker* markers, int maxMarkers)
+{
+  if (!gray || !markers || xs < MARKER_MIN_SIDE || ys < MARKER_MIN_SIDE || maxMarkers < 0)
+    return -1;
+
+  int stride = xs + 2;
+  int maxPoints = 4*(xs + ys);
+
+  if (!markerBuffers(stride*(ys + 2), xs, 2*maxPoints))
+    return -1;
+
+  if (!gMarkerHashBuilt)
+    markerHashBuild();
+
+  for (int d = 0; d < 8; d++)
+    pMarkerNeighbours[d] = pMarkerDY[d]*stride + pMarkerDX[d];
+
+  // The radius is capped so the column sums fit in 16 bits
+  markerThreshold(gray, xs, ys, MIN(MAX(xs / MARKER_WINDOW_DIVISOR, 1), 127));
+
+  int count = 0;
+
+  for (int y = 1; y <= ys; y++)
+  {
+    BYTE *row = pMarkerBin + y*stride;
+
+    for (int x = 1; x <= xs; x++)
+    {
+      // Only unvisited dark pixels with background to their west start a contour
+      if (row[x] != 1 || row[x - 1])
+        continue;
+
+      int n = markerTrace(y*stride + x, stride, maxPoints);
+      if (n < 4*MARKER_MIN_SIDE || n > maxPoints)
+        continue;
+
+      // Outer contours are traced clockwise, holes anticlockwise
+      long area = 0;
+      for (int i = 0, j = n - 1; i < n; j = i++)
+        area += (long)pMarkerContour[2*j]*pMarkerContour[2*i + 1] - (long)pMarkerContour[2*i]*pMarkerContour[2*j + 1];
+      if (area <= 0)
+        continue;
+
+      float qx[4], qy[4];
+      if (!markerQuad(n, qx, qy))
+        continue;
+
+      // Quads cut off by the edge of the image can't be complete markers
+      bool inside = true;
+      for (int k = 0; k < 4; k++)
+        inside &= qx[k] >= 1 && qx[k] <= xs - 2 && qy[k] >= 1 && qy[k] <= ys - 2;
+      if (!inside)
+        continue;
+
+      int rotation, errors;
+      int id = markerDecode(gray, xs, ys, qx, qy, &rotation, &errors);
+      if (id < 0)
+        continue;
+
+      /*
+      Markers can't overlap, so where two quads do, such as a marker and the
+      dark outline of the paper around it, the one needing fewer corrected
+      bits is kept, and otherwise the smaller one.
+      */
+      IPMarker *marker;
+      int other = markerOverlapping(markers, count, qx, qy);
+      if (other >= 0)
+      {
+        if (errors > markers[other].errors ||
+            (errors == markers[other].errors && markerArea(qx, qy) >= markerArea(markers[other].x, markers[other].y)))
+          continue;
+        marker = &markers[other];
+      }
+      else if (count < maxMarkers)
+        marker = &markers[count++];
+      else
+        continue;
+
+      marker->id = id;
+      marker->errors = errors;
+
+      // Rotate the corners so the first is the marker's top left
+      for (int k = 0; k < 4; k++)
+      {
+        marker->x[k] = qx[(k + rotation) & 3];
+        marker->y[k] = qy[(k + rotation) & 3];
+      }
+    }
+  }
+
+  return count;
+}
+
+int IPMarkerDraw(int id, BYTE* gray, int size)
+{
+  if (id < 0 || id >= IP_MARKER_COUNT || !gray || size < MARKER_CELLS + 2)
+    return -1;
+
+  // One cell of white is left around the marker
+  const int cells = MARKER_CELLS + 2;
+
+  for (int y = 0; y < size; y++)
+  for (int x = 0; x < size; x++)
+  {
+    int row = y*cells / size - 1, column = x*cells / size - 1;
+    BYTE value;
+
+    if (row < 0 || column < 0 || row >= MARKER_CELLS || column >= MARKER_CELLS)
+      value = 255;
+    else if (row == 0 || column == 0 || row == MARKER_CELLS - 1 || column == MARKER_CELLS - 1)
+      value = 0;
+    else
+    {
+      int bit = 15 - ((row - 1)*MARKER_BITS + column - 1);
+      value = (pMarkerCodes[id] >> bit) & 1 ? 255 : 0;
+    }
+
+    gray[y*size + x] = value;
+  }
+
+  return 0;
+}
@@ -0,0 +1,751 @@
+/*
+Int8 neural network inference for the NN*() functions.
+
+A network is a chain of layers, each reading the tensor written by the
+previous one. Tensors are int8 in height x width x channels order, and every
+tensor shares the same zero point of 0, so zero padding and ReLU need no
+offsets. Camera pixels enter the network as value - 128.
+
+Network file layout, as defined by NNHeader and NNLayer in eyebot.h:
+
+  NNHeader                      16 bytes
+  NNLayer[layerCount]           20 bytes each
+  weights and biases            at the offsets given by each layer
+
+The file is used in place, so it can be a const array in flash, a memory
+mapped data partition or a file read into memory. Weights should be 16 byte
+aligned within an aligned file for the vectorised kernels to be used.
+
+  Layer          Weights                              Biases
+  NN_CONV2D      [channels][kernel][kernel][in]       [channels]
+  NN_DEPTHWISE   [kernel][kernel][in]                 [in]
+  NN_DENSE       [channels][in height*width*in]       [channels]
+
+Pooling and ReLU layers have no weights. Each weighted layer sums its
+products and bias into an int32 accumulator, which is requantised as
+
+  out = clamp((acc * multiplier + (1 << (shift - 1))) >> shift)
+
+to [-128, 127], or [0, 127] with the relu flag set. Average pooling rounds
+half away from zero.
+
+On the ESP32-S3, dot products over multiples of 16 aligned bytes use the
+PIE vector instructions, once the first NNLoad() has checked them against
+portable C, and everywhere else portable C. NNRunReference()
+always uses plain nested loops, and must give bit-exact results to NNRun().
+
+Like eyebot_marker.cpp this file has no Arduino dependencies, so that it can
+be tested on a host machine (see host/nn_test.cpp).
+*/
+#include "eyebot.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+#define NN_SIMD 1
+#else
+#define NN_SIMD 0
+#endif
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define NN_ALIGN 16
+#define NN_ALIGN_UP(n) (((n) + NN_ALIGN - 1) & ~(NN_ALIGN - 1))
+
+static_assert(sizeof(NNHeader) == 16, "NNHeader must match the file layout");
+static_assert(sizeof(NNLayer) == 20, "NNLayer must match the file layout");
+
+// Input formats of nnInput()
+enum {
+  NN_INPUT_GRAY,
+  NN_INPUT_COLOR,
+  NN_INPUT_RGB565
+};
+
+struct NNShape
+{
+  int width, height, channels;
+};
+
+// 1 once the vector kernel has passed nnSIMDCheck() on the first NNLoad(), 0 if it failed, -1 before
+static int gNNSIMD = -1;
+static int nnSIMDCheck(void);
+
+static uint32_t nnMicros()
+{
+#ifdef ESP_PLATFORM
+  return (uint32_t)esp_timer_get_time();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)(now.tv_sec*1000000ull + now.tv_nsec / 1000);
+#endif
+}
+
+static inline int8_t nnRequantise(int32_t acc, const NNLayer *layer)
+{
+  int64_t value = (int64_t)acc*layer->multiplier;
+  if (layer->shift > 0)
+    value = (value + ((int64_t)1 << (layer->shift - 1))) >> layer->shift;
+
+  int lo = layer->relu ? 0 : -128;
+  return value < lo ? lo : value > 127 ? 127 : value;
+}
+
+// Output shape of a layer, or false if the layer doesn't fit its input
+static bool nnOutputShape(const NNLayer *layer, NNShape in, NNShape *out)
+{
+  switch (layer->type)
+  {
+    case NN_CONV2D:
+    case NN_DEPTHWISE:
+    case NN_MAXPOOL:
+    case NN_AVGPOOL:
+    {
+      int k = layer->kernel, s = layer->stride, p = layer->padding;
+      if (k == 0 || s == 0 || p >= k || in.width + 2*p < k || in.height + 2*p < k)
+        return false;
+
+      out->width = (in.width + 2*p - k) / s + 1;
+      out->height = (in.height + 2*p - k) / s + 1;
+      out->channels = layer->type == NN_CONV2D ? layer->channels : in.channels;
+      return out->channels > 0;
+    }
+    case NN_RELU:
+    {
+      *out = in;
+      return true;
+    }
+    case NN_DENSE:
+    {
+      out->width = 1;
+      out->height = 1;
+      out->channels = layer->channels;
+      return out->channels > 0;
+    }
+    default:
+      return false;
+  }
+}
+
+// Bytes of weights of a layer
+static uint64_t nnWeightSize(const NNLayer *layer, NNShape in)
+{
+  uint64_t k = layer->kernel;
+
+  switch (layer->type)
+  {
+    case NN_CONV2D: return (uint64_t)layer->channels*k*k*in.channels;
+    case NN_DEPTHWISE: return k*k*in.channels;
+    case NN_DENSE: return (uint64_t)layer->channels*in.width*in.height*in.channels;
+    default: return 0;
+  }
+}
+
+static int nnBiasCount(const NNLayer *layer, NNShape in)
+{
+  switch (layer->type)
+  {
+    case NN_CONV2D:
+    case NN_DENSE: return layer->channels;
+    case NN_DEPTHWISE: return in.channels;
+    default: return 0;
+  }
+}
+
+static void *nnAlloc(size_t size)
+{
+#ifdef ESP_PLATFORM
+  void *buf = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (buf)
+    return buf;
+#endif
+  return malloc(size);
+}
+
+int NNLoad(NNModel* model, const BYTE* data, int size)
+{
+  if (!model || !data || size < (int)sizeof(NNHeader))
+    return -1;
+
+  memset(model, 0, sizeof(NNModel));
+
+  if (gNNSIMD < 0)
+    gNNSIMD = nnSIMDCheck();
+  model->simd = gNNSIMD;
+
+  const NNHeader *header = (const NNHeader*)data;
+  if (memcmp(header->magic, "EBNN", 4) != 0 || header->version != NN_VERSION ||
+      header->layerCount > NN_MAX_LAYERS ||
+      sizeof(NNHeader) + header->layerCount*sizeof(NNLayer) > (size_t)size)
+    return -1;
+
+  const NNLayer *layers = (const NNLayer*)(data + sizeof(NNHeader));
+  NNShape shape = {header->width, header->height, header->channels};
+  if (shape.width == 0 || shape.height == 0 || shape.channels == 0)
+    return -1;
+
+  size_t inputSize = (size_t)shape.width*shape.height*shape.channels;
+  size_t bufferSize = 0;
+  int maxChannels = shape.channels;
+
+  // Check every layer fits its input and the file, and size the buffers
+  for (int i = 0; i < header->layerCount; i++)
+  {
+    const NNLayer *layer = &layers[i];
+    NNShape out;
+
+    if (!nnOutputShape(layer, shape, &out))
+      return -1;
+
+    uint64_t weights = nnWeightSize(layer, shape);
+    uint64_t biases = nnBiasCount(layer, shape)*sizeof(int32_t);
+    if ((weights && (uint64_t)layer->weights + weights > (uint64_t)size) ||
+        (biases && ((uint64_t)layer->bias + biases > (uint64_t)size || layer->bias % sizeof(int32_t))) ||
+        layer->shift > 62)
+      return -1;
+
+    shape = out;
+    bufferSize = MAX(bufferSize, (size_t)out.width*out.height*out.channels);
+    maxChannels = MAX(maxChannels, out.channels);
+  }
+
+  inputSize = NN_ALIGN_UP(inputSize);
+  bufferSize = NN_ALIGN_UP(bufferSize);
+
+  model->arena = nnAlloc(NN_ALIGN + inputSize + 2*bufferSize + maxChannels*sizeof(int32_t));
+  if (!model->arena)
+    return -1;
+
+  BYTE *arena = (BYTE*)NN_ALIGN_UP((uintptr_t)model->arena);
+  model->input = (int8_t*)arena;
+  model->buffers[0] = (int8_t*)(arena + inputSize);
+  model->buffers[1] = (int8_t*)(arena + inputSize + bufferSize);
+  model->scratch = (int32_t*)(arena + inputSize + 2*bufferSize);
+
+  model->header = header;
+  model->layers = layers;
+  model->width = header->width;
+  model->height = header->height;
+  model->channels = header->channels;
+  model->outWidth = shape.width;
+  model->outHeight = shape.height;
+  model->outChannels = shape.channels;
+  model->output = NULL;
+
+  return 0;
+}
+
+int NNRelease(NNModel* model)
+{
+  if (!model)
+    return -1;
+
+  free(model->arena);
+  memset(model, 0, sizeof(NNModel));
+  return 0;
+}
+
+/*
+Each input pixel is the average of the block of image pixels it covers, or
+the nearest image pixel where the input is larger than the image. Colour
+pixels are averaged to gray the same way CAMGetGray() does.
+*/
+static int nnInput(NNModel *model, const void *img, int format, int xs, int ys)
+{
+  if (!model || !model->input || !img || xs <= 0 || ys <= 0)
+    return -1;
+
+  int w = model->width, h = model->height, c = model->channels;
+
+  for (int y = 0; y < h; y++)
+  {
+    int y1 = y*ys / h, y2 = MAX((y + 1)*ys / h, y1 + 1);
+
+    for (int x = 0; x < w; x++)
+    {
+      int x1 = x*xs / w, x2 = MAX((x + 1)*xs / w, x1 + 1);
+      int sum[3] = {0, 0, 0};
+
+      for (int iy = y1; iy < y2; iy++)
+      for (int ix = x1; ix < x2; ix++)
+      {
+        int i = iy*xs + ix;
+
+        switch (format)
+        {
+          case NN_INPUT_GRAY:
+          {
+            int v = ((const BYTE*)img)[i];
+            sum[0] += v;
+            sum[1] += v;
+            sum[2] += v;
+            break;
+          }
+          case NN_INPUT_COLOR:
+          {
+            COLOR col = ((const COLOR*)img)[i];
+            sum[0] += (col >> 16) & 0xFF;
+            sum[1] += (col >> 8) & 0xFF;
+            sum[2] += col & 0xFF;
+            break;
+          }
+          case NN_INPUT_RGB565:
+          {
+            uint16_t col = ((const uint16_t*)img)[i];
+            int r = (col >> 11) & 0x1F, g = (col >> 5) & 0x3F, b = col & 0x1F;
+            sum[0] += (r << 3) | (r >> 2);
+            sum[1] += (g << 2) | (g >> 4);
+            sum[2] += (b << 3) | (b >> 2);
+            break;
+          }
+        }
+      }
+
+      int n = (y2 - y1)*(x2 - x1);
+      int8_t *out = model->input + (y*w + x)*c;
+
+      if (c == 3)
+      {
+        for (int ch = 0; ch < 3; ch++)
+          out[ch] = sum[ch] / n - 128;
+      }
+      else
+      {
+        int gray = (sum[0] + sum[1] + sum[2]) / (3*n) - 128;
+        for (int ch = 0; ch < c; ch++)
+          out[ch] = gray;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int NNInputGray(NNModel* model, BYTE* gray, int xs, int ys)
+{
+  return nnInput(model, gray, NN_INPUT_GRAY, xs, ys);
+}
+
+int NNInputColor(NNModel* model, BYTE* img, int xs, int ys)
+{
+  return nnInput(model, img, NN_INPUT_COLOR, xs, ys);
+}
+
+int NNInputRGB565(NNModel* model, uint16_t* img, int xs, int ys)
+{
+  return nnInput(model, img, NN_INPUT_RGB565, xs, ys);
+}
+
+/*
+Reference kernels. These follow the layer definitions as directly as
+possible, and aren't meant to be fast.
+*/
+static void nnConvReference(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out, NNShape os)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int k = layer->kernel;
+
+  for (int oy = 0; oy < os.height; oy++)
+  for (int ox = 0; ox < os.width; ox++)
+  for (int o = 0; o < os.channels; o++)
+  {
+    int32_t acc = bias[o];
+
+    for (int ky = 0; ky < k; ky++)
+    for (int kx = 0; kx < k; kx++)
+    for (int c = 0; c < is.channels; c++)
+    {
+      int iy = oy*layer->stride - layer->padding + ky;
+      int ix = ox*layer->stride - layer->padding + kx;
+      if (iy < 0 || iy >= is.height || ix < 0 || ix >= is.width)
+        continue;
+
+      int8_t x = in[(iy*is.width + ix)*is.channels + c];
+      int8_t w = weights[((o*k + ky)*k + kx)*is.channels + c];
+      acc += x*w;
+    }
+
+    out[(oy*os.width + ox)*os.channels + o] = nnRequantise(acc, layer);
+  }
+}
+
+static void nnDepthwiseReference(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out, NNShape os)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int k = layer->kernel;
+
+  for (int oy = 0; oy < os.height; oy++)
+  for (int ox = 0; ox < os.width; ox++)
+  for (int c = 0; c < os.channels; c++)
+  {
+    int32_t acc = bias[c];
+
+    for (int ky = 0; ky < k; ky++)
+    for (int kx = 0; kx < k; kx++)
+    {
+      int iy = oy*layer->stride - layer->padding + ky;
+      int ix = ox*layer->stride - layer->padding + kx;
+      if (iy < 0 || iy >= is.height || ix < 0 || ix >= is.width)
+        continue;
+
+      acc += in[(iy*is.width + ix)*is.channels + c]*weights[(ky*k + kx)*is.channels + c];
+    }
+
+    out[(oy*os.width + ox)*os.channels + c] = nnRequantise(acc, layer);
+  }
+}
+
+// Padding taps are left out of both the maximum and the average
+static void nnPool(const NNLayer *layer, const int8_t *in, NNShape is, int8_t *out, NNShape os)
+{
+  int k = layer->kernel;
+
+  for (int oy = 0; oy < os.height; oy++)
+  for (int ox = 0; ox < os.width; ox++)
+  for (int c = 0; c < os.channels; c++)
+  {
+    int max = -128, sum = 0, count = 0;
+
+    for (int ky = 0; ky < k; ky++)
+    for (int kx = 0; kx < k; kx++)
+    {
+      int iy = oy*layer->stride - layer->padding + ky;
+      int ix = ox*layer->stride - layer->padding + kx;
+      if (iy < 0 || iy >= is.height || ix < 0 || ix >= is.width)
+        continue;
+
+      int x = in[(iy*is.width + ix)*is.channels + c];
+      max = MAX(max, x);
+      sum += x;
+      count++;
+    }
+
+    int value;
+    if (layer->type == NN_MAXPOOL)
+      value = max;
+    else
+      value = (sum + (sum >= 0 ? count / 2 : -count / 2)) / count;
+
+    if (layer->relu)
+      value = MAX(value, 0);
+
+    out[(oy*os.width + ox)*os.channels + c] = value;
+  }
+}
+
+static void nnRelu(const int8_t *in, NNShape is, int8_t *out)
+{
+  int n = is.width*is.height*is.channels;
+
+  for (int i = 0; i < n; i++)
+    out[i] = in[i] > 0 ? in[i] : 0;
+}
+
+static void nnDenseReference(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int n = is.width*is.height*is.channels;
+
+  for (int o = 0; o < layer->channels; o++)
+  {
+    int32_t acc = bias[o];
+    for (int i = 0; i < n; i++)
+      acc += in[i]*weights[o*n + i];
+
+    out[o] = nnRequantise(acc, layer);
+  }
+}
+
+/*
+Optimised kernels. Since tensors are channels last, the taps of one kernel
+row are contiguous in both the input and the weights, so convolutions and
+dense layers reduce to dot products over runs of bytes.
+*/
+#if NN_SIMD
+/*
+ACCX is the 40-bit accumulator of ee.vmulas.s8.accx. GCC allocates neither
+it nor q0 and q1, and cannot be told they are clobbered, so the whole loop
+is a single asm statement: nothing the compiler keeps can live in them, and
+no code of its own runs between zeroing ACCX and reading it back. The
+memory clobber orders the loads after any stores to the operands.
+*/
+static inline int32_t nnDotSIMD(const int8_t *a, const int8_t *b, int n)
+{
+  int32_t result;
+  int blocks = n / 16;
+
+  asm volatile (
+    "ee.zero.accx\n\t"
+    "1:\n\t"
+    "ee.vld.128.ip q0, %0, 16\n\t"
+    "ee.vld.128.ip q1, %1, 16\n\t"
+    "addi %2, %2, -1\n\t"
+    "ee.vmulas.s8.accx q0, q1\n\t"
+    "bnez %2, 1b\n\t"
+    "rur.accx_0 %3\n\t"
+    : "+r" (a), "+r" (b), "+r" (blocks), "=r" (result)
+    :
+    : "memory");
+
+  return result;
+}
+#endif
+
+static inline int32_t nnDotScalar(const int8_t *a, const int8_t *b, int n)
+{
+  int32_t acc = 0;
+  for (int i = 0; i < n; i++)
+    acc += a[i]*b[i];
+
+  return acc;
+}
+
+static inline int32_t nnDot(const int8_t *a, const int8_t *b, int n)
+{
+#if NN_SIMD
+  if (gNNSIMD == 1 && n > 0 && (n & 15) == 0 && (((uintptr_t)a | (uintptr_t)b) & 15) == 0)
+    return nnDotSIMD(a, b, n);
+#endif
+
+  return nnDotScalar(a, b, n);
+}
+
+/*
+Checks the vector dot product against the scalar one on the board itself,
+over every length of whole blocks up to 256 bytes with the extremes of int8
+and with pseudo-random values, and keeps to the scalar kernel if any result
+differs by a bit.
+*/
+static int nnSIMDCheck(void)
+{
+#if NN_SIMD
+  static int8_t a[256] __attribute__((aligned(NN_ALIGN))), b[256] __attribute__((aligned(NN_ALIGN)));
+  uint32_t seed = 1;
+
+  for (int pattern = 0; pattern < 4; pattern++)
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      seed = seed*1664525 + 1013904223;
+      a[i] = pattern == 0 ? -128 : pattern == 1 ? 127 : (int8_t)(seed >> 24);
+      b[i] = pattern == 0 ? -128 : pattern == 1 ? -128 : (int8_t)(seed >> 16);
+    }
+
+    for (int n = 16; n <= 256; n += 16)
+      if (nnDotSIMD(a, b, n) != nnDotScalar(a, b, n))
+        return 0;
+  }
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static void nnConv(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out, NNShape os)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int k = layer->kernel, c = is.channels;
+
+  for (int oy = 0; oy < os.height; oy++)
+  {
+    int iy0 = oy*layer->stride - layer->padding;
+    int ky1 = MAX(0, -iy0), ky2 = MIN(k, is.height - iy0);
+
+    for (int ox = 0; ox < os.width; ox++)
+    {
+      int ix0 = ox*layer->stride - layer->padding;
+      int kx1 = MAX(0, -ix0), kx2 = MIN(k, is.width - ix0);
+      int run = (kx2 - kx1)*c;
+
+      for (int o = 0; o < os.channels; o++)
+      {
+        const int8_t *w = weights + o*k*k*c;
+        int32_t acc = bias[o];
+
+        for (int ky = ky1; ky < ky2; ky++)
+          acc += nnDot(in + ((iy0 + ky)*is.width + ix0 + kx1)*c, w + (ky*k + kx1)*c, run);
+
+        *out++ = nnRequantise(acc, layer);
+      }
+    }
+  }
+}
+
+static void nnDepthwise(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out, NNShape os, int32_t *acc)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int k = layer->kernel, c = is.channels;
+
+  for (int oy = 0; oy < os.height; oy++)
+  {
+    int iy0 = oy*layer->stride - layer->padding;
+    int ky1 = MAX(0, -iy0), ky2 = MIN(k, is.height - iy0);
+
+    for (int ox = 0; ox < os.width; ox++)
+    {
+      int ix0 = ox*layer->stride - layer->padding;
+      int kx1 = MAX(0, -ix0), kx2 = MIN(k, is.width - ix0);
+
+      memcpy(acc, bias, c*sizeof(int32_t));
+
+      // Channels are innermost, so each tap is a multiply-add of two vectors
+      for (int ky = ky1; ky < ky2; ky++)
+      for (int kx = kx1; kx < kx2; kx++)
+      {
+        const int8_t *x = in + ((iy0 + ky)*is.width + ix0 + kx)*c;
+        const int8_t *w = weights + (ky*k + kx)*c;
+        for (int ch = 0; ch < c; ch++)
+          acc[ch] += x[ch]*w[ch];
+      }
+
+      for (int ch = 0; ch < c; ch++)
+        *out++ = nnRequantise(acc[ch], layer);
+    }
+  }
+}
+
+static void nnDense(const NNLayer *layer, const BYTE *data, const int8_t *in, NNShape is, int8_t *out)
+{
+  const int8_t *weights = (const int8_t*)(data + layer->weights);
+  const int32_t *bias = (const int32_t*)(data + layer->bias);
+  int n = is.width*is.height*is.channels;
+
+  for (int o = 0; o < layer->channels; o++)
+    out[o] = nnRequantise(bias[o] + nnDot(in, weights + o*n, n), layer);
+}
+
+static int nnRun(NNModel *model, bool reference)
+{
+  if (!model || !model->header)
+    return -1;
+
+  const BYTE *data = (const BYTE*)model->header;
+  const int8_t *in = model->input;
+  NNShape is = {model->width, model->height, model->channels};
+
+  for (int i = 0; i < model->header->layerCount; i++)
+  {
+    const NNLayer *layer = &model->layers[i];
+    int8_t *out = model->buffers[i & 1];
+    NNShape os;
+    if (!nnOutputShape(layer, is, &os))
+      return -1;
+
+    uint32_t start = nnMicros();
+
+    switch (layer->type)
+    {
+      case NN_CONV2D:
+        if (reference)
+          nnConvReference(layer, data, in, is, out, os);
+        else
+          nnConv(layer, data, in, is, out, os);
+        break;
+      case NN_DEPTHWISE:
+        if (reference)
+          nnDepthwiseReference(layer, data, in, is, out, os);
+        else
+          nnDepthwise(layer, data, in, is, out, os, model->scratch);
+        break;
+      case NN_MAXPOOL:
+      case NN_AVGPOOL:
+        nnPool(layer, in, is, out, os);
+        break;
+      case NN_RELU:
+        nnRelu(in, is, out);
+        break;
+      case NN_DENSE:
+        if (reference)
+          nnDenseReference(layer, data, in, is, out);
+        else
+          nnDense(layer, data, in, is, out);
+        break;
+    }
+
+    model->layerMicros[i] = nnMicros() - start;
+
+    in = out;
+    is = os;
+  }
+
+  model->output = (int8_t*)in;
+  return 0;
+}
+
+int NNRun(NNModel* model)
+{
+  return nnRun(model, false);
+}
+
+int NNRunReference(NNModel* model)
+{
+  return nnRun(model, true);
+}
+
+/*
+A network with a single output gives the steering value directly, scaled
+by 1/127. A network with several outputs classifies the steering into
+evenly spaced bins from full left to full right.
+*/
+float NNSteering(NNModel* model)
+{
+  if (!model || !model->output)
+    return 0;
+
+  int n = model->outWidth*model->outHeight*model->outChannels;
+  if (n == 1)
+    return model->output[0] / 127.0f;
+
+  int best = 0;
+  for (int i = 1; i < n; i++)
+    if (model->output[i] > model->output[best])
+      best = i;
+
+  return -1.0f + 2.0f*best / (n - 1);
+}
+
+// A single output channel is thresholded at 0 to 0xFF or 0, like
+// IPThreshold(), and otherwise each pixel takes its highest scoring class.
+int NNMask(NNModel* model, BYTE* mask)
+{
+  if (!model || !model->output || !mask)
+    return -1;
+
+  int n = model->outWidth*model->outHeight, c = model->outChannels;
+
+  for (int i = 0; i < n; i++)
+  {
+    const int8_t *scores = model->output + i*c;
+
+    if (c == 1)
+    {
+      mask[i] = scores[0] > 0 ? 0xFF : 0;
+      continue;
+    }
+
+    int best = 0;
+    for (int ch = 1; ch < c; ch++)
+      if (scores[ch] > scores[best])
+        best = ch;
+
+    mask[i] = best;
+  }
+
+  return 0;
+}
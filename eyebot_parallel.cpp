@@ -0,0 +1,129 @@
+/*
+Band-parallel execution for IPParallelFor().
+
+The image is split into bands of rows. The caller works on the first band
+itself and hands the others to worker tasks, the second band going to the
+other core, then waits for all of them: one fork and one join per call,
+without allocation. Workers are started on first use, pinned to a core, and
+sleep on a semaphore of their own between calls, so an idle pool costs no
+CPU time.
+
+Bands share their input and write disjoint rows of the output, so the halo
+rows a filter reads beyond its band need no copying. The halo only bounds
+how thin the bands may become: a band of fewer rows than twice its halo
+would read more than it writes, so small images run in fewer bands.
+
+The pool serves one IPParallelFor() at a time. A call from another task
+while it is busy, or from within a band, runs serially on the caller.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+
+// Workers per core, as band k runs on core (caller + k) % 2
+#define BAND_SLOTS (IP_MAX_BANDS / 2)
+
+typedef struct {
+  void *start;
+  bool running;
+  IPBandFn fn;
+  void *arg;
+  int first, last;
+} BandWorker;
+
+static BandWorker gBandWorkers[2][BAND_SLOTS];
+static void *pBandsDone = NULL;
+static int gBands = 1;
+static std::atomic<bool> gBandsBusy(false);
+
+static void bandTask(void *arg)
+{
+  BandWorker *worker = (BandWorker*)arg;
+
+  for (;;)
+  {
+    halSemTake(worker->start);
+    worker->fn(worker->first, worker->last, worker->arg);
+    halSemGive(pBandsDone);
+  }
+}
+
+// The worker on core for slot, started if need be; NULL if it cannot be
+static BandWorker* bandWorker(int core, int slot)
+{
+  BandWorker *worker = &gBandWorkers[core][slot];
+
+  if (worker->running)
+    return worker;
+
+  if (!worker->start)
+    worker->start = halSemCreate();
+
+  if (!worker->start || halTaskCreate(bandTask, worker, core, "IPBand") != 0)
+    return NULL;
+
+  worker->running = true;
+
+  return worker;
+}
+
+int IPParallelFor(int rows, int halo, IPBandFn fn, void* arg)
+{
+  if (rows < 0 || halo < 0 || !fn)
+    return -1;
+
+  int bands = halo > 0 ? rows / (2*halo) : rows;
+  if (bands > gBands)
+    bands = gBands;
+
+  bool idle = false;
+  if (bands <= 1 || !gBandsBusy.compare_exchange_strong(idle, true))
+  {
+    fn(0, rows, arg);
+    return 0;
+  }
+
+  if (!pBandsDone)
+    pBandsDone = halSemCreate();
+
+  BandWorker *workers[IP_MAX_BANDS];
+  int core = halCoreID() & 1;
+  int count = 1;
+
+  while (count < bands && pBandsDone)
+  {
+    BandWorker *worker = bandWorker((core + count) % 2, (count - 1) / 2);
+    if (!worker)
+      break;
+
+    workers[count++] = worker;
+  }
+
+  for (int k = 1; k < count; k++)
+  {
+    workers[k]->fn = fn;
+    workers[k]->arg = arg;
+    workers[k]->first = rows*k / count;
+    workers[k]->last = rows*(k + 1) / count;
+    halSemGive(workers[k]->start);
+  }
+
+  fn(0, rows / count, arg);
+
+  for (int k = 1; k < count; k++)
+    halSemTake(pBandsDone);
+
+  gBandsBusy = false;
+
+  return 0;
+}
+
+int IPSetBands(int bands)
+{
+  if (bands < 1 || bands > IP_MAX_BANDS)
+    return -1;
+
+  gBands = bands;
+
+  return 0;
+}
@@ -0,0 +1,283 @@
+/*
+Frame pipeline scheduler for the PIPE*() functions.
+
+Every stage runs as a task of its own on the core it was added for, so that
+capturing, processing and displaying overlap and a frame takes as long as
+the slowest stage rather than the sum of all of them. Frames are buffers of
+a fixed pool: the first stage takes a free one, each stage passes it on
+through a queue to the next, and the last stage returns it to the pool.
+
+Each queue has a single producer and a single consumer and needs no lock:
+the producer owns the head and the consumer advances the tail. To drop the
+oldest frame of a full queue the producer advances the tail as well, which
+is why the tail is claimed with a compare-and-swap by both sides. The free
+pool is a bit mask, claimed and released with atomic operations.
+
+A stage with nothing to do sleeps on a semaphore rather than polling: the
+consumer of a queue on one given for every frame pushed, the first stage on
+one given for every frame released, and a producer of PIPE_BLOCK waiting
+for room on one given for every frame popped. A semaphore may count more
+than there is, after frames were dropped, and a stage woken for nothing
+just takes it again; it never counts less, so no stage misses its frame.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <stdlib.h>
+
+typedef struct {
+  std::atomic<uint32_t> head, tail;
+  std::atomic<uint8_t> slots[PIPE_MAX_FRAMES];
+  void *pushed, *popped;// Semaphores
+} PipeQueue;
+
+typedef struct {
+  const char *name;
+  PIPEStageFn fn;
+  void *arg;
+  int core;
+  int index;
+  std::atomic<int> frames, drops;
+} PipeStage;
+
+static BYTE *pPipeBuffers = NULL;
+static int gPipeFrameCount = 0;
+static int gPipeFrameSize = 0;
+static int gPipeQueueSize = 0;
+static int gPipePolicy = PIPE_DROP_OLDEST;
+
+static PipeStage gPipeStages[PIPE_MAX_STAGES];
+static int gPipeStageCount = 0;
+// The queue after each stage but the last
+static PipeQueue gPipeQueues[PIPE_MAX_STAGES - 1];
+
+static std::atomic<uint32_t> gPipeFree(0);
+static void *pPipeReleased = NULL;// Semaphore
+static std::atomic<bool> gPipeRunning(false);
+static std::atomic<int> gPipeActive(0);
+
+static_assert(PIPE_MAX_FRAMES <= 32 && (PIPE_MAX_FRAMES & (PIPE_MAX_FRAMES - 1)) == 0,
+              "the free pool is a 32-bit mask and queue slots wrap at PIPE_MAX_FRAMES");
+
+static int acquireFrame(void)
+{
+  uint32_t free = gPipeFree.load();
+
+  while (free)
+  {
+    int frame = __builtin_ctz(free);
+    if (gPipeFree.compare_exchange_weak(free, free & ~(1u << frame)))
+      return frame;
+  }
+
+  return -1;
+}
+
+static void releaseFrame(int frame)
+{
+  gPipeFree.fetch_or(1u << frame);
+  halSemGive(pPipeReleased);
+}
+
+static int queuePop(PipeQueue *queue)
+{
+  uint32_t tail = queue->tail.load(std::memory_order_acquire);
+
+  for (;;)
+  {
+    if (tail == queue->head.load(std::memory_order_acquire))
+      return -1;
+
+    int frame = queue->slots[tail & (PIPE_MAX_FRAMES - 1)].load(std::memory_order_relaxed);
+
+    // Fails if the producer dropped this frame meanwhile, and reloads tail
+    if (queue->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      halSemGive(queue->popped);
+      return frame;
+    }
+  }
+}
+
+static void queuePush(PipeStage *stage, int frame)
+{
+  PipeQueue *queue = &gPipeQueues[stage->index];
+
+  for (;;)
+  {
+    uint32_t head = queue->head.load(std::memory_order_relaxed);
+    uint32_t tail = queue->tail.load(std::memory_order_acquire);
+
+    if (head - tail < (uint32_t)gPipeQueueSize)
+    {
+      queue->slots[head & (PIPE_MAX_FRAMES - 1)].store(frame, std::memory_order_relaxed);
+      queue->head.store(head + 1, std::memory_order_release);
+      halSemGive(queue->pushed);
+      return;
+    }
+
+    if (!gPipeRunning)
+    {
+      releaseFrame(frame);
+      return;
+    }
+
+    if (gPipePolicy == PIPE_BLOCK)
+    {
+      halSemTake(queue->popped);
+      continue;
+    }
+
+    int oldest = queue->slots[tail & (PIPE_MAX_FRAMES - 1)].load(std::memory_order_relaxed);
+    if (queue->tail.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel))
+    {
+      releaseFrame(oldest);
+      stage->drops++;
+    }
+  }
+}
+
+static void stageTask(void *arg)
+{
+  PipeStage *stage = (PipeStage*)arg;
+  bool last = stage->index == gPipeStageCount - 1;
+
+  PipeQueue *input = stage->index == 0 ? NULL : &gPipeQueues[stage->index - 1];
+
+  while (gPipeRunning)
+  {
+    int frame = input ? queuePop(input) : acquireFrame();
+
+    if (frame < 0)
+    {
+      halSemTake(input ? input->pushed : pPipeReleased);
+      continue;
+    }
+
+    TRACEEvent(TRACE_BEGIN, stage->name);
+    int result = stage->fn(pPipeBuffers + (size_t)frame*gPipeFrameSize, stage->arg);
+    TRACEEvent(TRACE_END, stage->name);
+
+    stage->frames++;
+
+    if (result != 0 || last)
+      releaseFrame(frame);
+    else
+      queuePush(stage, frame);
+  }
+
+  gPipeActive--;
+}
+
+int PIPEInit(int frames, int frameSize, int queueSize, int policy)
+{
+  if (gPipeRunning || frames < 2 || frames > PIPE_MAX_FRAMES || frameSize <= 0 ||
+      queueSize < 1 || (policy != PIPE_DROP_OLDEST && policy != PIPE_BLOCK))
+    return -1;
+
+  free(pPipeBuffers);
+  pPipeBuffers = (BYTE*)calloc(frames, frameSize);
+  if (!pPipeBuffers)
+    return -1;
+
+  gPipeFrameCount = frames;
+  gPipeFrameSize = frameSize;
+  gPipeQueueSize = queueSize < frames ? queueSize : frames;
+  gPipePolicy = policy;
+  gPipeStageCount = 0;
+
+  return 0;
+}
+
+int PIPEAddStage(const char* name, PIPEStageFn fn, void* arg, int core)
+{
+  if (gPipeRunning || !pPipeBuffers || !name || !fn || core < 0 || core > 1 ||
+      gPipeStageCount >= PIPE_MAX_STAGES)
+    return -1;
+
+  PipeStage *stage = &gPipeStages[gPipeStageCount];
+  stage->name = name;
+  stage->fn = fn;
+  stage->arg = arg;
+  stage->core = core;
+  stage->index = gPipeStageCount;
+
+  return gPipeStageCount++;
+}
+
+int PIPEStart(void)
+{
+  if (gPipeRunning || gPipeStageCount == 0)
+    return -1;
+
+  // Kept from one run to the next, as they cannot be deleted
+  if (!pPipeReleased && !(pPipeReleased = halSemCreate()))
+    return -1;
+
+  for (int i = 0; i < gPipeStageCount - 1; i++)
+  {
+    PipeQueue *queue = &gPipeQueues[i];
+    if ((!queue->pushed && !(queue->pushed = halSemCreate())) || (!queue->popped && !(queue->popped = halSemCreate())))
+      return -1;
+
+    queue->head = 0;
+    queue->tail = 0;
+  }
+
+  for (int i = 0; i < gPipeStageCount; i++)
+  {
+    gPipeStages[i].frames = 0;
+    gPipeStages[i].drops = 0;
+  }
+
+  gPipeFree = gPipeFrameCount == 32 ? 0xFFFFFFFF : (1u << gPipeFrameCount) - 1;
+  gPipeRunning = true;
+  gPipeActive = 0;
+
+  for (int i = 0; i < gPipeStageCount; i++)
+  {
+    PipeStage *stage = &gPipeStages[i];
+    gPipeActive++;
+
+    if (halTaskCreate(stageTask, stage, stage->core, stage->name) != 0)
+    {
+      gPipeActive--;
+      PIPEStop();
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Wakes every stage that may be asleep until all of them have seen the stop
+int PIPEStop(void)
+{
+  gPipeRunning = false;
+
+  while (gPipeActive > 0)
+  {
+    halSemGive(pPipeReleased);
+    for (int i = 0; i < gPipeStageCount - 1; i++)
+    {
+      halSemGive(gPipeQueues[i].pushed);
+      halSemGive(gPipeQueues[i].popped);
+    }
+    halYield();
+  }
+
+  return 0;
+}
+
+int PIPEGetStats(int stage, int* frames, int* drops)
+{
+  if (stage < 0 || stage >= gPipeStageCount)
+    return -1;
+
+  if (frames)
+    *frames = gPipeStages[stage].frames;
+  if (drops)
+    *drops = gPipeStages[stage].drops;
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/*
+Frame pipeline profiler for the PROF*() functions.
+
+Each run of a stage is recorded with its start and end in halCycles() into
+a fixed ring buffer, so that the profiler never allocates and its cost per
+marker is two counter reads and one record. Once the ring is full the
+oldest runs are overwritten, so the statistics always describe the last
+PROF_RING_SIZE runs across all stages. They are computed only when asked
+for, by sorting the durations of one stage.
+
+A stage may run in several tasks at once, as the bands of IPParallelFor()
+or a pipeline stage beside the same code in the loop do, so start times are
+kept per task. A task takes one of PROF_MAX_TASKS slots when it begins a
+stage and gives it back when it has ended all it began, so any number of
+tasks may time stages over a program's life, but runs of tasks beyond
+PROF_MAX_TASKS with stages open at once are not recorded.
+
+The PROF_SCOPE(), PROF_BEGIN() and PROF_END() macros of eyebot.h look a
+stage up by name once per call site and compile to nothing when
+EYEBOT_PROFILE is 0, which for the library's own markers is its
+EYEBOT_PROFILE_LIBRARY. While a trace is being recorded, every stage run
+also appears in it as a pair of begin and end events.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Height in pixels of a table row at font size 1
+#define PROF_LINE_HEIGHT 10
+// Tasks timing stages at once
+#define PROF_MAX_TASKS 16
+
+typedef struct {
+  uint8_t stage;
+  uint32_t start, end;
+} ProfRecord;
+
+// Stages are only ever added, each name written before the count that
+// publishes it, and added under a flag so that two never take one index
+static const char *pProfNames[PROF_MAX_STAGES];
+static std::atomic<int> gProfStageCount(0);
+static std::atomic_flag gProfAdding = ATOMIC_FLAG_INIT;
+
+// The halTaskID() owning each slot, 0 for none, and the start of each stage
+// it has begun but not ended, marked by a bit of gProfOpen. Only the owner
+// touches its row, so releasing the slot publishes it to the next owner.
+static std::atomic<uint32_t> gProfTasks[PROF_MAX_TASKS];
+static uint32_t gProfStart[PROF_MAX_TASKS][PROF_MAX_STAGES];
+static uint32_t gProfOpen[PROF_MAX_TASKS];
+static_assert(PROF_MAX_STAGES <= 32, "gProfOpen holds a bit per stage");
+
+static ProfRecord gProfRing[PROF_RING_SIZE];
+static_assert((PROF_RING_SIZE & (PROF_RING_SIZE - 1)) == 0, "PROF_RING_SIZE must be a power of two");
+// Runs recorded since the last reset; the ring slot is claimed atomically,
+// as stages of a pipeline record from tasks on both cores
+static std::atomic<uint32_t> gProfHead(0);
+
+static uint32_t gProfCycles[PROF_RING_SIZE];
+
+static int compareCycles(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static int findStage(const char *name, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (strcmp(pProfNames[i], name) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+int PROFStage(const char* name)
+{
+  if (!name)
+    return -1;
+
+  int stage = findStage(name, gProfStageCount.load(std::memory_order_acquire));
+  if (stage >= 0)
+    return stage;
+
+  while (gProfAdding.test_and_set(std::memory_order_acquire))
+    halYield();
+
+  // Another task may have added it meanwhile
+  int count = gProfStageCount.load(std::memory_order_relaxed);
+  stage = findStage(name, count);
+  if (stage < 0 && count < PROF_MAX_STAGES)
+  {
+    pProfNames[count] = name;
+    gProfStageCount.store(count + 1, std::memory_order_release);
+    stage = count;
+  }
+
+  gProfAdding.clear(std::memory_order_release);
+
+  return stage;
+}
+
+/*
+Slot of the calling task, or with claim a free one taken for it; -1 if it
+has none. Its own slot is looked for first, as one released by another task
+before it may be free again, and the task must not end up with two.
+*/
+static int profTask(bool claim)
+{
+  uint32_t id = halTaskID();
+
+  for (int t = 0; t < PROF_MAX_TASKS; t++)
+  {
+    if (gProfTasks[t].load(std::memory_order_acquire) == id)
+      return t;
+  }
+
+  for (int t = 0; claim && t < PROF_MAX_TASKS; t++)
+  {
+    uint32_t owner = 0;
+    if (gProfTasks[t].compare_exchange_strong(owner, id, std::memory_order_acq_rel))
+      return t;
+  }
+
+  return -1;
+}
+
+void PROFBegin(int stage)
+{
+  if (stage < 0 || stage >= gProfStageCount.load(std::memory_order_acquire))
+    return;
+
+  int task = profTask(true);
+  if (task < 0)
+    return;
+
+  TRACEEvent(TRACE_BEGIN, pProfNames[stage]);
+  gProfOpen[task] |= 1u << stage;
+  gProfStart[task][stage] = halCycles();
+}
+
+void PROFEnd(int stage)
+{
+  uint32_t end = halCycles();
+
+  if (stage < 0 || stage >= gProfStageCount.load(std::memory_order_acquire))
+    return;
+
+  int task = profTask(false);
+  if (task < 0 || !(gProfOpen[task] & 1u << stage))
+    return;
+
+  ProfRecord *record = &gProfRing[gProfHead.fetch_add(1) & (PROF_RING_SIZE - 1)];
+  record->stage = stage;
+  record->start = gProfStart[task][stage];
+  record->end = end;
+  TRACEEvent(TRACE_END, pProfNames[stage]);
+
+  gProfOpen[task] &= ~(1u << stage);
+  if (!gProfOpen[task])
+    gProfTasks[task].store(0, std::memory_order_release);
+}
+
+int PROFGet(int stage, PROFStats* stats)
+{
+  if (stage < 0 || stage >= gProfStageCount.load(std::memory_order_acquire) || !stats)
+    return -1;
+
+  int count = 0;
+  double sum = 0;
+
+  uint32_t recorded = gProfHead;
+  int runs = recorded < PROF_RING_SIZE ? recorded : PROF_RING_SIZE;
+
+  for (int i = 0; i < runs; i++)
+  {
+    if (gProfRing[i].stage != stage)
+      continue;
+
+    uint32_t cycles = gProfRing[i].end - gProfRing[i].start;
+    gProfCycles[count++] = cycles;
+    sum += cycles;
+  }
+
+  stats->name = pProfNames[stage];
+  stats->count = count;
+  stats->min = stats->avg = stats->p99 = 0;
+
+  if (count == 0)
+    return 0;
+
+  qsort(gProfCycles, count, sizeof(uint32_t), compareCycles);
+
+  float us = 1.0f / halCyclesPerMicro();
+  int rank = (99*count + 99) / 100;
+
+  stats->min = gProfCycles[0]*us;
+  stats->avg = sum / count*us;
+  stats->p99 = gProfCycles[rank - 1]*us;
+
+  return 0;
+}
+
+int PROFReset(void)
+{
+  gProfHead = 0;
+
+  return 0;
+}
+
+int PROFPrint(void)
+{
+  char line[128];
+  PROFStats stats;
+
+  for (int i = 0; i < gProfStageCount.load(std::memory_order_acquire); i++)
+  {
+    PROFGet(i, &stats);
+    snprintf(line, sizeof(line), "prof=%s count=%d us_min=%.1f us_avg=%.1f us_p99=%.1f\n",
+             stats.name, stats.count, stats.min, stats.avg, stats.p99);
+    halConsole(line);
+  }
+
+  return 0;
+}
+
+/*
+The table is drawn in font size 1, 27 characters wide, which fits the
+170 pixel width of the display from x = 0.
+*/
+int PROFOverlay(int x, int y)
+{
+  PROFStats stats;
+
+  LCDSetFontSize(1);
+  LCDSetColor(WHITE, BLACK);
+  LCDSetPrintf(y, x, "%-9s%6s%6s%6s", "STAGE ms", "MIN", "AVG", "P99");
+
+  for (int i = 0; i < gProfStageCount.load(std::memory_order_acquire); i++)
+  {
+    PROFGet(i, &stats);
+    LCDSetPrintf(y + (i + 1)*PROF_LINE_HEIGHT, x, "%-9.9s%6.2f%6.2f%6.2f",
+                 stats.name, stats.min / 1000, stats.avg / 1000, stats.p99 / 1000);
+  }
+
+  return 0;
+}
@@ -0,0 +1,574 @@
+/*
+Frame recorder for the REC*() functions.
+
+RECFrame() only copies the image into one of REC_BUFFERS buffers, with the
+time and VW pose, and wakes the writer task, so the control loop never
+waits for the flash. The writer task, on core 0 beside the camera, encodes
+each frame losslessly and writes it in chunks. When every buffer is still
+waiting to be written the new frame is dropped and counted instead.
+
+Colour frames are encoded with the operations of QOI (the Quite OK Image
+format) on their RGB values, and gray frames as runs and small deltas from
+the previous pixel, which typically halves a camera frame or better at a
+few cycles per pixel. The file, little-endian throughout, is:
+
+  "EBREC1"                   magic
+  u8 format, u8 0            REC_GRAY or REC_COLOR
+  u16 width, u16 height      always QQVGA
+  frames x (u32 time in us, i32 x, i32 y, i32 phi, encoded pixels)
+
+The encoding of a frame ends with its last pixel, so frames need no length.
+RECOpen() and RECRead() decode a recording again, on the EyeBot or on a host.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#define REC_WIDTH 160
+#define REC_HEIGHT 120
+#define REC_PIXELS (REC_WIDTH*REC_HEIGHT)
+#define REC_HEADER_SIZE 12
+#define REC_FRAME_HEADER_SIZE 16
+#define REC_CHUNK 4096
+#define REC_CORE 0
+
+// QOI operations on colour frames
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_MASK 0xC0
+#define QOI_MAX_RUN 62
+
+// Operations on gray frames: a run of 1..64 copies of the previous pixel,
+// a delta of -32..31 from it, or the pixel itself in the following byte
+#define GRAY_OP_RUN 0x00
+#define GRAY_OP_DELTA 0x40
+#define GRAY_OP_RAW 0x80
+#define GRAY_MASK 0xC0
+#define GRAY_MAX_RUN 64
+
+typedef struct {
+  RECInfo info;
+  BYTE *pixels;
+} RecSlot;
+
+// Buffered output or input of a recording
+typedef struct {
+  void *file;
+  BYTE buf[REC_CHUNK];
+  int pos, len;
+  bool ok;
+} RecStream;
+
+static RecSlot gRecSlots[REC_BUFFERS];
+static int gRecHead = 0, gRecTail = 0;
+static std::atomic<int> gRecQueued(0);
+static std::atomic<bool> gRecRunning(false);
+static void *pRecReady = NULL, *pRecDone = NULL;
+static int gRecFormat = REC_COLOR;
+static int gRecFrames = 0, gRecDrops = 0;
+static std::atomic<int> gRecBytes(0);
+
+static RecStream gRecOut;
+static RecStream gRecIn;
+static int gRecInFormat = 0;
+
+static int frameBytes(int format)
+{
+  return format == REC_COLOR ? REC_PIXELS*sizeof(COLOR) : REC_PIXELS;
+}
+
+static void flushOut(RecStream *out)
+{
+  if (out->pos > 0 && out->ok)
+  {
+    out->ok = halFileWrite(out->file, out->buf, out->pos) == out->pos;
+    gRecBytes += out->pos;
+  }
+
+  out->pos = 0;
+}
+
+static inline void putByte(RecStream *out, BYTE b)
+{
+  if (out->pos == REC_CHUNK)
+    flushOut(out);
+
+  out->buf[out->pos++] = b;
+}
+
+static void put32(RecStream *out, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    putByte(out, v >> 8*i);
+}
+
+static inline int qoiHash(BYTE r, BYTE g, BYTE b)
+{
+  return (r*3 + g*5 + b*7 + 255*11) % 64;
+}
+
+static void encodeColor(RecStream *out, const COLOR *img)
+{
+  BYTE index[64][3] = {};
+  BYTE pr = 0, pg = 0, pb = 0;
+  int run = 0;
+
+  for (int i = 0; i < REC_PIXELS; i++)
+  {
+    BYTE r, g, b;
+    IPPCol2RGB(img[i], &r, &g, &b);
+
+    if (r == pr && g == pg && b == pb)
+    {
+      if (++run == QOI_MAX_RUN)
+      {
+        putByte(out, QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0)
+    {
+      putByte(out, QOI_OP_RUN | (run - 1));
+      run = 0;
+    }
+
+    int h = qoiHash(r, g, b);
+    if (index[h][0] == r && index[h][1] == g && index[h][2] == b)
+    {
+      putByte(out, QOI_OP_INDEX | h);
+    }
+    else
+    {
+      index[h][0] = r;
+      index[h][1] = g;
+      index[h][2] = b;
+
+      signed char dr = r - pr, dg = g - pg, db = b - pb;
+      signed char dr_dg = dr - dg, db_dg = db - dg;
+
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+      {
+        putByte(out, QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+      }
+      else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+      {
+        putByte(out, QOI_OP_LUMA | (dg + 32));
+        putByte(out, (dr_dg + 8) << 4 | (db_dg + 8));
+      }
+      else
+      {
+        putByte(out, QOI_OP_RGB);
+        putByte(out, r);
+        putByte(out, g);
+        putByte(out, b);
+      }
+    }
+
+    pr = r;
+    pg = g;
+    pb = b;
+  }
+
+  if (run > 0)
+    putByte(out, QOI_OP_RUN | (run - 1));
+}
+
+static void encodeGray(RecStream *out, const BYTE *img)
+{
+  BYTE prev = 0;
+  int run = 0;
+
+  for (int i = 0; i < REC_PIXELS; i++)
+  {
+    BYTE v = img[i];
+
+    if (v == prev)
+    {
+      if (++run == GRAY_MAX_RUN)
+      {
+        putByte(out, GRAY_OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0)
+    {
+      putByte(out, GRAY_OP_RUN | (run - 1));
+      run = 0;
+    }
+
+    signed char delta = v - prev;
+    if (delta >= -32 && delta <= 31)
+    {
+      putByte(out, GRAY_OP_DELTA | (delta + 32));
+    }
+    else
+    {
+      putByte(out, GRAY_OP_RAW);
+      putByte(out, v);
+    }
+
+    prev = v;
+  }
+
+  if (run > 0)
+    putByte(out, GRAY_OP_RUN | (run - 1));
+}
+
+static void writerTask(void *arg)
+{
+  for (;;)
+  {
+    halSemTake(pRecReady);
+
+    // RECStop() signals once more than there are frames
+    if (gRecQueued == 0)
+      break;
+
+    RecSlot *slot = &gRecSlots[gRecTail];
+    TRACEEvent(TRACE_BEGIN, "REC write");
+
+    put32(&gRecOut, slot->info.time);
+    put32(&gRecOut, slot->info.x);
+    put32(&gRecOut, slot->info.y);
+    put32(&gRecOut, slot->info.phi);
+
+    if (gRecFormat == REC_COLOR)
+      encodeColor(&gRecOut, (const COLOR*)slot->pixels);
+    else
+      encodeGray(&gRecOut, slot->pixels);
+
+    TRACEEvent(TRACE_END, "REC write");
+
+    gRecTail = (gRecTail + 1) % REC_BUFFERS;
+    gRecQueued--;
+  }
+
+  flushOut(&gRecOut);
+  halSemGive(pRecDone);
+}
+
+static void freeSlots(void)
+{
+  for (int i = 0; i < REC_BUFFERS; i++)
+  {
+    free(gRecSlots[i].pixels);
+    gRecSlots[i].pixels = NULL;
+  }
+}
+
+int RECStart(const char* filename, int format)
+{
+  if (gRecRunning || !filename || (format != REC_GRAY && format != REC_COLOR))
+    return -1;
+
+  if (!pRecReady)
+    pRecReady = halSemCreate();
+  if (!pRecDone)
+    pRecDone = halSemCreate();
+  if (!pRecReady || !pRecDone)
+    return -1;
+
+  // The buffers are only copied into and read once, so PSRAM does
+  for (int i = 0; i < REC_BUFFERS; i++)
+  {
+    gRecSlots[i].pixels = (BYTE*)halAllocExternal(frameBytes(format));
+    if (!gRecSlots[i].pixels)
+    {
+      freeSlots();
+      return -1;
+    }
+  }
+
+  gRecOut.file = halFileOpen(filename, "w");
+  if (!gRecOut.file)
+  {
+    freeSlots();
+    return -1;
+  }
+
+  gRecOut.pos = 0;
+  gRecOut.ok = true;
+  gRecFormat = format;
+  gRecHead = gRecTail = 0;
+  gRecQueued = 0;
+  gRecFrames = gRecDrops = 0;
+  gRecBytes = 0;
+
+  const BYTE header[REC_HEADER_SIZE] = {'E', 'B', 'R', 'E', 'C', '1', (BYTE)format, 0,
+                                        REC_WIDTH & 0xFF, REC_WIDTH >> 8, REC_HEIGHT & 0xFF, REC_HEIGHT >> 8};
+  for (int i = 0; i < REC_HEADER_SIZE; i++)
+    putByte(&gRecOut, header[i]);
+
+  if (halTaskCreate(writerTask, NULL, REC_CORE, "REC") != 0)
+  {
+    halFileClose(gRecOut.file);
+    freeSlots();
+    return -1;
+  }
+
+  gRecRunning = true;
+
+  return 0;
+}
+
+int RECFrame(BYTE* img)
+{
+  if (!gRecRunning || !img)
+    return -1;
+
+  if (gRecQueued == REC_BUFFERS)
+  {
+    gRecDrops++;
+    return -1;
+  }
+
+  RecSlot *slot = &gRecSlots[gRecHead];
+  slot->info.time = halMicros();
+  VWGetPosition(&slot->info.x, &slot->info.y, &slot->info.phi);
+  memcpy(slot->pixels, img, frameBytes(gRecFormat));
+
+  gRecHead = (gRecHead + 1) % REC_BUFFERS;
+  gRecFrames++;
+  gRecQueued++;
+  halSemGive(pRecReady);
+
+  return 0;
+}
+
+int RECStop(void)
+{
+  if (!gRecRunning)
+    return -1;
+
+  gRecRunning = false;
+  halSemGive(pRecReady);
+  halSemTake(pRecDone);
+
+  bool ok = gRecOut.ok;
+  halFileClose(gRecOut.file);
+  gRecOut.file = NULL;
+  freeSlots();
+
+  return ok ? 0 : -1;
+}
+
+int RECGetStats(int* frames, int* drops, int* bytes)
+{
+  if (frames)
+    *frames = gRecFrames;
+  if (drops)
+    *drops = gRecDrops;
+  if (bytes)
+    *bytes = gRecBytes;
+
+  return 0;
+}
+
+static int getByte(RecStream *in)
+{
+  if (in->pos == in->len)
+  {
+    in->len = halFileRead(in->file, in->buf, REC_CHUNK);
+    in->pos = 0;
+    if (in->len <= 0)
+    {
+      in->len = 0;
+      return -1;
+    }
+  }
+
+  return in->buf[in->pos++];
+}
+
+static int get32(RecStream *in, uint32_t *v)
+{
+  *v = 0;
+
+  for (int i = 0; i < 4; i++)
+  {
+    int c = getByte(in);
+    if (c < 0)
+      return -1;
+    *v |= (uint32_t)c << 8*i;
+  }
+
+  return 0;
+}
+
+static int decodeColor(RecStream *in, COLOR *img)
+{
+  BYTE index[64][3] = {};
+  BYTE r = 0, g = 0, b = 0;
+
+  for (int i = 0; i < REC_PIXELS; )
+  {
+    int op = getByte(in);
+    if (op < 0)
+      return -1;
+
+    int run = 1;
+
+    if (op == QOI_OP_RGB)
+    {
+      int c[3];
+      for (int k = 0; k < 3; k++)
+      {
+        if ((c[k] = getByte(in)) < 0)
+          return -1;
+      }
+      r = c[0];
+      g = c[1];
+      b = c[2];
+    }
+    else if ((op & QOI_MASK) == QOI_OP_INDEX)
+    {
+      r = index[op][0];
+      g = index[op][1];
+      b = index[op][2];
+    }
+    else if ((op & QOI_MASK) == QOI_OP_DIFF)
+    {
+      r += ((op >> 4) & 3) - 2;
+      g += ((op >> 2) & 3) - 2;
+      b += (op & 3) - 2;
+    }
+    else if ((op & QOI_MASK) == QOI_OP_LUMA)
+    {
+      int next = getByte(in);
+      if (next < 0)
+        return -1;
+      int dg = (op & 0x3F) - 32;
+      g += dg;
+      r += dg + (next >> 4) - 8;
+      b += dg + (next & 0x0F) - 8;
+    }
+    else
+    {
+      run = (op & 0x3F) + 1;
+    }
+
+    int h = qoiHash(r, g, b);
+    index[h][0] = r;
+    index[h][1] = g;
+    index[h][2] = b;
+
+    COLOR col = (COLOR)r << 16 | (COLOR)g << 8 | b;
+    for (; run > 0 && i < REC_PIXELS; run--)
+      img[i++] = col;
+  }
+
+  return 0;
+}
+
+static int decodeGray(RecStream *in, BYTE *img)
+{
+  BYTE v = 0;
+
+  for (int i = 0; i < REC_PIXELS; )
+  {
+    int op = getByte(in);
+    if (op < 0)
+      return -1;
+
+    int run = 1;
+
+    if ((op & GRAY_MASK) == GRAY_OP_RUN)
+    {
+      run = (op & 0x3F) + 1;
+    }
+    else if ((op & GRAY_MASK) == GRAY_OP_DELTA)
+    {
+      v += (op & 0x3F) - 32;
+    }
+    else
+    {
+      int raw = getByte(in);
+      if (raw < 0)
+        return -1;
+      v = raw;
+    }
+
+    for (; run > 0 && i < REC_PIXELS; run--)
+      img[i++] = v;
+  }
+
+  return 0;
+}
+
+int RECOpen(const char* filename)
+{
+  if (!filename)
+    return -1;
+
+  RECClose();
+
+  gRecIn.file = halFileOpen(filename, "r");
+  if (!gRecIn.file)
+    return -1;
+
+  gRecIn.pos = gRecIn.len = 0;
+
+  BYTE header[REC_HEADER_SIZE];
+  for (int i = 0; i < REC_HEADER_SIZE; i++)
+  {
+    int c = getByte(&gRecIn);
+    header[i] = c < 0 ? 0 : c;
+  }
+
+  int format = header[6];
+  if (memcmp(header, "EBREC1", 6) != 0 || (format != REC_GRAY && format != REC_COLOR) ||
+      (header[8] | header[9] << 8) != REC_WIDTH || (header[10] | header[11] << 8) != REC_HEIGHT)
+  {
+    RECClose();
+    return -1;
+  }
+
+  gRecInFormat = format;
+
+  return format;
+}
+
+int RECRead(BYTE* img, RECInfo* info)
+{
+  if (!gRecIn.file || !img)
+    return -1;
+
+  uint32_t v[4];
+  for (int i = 0; i < 4; i++)
+  {
+    if (get32(&gRecIn, &v[i]) != 0)
+      return -1;
+  }
+
+  if (info)
+  {
+    info->time = v[0];
+    info->x = (int32_t)v[1];
+    info->y = (int32_t)v[2];
+    info->phi = (int32_t)v[3];
+  }
+
+  if (gRecInFormat == REC_COLOR)
+    return decodeColor(&gRecIn, (COLOR*)img);
+
+  return decodeGray(&gRecIn, img);
+}
+
+int RECClose(void)
+{
+  if (gRecIn.file)
+    halFileClose(gRecIn.file);
+
+  gRecIn.file = NULL;
+
+  return 0;
+}
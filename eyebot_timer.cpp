@@ -0,0 +1,217 @@
+/*
+Timer service and system clock of the OS*() functions.
+
+One timer of halTickStart() ticks at the 1000 Hz of RoBIOS and serves every
+callback of OSAttachTimer(), each called on every scale-th tick. The ticks
+are handled by a task above the program rather than in the timer interrupt,
+so a callback may take its time and use the rest of the library, while a
+control loop called this way keeps its rate whatever the camera does.
+
+Calls keep to the grid of ticks from when their timer was attached. A
+callback that falls a whole period behind, because it or another ran long,
+loses the calls it missed, which are counted as overruns rather than made
+up in a burst. How late each call starts after its tick is kept as jitter.
+
+The tick task marks each timer busy while it looks at it, before reading
+its function, so OSDetachTimer() can wait out a call under way and
+OSAttachTimer() never resets a timer the task is still using.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+
+// Microseconds between ticks of the 1000 Hz timer
+#define OS_TICK_US 1000
+
+// The function, scale and statistics of a timer are written by OSAttachTimer()
+// while it is unused and not busy, and the rest only by the tick task once fct
+// is set
+typedef struct {
+  std::atomic<void (*)(void)> fct;
+  std::atomic<uint32_t> busy;// halTaskID() of the tick task while it uses the timer, else 0
+  int scale;
+  bool scheduled;
+  uint32_t due;// Tick of the next call
+  std::atomic<uint32_t> calls, overruns, jitterSum, jitterMax, runMax;// us
+} OSTimer;
+
+static OSTimer gOSTimers[OS_MAX_TIMERS];
+static bool gOSTickStarted = false;
+// Microseconds since the first tick, kept by the tick task from halMicros()
+static bool gOSTicking = false;
+static uint32_t gOSLastMicros = 0;
+static uint64_t gOSMicros = 0;
+
+static void storeMax(std::atomic<uint32_t> &max, uint32_t value)
+{
+  if (value > max.load(std::memory_order_relaxed))
+    max.store(value, std::memory_order_relaxed);
+}
+
+// Calls fct of timer if it is due at tick, keeping its statistics
+static void osTickTimer(OSTimer &timer, void (*fct)(void), uint32_t tick)
+{
+  if (!timer.scheduled)
+  {
+    timer.due = tick + timer.scale;
+    timer.scheduled = true;
+    return;
+  }
+
+  if ((int32_t)(tick - timer.due) < 0)
+    return;
+
+  uint32_t missed = (tick - timer.due) / timer.scale;
+  uint32_t due = timer.due + missed*timer.scale;
+  timer.due = due + timer.scale;
+
+  uint32_t start = halMicros();
+  int64_t late = (int64_t)(gOSMicros + (uint32_t)(start - gOSLastMicros)) - (int64_t)due*OS_TICK_US;
+  late = late < 0 ? 0 : late;
+
+  timer.calls.fetch_add(1, std::memory_order_relaxed);
+  timer.overruns.fetch_add(missed, std::memory_order_relaxed);
+  timer.jitterSum.fetch_add((uint32_t)late, std::memory_order_relaxed);
+  storeMax(timer.jitterMax, (uint32_t)late);
+
+  fct();
+
+  storeMax(timer.runMax, halMicros() - start);
+}
+
+/*
+The task may wake late, and a wake may stand for several ticks when the one
+before ran long, so the tick is taken from the clock to the nearest tick
+rather than counted.
+*/
+static void osTick(void)
+{
+  uint32_t micros = halMicros();
+  if (!gOSTicking)
+  {
+    gOSLastMicros = micros;
+    gOSTicking = true;
+  }
+  gOSMicros += micros - gOSLastMicros;
+  gOSLastMicros = micros;
+
+  uint32_t tick = (uint32_t)((gOSMicros + OS_TICK_US/2) / OS_TICK_US);
+  uint32_t task = halTaskID();
+
+  // Marked busy before fct is read, so that OSDetachTimer() either sees the
+  // mark or keeps fct from being read at all
+  for (int t = 0; t < OS_MAX_TIMERS; t++)
+  {
+    OSTimer &timer = gOSTimers[t];
+    timer.busy.store(task);
+
+    void (*fct)(void) = timer.fct.load();
+    if (fct)
+      osTickTimer(timer, fct, tick);
+
+    timer.busy.store(0, std::memory_order_release);
+  }
+}
+
+// Sleeps on a board, which delay() does between ticks of FreeRTOS
+int OSWait(int n)
+{
+  if (n < 0)
+    return -1;
+
+  halDelay(n);
+
+  return 0;
+}
+
+/*
+The tick timer starts with the first timer attached, so a program that
+attaches none pays nothing for it.
+*/
+TIMER OSAttachTimer(int scale, void (*fct)(void))
+{
+  if (scale <= 0 || !fct)
+    return -1;
+
+  if (!gOSTickStarted)
+  {
+    if (halTickStart(OS_TICK_US, osTick) != 0)
+      return -1;
+    gOSTickStarted = true;
+  }
+
+  for (int t = 0; t < OS_MAX_TIMERS; t++)
+  {
+    OSTimer &timer = gOSTimers[t];
+    if (timer.fct.load(std::memory_order_relaxed) || timer.busy.load(std::memory_order_acquire))
+      continue;
+
+    timer.scale = scale;
+    timer.scheduled = false;
+    timer.calls.store(0, std::memory_order_relaxed);
+    timer.overruns.store(0, std::memory_order_relaxed);
+    timer.jitterSum.store(0, std::memory_order_relaxed);
+    timer.jitterMax.store(0, std::memory_order_relaxed);
+    timer.runMax.store(0, std::memory_order_relaxed);
+    timer.fct.store(fct, std::memory_order_release);
+
+    return t;
+  }
+
+  return -1;
+}
+
+/*
+A call already under way in the tick task is waited for, unless it is the
+caller, as when a callback detaches its own timer.
+*/
+int OSDetachTimer(TIMER t)
+{
+  if (t < 0 || t >= OS_MAX_TIMERS || !gOSTimers[t].fct.load(std::memory_order_relaxed))
+    return -1;
+
+  OSTimer &timer = gOSTimers[t];
+  timer.fct.store(NULL);
+
+  uint32_t busy, task = halTaskID();
+  while ((busy = timer.busy.load()) != 0 && busy != task)
+    halYield();
+
+  return 0;
+}
+
+int OSGetTimerStats(TIMER t, OSTimerStats *stats)
+{
+  if (t < 0 || t >= OS_MAX_TIMERS || !stats || !gOSTimers[t].fct.load(std::memory_order_acquire))
+    return -1;
+
+  const OSTimer &timer = gOSTimers[t];
+  stats->calls = timer.calls.load(std::memory_order_relaxed);
+  stats->overruns = timer.overruns.load(std::memory_order_relaxed);
+  stats->jitter_mean = stats->calls ? (float)timer.jitterSum.load(std::memory_order_relaxed) / stats->calls : 0;
+  stats->jitter_max = timer.jitterMax.load(std::memory_order_relaxed);
+  stats->run_max = timer.runMax.load(std::memory_order_relaxed);
+
+  return 0;
+}
+
+int OSGetTime(int *hrs, int *mins, int *secs, int *ticks)
+{
+  uint32_t ms = halMillis();
+
+  if (hrs)
+    *hrs = ms / 3600000;
+  if (mins)
+    *mins = ms / 60000 % 60;
+  if (secs)
+    *secs = ms / 1000 % 60;
+  if (ticks)
+    *ticks = ms % 1000;
+
+  return 0;
+}
+
+int OSGetCount(void)
+{
+  return (int)halMillis();
+}
@@ -0,0 +1,224 @@
+/*
+Event tracing for the TRACE*() functions.
+
+Events go into a ring buffer of the last TRACE_BUFFER_EVENTS events. A
+writer claims its slot with one atomic increment of the head, so events can
+be recorded from both cores and from interrupt handlers without locks, and
+an event costs a timestamp read and a 16 byte store. Names are kept as
+pointers and tasks as their halTaskID() while recording, and only turned
+into a string table and small task numbers when the buffer is written out,
+which is why names must stay valid. An event in an interrupt handler is
+counted to the task it interrupted.
+
+Writing stops the recording, so that no slot changes while it is read, and
+resumes it afterwards. The binary format, little-endian throughout, is:
+
+  "EBTRACE2"                 magic, also found within a serial capture
+  u16 names, u32 events      counts
+  names x (u8 length, chars) string table
+  events x (u32 time in us, u16 name, u8 type, u8 core, u16 task)
+
+Tasks are numbered from 1 in the order they first appear in the written
+events, 0 standing for those beyond TRACE_MAX_TASKS.
+
+host/trace2json.cpp converts it to the Chrome trace JSON read by Perfetto.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <string.h>
+
+// Distinct names in one trace; events with further names are written as "?"
+#define TRACE_MAX_NAMES 64
+// Distinct tasks in one trace; events of further tasks are written as task 0
+#define TRACE_MAX_TASKS 32
+#define TRACE_WRITE_CHUNK 64
+#define TRACE_EVENT_SIZE 10
+
+typedef struct {
+  const char *name;
+  uint32_t time;
+  uint8_t type;
+  uint8_t core;
+  uint32_t task;
+} TraceEvent;
+
+typedef int (*TraceWriter)(void *ctx, const void *data, int size);
+
+static TraceEvent gTraceEvents[TRACE_BUFFER_EVENTS];
+static std::atomic<uint32_t> gTraceHead(0);
+static std::atomic<bool> gTraceEnabled(false);
+
+static const char *pTraceNames[TRACE_MAX_NAMES];
+static int gTraceNameCount = 0;
+static uint32_t gTraceTasks[TRACE_MAX_TASKS];
+static int gTraceTaskCount = 0;
+
+static_assert((TRACE_BUFFER_EVENTS & (TRACE_BUFFER_EVENTS - 1)) == 0, "TRACE_BUFFER_EVENTS must be a power of two");
+
+int TRACEStart(void)
+{
+  gTraceEnabled = false;
+  gTraceHead = 0;
+  gTraceEnabled = true;
+
+  return 0;
+}
+
+int TRACEStop(void)
+{
+  gTraceEnabled = false;
+
+  return 0;
+}
+
+void TRACEEvent(int type, const char* name)
+{
+  if (!gTraceEnabled.load(std::memory_order_relaxed))
+    return;
+
+  uint32_t slot = gTraceHead.fetch_add(1, std::memory_order_relaxed) & (TRACE_BUFFER_EVENTS - 1);
+  TraceEvent *event = &gTraceEvents[slot];
+
+  event->name = name;
+  event->time = halMicros();
+  event->type = type;
+  event->core = halCoreID();
+  event->task = halTaskID();
+}
+
+// Index of name in the string table, adding it if it is new
+static int traceNameIndex(const char *name)
+{
+  for (int i = 0; i < gTraceNameCount; i++)
+  {
+    if (pTraceNames[i] == name || strcmp(pTraceNames[i], name) == 0)
+      return i;
+  }
+
+  if (gTraceNameCount >= TRACE_MAX_NAMES)
+    return 0;
+
+  pTraceNames[gTraceNameCount] = name;
+
+  return gTraceNameCount++;
+}
+
+// Number of a task in the trace, from 1, giving it the next if it is new
+static int traceTaskNumber(uint32_t task)
+{
+  for (int i = 0; i < gTraceTaskCount; i++)
+  {
+    if (gTraceTasks[i] == task)
+      return i + 1;
+  }
+
+  if (gTraceTaskCount >= TRACE_MAX_TASKS)
+    return 0;
+
+  gTraceTasks[gTraceTaskCount] = task;
+
+  return ++gTraceTaskCount;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+static int traceWrite(TraceWriter write, void *ctx)
+{
+  bool enabled = gTraceEnabled.exchange(false);
+
+  uint32_t head = gTraceHead;
+  uint32_t count = head < TRACE_BUFFER_EVENTS ? head : TRACE_BUFFER_EVENTS;
+  uint32_t first = head - count;
+
+  // Entry 0 stands in for the names that do not fit the table
+  gTraceNameCount = 0;
+  gTraceTaskCount = 0;
+  traceNameIndex("?");
+  for (uint32_t i = 0; i < count; i++)
+    traceNameIndex(gTraceEvents[(first + i) & (TRACE_BUFFER_EVENTS - 1)].name);
+
+  uint8_t buf[TRACE_WRITE_CHUNK*TRACE_EVENT_SIZE];
+  int ok = 1;
+
+  memcpy(buf, "EBTRACE2", 8);
+  put16(buf + 8, gTraceNameCount);
+  put32(buf + 10, count);
+  ok &= write(ctx, buf, 14) == 14;
+
+  for (int i = 0; i < gTraceNameCount; i++)
+  {
+    int len = strlen(pTraceNames[i]);
+    if (len > 255)
+      len = 255;
+
+    buf[0] = len;
+    memcpy(buf + 1, pTraceNames[i], len);
+    ok &= write(ctx, buf, len + 1) == len + 1;
+  }
+
+  for (uint32_t i = 0; i < count; i += TRACE_WRITE_CHUNK)
+  {
+    int n = count - i < TRACE_WRITE_CHUNK ? count - i : TRACE_WRITE_CHUNK;
+
+    for (int k = 0; k < n; k++)
+    {
+      TraceEvent *event = &gTraceEvents[(first + i + k) & (TRACE_BUFFER_EVENTS - 1)];
+      uint8_t *p = buf + TRACE_EVENT_SIZE*k;
+
+      put32(p, event->time);
+      put16(p + 4, traceNameIndex(event->name));
+      p[6] = event->type;
+      p[7] = event->core;
+      put16(p + 8, traceTaskNumber(event->task));
+    }
+
+    ok &= write(ctx, buf, TRACE_EVENT_SIZE*n) == TRACE_EVENT_SIZE*n;
+  }
+
+  gTraceEnabled = enabled;
+
+  return ok ? 0 : -1;
+}
+
+static int fileWriter(void *ctx, const void *data, int size)
+{
+  return halFileWrite(ctx, data, size);
+}
+
+static int consoleWriter(void *ctx, const void *data, int size)
+{
+  halConsoleWrite(data, size);
+
+  return size;
+}
+
+int TRACEWrite(const char* filename)
+{
+  if (!filename)
+    return -1;
+
+  void *file = halFileOpen(filename, "w");
+  if (!file)
+    return -1;
+
+  int result = traceWrite(fileWriter, file);
+  halFileClose(file);
+
+  return result;
+}
+
+int TRACEStream(void)
+{
+  return traceWrite(consoleWriter, NULL);
+}
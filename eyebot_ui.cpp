@@ -0,0 +1,476 @@
+/*
+Retained widgets of the UI*() functions and the soft key menu of LCDMenu().
+
+Each widget keeps its place, text, value and colours, and is drawn once
+when added and again only when something about it changes. UIUpdate()
+reads the touch screen once and, for a touch that has just begun, finds the
+widget under it in a table of screen cells, each holding a bit for every
+widget overlapping it, so a hit costs a lookup rather than a search.
+
+A touched widget is drawn highlighted and handed back, and its callback is
+called, at once. UIUpdate() draws it plainly again once UI_FLASH_MS have
+passed, so feedback never waits and a control loop that calls UIUpdate()
+every frame pays for little more than the touch read. A stepper held down
+steps again every UI_REPEAT_MS once it has been held for
+UI_REPEAT_DELAY_MS, as long as the finger stays on the same third.
+
+The entries of LCDMenu() are buttons, which UIUpdate() also records in a
+key word while they are held. KEYRead() only reads that word, so it stays
+cheap and leaves every touch to the program's own UIUpdate().
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <stdio.h>
+#include <string.h>
+
+#define UI_TEXT_SIZE 32
+// Side of a square cell of the hit table, in pixels
+#define UI_CELL 16
+#define UI_CELL_COLUMNS ((LCD_WIDTH + UI_CELL - 1) / UI_CELL)
+#define UI_CELL_ROWS ((LCD_HEIGHT + UI_CELL - 1) / UI_CELL)
+#define UI_MENU_HEIGHT 24
+#define UI_MENU_ENTRIES 4
+
+enum {
+  UI_UNUSED,
+  UI_BUTTON_WIDGET,
+  UI_STEPPER_WIDGET,
+  UI_LABEL_WIDGET
+};
+
+// Parts of a widget shown highlighted; a button highlights as a whole
+enum {
+  UI_PART_NONE,
+  UI_PART_WHOLE,
+  UI_PART_MINUS,
+  UI_PART_PLUS
+};
+
+typedef struct {
+  int type;
+  int x, y, w, h;
+  char text[UI_TEXT_SIZE];
+  int value, min, max, step;
+  COLOR fg, bg;
+  UIEventFn fn;
+  void *arg;
+  int flash;// UI_PART_* highlighted
+  uint32_t flashStart;// ms
+  bool dirty;
+} UIWidget;
+
+static UIWidget gUIWidgets[UI_MAX_WIDGETS];
+static uint32_t gUICells[UI_CELL_ROWS][UI_CELL_COLUMNS];
+static bool gUITouching = false;
+// The stepper held down since its touch began, the part held and when it steps again
+static int gUIHeld = -1, gUIHeldPart = UI_PART_NONE;
+static uint32_t gUIRepeatAt = 0;// ms
+static int gUIMenu[UI_MENU_ENTRIES] = {-1, -1, -1, -1};
+// KEY1..KEY4 of the menu entry under the touch at the last UIUpdate()
+static int gUIMenuKeys = NOKEY;
+
+// Sets or clears the bit of a widget in every cell it overlaps
+static void indexWidget(int id, bool set)
+{
+  const UIWidget &widget = gUIWidgets[id];
+  int col1 = widget.x < 0 ? 0 : widget.x / UI_CELL;
+  int row1 = widget.y < 0 ? 0 : widget.y / UI_CELL;
+  int col2 = (widget.x + widget.w - 1) / UI_CELL, row2 = (widget.y + widget.h - 1) / UI_CELL;
+
+  for (int row = row1; row <= row2 && row < UI_CELL_ROWS; row++)
+  for (int col = col1; col <= col2 && col < UI_CELL_COLUMNS; col++)
+  {
+    if (set)
+      gUICells[row][col] |= 1u << id;
+    else
+      gUICells[row][col] &= ~(1u << id);
+  }
+}
+
+// The widget under a point, the last added where they overlap, or -1
+static int hitWidget(int x, int y)
+{
+  if (x < 0 || x >= LCD_WIDTH || y < 0 || y >= LCD_HEIGHT)
+    return -1;
+
+  uint32_t bits = gUICells[y / UI_CELL][x / UI_CELL];
+
+  for (int id = UI_MAX_WIDGETS - 1; id >= 0; id--)
+  {
+    const UIWidget &widget = gUIWidgets[id];
+
+    if ((bits >> id & 1) && x >= widget.x && x < widget.x + widget.w && y >= widget.y && y < widget.y + widget.h)
+      return id;
+  }
+
+  return -1;
+}
+
+static void drawWidget(int id)
+{
+  UIWidget &widget = gUIWidgets[id];
+  widget.dirty = false;
+
+  if (widget.type == UI_STEPPER_WIDGET)
+  {
+    int third = widget.w / 3;
+    char value[16];
+    snprintf(value, sizeof(value), "%d", widget.value);
+
+    bool minus = widget.flash == UI_PART_MINUS, plus = widget.flash == UI_PART_PLUS;
+    LCDTextBox(widget.x, widget.y, third, widget.h, "-", minus ? widget.bg : widget.fg, minus ? widget.fg : widget.bg);
+    LCDTextBox(widget.x + third, widget.y, widget.w - 2*third, widget.h, value, widget.fg, widget.bg);
+    LCDTextBox(widget.x + widget.w - third, widget.y, third, widget.h, "+", plus ? widget.bg : widget.fg, plus ? widget.fg : widget.bg);
+    return;
+  }
+
+  bool inverse = widget.flash == UI_PART_WHOLE;
+  LCDTextBox(widget.x, widget.y, widget.w, widget.h, widget.text, inverse ? widget.bg : widget.fg, inverse ? widget.fg : widget.bg);
+}
+
+static int addWidget(int type, int x, int y, int w, int h, const char *text, COLOR fg, COLOR bg)
+{
+  if (w <= 0 || h <= 0)
+    return -1;
+
+  for (int id = 0; id < UI_MAX_WIDGETS; id++)
+  {
+    UIWidget &widget = gUIWidgets[id];
+    if (widget.type != UI_UNUSED)
+      continue;
+
+    widget = UIWidget();
+    widget.type = type;
+    widget.x = x;
+    widget.y = y;
+    widget.w = w;
+    widget.h = h;
+    widget.fg = fg;
+    widget.bg = bg;
+    snprintf(widget.text, sizeof(widget.text), "%s", text ? text : "");
+
+    if (type != UI_LABEL_WIDGET)
+      indexWidget(id, true);
+
+    return id;
+  }
+
+  return -1;
+}
+
+static UIWidget* getWidget(int id)
+{
+  if (id < 0 || id >= UI_MAX_WIDGETS || gUIWidgets[id].type == UI_UNUSED)
+    return NULL;
+
+  return &gUIWidgets[id];
+}
+
+int UIButton(int x, int y, int w, int h, const char* text, COLOR fg, COLOR bg)
+{
+  int id = addWidget(UI_BUTTON_WIDGET, x, y, w, h, text, fg, bg);
+  if (id >= 0)
+    drawWidget(id);
+
+  return id;
+}
+
+int UIStepper(int x, int y, int w, int h, int value, int min, int max, int step, COLOR fg, COLOR bg)
+{
+  if (min > max || step <= 0)
+    return -1;
+
+  int id = addWidget(UI_STEPPER_WIDGET, x, y, w, h, NULL, fg, bg);
+  if (id < 0)
+    return -1;
+
+  UIWidget &widget = gUIWidgets[id];
+  widget.min = min;
+  widget.max = max;
+  widget.step = step;
+  widget.value = value < min ? min : value > max ? max : value;
+  drawWidget(id);
+
+  return id;
+}
+
+int UILabel(int x, int y, int w, int h, const char* text, COLOR fg, COLOR bg)
+{
+  int id = addWidget(UI_LABEL_WIDGET, x, y, w, h, text, fg, bg);
+  if (id >= 0)
+    drawWidget(id);
+
+  return id;
+}
+
+int UISetText(int id, const char* text)
+{
+  UIWidget *widget = getWidget(id);
+  if (!widget || !text || widget->type == UI_STEPPER_WIDGET)
+    return -1;
+
+  if (strncmp(widget->text, text, UI_TEXT_SIZE - 1) != 0)
+  {
+    snprintf(widget->text, sizeof(widget->text), "%s", text);
+    widget->dirty = true;
+  }
+
+  return 0;
+}
+
+int UISetValue(int id, int value)
+{
+  UIWidget *widget = getWidget(id);
+  if (!widget)
+    return -1;
+
+  if (widget->type == UI_STEPPER_WIDGET)
+    value = value < widget->min ? widget->min : value > widget->max ? widget->max : value;
+
+  if (value != widget->value)
+  {
+    widget->value = value;
+    widget->dirty = widget->type == UI_STEPPER_WIDGET;
+  }
+
+  return 0;
+}
+
+int UIGetValue(int id)
+{
+  UIWidget *widget = getWidget(id);
+
+  return widget ? widget->value : 0;
+}
+
+int UISetCallback(int id, UIEventFn fn, void* arg)
+{
+  UIWidget *widget = getWidget(id);
+  if (!widget)
+    return -1;
+
+  widget->fn = fn;
+  widget->arg = arg;
+
+  return 0;
+}
+
+int UIRemove(int id)
+{
+  if (!getWidget(id))
+    return -1;
+
+  indexWidget(id, false);
+  gUIWidgets[id].type = UI_UNUSED;
+
+  if (gUIHeld == id)
+    gUIHeld = -1;
+
+  for (int k = 0; k < UI_MENU_ENTRIES; k++)
+  {
+    if (gUIMenu[k] == id)
+    {
+      gUIMenu[k] = -1;
+      gUIMenuKeys &= ~(KEY1 << k);
+    }
+  }
+
+  return 0;
+}
+
+int UIClear(void)
+{
+  for (int id = 0; id < UI_MAX_WIDGETS; id++)
+    UIRemove(id);
+
+  return 0;
+}
+
+int UIRedraw(void)
+{
+  for (int id = 0; id < UI_MAX_WIDGETS; id++)
+    if (gUIWidgets[id].type != UI_UNUSED)
+      drawWidget(id);
+
+  return 0;
+}
+
+// The third of a stepper at x
+static int stepperPart(const UIWidget &widget, int x)
+{
+  int third = widget.w / 3;
+
+  if (x < widget.x + third)
+    return UI_PART_MINUS;
+  if (x >= widget.x + widget.w - third)
+    return UI_PART_PLUS;
+
+  return UI_PART_NONE;
+}
+
+// Applies a touch to a widget; false if it touched nothing that acts
+static bool pressWidget(int id, int x)
+{
+  UIWidget &widget = gUIWidgets[id];
+
+  if (widget.type == UI_BUTTON_WIDGET)
+  {
+    widget.value++;
+    widget.flash = UI_PART_WHOLE;
+  }
+  else
+  {
+    int part = stepperPart(widget, x);
+
+    if (part == UI_PART_MINUS)
+      widget.value = widget.value - widget.step < widget.min ? widget.min : widget.value - widget.step;
+    else if (part == UI_PART_PLUS)
+      widget.value = widget.value + widget.step > widget.max ? widget.max : widget.value + widget.step;
+    else
+      return false;
+
+    widget.flash = part;
+  }
+
+  widget.flashStart = halMillis();
+  drawWidget(id);
+
+  if (widget.fn)
+    widget.fn(id, widget.value, widget.arg);
+
+  return true;
+}
+
+// KEY1..KEY4 if id is an entry of the menu, else NOKEY
+static int menuKey(int id)
+{
+  for (int k = 0; k < UI_MENU_ENTRIES; k++)
+    if (id >= 0 && gUIMenu[k] == id)
+      return KEY1 << k;
+
+  return NOKEY;
+}
+
+int UIUpdate(void)
+{
+  int touched = -1, x, y;
+  uint32_t now = halMillis();
+
+  // Only the start of a touch acts, however long the finger stays down,
+  // but for the repeats of a stepper
+  if (KEYReadXY(&x, &y) == 0 && x >= 0 && y >= 0)
+  {
+    if (!gUITouching)
+    {
+      int id = hitWidget(x, y);
+      if (id >= 0 && pressWidget(id, x))
+      {
+        touched = id;
+        gUIMenuKeys = menuKey(id);
+
+        if (gUIWidgets[id].type == UI_STEPPER_WIDGET)
+        {
+          gUIHeld = id;
+          gUIHeldPart = gUIWidgets[id].flash;
+          gUIRepeatAt = now + UI_REPEAT_DELAY_MS;
+        }
+      }
+    }
+    else if (gUIHeld >= 0 && (int32_t)(now - gUIRepeatAt) >= 0)
+    {
+      // A finger slid off the third it pressed stops the repeats
+      if (hitWidget(x, y) == gUIHeld && stepperPart(gUIWidgets[gUIHeld], x) == gUIHeldPart && pressWidget(gUIHeld, x))
+      {
+        touched = gUIHeld;
+        gUIRepeatAt = now + UI_REPEAT_MS;
+      }
+      else
+        gUIHeld = -1;
+    }
+    gUITouching = true;
+  }
+  else
+  {
+    gUITouching = false;
+    gUIHeld = -1;
+    gUIMenuKeys = NOKEY;
+  }
+
+  for (int id = 0; id < UI_MAX_WIDGETS; id++)
+  {
+    UIWidget &widget = gUIWidgets[id];
+    if (widget.type == UI_UNUSED || id == touched)
+      continue;
+
+    // A stepper stays highlighted while it is held
+    if (widget.flash != UI_PART_NONE && id != gUIHeld && now - widget.flashStart >= UI_FLASH_MS)
+    {
+      widget.flash = UI_PART_NONE;
+      widget.dirty = true;
+    }
+
+    if (widget.dirty)
+      drawWidget(id);
+  }
+
+  return touched;
+}
+
+/*
+The entries are buttons along the bottom of the display, an empty or NULL
+string leaving its place blank. A menu replaces the one before it.
+*/
+static int setMenuEntry(int pos, const char *string, COLOR fg, COLOR bg)
+{
+  int k = pos - 1;
+
+  if (gUIMenu[k] >= 0)
+    UIRemove(gUIMenu[k]);
+
+  int x1 = k*LCD_WIDTH/UI_MENU_ENTRIES, x2 = (k + 1)*LCD_WIDTH/UI_MENU_ENTRIES;
+  LCDArea(x1, LCD_HEIGHT - UI_MENU_HEIGHT, x2, LCD_HEIGHT, BLACK);
+
+  if (!string || !*string)
+    return 0;
+
+  gUIMenu[k] = UIButton(x1, LCD_HEIGHT - UI_MENU_HEIGHT, x2 - x1 - 1, UI_MENU_HEIGHT, string, fg, bg);
+
+  return gUIMenu[k] >= 0 ? 0 : -1;
+}
+
+int LCDMenu(char *st1, char *st2, char *st3, char *st4)
+{
+  const char *entries[UI_MENU_ENTRIES] = {st1, st2, st3, st4};
+  int result = 0;
+
+  for (int k = 0; k < UI_MENU_ENTRIES; k++)
+    if (setMenuEntry(k + 1, entries[k], BLACK, WHITE) != 0)
+      result = -1;
+
+  return result;
+}
+
+int LCDMenuI(int pos, char *string, COLOR fg, COLOR bg)
+{
+  if (pos < 1 || pos > UI_MENU_ENTRIES)
+    return -1;
+
+  return setMenuEntry(pos, string, fg, bg);
+}
+
+int UIMenuRead(void)
+{
+  return gUIMenuKeys;
+}
+
+int UIMenuGet(void)
+{
+  bool shown = false;
+  for (int k = 0; k < UI_MENU_ENTRIES; k++)
+    shown |= gUIMenu[k] >= 0;
+
+  if (!shown)
+    return NOKEY;
+
+  return menuKey(UIUpdate());
+}
@@ -0,0 +1,64 @@
+/*
+Host implementation of the Arduino core functions declared in
+host/include/Arduino.h, on top of the simulated board.
+*/
+#include <Arduino.h>
+#include "eyebot_hal.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+uint32_t EspClass::getCycleCount()
+{
+  return halCycles();
+}
+
+size_t HardwareSerial::printf(const char *format, ...)
+{
+  va_list arg_ptr;
+  va_start(arg_ptr, format);
+  int len = vprintf(format, arg_ptr);
+  va_end(arg_ptr);
+
+  return len < 0 ? 0 : len;
+}
+
+unsigned long millis(void)
+{
+  return halMillis();
+}
+
+unsigned long micros(void)
+{
+  return halMicros();
+}
+
+void delay(unsigned long ms)
+{
+  halDelay(ms);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  uint32_t start = halMicros();
+  while (halMicros() - start < us);
+}
+
+void yield(void)
+{
+}
+
+long random(long howbig)
+{
+  return howbig > 0 ? rand() % howbig : 0;
+}
+
+long random(long howsmall, long howbig)
+{
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+  srand(seed);
+}
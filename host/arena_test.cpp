@@ -0,0 +1,259 @@
+/*
+Host tests for the scratch memory of the ARENA*() functions.
+
+Allocations must be zeroed and aligned as asked, fall back to the other
+pool when the hinted one is full or missing, and be refused when neither
+has room, however large the size or alignment. ARENAReset() must hand out
+the same memory again while the high-water mark of each pool keeps the
+most ever in use. Only the task that called ARENAInit() may allocate.
+IPHistogram*() and IPMarkerDetect() must take their scratch from the arena
+when it has room, and give the same results from it, without it and from
+every band of IPParallelFor() at once. The usage of both pools is printed
+with ARENAPrint().
+
+Build and run from the repository root as the arena_test target of the host
+build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/arena_test
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SRAM_SIZE 4096
+#define PSRAM_SIZE 16384
+#define HIST_RUNS 50
+#define WIDTH 160
+#define HEIGHT 120
+
+static BYTE gGray[QQVGA_PIXELS];
+static int gHist[256];
+static int gBandHists[IP_MAX_BANDS][256];
+static std::atomic<int> gBandErrors(0);
+static std::atomic<bool> gOtherDone(false);
+static void *pOtherAlloc = (void*)1;
+
+static bool zeroed(const void *mem, int size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    if (((const BYTE*)mem)[i])
+      return false;
+  }
+
+  return true;
+}
+
+static bool usage(int pool, int size, int used, int peak)
+{
+  int s, u, p;
+  return ARENAGetUsage(pool, &s, &u, &p) == 0 && s == size && u == used && p == peak;
+}
+
+static int testAlignment(void)
+{
+  int failures = 0;
+
+  ARENAInit(SRAM_SIZE, PSRAM_SIZE);
+
+  BYTE *a = (BYTE*)ARENAAlloc(1, ARENA_SRAM);
+  BYTE *b = (BYTE*)ARENAAlloc(100, ARENA_SRAM);
+  BYTE *c = (BYTE*)ARENAAlloc(10, ARENA_SRAM, 256);
+  BYTE *d = (BYTE*)ARENAAlloc(0, ARENA_SRAM, 1);
+
+  if (!a || !b || !c || !d || (uintptr_t)a % ARENA_ALIGN || (uintptr_t)b % ARENA_ALIGN || (uintptr_t)c % 256 ||
+      b < a + 1 || c < b + 100 || d < c + 10 || !zeroed(b, 100))
+  {
+    printf("allocations misaligned or overlapping\n");
+    failures++;
+  }
+
+  if (ARENAAlloc(16, ARENA_SRAM, 3) || ARENAAlloc(16, ARENA_SRAM, -4) || ARENAAlloc(-1, ARENA_SRAM) ||
+      ARENAAlloc(16, 2))
+  {
+    printf("invalid allocation granted\n");
+    failures++;
+  }
+
+  // Sizes and alignments that would overflow the end of a pool
+  if (ARENAAlloc(INT_MAX, ARENA_SRAM) || ARENAAlloc(INT_MAX - 8, ARENA_PSRAM, 1) ||
+      ARENAAlloc(1, ARENA_SRAM, 1 << 30))
+  {
+    printf("oversized allocation granted\n");
+    failures++;
+  }
+
+  // Memory handed out again after a reset is zeroed again
+  memset(b, 0xFF, 100);
+  ARENAReset();
+  ARENAAlloc(1, ARENA_SRAM);
+  if (ARENAAlloc(100, ARENA_SRAM) != b || !zeroed(b, 100))
+  {
+    printf("memory after reset not reused or not zeroed\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testFallback(void)
+{
+  int failures = 0;
+
+  ARENAInit(SRAM_SIZE, PSRAM_SIZE);
+
+  void *whole = ARENAAlloc(SRAM_SIZE, ARENA_SRAM);
+  void *spill = ARENAAlloc(1000, ARENA_SRAM);
+
+  if (!whole || !spill || !usage(ARENA_SRAM, SRAM_SIZE, SRAM_SIZE, SRAM_SIZE) ||
+      !usage(ARENA_PSRAM, PSRAM_SIZE, 1000, 1000))
+  {
+    printf("full SRAM pool did not fall back to PSRAM\n");
+    failures++;
+  }
+
+  if (ARENAAlloc(PSRAM_SIZE, ARENA_PSRAM) || ARENAAlloc(PSRAM_SIZE - 1000 + 1, ARENA_SRAM, 1))
+  {
+    printf("allocation granted beyond both pools\n");
+    failures++;
+  }
+
+  // Without a PSRAM pool everything comes from SRAM
+  ARENAInit(SRAM_SIZE, 0);
+  if (!ARENAAlloc(100, ARENA_PSRAM) || !usage(ARENA_SRAM, SRAM_SIZE, 100, 100) || !usage(ARENA_PSRAM, 0, 0, 0) ||
+      ARENAAlloc(SRAM_SIZE, ARENA_PSRAM))
+  {
+    printf("missing PSRAM pool did not fall back to SRAM\n");
+    failures++;
+  }
+
+  if (ARENAInit(-1, 0) != -1)
+  {
+    printf("negative pool size accepted\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testPeak(void)
+{
+  int failures = 0;
+
+  ARENAInit(SRAM_SIZE, PSRAM_SIZE);
+
+  ARENAAlloc(1000, ARENA_PSRAM, 1);
+  ARENAAlloc(2000, ARENA_PSRAM, 1);
+  ARENAReset();
+  ARENAAlloc(500, ARENA_PSRAM, 1);
+
+  if (!usage(ARENA_PSRAM, PSRAM_SIZE, 500, 3000) || !usage(ARENA_SRAM, SRAM_SIZE, 0, 0))
+  {
+    printf("peak not kept across reset\n");
+    failures++;
+  }
+
+  ARENAAlloc(3000, ARENA_PSRAM, 1);
+  if (!usage(ARENA_PSRAM, PSRAM_SIZE, 3500, 3500))
+  {
+    printf("peak not raised\n");
+    failures++;
+  }
+
+  ARENAPrint();
+
+  // A new arena starts its statistics afresh
+  ARENAInit(SRAM_SIZE, PSRAM_SIZE);
+  if (!usage(ARENA_PSRAM, PSRAM_SIZE, 0, 0))
+  {
+    printf("peak kept across ARENAInit\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+static void otherTask(void *arg)
+{
+  pOtherAlloc = ARENAAlloc(16, ARENA_SRAM);
+  gOtherDone = true;
+}
+
+// Each band histograms the whole image over and over, all bands at once
+static void histogramBand(int first, int last, void *arg)
+{
+  for (int run = 0; run < HIST_RUNS; run++)
+  {
+    IPHistogram(gGray, gBandHists[first]);
+    if (memcmp(gBandHists[first], gHist, sizeof(gHist)) != 0)
+      gBandErrors++;
+  }
+}
+
+static int testKernels(void)
+{
+  int failures = 0, used, hist[256];
+
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    gGray[i] = (i*7 + i/WIDTH*3) & 0xFF;
+
+  ARENAInit(0, 0);
+  IPHistogram(gGray, gHist);
+
+  ARENAInit(64*1024, 0);
+  halTaskCreate(otherTask, NULL, 1, "other");
+  while (!gOtherDone)
+    halYield();
+  if (pOtherAlloc)
+  {
+    printf("another task allocated from the arena\n");
+    failures++;
+  }
+
+  IPHistogram(gGray, hist);
+  ARENAGetUsage(ARENA_SRAM, NULL, &used, NULL);
+  if (used < 4*256*(int)sizeof(uint32_t) || memcmp(hist, gHist, sizeof(hist)) != 0)
+  {
+    printf("histogram took %d bytes of the arena\n", used);
+    failures++;
+  }
+
+  IPMarker markers[4];
+  int before = used, found = IPMarkerDetect(gGray, WIDTH, HEIGHT, markers, 4);
+  ARENAGetUsage(ARENA_SRAM, NULL, &used, NULL);
+  if (found < 0 || used < before + (WIDTH + 2)*(HEIGHT + 2))
+  {
+    printf("marker detection took %d bytes of the arena\n", used - before);
+    failures++;
+  }
+
+  // The band in this task takes from the arena, the rest share or allocate
+  ARENAReset();
+  IPSetBands(IP_MAX_BANDS);
+  IPParallelFor(IP_MAX_BANDS, 0, histogramBand, NULL);
+  IPSetBands(1);
+  if (gBandErrors != 0)
+  {
+    printf("%d histograms wrong in parallel bands\n", (int)gBandErrors);
+    failures++;
+  }
+
+  return failures;
+}
+
+int main(void)
+{
+  int failures = testAlignment();
+  failures += testFallback();
+  failures += testPeak();
+  failures += testKernels();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#ifndef EYEBOT_HOST_H
+#define EYEBOT_HOST_H
+
+/*
+Controls of the simulated EyeBot in host/hal_linux.cpp.
+
+Host programs and tests use these to drive the simulated board directly.
+Example sketches run unchanged, so the same controls are also read from
+environment variables when the library first touches the board:
+
+  EYEBOT_CLOCK=virtual     Time only advances through delays, camera frames
+                           and busy waits, instead of following the wall clock;
+                           once tasks of halTaskCreate() run, waits also take
+                           their time on the wall clock
+  EYEBOT_CAMERA=<path>     A PPM or PGM image, or a directory of them played in
+                           name order, instead of the synthetic camera scene
+  EYEBOT_CAMERA_FPS=<n>    Camera frame rate, 0 for frames without waiting (30)
+  EYEBOT_PSD_RAW=<n>       Raw ADC value of the PSD distance sensor (0)
+  EYEBOT_RUN_MS=<n>        Exit after n milliseconds on the clock
+  EYEBOT_RUN_FRAMES=<n>    Exit when the program asks for camera frame n+1
+  EYEBOT_LCD_DUMP=<path>   Write the display to a .png or .ppm file on exit
+  EYEBOT_TRACE_MOTORS=1    Print every change of motor direction and PWM
+  EYEBOT_FATFS=<dir>       Directory holding the flash file system (.)
+  EYEBOT_SCRIPT=<events>   Timed input, as events separated by ';' of the form
+                           "<ms> key1|key2 [<hold ms>]", "<ms> touch <x> <y> [<hold ms>]",
+                           "<ms> psd <raw>", "<ms> dump <path>" or "<ms> quit"
+  EYEBOT_SIM=<map>         Drive a simulated robot on a floor map, "circuit" for
+                           the built-in oval lane or a PPM or PGM image, which
+                           then provides the camera and PSD (see host/sim.cpp)
+  EYEBOT_SIM_SCALE=<mm>    Millimetres per pixel of the floor map (5)
+  EYEBOT_SIM_POSE=<x,y,phi> Starting pose in mm and degrees clockwise from the
+                           map's y axis (the circuit's start, or the map centre)
+  EYEBOT_SIM_LOG=<path>    Write the pose of every camera frame as CSV
+*/
+
+#include "eyebot_hal.h"
+
+// Source of simulated camera frames, filling a QQVGA RGB565 image
+typedef void (*HostCamSource)(RGB565 *frame, int index, void *arg);
+
+// Reads the environment, called automatically on first use of the board
+void hostInit(void);
+
+// Runs due timers, scripted input and run limits
+void hostPoll(void);
+
+// Time on the simulated clock in microseconds
+uint64_t hostClockMicros(void);
+
+// Selects the virtual clock, which only advances when told to
+void hostClockVirtual(int enable);
+
+// Advances the clock, running whatever falls due on the way
+void hostClockAdvance(uint64_t us);
+
+// Presses or releases a physical button
+void hostSetButton(int button, int pressed);
+
+// Touches the screen at x, y, or releases it when x is negative
+void hostSetTouch(int x, int y);
+
+// Sets the raw ADC value of the PSD distance sensor
+void hostSetPSDRaw(int raw);
+
+// Reads a motor's direction pin level and PWM duty cycle
+void hostGetMotor(int motor, int *level, int *duty);
+
+// Replaces the camera scene, or restores the configured one when source is NULL
+void hostCamSetSource(HostCamSource source, void *arg);
+
+// Number of camera frames delivered so far
+int hostCamFrames(void);
+
+// The simulated display, LCD_WIDTH x LCD_HEIGHT native RGB565 pixels
+const RGB565* hostLCDPixels(void);
+
+// Number of regions copied from the frame buffer to the display by halLCDFlush, and their pixels, since the start
+void hostLCDGetFlushes(int *flushes, int *pixels);
+
+// Writes the display to a .png or .ppm file
+int hostLCDWrite(const char *path);
+
+// Laps, lane departures and wall collisions of the simulated robot, and the distance it drove in mm
+typedef struct {
+  int laps;
+  uint32_t lastLapMs, bestLapMs;
+  int departures;
+  int collisions;
+  double distance;
+} HostSimStats;
+
+// Drives a simulated robot on a PPM or PGM floor map of scale mm per pixel (0: 5), or on the built-in circuit when path is NULL or "circuit"
+int hostSimStart(const char *path, double scale);
+
+// Places the simulated robot at x, y in mm, heading phi degrees clockwise from the map's y axis, and makes it the start of a lap
+void hostSimSetPose(double x, double y, double phi);
+
+// Reads the pose of the simulated robot
+void hostSimGetPose(double *x, double *y, double *phi);
+
+// Moves the simulated robot up to the current time, done by the board before every motor change and sensor read
+void hostSimUpdate(void);
+
+// Reads the statistics of the simulated drive
+void hostSimGetStats(HostSimStats *stats);
+
+// Prints the statistics of the simulated drive as one line of key=value pairs, done when the program ends
+void hostSimPrint(void);
+
+#endif
@@ -0,0 +1,1329 @@
+/*
+Linux implementation of eyebot_hal.h: a simulated EyeBot.
+
+The display is a framebuffer in memory that can be written to PNG or PPM
+files, the camera plays image files or renders a synthetic scene, and the
+motors, buttons, touch screen and PSD sensor are plain variables set through
+eyebot_host.h or an input script, or driven by the robot simulation of
+host/sim.cpp. The clock either follows the wall clock or is virtual, in
+which case it only advances when the program waits, so that runs are
+repeatable and independent of the speed of the host.
+*/
+#include "eyebot.h"
+#include "eyebot_host.h"
+#include "lcd_font.h"
+#include <FFat.h>
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+
+#define QQVGA_WIDTH 160
+#define QQVGA_HEIGHT 120
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// Camera frame rate unless EYEBOT_CAMERA_FPS says otherwise
+#define DEFAULT_CAM_FPS 30
+// Time a busy wait costs on the virtual clock, and roughly what reading
+// each input costs on the board, so that programs polling them see time pass
+#define IDLE_US 1000
+#define CLOCK_READ_US 1
+#define BUTTON_READ_US 1
+#define PSD_READ_US 20
+#define TOUCH_READ_US 200
+#define TOUCH_PEEK_US 1
+
+enum ScriptAction
+{
+  SCRIPT_KEY,
+  SCRIPT_TOUCH,
+  SCRIPT_PSD,
+  SCRIPT_DUMP,
+  SCRIPT_QUIT
+};
+
+struct ScriptEvent
+{
+  uint64_t time;// us
+  int action;
+  int a, b;
+  uint64_t hold;// us
+  std::string path;
+};
+
+// One lock serialises the simulated board between the tasks of
+// halTaskCreate(). It is recursive, as the board calls back into itself.
+static std::recursive_mutex gLock;
+#define HOST_LOCK() std::lock_guard<std::recursive_mutex> host_lock(gLock)
+static thread_local int gCoreID = 0;
+// Tasks of halTaskCreate() not waiting on a semaphore
+static std::atomic<int> gTaskCount(0);
+static thread_local bool gIsTask = false;
+
+static bool gInitialised = false;
+
+static bool gVirtualClock = false;
+static uint64_t gVirtualMicros = 0;
+static struct timespec gStartTime;
+static uint64_t gRunLimit = 0;// us, 0 for none
+static int gFrameLimit = 0;
+
+static RGB565 gLCD[LCD_WIDTH*LCD_HEIGHT];
+// Off-screen frame buffer of halLCDSetBuffered(), and where drawing goes
+static RGB565 gLCDFrame[LCD_WIDTH*LCD_HEIGHT];
+static RGB565 *pLCDDraw = gLCD;
+static int gLCDFlushes = 0, gLCDFlushPixels = 0;
+static int gCursorX = 0, gCursorY = 0;
+static RGB565 gTextFg = 0xFFFF, gTextBg = 0xFFFF;
+static int gTextSize = 1, gTextFont = HAL_FONT_GLCD;
+static std::string gLCDDumpPath;
+
+// The block of halLCDPushRectAsync() not yet on the display
+typedef struct {
+  int x, y, w, h;
+  const RGB565 *data;
+} LCDPush;
+static LCDPush gLCDPush = {0, 0, 0, 0, NULL};
+
+static int gMotorLevel[2] = {1, 0};
+static int gMotorDuty[2] = {0, 0};
+static bool gTraceMotors = false;
+static void (*gMotorTimerCallback)(void) = NULL;
+static bool gMotorTimerActive = false;
+static uint64_t gMotorTimerDeadline = 0;
+// The tick timer, which is not ticked again while its callback runs
+static void (*gTickCallback)(void) = NULL;
+static uint64_t gTickPeriod = 0, gTickNext = 0;
+static bool gTickRunning = false;
+
+static int gButtons[2] = {0, 0};
+static uint64_t gButtonRelease[2] = {0, 0};
+// When each button went down, and whether it has been reported held since
+static uint64_t gButtonDown[2] = {0, 0};
+static bool gButtonHeld[2] = {false, false};
+static void (*gButtonReport)(int button, int state) = NULL;
+static uint64_t gButtonHold = 0;
+static int gTouchX = -1, gTouchY = -1;
+static uint64_t gTouchRelease = 0;
+static void (*gTouchReport)(int x, int y, int touched) = NULL;
+static int gPSDRaw = 0;
+
+static std::vector<ScriptEvent> gScript;
+static size_t gScriptNext = 0;
+
+static HostCamSource gCamSource = NULL;
+static void *gCamSourceArg = NULL;
+static std::vector<std::vector<RGB565> > gCamFiles;
+static int gCamFrames = 0;
+static uint64_t gCamPeriod = 1000000 / DEFAULT_CAM_FPS;
+static uint64_t gCamNextFrame = 0;
+
+static RGB565 rgb565(int r, int g, int b)
+{
+  return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+static uint64_t wallMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - gStartTime.tv_sec)*1000000 + now.tv_nsec/1000 - gStartTime.tv_nsec/1000;
+}
+
+static uint64_t now()
+{
+  return gVirtualClock ? gVirtualMicros : wallMicros();
+}
+
+// Charges the cost of an input read to the virtual clock
+static void spend(uint64_t us)
+{
+  if (gVirtualClock)
+    gVirtualMicros += us;
+}
+
+// Waits on whichever clock is in use
+static void waitMicros(uint64_t us)
+{
+  if (gVirtualClock)
+  {
+    hostClockAdvance(us);
+
+    // A virtual wait would leave the other tasks no time to run, so once
+    // there are any it also takes its time on the wall clock
+    if (gTaskCount == 0)
+      return;
+  }
+
+  // Callers hold the lock once, and other tasks may use the board meanwhile
+  struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000)*1000};
+  gLock.unlock();
+  nanosleep(&ts, NULL);
+  gLock.lock();
+  if (!gVirtualClock)
+    hostPoll();
+}
+
+/*
+Images are read as binary PPM or PGM with 8-bit samples, and scaled to QQVGA
+by nearest neighbour if they are of another size.
+*/
+static bool readImage(const char *path, std::vector<RGB565> *frame)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  char magic[3] = {};
+  int width, height, maxval;
+  if (fscanf(file, "%2s %d %d %d", magic, &width, &height, &maxval) != 4 || maxval != 255 ||
+      (strcmp(magic, "P6") && strcmp(magic, "P5")) || width <= 0 || height <= 0)
+  {
+    fclose(file);
+    return false;
+  }
+  fgetc(file);
+
+  int channels = magic[1] == '6' ? 3 : 1;
+  std::vector<uint8_t> data((size_t)width*height*channels);
+  bool complete = fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  if (!complete)
+    return false;
+
+  frame->resize(QQVGA_WIDTH*QQVGA_HEIGHT);
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  for (int x = 0; x < QQVGA_WIDTH; x++)
+  {
+    const uint8_t *p = &data[((size_t)(y*height/QQVGA_HEIGHT)*width + x*width/QQVGA_WIDTH)*channels];
+    (*frame)[y*QQVGA_WIDTH + x] = channels == 3 ? rgb565(p[0], p[1], p[2]) : rgb565(p[0], p[0], p[0]);
+  }
+
+  return true;
+}
+
+static bool hasImageExtension(const std::string &name)
+{
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos)
+    return false;
+
+  std::string ext = name.substr(dot);
+  return ext == ".ppm" || ext == ".pgm";
+}
+
+static void loadCamFiles(const char *path)
+{
+  std::vector<std::string> names;
+  DIR *dir = opendir(path);
+
+  if (dir)
+  {
+    while (struct dirent *entry = readdir(dir))
+      if (hasImageExtension(entry->d_name))
+        names.push_back(std::string(path) + "/" + entry->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+  }
+  else
+    names.push_back(path);
+
+  for (const std::string &name : names)
+  {
+    std::vector<RGB565> frame;
+    if (readImage(name.c_str(), &frame))
+      gCamFiles.push_back(frame);
+    else
+      fprintf(stderr, "eyebot: cannot read camera image %s\n", name.c_str());
+  }
+}
+
+/*
+The synthetic scene is a light floor with a dark lane line that sways from
+side to side, and a red ball moving across the top of the image, so that the
+lane and colour following examples have something to follow.
+*/
+static void syntheticScene(RGB565 *frame, int index, void *arg)
+{
+  float ball_x = QQVGA_WIDTH/2 + 50*sinf(index*0.03f);
+  const float BALL_Y = 30, BALL_R = 10;
+
+  for (int y = 0; y < QQVGA_HEIGHT; y++)
+  {
+    float line_x = QQVGA_WIDTH/2 + 30*sinf(index*0.05f + y*0.02f);
+    int floor = 140 + 40*y/QQVGA_HEIGHT;
+
+    for (int x = 0; x < QQVGA_WIDTH; x++)
+    {
+      float dx = x - ball_x, dy = y - BALL_Y;
+      RGB565 col;
+
+      if (dx*dx + dy*dy <= BALL_R*BALL_R)
+        col = rgb565(220, 30, 30);
+      else if (fabsf(x - line_x) <= 3)
+        col = rgb565(20, 20, 20);
+      else
+        col = rgb565(floor, floor, floor - 10);
+
+      frame[y*QQVGA_WIDTH + x] = col;
+    }
+  }
+}
+
+static void fileScene(RGB565 *frame, int index, void *arg)
+{
+  const std::vector<RGB565> &file = gCamFiles[index % gCamFiles.size()];
+  memcpy(frame, file.data(), file.size()*sizeof(RGB565));
+}
+
+static void parseScript(const char *script)
+{
+  std::string text(script);
+  size_t pos = 0;
+
+  while (pos < text.size())
+  {
+    size_t end = text.find(';', pos);
+    if (end == std::string::npos)
+      end = text.size();
+    std::string item = text.substr(pos, end - pos);
+    pos = end + 1;
+
+    char name[16], path[256];
+    unsigned long ms, hold = 100;
+    int a = 0, b = 0;
+    ScriptEvent event;
+
+    if (sscanf(item.c_str(), "%lu %15s", &ms, name) != 2)
+      continue;
+
+    const char *args = strstr(item.c_str(), name) + strlen(name);
+
+    if (!strcmp(name, "key1") || !strcmp(name, "key2"))
+    {
+      sscanf(args, "%lu", &hold);
+      event.action = SCRIPT_KEY;
+      a = name[3] == '1' ? HAL_BUTTON_LEFT : HAL_BUTTON_RIGHT;
+    }
+    else if (!strcmp(name, "touch") && sscanf(args, "%d %d %lu", &a, &b, &hold) >= 2)
+      event.action = SCRIPT_TOUCH;
+    else if (!strcmp(name, "psd") && sscanf(args, "%d", &a) == 1)
+      event.action = SCRIPT_PSD;
+    else if (!strcmp(name, "dump") && sscanf(args, "%255s", path) == 1)
+    {
+      event.action = SCRIPT_DUMP;
+      event.path = path;
+    }
+    else if (!strcmp(name, "quit"))
+      event.action = SCRIPT_QUIT;
+    else
+    {
+      fprintf(stderr, "eyebot: ignoring script event '%s'\n", item.c_str());
+      continue;
+    }
+
+    event.time = (uint64_t)ms*1000;
+    event.a = a;
+    event.b = b;
+    event.hold = (uint64_t)hold*1000;
+    gScript.push_back(event);
+  }
+
+  std::stable_sort(gScript.begin(), gScript.end(),
+                   [](const ScriptEvent &x, const ScriptEvent &y) { return x.time < y.time; });
+}
+
+static void reportOnExit()
+{
+  hostSimPrint();
+  if (!gLCDDumpPath.empty())
+    hostLCDWrite(gLCDDumpPath.c_str());
+}
+
+// Ends the run from whichever task reaches a limit, without destroying
+// state that other tasks may still be using
+static void finish()
+{
+  reportOnExit();
+  fflush(stdout);
+  fflush(stderr);
+  _exit(0);
+}
+
+// A change of touch is reported at once, as the controller's interrupt would
+// have it read; the report may poll, so the release time is set beforehand
+static void setTouch(int x, int y)
+{
+  bool changed = x != gTouchX || y != gTouchY;
+  gTouchX = x;
+  gTouchY = y;
+
+  if (changed && gTouchReport)
+    gTouchReport(x, y, x >= 0);
+}
+
+// Likewise a button, which needs no debouncing here
+static void setButton(int button, int pressed)
+{
+  if (pressed == gButtons[button])
+    return;
+
+  gButtons[button] = pressed;
+  gButtonDown[button] = now();
+  gButtonHeld[button] = false;
+
+  if (gButtonReport)
+    gButtonReport(button, pressed ? HAL_BUTTON_PRESSED : HAL_BUTTON_RELEASED);
+}
+
+static void runScript(uint64_t time)
+{
+  while (gScriptNext < gScript.size() && gScript[gScriptNext].time <= time)
+  {
+    const ScriptEvent &event = gScript[gScriptNext++];
+
+    switch (event.action)
+    {
+      case SCRIPT_KEY:
+        gButtonRelease[event.a] = event.time + event.hold;
+        setButton(event.a, 1);
+        break;
+      case SCRIPT_TOUCH:
+        gTouchRelease = event.time + event.hold;
+        setTouch(event.a, event.b);
+        break;
+      case SCRIPT_PSD:
+        gPSDRaw = event.a;
+        break;
+      case SCRIPT_DUMP:
+        hostLCDWrite(event.path.c_str());
+        break;
+      case SCRIPT_QUIT:
+        finish();
+    }
+  }
+}
+
+void hostInit(void)
+{
+  HOST_LOCK();
+  if (gInitialised)
+    return;
+  gInitialised = true;
+
+  clock_gettime(CLOCK_MONOTONIC, &gStartTime);
+
+  const char *value;
+  if ((value = getenv("EYEBOT_CLOCK")) && !strcmp(value, "virtual"))
+    gVirtualClock = true;
+  if ((value = getenv("EYEBOT_CAMERA")) && *value)
+    loadCamFiles(value);
+  if ((value = getenv("EYEBOT_CAMERA_FPS")))
+    gCamPeriod = atoi(value) > 0 ? 1000000 / atoi(value) : 0;
+  if ((value = getenv("EYEBOT_PSD_RAW")))
+    gPSDRaw = atoi(value);
+  if ((value = getenv("EYEBOT_RUN_MS")))
+    gRunLimit = (uint64_t)atol(value)*1000;
+  if ((value = getenv("EYEBOT_RUN_FRAMES")))
+    gFrameLimit = atoi(value);
+  if ((value = getenv("EYEBOT_TRACE_MOTORS")))
+    gTraceMotors = atoi(value) != 0;
+  if ((value = getenv("EYEBOT_SCRIPT")))
+    parseScript(value);
+  if ((value = getenv("EYEBOT_LCD_DUMP")) && *value)
+    gLCDDumpPath = value;
+  if ((value = getenv("EYEBOT_SIM")) && *value)
+  {
+    const char *scale = getenv("EYEBOT_SIM_SCALE"), *pose = getenv("EYEBOT_SIM_POSE");
+    double x, y, phi;
+
+    if (hostSimStart(value, scale ? atof(scale) : 0) == 0 && pose && sscanf(pose, "%lf,%lf,%lf", &x, &y, &phi) == 3)
+      hostSimSetPose(x, y, phi);
+  }
+
+  atexit(reportOnExit);
+}
+
+void hostPoll(void)
+{
+  HOST_LOCK();
+  hostInit();
+  uint64_t time = now();
+
+  if (gMotorTimerActive && time >= gMotorTimerDeadline)
+  {
+    gMotorTimerActive = false;
+    if (gMotorTimerCallback)
+      gMotorTimerCallback();
+  }
+
+  // Ticks missed meanwhile are one call, as they are for the tick task
+  if (gTickCallback && !gTickRunning && time >= gTickNext)
+  {
+    gTickNext += ((time - gTickNext) / gTickPeriod + 1)*gTickPeriod;
+    gTickRunning = true;
+    gTickCallback();
+    gTickRunning = false;
+  }
+
+  runScript(time);
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (gButtons[i] && gButtonRelease[i] && time >= gButtonRelease[i])
+      setButton(i, 0);
+
+    if (gButtons[i] && gButtonReport && !gButtonHeld[i] && time - gButtonDown[i] >= gButtonHold)
+    {
+      gButtonHeld[i] = true;
+      gButtonReport(i, HAL_BUTTON_HELD);
+    }
+  }
+
+  if (gTouchX >= 0 && gTouchRelease && time >= gTouchRelease)
+    setTouch(-1, -1);
+
+  if (gRunLimit && time >= gRunLimit)
+    finish();
+}
+
+uint64_t hostClockMicros(void)
+{
+  HOST_LOCK();
+  hostInit();
+  return now();
+}
+
+void hostClockVirtual(int enable)
+{
+  HOST_LOCK();
+  hostInit();
+  if (enable && !gVirtualClock)
+    gVirtualMicros = wallMicros();
+  gVirtualClock = enable;
+}
+
+// The clock is stepped to each pending timer deadline and tick, so that a
+// timer firing during a long delay sees the time it was due
+void hostClockAdvance(uint64_t us)
+{
+  HOST_LOCK();
+  hostInit();
+  uint64_t target = gVirtualMicros + us;
+
+  while (true)
+  {
+    uint64_t next = target;
+    if (gMotorTimerActive)
+      next = MIN(next, gMotorTimerDeadline);
+    if (gTickCallback && !gTickRunning)
+      next = MIN(next, gTickNext);
+    if (next >= target)
+      break;
+
+    gVirtualMicros = MAX(gVirtualMicros, next);
+    hostPoll();
+  }
+
+  gVirtualMicros = target;
+  hostPoll();
+}
+
+void hostSetButton(int button, int pressed)
+{
+  HOST_LOCK();
+  gButtonRelease[button] = 0;
+  setButton(button, pressed != 0);
+}
+
+void hostSetTouch(int x, int y)
+{
+  HOST_LOCK();
+  gTouchRelease = 0;
+  setTouch(x < 0 ? -1 : x, x < 0 ? -1 : y);
+}
+
+void hostSetPSDRaw(int raw)
+{
+  HOST_LOCK();
+  gPSDRaw = raw;
+}
+
+void hostGetMotor(int motor, int *level, int *duty)
+{
+  HOST_LOCK();
+  *level = gMotorLevel[motor];
+  *duty = gMotorDuty[motor];
+}
+
+void hostCamSetSource(HostCamSource source, void *arg)
+{
+  HOST_LOCK();
+  gCamSource = source;
+  gCamSourceArg = arg;
+}
+
+int hostCamFrames(void)
+{
+  HOST_LOCK();
+  return gCamFrames;
+}
+
+const RGB565* hostLCDPixels(void)
+{
+  halLCDWait();
+  return gLCD;
+}
+
+void hostLCDGetFlushes(int *flushes, int *pixels)
+{
+  HOST_LOCK();
+  *flushes = gLCDFlushes;
+  *pixels = gLCDFlushPixels;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static void putBE32(std::vector<uint8_t> *out, uint32_t value)
+{
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(value >> shift);
+}
+
+static void pngChunk(FILE *file, const char *type, const std::vector<uint8_t> &data)
+{
+  std::vector<uint8_t> chunk;
+  putBE32(&chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  putBE32(&chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+  fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+/*
+PNG files are written without compression, as zlib stored blocks, so that
+no image library is needed.
+*/
+static void writePNG(FILE *file, const std::vector<uint8_t> &rgb)
+{
+  static const uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file);
+
+  std::vector<uint8_t> header;
+  putBE32(&header, LCD_WIDTH);
+  putBE32(&header, LCD_HEIGHT);
+  header.insert(header.end(), {8, 2, 0, 0, 0});// 8-bit RGB
+  pngChunk(file, "IHDR", header);
+
+  std::vector<uint8_t> raw;
+  for (int y = 0; y < LCD_HEIGHT; y++)
+  {
+    raw.push_back(0);// No filter
+    raw.insert(raw.end(), rgb.begin() + y*LCD_WIDTH*3, rgb.begin() + (y + 1)*LCD_WIDTH*3);
+  }
+
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  uint32_t a = 1, b = 0;
+  for (size_t pos = 0; pos < raw.size(); pos += 65535)
+  {
+    size_t len = MIN(raw.size() - pos, (size_t)65535);
+    zlib.push_back(pos + len == raw.size());
+    zlib.insert(zlib.end(), {(uint8_t)len, (uint8_t)(len >> 8), (uint8_t)~len, (uint8_t)(~len >> 8)});
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+  }
+  for (uint8_t v : raw)
+  {
+    a = (a + v) % 65521;
+    b = (b + a) % 65521;
+  }
+  putBE32(&zlib, (b << 16) | a);
+  pngChunk(file, "IDAT", zlib);
+  pngChunk(file, "IEND", std::vector<uint8_t>());
+}
+
+int hostLCDWrite(const char *path)
+{
+  HOST_LOCK();
+  halLCDWait();
+  std::vector<uint8_t> rgb(LCD_WIDTH*LCD_HEIGHT*3);
+  for (int i = 0; i < LCD_WIDTH*LCD_HEIGHT; i++)
+  {
+    RGB565 col = gLCD[i];
+    uint8_t r = (col >> 8) & 0xF8, g = (col >> 3) & 0xFC, b = (col << 3) & 0xF8;
+    rgb[3*i] = r | (r >> 5);
+    rgb[3*i + 1] = g | (g >> 6);
+    rgb[3*i + 2] = b | (b >> 5);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+
+  size_t len = strlen(path);
+  if (len > 4 && !strcmp(path + len - 4, ".png"))
+    writePNG(file, rgb);
+  else
+  {
+    fprintf(file, "P6\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+  }
+
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+uint32_t halMillis(void)
+{
+  HOST_LOCK();
+  return halMicros() / 1000;
+}
+
+uint32_t halMicros(void)
+{
+  HOST_LOCK();
+  hostPoll();
+  spend(CLOCK_READ_US);
+  return (uint32_t)now();
+}
+
+void halDelay(uint32_t ms)
+{
+  HOST_LOCK();
+  hostInit();
+  waitMicros((uint64_t)ms*1000);
+}
+
+void halIdle(void)
+{
+  HOST_LOCK();
+  hostInit();
+  waitMicros(IDLE_US);
+}
+
+void* halAllocInternal(size_t size)
+{
+  return calloc(size, 1);
+}
+
+void* halAllocExternal(size_t size)
+{
+  return calloc(size, 1);
+}
+
+// Always the wall clock, so that code can be timed on the virtual clock too
+uint32_t halCycles(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)((uint64_t)now.tv_sec*1000000000 + now.tv_nsec);
+}
+
+uint32_t halCyclesPerMicro(void)
+{
+  return 1000;
+}
+
+void halConsole(const char *str)
+{
+  fputs(str, stdout);
+}
+
+void halConsoleWrite(const void *data, int size)
+{
+  fwrite(data, 1, size, stdout);
+}
+
+int halCoreID(void)
+{
+  return gCoreID;
+}
+
+// Threads are numbered from 1 in the order they first ask
+uint32_t halTaskID(void)
+{
+  static std::atomic<uint32_t> next(1);
+  static thread_local uint32_t id = next++;
+  return id;
+}
+
+// Tasks are threads, numbered with the core they were meant for
+int halTaskCreate(void (*fn)(void *arg), void *arg, int core, const char *name)
+{
+  hostInit();
+  gTaskCount++;
+  std::thread([=]() {
+    gCoreID = core;
+    gIsTask = true;
+    fn(arg);
+    gTaskCount--;
+  }).detach();
+
+  return 0;
+}
+
+void halYield(void)
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+typedef struct {
+  std::mutex mutex;
+  std::condition_variable cond;
+  int count;
+} HostSem;
+
+void* halSemCreate(void)
+{
+  return new HostSem();
+}
+
+void halSemGive(void *sem)
+{
+  HostSem *s = (HostSem*)sem;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  s->count++;
+  s->cond.notify_one();
+}
+
+void halSemTake(void *sem)
+{
+  HostSem *s = (HostSem*)sem;
+  std::unique_lock<std::mutex> lock(s->mutex);
+
+  if (gIsTask)
+    gTaskCount--;
+  s->cond.wait(lock, [s]() { return s->count > 0; });
+  s->count--;
+  if (gIsTask)
+    gTaskCount++;
+}
+
+// Files live below EYEBOT_FATFS, through the FFat shim of host/include
+void* halFileOpen(const char *path, const char *mode)
+{
+  File file = FFat.open(path, mode);
+  if (!file)
+    return NULL;
+
+  return new File(file);
+}
+
+int halFileRead(void *file, void *data, int size)
+{
+  return ((File*)file)->read((uint8_t*)data, size);
+}
+
+int halFileWrite(void *file, const void *data, int size)
+{
+  return ((File*)file)->write((const uint8_t*)data, size);
+}
+
+void halFileClose(void *file)
+{
+  ((File*)file)->close();
+  delete (File*)file;
+}
+
+int halMotorInit(void)
+{
+  HOST_LOCK();
+  hostInit();
+  halMotorPWM(HAL_MOTOR_LEFT, 0);
+  halMotorPWM(HAL_MOTOR_RIGHT, 0);
+  // Forward is a high left and a low right direction pin,
+  // as the motor driver's channels are wired inverted
+  halMotorDir(HAL_MOTOR_LEFT, 1);
+  halMotorDir(HAL_MOTOR_RIGHT, 0);
+
+  return 0;
+}
+
+void halMotorDir(int motor, int level)
+{
+  HOST_LOCK();
+  hostSimUpdate();
+  if (gTraceMotors && gMotorLevel[motor] != level)
+    fprintf(stderr, "t_ms=%llu motor=%s dir=%d\n", (unsigned long long)(now() / 1000),
+            motor == HAL_MOTOR_LEFT ? "left" : "right", level);
+  gMotorLevel[motor] = level;
+}
+
+void halMotorPWM(int motor, int duty)
+{
+  HOST_LOCK();
+  hostSimUpdate();
+  duty = MAX(0, MIN(duty, 255));
+  if (gTraceMotors && gMotorDuty[motor] != duty)
+    fprintf(stderr, "t_ms=%llu motor=%s pwm=%d\n", (unsigned long long)(now() / 1000),
+            motor == HAL_MOTOR_LEFT ? "left" : "right", duty);
+  gMotorDuty[motor] = duty;
+}
+
+int halMotorTimerInit(void (*callback)(void))
+{
+  HOST_LOCK();
+  gMotorTimerCallback = callback;
+  return 0;
+}
+
+int halMotorTimerStart(uint64_t ms)
+{
+  HOST_LOCK();
+  gMotorTimerDeadline = now() + ms*1000;
+  gMotorTimerActive = true;
+  return 0;
+}
+
+void halMotorTimerStop(void)
+{
+  HOST_LOCK();
+  gMotorTimerActive = false;
+}
+
+int halTickStart(uint32_t us, void (*tick)(void))
+{
+  HOST_LOCK();
+  hostInit();
+  gTickPeriod = us;
+  gTickNext = now() + us;
+  gTickCallback = tick;
+  return 0;
+}
+
+int halButton(int button)
+{
+  HOST_LOCK();
+  hostPoll();
+  spend(BUTTON_READ_US);
+  return gButtons[button];
+}
+
+int halButtonStart(void (*report)(int button, int state), uint32_t hold_ms)
+{
+  HOST_LOCK();
+  gButtonReport = report;
+  gButtonHold = (uint64_t)hold_ms*1000;
+  return 0;
+}
+
+int halPSDRaw(void)
+{
+  HOST_LOCK();
+  hostPoll();
+  spend(PSD_READ_US);
+  hostSimUpdate();
+  return gPSDRaw;
+}
+
+int halTouchInit(void)
+{
+  return 0;
+}
+
+int halTouchRead(int *x, int *y)
+{
+  HOST_LOCK();
+  hostPoll();
+  spend(TOUCH_READ_US);
+  if (gTouchX < 0)
+    return 0;
+
+  *x = gTouchX;
+  *y = gTouchY;
+  return 1;
+}
+
+int halTouchStart(void (*report)(int x, int y, int touched))
+{
+  HOST_LOCK();
+  gTouchReport = report;
+  return 0;
+}
+
+// Scripted touches and presses fall due while the clock moves on
+void halInputWait(int ms)
+{
+  HOST_LOCK();
+  hostInit();
+  waitMicros(IDLE_US);
+}
+
+// A loop that only watches the keys or the touch screen still moves the clock on
+void halInputPeek(void)
+{
+  HOST_LOCK();
+  hostPoll();
+  spend(TOUCH_PEEK_US);
+}
+
+int halCamInit(void)
+{
+  HOST_LOCK();
+  hostInit();
+  gCamNextFrame = now();
+  return 0;
+}
+
+// Frames are paced like the ESP32-CAM's: a frame asked for early waits
+// for its time, and one asked for late is delivered straight away
+int halCamRead(RGB565 *buf)
+{
+  HOST_LOCK();
+  hostPoll();
+  if (gFrameLimit && gCamFrames >= gFrameLimit)
+    finish();
+
+  uint64_t time = now();
+  if (time < gCamNextFrame)
+    waitMicros(gCamNextFrame - time);
+  gCamNextFrame = MAX(time, gCamNextFrame) + gCamPeriod;
+
+  if (gCamSource)
+    gCamSource(buf, gCamFrames, gCamSourceArg);
+  else if (!gCamFiles.empty())
+    fileScene(buf, gCamFrames, NULL);
+  else
+    syntheticScene(buf, gCamFrames, NULL);
+
+  gCamFrames++;
+  TRACEEvent(TRACE_INSTANT, "CAM frame");
+  return 0;
+}
+
+int halLCDInit(void)
+{
+  HOST_LOCK();
+  hostInit();
+  halLCDFill(0);
+  return 0;
+}
+
+void halLCDFill(RGB565 col)
+{
+  HOST_LOCK();
+  halLCDWait();
+  std::fill(pLCDDraw, pLCDDraw + LCD_WIDTH*LCD_HEIGHT, col);
+}
+
+void halLCDPixel(int x, int y, RGB565 col)
+{
+  HOST_LOCK();
+  halLCDWait();
+  if (x >= 0 && x < LCD_WIDTH && y >= 0 && y < LCD_HEIGHT)
+    pLCDDraw[y*LCD_WIDTH + x] = col;
+}
+
+RGB565 halLCDReadPixel(int x, int y)
+{
+  HOST_LOCK();
+  halLCDWait();
+  if (x < 0 || x >= LCD_WIDTH || y < 0 || y >= LCD_HEIGHT)
+    return 0;
+  return pLCDDraw[y*LCD_WIDTH + x];
+}
+
+static void fillRect(int x, int y, int w, int h, RGB565 col)
+{
+  int x1 = MAX(x, 0), y1 = MAX(y, 0);
+  int x2 = MIN(x + w, LCD_WIDTH), y2 = MIN(y + h, LCD_HEIGHT);
+
+  for (int j = y1; j < y2; j++)
+    std::fill(pLCDDraw + j*LCD_WIDTH + x1, pLCDDraw + j*LCD_WIDTH + MAX(x2, x1), col);
+}
+
+void halLCDHLine(int x, int y, int w, RGB565 col)
+{
+  HOST_LOCK();
+  halLCDWait();
+  fillRect(x, y, w, 1, col);
+}
+
+void halLCDVLine(int x, int y, int h, RGB565 col)
+{
+  HOST_LOCK();
+  halLCDWait();
+  fillRect(x, y, 1, h, col);
+}
+
+void halLCDLine(int x1, int y1, int x2, int y2, RGB565 col)
+{
+  HOST_LOCK();
+  halLCDWait();
+  int dx = abs(x2 - x1), dy = -abs(y2 - y1);
+  int sx = x1 < x2 ? 1 : -1, sy = y1 < y2 ? 1 : -1;
+  int err = dx + dy;
+
+  while (true)
+  {
+    halLCDPixel(x1, y1, col);
+    if (x1 == x2 && y1 == y2)
+      break;
+
+    int e2 = 2*err;
+    if (e2 >= dy)
+    {
+      err += dy;
+      x1 += sx;
+    }
+    if (e2 <= dx)
+    {
+      err += dx;
+      y1 += sy;
+    }
+  }
+}
+
+void halLCDRect(int x, int y, int w, int h, RGB565 col, int fill)
+{
+  HOST_LOCK();
+  halLCDWait();
+  if (fill)
+  {
+    fillRect(x, y, w, h, col);
+    return;
+  }
+
+  halLCDHLine(x, y, w, col);
+  halLCDHLine(x, y + h - 1, w, col);
+  halLCDVLine(x, y, h, col);
+  halLCDVLine(x + w - 1, y, h, col);
+}
+
+// Midpoint circle, drawn as points or as spans between them
+void halLCDCircle(int x, int y, int r, RGB565 col, int fill)
+{
+  HOST_LOCK();
+  halLCDWait();
+  int dx = 0, dy = r, err = 1 - r;
+
+  while (dx <= dy)
+  {
+    if (fill)
+    {
+      halLCDHLine(x - dy, y + dx, 2*dy + 1, col);
+      halLCDHLine(x - dy, y - dx, 2*dy + 1, col);
+      halLCDHLine(x - dx, y + dy, 2*dx + 1, col);
+      halLCDHLine(x - dx, y - dy, 2*dx + 1, col);
+    }
+    else
+    {
+      const int points[8][2] = {{dx, dy}, {-dx, dy}, {dx, -dy}, {-dx, -dy},
+                                {dy, dx}, {-dy, dx}, {dy, -dx}, {-dy, -dx}};
+      for (int i = 0; i < 8; i++)
+        halLCDPixel(x + points[i][0], y + points[i][1], col);
+    }
+
+    dx++;
+    if (err < 0)
+      err += 2*dx + 1;
+    else
+    {
+      dy--;
+      err += 2*(dx - dy) + 1;
+    }
+  }
+}
+
+void halLCDPushRect(int x, int y, int w, int h, const RGB565 *data)
+{
+  HOST_LOCK();
+  halLCDWait();
+  int x1 = MAX(x, 0), x2 = MIN(x + w, LCD_WIDTH);
+
+  for (int j = MAX(y, 0); j < MIN(y + h, LCD_HEIGHT); j++)
+  {
+    const RGB565 *row = data + (j - y)*w - x;
+    for (int i = x1; i < x2; i++)
+      pLCDDraw[j*LCD_WIDTH + i] = (row[i] >> 8) | (row[i] << 8);
+  }
+}
+
+/*
+The simulated display takes the block only when it is waited for, as any
+other drawing does first, so that a program changing the pixels of a
+block still on its way shows up as it would on the board. A block for the
+frame buffer is only a copy in memory, so it is made at once.
+*/
+void halLCDPushRectAsync(int x, int y, int w, int h, const RGB565 *data)
+{
+  HOST_LOCK();
+  halLCDWait();
+  if (pLCDDraw == gLCDFrame)
+    halLCDPushRect(x, y, w, h, data);
+  else
+    gLCDPush = {x, y, w, h, data};
+}
+
+void halLCDWait(void)
+{
+  HOST_LOCK();
+  if (!gLCDPush.data)
+    return;
+
+  LCDPush push = gLCDPush;
+  gLCDPush.data = NULL;
+  halLCDPushRect(push.x, push.y, push.w, push.h, push.data);
+}
+
+int halLCDSetBuffered(int on)
+{
+  HOST_LOCK();
+  halLCDWait();
+  if (on && pLCDDraw != gLCDFrame)
+    std::fill(gLCDFrame, gLCDFrame + LCD_WIDTH*LCD_HEIGHT, 0);
+  pLCDDraw = on ? gLCDFrame : gLCD;
+  return 0;
+}
+
+void halLCDFlush(int x, int y, int w, int h)
+{
+  HOST_LOCK();
+  halLCDWait();
+  int x1 = MAX(x, 0), y1 = MAX(y, 0);
+  int x2 = MIN(x + w, LCD_WIDTH), y2 = MIN(y + h, LCD_HEIGHT);
+  if (x2 <= x1 || y2 <= y1)
+    return;
+
+  for (int j = y1; j < y2; j++)
+    std::copy(gLCDFrame + j*LCD_WIDTH + x1, gLCDFrame + j*LCD_WIDTH + x2, gLCD + j*LCD_WIDTH + x1);
+
+  gLCDFlushes++;
+  gLCDFlushPixels += (x2 - x1)*(y2 - y1);
+}
+
+void halLCDSetCursor(int x, int y)
+{
+  HOST_LOCK();
+  gCursorX = x;
+  gCursorY = y;
+}
+
+void halLCDGetCursor(int *x, int *y)
+{
+  HOST_LOCK();
+  *x = gCursorX;
+  *y = gCursorY;
+}
+
+void halLCDSetTextColor(RGB565 fg, RGB565 bg)
+{
+  HOST_LOCK();
+  gTextFg = fg;
+  gTextBg = bg;
+}
+
+// Every font is drawn with the GLCD glyphs of font 1, bold ones struck twice
+void halLCDSetTextFont(int font)
+{
+  HOST_LOCK();
+  gTextFont = font;
+}
+
+void halLCDSetTextSize(int size)
+{
+  HOST_LOCK();
+  gTextSize = MAX(size, 1);
+}
+
+int halLCDFontHeight(void)
+{
+  HOST_LOCK();
+  return 8*gTextSize;
+}
+
+void halLCDGlyphSize(char c, int *w, int *h)
+{
+  HOST_LOCK();
+  *w = 6*gTextSize;
+  *h = 8*gTextSize;
+}
+
+void halLCDGlyph(char c, uint8_t *mask)
+{
+  HOST_LOCK();
+  if (c < LCD_FONT_FIRST || c > LCD_FONT_LAST)
+    c = '?';
+  const uint8_t *glyph = gLCDFont[c - LCD_FONT_FIRST];
+  bool bold = gTextFont % 2 == 1;
+  int s = gTextSize, w = 6*s;
+
+  for (int y = 0; y < 8*s; y++)
+  for (int x = 0; x < w; x++)
+  {
+    int col = x / s, row = y / s;
+    uint8_t bits = col < 5 ? glyph[col] : 0;
+    if (bold && col > 0)
+      bits |= glyph[col - 1];
+    mask[y*w + x] = (bits >> row) & 1;
+  }
+}
+
+// A background colour equal to the foreground leaves the background untouched,
+// as with TFT_eSPI
+static void drawChar(int x, int y, char c)
+{
+  int w, h;
+  halLCDGlyphSize(c, &w, &h);
+  std::vector<uint8_t> mask(w*h);
+  halLCDGlyph(c, mask.data());
+
+  for (int j = 0; j < h; j++)
+  for (int i = 0; i < w; i++)
+  {
+    if (mask[j*w + i])
+      fillRect(x + i, y + j, 1, 1, gTextFg);
+    else if (gTextBg != gTextFg)
+      fillRect(x + i, y + j, 1, 1, gTextBg);
+  }
+}
+
+// Text wraps at the right edge and on newlines back to the left edge
+void halLCDPrint(const char *str)
+{
+  HOST_LOCK();
+  halLCDWait();
+  int width = 6*gTextSize, height = 8*gTextSize;
+
+  for (; *str; str++)
+  {
+    if (*str == '\n')
+    {
+      gCursorX = 0;
+      gCursorY += height;
+      continue;
+    }
+    if (*str == '\r')
+      continue;
+
+    if (gCursorX + width > LCD_WIDTH)
+    {
+      gCursorX = 0;
+      gCursorY += height;
+    }
+
+    drawChar(gCursorX, gCursorY, *str);
+    gCursorX += width;
+  }
+}
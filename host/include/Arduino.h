@@ -0,0 +1,85 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*
+The parts of the Arduino core used by the EyeBot example sketches, so that
+they build as host programs. Time follows the simulated clock of
+host/hal_linux.cpp, and Serial writes to standard output.
+*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define HIGH 1
+#define LOW 0
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class HardwareSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  void flush() { fflush(stdout); }
+  operator bool() const { return true; }
+
+  size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t *buf, size_t size) { return fwrite(buf, 1, size, stdout); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t print(const char *s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int n) { return printf("%d", n); }
+  size_t print(unsigned int n) { return printf("%u", n); }
+  size_t print(long n) { return printf("%ld", n); }
+  size_t print(unsigned long n) { return printf("%lu", n); }
+  size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  size_t println(double n, int digits) { return print(n, digits) + println(); }
+  size_t println() { return print("\r\n"); }
+};
+
+extern HardwareSerial Serial;
+
+// The CPU of a host counts as a 1 GHz core, so cycles are nanoseconds
+class EspClass
+{
+public:
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz() { return 1000; }
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef FFAT_H
+#define FFAT_H
+
+/*
+The FFat file system of the Arduino core as used by the EyeBot example
+sketches. Paths are resolved below the directory named by the EYEBOT_FATFS
+environment variable, or the working directory.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+class File
+{
+public:
+  File(FILE *file = NULL) : mFile(file) {}
+
+  operator bool() const { return mFile != NULL; }
+
+  size_t size()
+  {
+    long pos = ftell(mFile);
+    fseek(mFile, 0, SEEK_END);
+    long end = ftell(mFile);
+    fseek(mFile, pos, SEEK_SET);
+    return end;
+  }
+
+  size_t position() { return ftell(mFile); }
+  bool seek(size_t pos) { return fseek(mFile, pos, SEEK_SET) == 0; }
+  int available() { return size() - position(); }
+  int read() { return fgetc(mFile); }
+  size_t read(uint8_t *buf, size_t size) { return fread(buf, 1, size, mFile); }
+  size_t write(uint8_t c) { return fputc(c, mFile) == EOF ? 0 : 1; }
+  size_t write(const uint8_t *buf, size_t size) { return fwrite(buf, 1, size, mFile); }
+  void flush() { fflush(mFile); }
+
+  void close()
+  {
+    if (mFile)
+      fclose(mFile);
+    mFile = NULL;
+  }
+
+private:
+  FILE *mFile;
+};
+
+class FFatFS
+{
+public:
+  bool begin(bool formatOnFail = false) { return true; }
+  void end() {}
+
+  File open(const char *path, const char *mode = FILE_READ)
+  {
+    std::string binary = std::string(mode) + "b";
+    return File(fopen(resolve(path).c_str(), binary.c_str()));
+  }
+
+  bool exists(const char *path)
+  {
+    FILE *file = fopen(resolve(path).c_str(), "rb");
+    if (file)
+      fclose(file);
+    return file != NULL;
+  }
+
+  bool remove(const char *path) { return ::remove(resolve(path).c_str()) == 0; }
+
+private:
+  std::string resolve(const char *path)
+  {
+    const char *root = getenv("EYEBOT_FATFS");
+    return std::string(root ? root : ".") + (path[0] == '/' ? "" : "/") + path;
+  }
+};
+
+static FFatFS FFat;
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+/*
+The heap_caps_*() allocators of ESP-IDF used by the EyeBot example
+sketches. A host has a single heap, so the capabilities are ignored.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+  return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+  return calloc(n, size);
+}
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+  void *ptr = NULL;
+  return posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) ? NULL : ptr;
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+  free(ptr);
+}
+
+#endif
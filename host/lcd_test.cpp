@@ -0,0 +1,683 @@
+/*
+Host tests for the image drawing functions of the LCD.
+
+LCDImageAsync() must put the same pixels on the display as LCDImage(),
+whatever is drawn or changed in between, as the simulated display takes a
+background block only when it is waited for. The palettes of LCDImageGray()
+and LCDImagePalette() must give the colour of each value as IPPRGB2Col()
+does, and packed binary images the same pixels as LCDImageBinary(). Both
+palettes must draw as the per-pixel conversions they replaced and are timed
+against them. Images
+of a source geometry other than the window's must be cropped at their
+stride, scaled and rotated, pixel for pixel. Drawing in LCD_NOAUTOREFRESH
+mode must leave the display alone until LCDRefresh(), which must then show
+what direct drawing would have, in a few transfers of the changed regions.
+Text composed from cached glyphs must look as the HAL prints it, in every
+size and font, wrapping at the same places, and both are timed. A glyph
+wider than the display must be cut at its right edge.
+Annotations queued with LCDOverlay*() must put the same pixels on the
+display with each image function as drawing them after the image does,
+be cut at the window and be used up by the image they are drawn into.
+
+Build and run from the repository root as the lcd_test target of the host
+build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/lcd_test
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static COLOR gImg[QQVGA_PIXELS];
+
+static void makeImage(COLOR *img, int seed)
+{
+  srand(seed);
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    img[i] = rand() & 0xFFFFFF;
+}
+
+static std::vector<RGB565> display(void)
+{
+  const RGB565 *pixels = hostLCDPixels();
+  return std::vector<RGB565>(pixels, pixels + LCD_WIDTH*LCD_HEIGHT);
+}
+
+static int testAsync(void)
+{
+  int failures = 0;
+
+  for (int frame = 0; frame < 4; frame++)
+  {
+    LCDClear();
+    makeImage(gImg, frame);
+    LCDImageStart(5, 10 + frame, CAMWIDTH, CAMHEIGHT - frame);
+    LCDImage((BYTE*)gImg);
+    std::vector<RGB565> expected = display();
+
+    LCDClear();
+    LCDImageAsync((BYTE*)gImg);
+    // The image is converted on return, so it may be overwritten at once
+    memset(gImg, 0, sizeof(gImg));
+    LCDImageWait();
+
+    if (display() != expected)
+    {
+      printf("LCDImageAsync frame %d differs from LCDImage\n", frame);
+      failures++;
+    }
+  }
+
+  // Images alternate between the buffers, and drawing in between waits
+  LCDClear();
+  LCDImageStart(0, 0, CAMWIDTH, CAMHEIGHT);
+  makeImage(gImg, 10);
+  LCDImageAsync((BYTE*)gImg);
+  makeImage(gImg, 11);
+  LCDImageAsync((BYTE*)gImg);
+  LCDPixel(0, 0, WHITE);
+  makeImage(gImg, 12);
+  LCDImageAsync((BYTE*)gImg);
+  LCDImageWait();
+  std::vector<RGB565> async = display();
+
+  LCDClear();
+  LCDImage((BYTE*)gImg);
+  if (display() != async)
+  {
+    printf("LCDImageAsync sequence differs from LCDImage\n");
+    failures++;
+  }
+
+  if (LCDImageAsync(NULL) != -1)
+  {
+    printf("LCDImageAsync accepted no image\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+// A colour as the simulated display holds it
+static RGB565 displayColor(COLOR col)
+{
+  return ((col >> 8) & 0xF800) | ((col >> 5) & 0x07E0) | ((col >> 3) & 0x001F);
+}
+
+// The conversions of LCDImageGray() and LCDImageBinary() before their palettes,
+// pixel by pixel into big-endian RGB565, drawn at 3, 4 as the tests do
+static RGB565 gRefImage[QQVGA_PIXELS];
+static BYTE gRefInput[QQVGA_PIXELS];
+
+static void refGray(void *arg)
+{
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+  {
+    RGB565 hue = displayColor(IPPRGB2Col(gRefInput[i], gRefInput[i], gRefInput[i]));
+    gRefImage[i] = (hue << 8) | (hue >> 8);
+  }
+
+  halLCDPushRect(3, 4, CAMWIDTH, CAMHEIGHT, gRefImage);
+}
+
+static void refBinary(void *arg)
+{
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    gRefImage[i] = gRefInput[i] ? 0xFFFF : 0;
+
+  halLCDPushRect(3, 4, CAMWIDTH, CAMHEIGHT, gRefImage);
+}
+
+static void benchGray(void *arg) { LCDImageGray(gRefInput); }
+static void benchBinary(void *arg) { LCDImageBinary(gRefInput); }
+
+static int testPalettes(void)
+{
+  static BYTE img[QQVGA_PIXELS], bits[QQVGA_PIXELS/8];
+  static COLOR user[256];
+  int failures = 0;
+
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    img[i] = i*7 + i/160;
+
+  LCDImageStart(3, 4, CAMWIDTH, CAMHEIGHT);
+  LCDImageGray(img);
+  const RGB565 *pixels = hostLCDPixels();
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+  {
+    if (pixels[(4 + i/160)*LCD_WIDTH + 3 + i%160] != displayColor(IPPRGB2Col(img[i], img[i], img[i])))
+    {
+      printf("LCDImageGray pixel %d differs\n", i);
+      failures++;
+      break;
+    }
+  }
+
+  for (int v = 0; v < 256; v++)
+    user[v] = IPPRGB2Col(v, 255 - v, v/2);
+  LCDSetPalette(LCD_PALETTE_USER, user);
+  LCDImagePalette(img, LCD_PALETTE_USER);
+  pixels = hostLCDPixels();
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+  {
+    if (pixels[(4 + i/160)*LCD_WIDTH + 3 + i%160] != displayColor(user[img[i]]))
+    {
+      printf("LCDImagePalette pixel %d differs\n", i);
+      failures++;
+      break;
+    }
+  }
+
+  // Heat rises in brightness, and labels differ from their neighbours
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    img[i] = i % 160 * 256 / 160;
+  LCDImagePalette(img, LCD_PALETTE_HEAT);
+  pixels = hostLCDPixels();
+  if (pixels[4*LCD_WIDTH + 3] != 0 || pixels[4*LCD_WIDTH + 3 + 159] == 0)
+  {
+    printf("heat palette does not run from black\n");
+    failures++;
+  }
+
+  LCDImagePalette(img, LCD_PALETTE_LABELS);
+  pixels = hostLCDPixels();
+  for (int x = 1; x < 159; x++)
+  {
+    RGB565 col = pixels[4*LCD_WIDTH + 3 + x], next = pixels[4*LCD_WIDTH + 3 + x + 1];
+    if (img[x] != img[x + 1] && (col == next || col == 0))
+    {
+      printf("labels %d and %d look alike\n", img[x], img[x + 1]);
+      failures++;
+      break;
+    }
+  }
+
+  // A packed image draws as its unpacked bytes do
+  srand(3);
+  for (int i = 0; i < QQVGA_PIXELS/8; i++)
+    bits[i] = rand();
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    img[i] = bits[i/8] >> (7 - i%8) & 1;
+
+  LCDClear();
+  LCDImageBinary(img);
+  std::vector<RGB565> expected = display();
+  LCDClear();
+  LCDImagePacked(bits, WHITE, BLACK);
+  if (display() != expected)
+  {
+    printf("LCDImagePacked differs from LCDImageBinary\n");
+    failures++;
+  }
+
+  // The palettes against the conversions they replaced, in pixels and time
+  BENCHStats stats;
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    gRefInput[i] = i*7 + i/160;
+  LCDImageStart(3, 4, CAMWIDTH, CAMHEIGHT);
+  for (int binary = 0; binary <= 1; binary++)
+  {
+    LCDClear();
+    (binary ? refBinary : refGray)(NULL);
+    expected = display();
+    LCDClear();
+    (binary ? benchBinary : benchGray)(NULL);
+    if (display() != expected)
+    {
+      printf("%s differs from its conversion\n", binary ? "LCDImageBinary" : "LCDImageGray");
+      failures++;
+    }
+  }
+
+  if (BENCHRun(benchGray, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImageGray path=palette", &stats);
+  if (BENCHRun(refGray, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImageGray path=convert", &stats);
+  if (BENCHRun(benchBinary, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImageBinary path=palette", &stats);
+  if (BENCHRun(refBinary, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImageBinary path=convert", &stats);
+
+  if (LCDImagePalette(img, LCD_PALETTES) != -1 || LCDSetPalette(-1, user) != -1 || LCDImagePacked(NULL, WHITE, BLACK) != -1)
+  {
+    printf("invalid palette arguments accepted\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+// Whether the window at x0, y0 of w x h shows src[index(x, y)] at every pixel
+static int checkWindow(const char *name, const COLOR *src, int x0, int y0, int w, int h, int (*index)(int x, int y))
+{
+  const RGB565 *pixels = hostLCDPixels();
+
+  for (int y = 0; y < h; y++)
+  for (int x = 0; x < w; x++)
+  {
+    if (pixels[(y0 + y)*LCD_WIDTH + x0 + x] != displayColor(src[index(x, y)]))
+    {
+      printf("%s pixel %d,%d differs\n", name, x, y);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int testGeometry(void)
+{
+  static COLOR big[320*240];
+  static BYTE gray[QQVGA_PIXELS], bits[QQVGA_PIXELS/8];
+  int failures = 0;
+
+  for (int i = 0; i < 320*240; i++)
+    big[i] = rand() & 0xFFFFFF;
+
+  // A region of a camera frame, at the frame's stride
+  LCDClear();
+  LCDImageStart(7, 9, 100, 60, 0, 0, 160);
+  LCDImage((BYTE*)(big + 10*160 + 20));
+  failures += checkWindow("crop", big, 7, 9, 100, 60, [](int x, int y) { return (y + 10)*160 + x + 20; });
+
+  // A window wider than the display shows the left of the image
+  LCDImageStart(0, 0, 320, 240);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("oversize", big, 0, 0, LCD_WIDTH, 240, [](int x, int y) { return y*320 + x; });
+
+  LCDImageStart(1, 2, 160, 240, 80, 60);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("scale up", big, 1, 2, 160, 240, [](int x, int y) { return y/4*80 + x/2; });
+
+  LCDImageStart(1, 2, 80, 40, 160, 120);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("scale down", big, 1, 2, 80, 40, [](int x, int y) { return y*3*160 + x*2; });
+
+  LCDImageStart(0, 0, 120, 160, 160, 120, 160, LCD_ROTATE_90);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("rotate 90", big, 0, 0, 120, 160, [](int x, int y) { return (119 - x)*160 + y; });
+
+  LCDImageStart(0, 0, 160, 120, 160, 120, 160, LCD_ROTATE_180);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("rotate 180", big, 0, 0, 160, 120, [](int x, int y) { return (119 - y)*160 + 159 - x; });
+
+  // A landscape frame filling the portrait display
+  LCDImageStart(0, 0, 170, 320, 160, 120, 160, LCD_ROTATE_270);
+  LCDImage((BYTE*)big);
+  failures += checkWindow("rotate 270", big, 0, 0, 170, 320,
+                          [](int x, int y) { return x*120/170*160 + 159 - y*160/320; });
+
+  // The other image types take the same geometry, packed rows starting on a byte
+  srand(5);
+  for (int i = 0; i < QQVGA_PIXELS/8; i++)
+    bits[i] = rand();
+  for (int y = 0; y < 100; y++)
+  for (int x = 0; x < 60; x++)
+    gray[y*60 + x] = bits[y*8 + x/8] >> (7 - x%8) & 1;
+
+  LCDImageStart(0, 0, 100, 120, 60, 100, 60, LCD_ROTATE_90);
+  LCDClear();
+  LCDImageBinary(gray);
+  std::vector<RGB565> expected = display();
+  LCDClear();
+  LCDImagePacked(bits, WHITE, BLACK);
+  if (display() != expected)
+  {
+    printf("rotated LCDImagePacked differs from LCDImageBinary\n");
+    failures++;
+  }
+
+  if (LCDImageStart(0, 0, 160, 120, 160, 120, 100) != -1 || LCDImageStart(0, 0, 160, 120, 0, 0, 0, LCD_ROTATE_270 + 1) != -1 ||
+      LCDImageStart(0, 0, 0, 120) != -1)
+  {
+    printf("invalid image geometry accepted\n");
+    failures++;
+  }
+
+  LCDImageStart();
+  return failures;
+}
+
+static void drawScene(void)
+{
+  LCDArea(10, 200, 60, 230, RED);
+  LCDArea(100, 200, 150, 230, GREEN, 0);
+  LCDLine(0, 300, 169, 250, YELLOW);
+  LCDCircle(85, 150, 12, CYAN);
+  LCDSetPrintf(180, 5, "refresh %d\nnext line", 42);
+  LCDImageStart(5, 5, CAMWIDTH, CAMHEIGHT);
+  LCDImage((BYTE*)gImg);
+}
+
+static int testRefresh(void)
+{
+  int failures = 0, flushes, pixels, lastFlushes, lastPixels;
+
+  makeImage(gImg, 20);
+  LCDClear();
+  drawScene();
+  std::vector<RGB565> expected = display();
+
+  LCDClear();
+  std::vector<RGB565> before = display();
+  if (LCDSetMode(LCD_NOAUTOREFRESH) != 0)
+  {
+    printf("LCD_NOAUTOREFRESH failed\n");
+    return 1;
+  }
+
+  drawScene();
+  if (display() != before)
+  {
+    printf("drawing reached the display before LCDRefresh\n");
+    failures++;
+  }
+
+  if (displayColor(LCDGetPixel(20, 210)) != displayColor(RED))
+  {
+    printf("LCDGetPixel does not read the frame buffer\n");
+    failures++;
+  }
+
+  hostLCDGetFlushes(&lastFlushes, &lastPixels);
+  LCDRefresh();
+  hostLCDGetFlushes(&flushes, &pixels);
+  printf("refresh=scene flushes=%d pixels=%d of %d\n", flushes - lastFlushes, pixels - lastPixels, LCD_WIDTH*LCD_HEIGHT);
+  if (display() != expected)
+  {
+    printf("refreshed scene differs from direct drawing\n");
+    failures++;
+  }
+
+  // Nothing changed, nothing to push
+  LCDRefresh();
+  hostLCDGetFlushes(&lastFlushes, &lastPixels);
+  if (lastFlushes != flushes)
+  {
+    printf("LCDRefresh pushed an unchanged frame\n");
+    failures++;
+  }
+
+  // Scattered pixels end up in no more transfers than there are regions
+  srand(7);
+  for (int k = 0; k < 50; k++)
+    LCDPixel(rand() % LCD_WIDTH, rand() % LCD_HEIGHT, WHITE);
+  LCDRefresh();
+  hostLCDGetFlushes(&flushes, &pixels);
+  printf("refresh=scattered flushes=%d pixels=%d\n", flushes - lastFlushes, pixels - lastPixels);
+  if (flushes - lastFlushes > 32 || pixels - lastPixels > LCD_WIDTH*LCD_HEIGHT/10)
+  {
+    printf("50 pixels took %d transfers of %d pixels\n", flushes - lastFlushes, pixels - lastPixels);
+    failures++;
+  }
+
+  // Leaving the mode shows what is pending
+  LCDArea(0, 0, 20, 20, MAGENTA);
+  LCDSetMode(LCD_AUTOREFRESH);
+  if (hostLCDPixels()[10*LCD_WIDTH + 10] != displayColor(MAGENTA))
+  {
+    printf("LCD_AUTOREFRESH did not refresh\n");
+    failures++;
+  }
+
+  // Earlier content does not show through between regions merged at the
+  // first refresh, as the whole frame buffer replaces it
+  LCDClear();
+  LCDArea(10, 10, 20, 20, RED);
+  LCDArea(30, 10, 40, 20, RED);
+  expected = display();
+  LCDArea(0, 0, LCD_WIDTH, LCD_HEIGHT, GREEN);
+  LCDSetMode(LCD_NOAUTOREFRESH);
+  LCDArea(10, 10, 20, 20, RED);
+  LCDArea(30, 10, 40, 20, RED);
+  LCDRefresh();
+  LCDSetMode(LCD_AUTOREFRESH);
+  if (display() != expected)
+  {
+    printf("first refresh left part of the earlier display\n");
+    failures++;
+  }
+
+  if (LCDSetMode(LCD_SCROLLING) != -1)
+  {
+    printf("unimplemented mode accepted\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+// The display after printing str at x, y through LCDSetPrintf() or the HAL
+static std::vector<RGB565> printed(const char *str, int x, int y, bool hal, int *xEnd, int *yEnd)
+{
+  LCDClear();
+  if (hal)
+  {
+    halLCDSetCursor(x, y);
+    halLCDPrint(str);
+  }
+  else
+    LCDSetPrintf(y, x, "%s", str);
+
+  LCDGetPos(yEnd, xEnd);
+  return display();
+}
+
+static void benchGlyphs(void *arg) { LCDSetPrintf(130, 5, "DIST: %d mm ", 1234); }
+static void benchHAL(void *arg) { halLCDSetCursor(5, 130); halLCDPrint("DIST: 1234 mm "); }
+
+static int testText(void)
+{
+  const char *text = "DIST: 1234 mm \nA line long enough to wrap at the right edge\r of the display\x01";
+  int failures = 0;
+
+  LCDSetColor(YELLOW, NAVY);
+  for (int font = HELVETICA; font <= COURIER; font++)
+  for (int variation = NORMAL; variation <= BOLD; variation++)
+  for (int size = 1; size <= 4; size++)
+  {
+    LCDSetFont(font, variation);
+    LCDSetFontSize(size);
+
+    int xGlyphs, yGlyphs, xHAL, yHAL;
+    std::vector<RGB565> glyphs = printed(text, 7, 11, false, &xGlyphs, &yGlyphs);
+    std::vector<RGB565> hal = printed(text, 7, 11, true, &xHAL, &yHAL);
+
+    if (glyphs != hal || xGlyphs != xHAL || yGlyphs != yHAL)
+    {
+      printf("text font=%d variation=%d size=%d differs from the HAL\n", font, variation, size);
+      failures++;
+    }
+  }
+
+  // Glyphs wider than the display lose their right columns, one to a line
+  LCDSetFont(COURIER, NORMAL);
+  LCDSetFontSize(30);
+  int xWide, yWide;
+  std::vector<RGB565> wide = printed("AB", 0, 0, false, &xWide, &yWide);
+  if (xWide != LCD_WIDTH || yWide == 0 || wide[LCD_WIDTH - 1] != displayColor(NAVY))
+  {
+    printf("glyph wider than the display printed to %d, %d\n", xWide, yWide);
+    failures++;
+  }
+
+  LCDSetFontSize(1);
+  int x, y;
+  std::vector<RGB565> normal = printed("Bold", 0, 0, false, &x, &y);
+  LCDSetFont(COURIER, BOLD);
+  if (printed("Bold", 0, 0, false, &x, &y) == normal)
+  {
+    printf("BOLD looks as NORMAL\n");
+    failures++;
+  }
+
+  if (LCDSetFont(COURIER + 1, NORMAL) != -1 || LCDSetFont(HELVETICA, BOLD + 1) != -1)
+  {
+    printf("invalid font accepted\n");
+    failures++;
+  }
+
+  LCDSetFont(COURIER, NORMAL);
+  LCDSetFontSize(2);
+  BENCHStats stats;
+  if (BENCHRun(benchGlyphs, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDSetPrintf text=glyphs", &stats);
+  if (BENCHRun(benchHAL, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDSetPrintf text=hal", &stats);
+
+  LCDSetFontSize(1);
+  LCDSetColor();
+  return failures;
+}
+
+// The annotations of the overlay tests, in window pixels, queued or drawn directly at the window's place
+static void annotate(bool queue, int x, int y)
+{
+  if (queue)
+  {
+    LCDOverlayLine(3, 4, 150, 90, RED);
+    LCDOverlayLine(80, 0, 80, 119, GREEN);
+    LCDOverlayArea(20, 30, 60, 50, BLUE, 0);
+    LCDOverlayArea(100, 10, 90, 20, YELLOW);
+    LCDOverlayCircle(120, 70, 15, WHITE, 0);
+    LCDOverlayCircle(40, 90, 8, MAGENTA);
+    LCDOverlayPrintf(100, 10, CYAN, "x=%d", 42);
+    return;
+  }
+
+  LCDLine(x + 3, y + 4, x + 150, y + 90, RED);
+  LCDLine(x + 80, y, x + 80, y + 119, GREEN);
+  LCDArea(x + 20, y + 30, x + 60, y + 50, BLUE, 0);
+  LCDArea(x + 100, y + 10, x + 90, y + 20, YELLOW);
+  LCDCircle(x + 120, y + 70, 15, WHITE, 0);
+  LCDCircle(x + 40, y + 90, 8, MAGENTA);
+  LCDSetColor(CYAN, CYAN);
+  LCDSetPrintf(y + 100, x + 10, "x=%d", 42);
+  LCDSetColor();
+}
+
+static void benchDirect(void *arg)
+{
+  LCDImage((BYTE*)gImg);
+  annotate(false, 5, 10);
+}
+
+static void benchOverlay(void *arg)
+{
+  annotate(true, 5, 10);
+  LCDImage((BYTE*)gImg);
+}
+
+static int testOverlay(void)
+{
+  static BYTE gray[QQVGA_PIXELS];
+  int failures = 0;
+
+  makeImage(gImg, 20);
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+    gray[i] = gImg[i] & 0xFF;
+
+  LCDSetFontSize(1);
+  LCDImageStart(5, 10, CAMWIDTH, CAMHEIGHT);
+
+  for (int kind = 0; kind < 3; kind++)
+  {
+    LCDClear();
+    kind == 2 ? LCDImageGray(gray) : LCDImage((BYTE*)gImg);
+    annotate(false, 5, 10);
+    std::vector<RGB565> expected = display();
+
+    LCDClear();
+    annotate(true, 5, 10);
+    if (kind == 0)
+      LCDImage((BYTE*)gImg);
+    else if (kind == 1)
+    {
+      LCDImageAsync((BYTE*)gImg);
+      LCDImageWait();
+    }
+    else
+      LCDImageGray(gray);
+
+    if (display() != expected)
+    {
+      printf("overlay on image function %d differs from drawing\n", kind);
+      failures++;
+    }
+  }
+
+  // Used up by the image, and cut at the window
+  LCDClear();
+  LCDImage((BYTE*)gImg);
+  std::vector<RGB565> plain = display();
+  LCDOverlayArea(-20, -20, 300, 300, RED);
+  LCDOverlayClear();
+  LCDOverlayLine(-50, 60, 400, 60, RED);
+  LCDImage((BYTE*)gImg);
+  LCDImage((BYTE*)gImg);
+  if (display() != plain)
+  {
+    printf("overlay drawn twice or after clearing\n");
+    failures++;
+  }
+
+  LCDClear();
+  LCDOverlayLine(-50, 60, 400, 60, RED);
+  LCDOverlayCircle(0, 0, 30, RED);
+  LCDImage((BYTE*)gImg);
+  std::vector<RGB565> cut = display();
+  if (cut[70*LCD_WIDTH + 4] != 0 || cut[70*LCD_WIDTH + 165] != 0 || cut[9*LCD_WIDTH + 5] != 0 ||
+      cut[70*LCD_WIDTH + 5] != displayColor(RED) || cut[10*LCD_WIDTH + 5] != displayColor(RED))
+  {
+    printf("overlay not cut at the window\n");
+    failures++;
+  }
+
+  // Annotations alone on a background, as a panel
+  LCDClear();
+  LCDArea(5, 10, 5 + CAMWIDTH, 10 + CAMHEIGHT, BLACK);
+  annotate(false, 5, 10);
+  std::vector<RGB565> panel = display();
+  LCDClear();
+  annotate(true, 5, 10);
+  LCDOverlayDraw(BLACK);
+  if (display() != panel)
+  {
+    printf("LCDOverlayDraw differs from drawing\n");
+    failures++;
+  }
+
+  int queued = 0;
+  while (LCDOverlayLine(0, 0, 1, 1, RED) == 0)
+    queued++;
+  LCDOverlayClear();
+  if (queued != LCD_OVERLAY_MAX)
+  {
+    printf("%d annotations queued for %d\n", queued, LCD_OVERLAY_MAX);
+    failures++;
+  }
+
+  BENCHStats stats;
+  if (BENCHRun(benchDirect, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImage annotations=direct", &stats);
+  if (BENCHRun(benchOverlay, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=LCDImage annotations=overlay", &stats);
+
+  return failures;
+}
+
+int main(int argc, char **argv)
+{
+  hostClockVirtual(1);
+  EYEBOTInit();
+
+  int failures = testAsync() + testPalettes() + testGeometry() + testRefresh() + testText() + testOverlay();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+/*
+Host benchmark for IPMarkerDetect() on synthetic renders.
+
+Each frame shows up to three markers under a lighting gradient, placed with
+random size, rotation and perspective, and rendered with 2x2 supersampling
+and pixel noise. Rendering isn't timed. For each resolution a single line of
+key=value pairs is printed with the detection rate, the number of false
+detections, the mean corner error and the detection time per frame.
+
+Build and run from the repository root with:
+
+  g++ -O2 -I. host/marker_bench.cpp eyebot_marker.cpp -o marker_bench
+  ./marker_bench [frames]
+
+or as the marker_bench target of the host build in CMakeLists.txt.
+
+A marker can also be written out as a PGM image for printing with:
+
+  ./marker_bench -p <id> <size> <file.pgm>
+*/
+#include "eyebot.h"
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define TEXTURE_SIZE 128
+#define MAX_SCENE_MARKERS 3
+#define NOISE 8
+
+struct Homography
+{
+  float m[9];
+};
+
+struct SceneMarker
+{
+  int id;
+  float x[4], y[4];// Corners of the black square, clockwise from its top left
+  Homography toTexture;
+};
+
+static unsigned gSeed = 1;
+
+static float randomFloat(float lo, float hi)
+{
+  gSeed = gSeed*1103515245 + 12345;
+  return lo + (hi - lo)*((gSeed >> 8) & 0xFFFF) / 65535.0f;
+}
+
+// Projective mapping of the unit square onto the quadrilateral x, y
+static Homography squareToQuad(const float *x, const float *y)
+{
+  float dx1 = x[1] - x[2], dx2 = x[3] - x[2], dx3 = x[0] - x[1] + x[2] - x[3];
+  float dy1 = y[1] - y[2], dy2 = y[3] - y[2], dy3 = y[0] - y[1] + y[2] - y[3];
+  float det = dx1*dy2 - dx2*dy1;
+  float g = (dx3*dy2 - dx2*dy3) / det;
+  float h = (dx1*dy3 - dx3*dy1) / det;
+
+  Homography H = {{
+    x[1] - x[0] + g*x[1], x[3] - x[0] + h*x[3], x[0],
+    y[1] - y[0] + g*y[1], y[3] - y[0] + h*y[3], y[0],
+    g, h, 1
+  }};
+  return H;
+}
+
+static Homography invert(const Homography &H)
+{
+  const float *m = H.m;
+  Homography I = {{
+    m[4]*m[8] - m[5]*m[7], m[2]*m[7] - m[1]*m[8], m[1]*m[5] - m[2]*m[4],
+    m[5]*m[6] - m[3]*m[8], m[0]*m[8] - m[2]*m[6], m[2]*m[3] - m[0]*m[5],
+    m[3]*m[7] - m[4]*m[6], m[1]*m[6] - m[0]*m[7], m[0]*m[4] - m[1]*m[3]
+  }};
+  return I;
+}
+
+static void apply(const Homography &H, float x, float y, float *u, float *v)
+{
+  float w = H.m[6]*x + H.m[7]*y + H.m[8];
+  *u = (H.m[0]*x + H.m[1]*y + H.m[2]) / w;
+  *v = (H.m[3]*x + H.m[4]*y + H.m[5]) / w;
+}
+
+/*
+Places markers at random without overlapping and renders the frame. The
+quadrilateral of each marker covers its texture including the white margin,
+and the ground truth corners are those of the black square inside it.
+*/
+static int renderScene(BYTE *gray, int xs, int ys, std::vector<BYTE> *textures, SceneMarker *scene)
+{
+  int count = 0;
+  int wanted = 1 + (int)randomFloat(0, MAX_SCENE_MARKERS - 0.01f);
+  float minSize = ys / 6.0f, maxSize = ys / 2.0f;
+
+  for (int attempt = 0; attempt < 20 && count < wanted; attempt++)
+  {
+    float size = randomFloat(minSize, maxSize);
+    float cx = randomFloat(size*0.75f, xs - size*0.75f);
+    float cy = randomFloat(size*0.75f, ys - size*0.75f);
+
+    bool overlaps = false;
+    for (int i = 0; i < count; i++)
+    {
+      float ox = (scene[i].x[0] + scene[i].x[2]) / 2, oy = (scene[i].y[0] + scene[i].y[2]) / 2;
+      float ds = fabsf(scene[i].x[2] - scene[i].x[0]) + fabsf(scene[i].y[2] - scene[i].y[0]);
+      if (fabsf(cx - ox) < (size + ds)*0.75f && fabsf(cy - oy) < (size + ds)*0.75f)
+        overlaps = true;
+    }
+    if (overlaps)
+      continue;
+
+    SceneMarker *marker = &scene[count++];
+    marker->id = (int)randomFloat(0, IP_MARKER_COUNT - 0.01f);
+
+    // Rotated square with each corner moved by up to 10% of its size
+    float angle = randomFloat(0, 2*(float)M_PI);
+    float qx[4], qy[4];
+    for (int k = 0; k < 4; k++)
+    {
+      float a = angle + (float)M_PI*(k/2.0f - 0.75f);
+      qx[k] = cx + size*0.70710678f*cosf(a) + randomFloat(-0.1f, 0.1f)*size;
+      qy[k] = cy + size*0.70710678f*sinf(a) + randomFloat(-0.1f, 0.1f)*size;
+    }
+
+    Homography toImage = squareToQuad(qx, qy);
+    marker->toTexture = invert(toImage);
+
+    // The black square spans cells 1 to 7 of the 8 across the texture
+    const float uv[4][2] = {{1/8.0f, 1/8.0f}, {7/8.0f, 1/8.0f}, {7/8.0f, 7/8.0f}, {1/8.0f, 7/8.0f}};
+    for (int k = 0; k < 4; k++)
+      apply(toImage, uv[k][0], uv[k][1], &marker->x[k], &marker->y[k]);
+  }
+
+  for (int y = 0; y < ys; y++)
+  for (int x = 0; x < xs; x++)
+  {
+    // Lighting falls off towards the bottom right of the image
+    float light = 1.0f - 0.5f*(x + y) / (xs + ys);
+    float sum = 0;
+
+    for (int s = 0; s < 4; s++)
+    {
+      float px = x - 0.25f + 0.5f*(s & 1), py = y - 0.25f + 0.5f*(s >> 1);
+      float value = 110;// Background
+
+      for (int i = 0; i < count; i++)
+      {
+        float u, v;
+        apply(scene[i].toTexture, px, py, &u, &v);
+        if (u >= 0 && u < 1 && v >= 0 && v < 1)
+        {
+          BYTE texel = textures[scene[i].id][(int)(v*TEXTURE_SIZE)*TEXTURE_SIZE + (int)(u*TEXTURE_SIZE)];
+          value = texel ? 230 : 30;
+        }
+      }
+      sum += value;
+    }
+
+    int value = (int)(sum / 4*light + randomFloat(-NOISE, NOISE));
+    gray[y*xs + x] = value < 0 ? 0 : value > 255 ? 255 : value;
+  }
+
+  return count;
+}
+
+static void benchmark(int xs, int ys, int frames)
+{
+  std::vector<BYTE> textures[IP_MARKER_COUNT];
+  for (int id = 0; id < IP_MARKER_COUNT; id++)
+  {
+    textures[id].resize(TEXTURE_SIZE*TEXTURE_SIZE);
+    IPMarkerDraw(id, textures[id].data(), TEXTURE_SIZE);
+  }
+
+  std::vector<BYTE> gray(xs*ys);
+  SceneMarker scene[MAX_SCENE_MARKERS];
+  IPMarker found[16];
+  int total = 0, detected = 0, falseDetections = 0, cornerCount = 0;
+  double cornerError = 0, totalMs = 0, minMs = 1e9;
+
+  for (int frame = 0; frame < frames; frame++)
+  {
+    int count = renderScene(gray.data(), xs, ys, textures, scene);
+    total += count;
+
+    auto start = std::chrono::steady_clock::now();
+    int n = IPMarkerDetect(gray.data(), xs, ys, found, 16);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    totalMs += ms;
+    minMs = ms < minMs ? ms : minMs;
+
+    for (int i = 0; i < n; i++)
+    {
+      // A detection matches a marker of the same ID whose top left corner is close by
+      int match = -1;
+      for (int j = 0; j < count; j++)
+        if (found[i].id == scene[j].id && fabsf(found[i].x[0] - scene[j].x[0]) < 4 && fabsf(found[i].y[0] - scene[j].y[0]) < 4)
+          match = j;
+
+      if (match < 0)
+      {
+        falseDetections++;
+        continue;
+      }
+
+      detected++;
+      for (int k = 0; k < 4; k++)
+      {
+        cornerError += hypotf(found[i].x[k] - scene[match].x[k], found[i].y[k] - scene[match].y[k]);
+        cornerCount++;
+      }
+    }
+  }
+
+  printf("resolution=%dx%d frames=%d markers=%d detected=%d rate=%.3f false=%d corner_error_px=%.3f ms_avg=%.3f ms_min=%.3f\n",
+         xs, ys, frames, total, detected, total ? detected / (double)total : 0.0, falseDetections,
+         cornerCount ? cornerError / cornerCount : 0.0, totalMs / frames, minMs);
+}
+
+static int writeMarker(int id, int size, const char *filename)
+{
+  std::vector<BYTE> gray(size*size);
+  if (IPMarkerDraw(id, gray.data(), size) != 0)
+  {
+    fprintf(stderr, "Invalid marker %d or size %d\n", id, size);
+    return 1;
+  }
+
+  FILE *file = fopen(filename, "wb");
+  if (!file)
+  {
+    perror(filename);
+    return 1;
+  }
+
+  fprintf(file, "P5\n%d %d\n255\n", size, size);
+  fwrite(gray.data(), 1, gray.size(), file);
+  fclose(file);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 5 && strcmp(argv[1], "-p") == 0)
+    return writeMarker(atoi(argv[2]), atoi(argv[3]), argv[4]);
+
+  int frames = argc > 1 ? atoi(argv[1]) : 200;
+  if (frames <= 0)
+  {
+    fprintf(stderr, "Usage: %s [frames] | -p <id> <size> <file.pgm>\n", argv[0]);
+    return 1;
+  }
+
+  benchmark(160, 120, frames);
+  benchmark(320, 240, frames);
+  return 0;
+}
@@ -0,0 +1,338 @@
+/*
+Host tests for the NN*() functions.
+
+Random networks covering every layer type, with channel counts both on and
+off the 16 byte vector width, are run through NNRun() and NNRunReference(),
+which must agree bit for bit. Malformed network files must be rejected by
+NNLoad(). Finally a lane network of the size meant for the EyeBot is timed,
+and its per-layer latency is printed as one key=value line per layer.
+
+Build and run from the repository root with:
+
+  g++ -O2 -I. host/nn_test.cpp eyebot_nn.cpp -o nn_test
+  ./nn_test [networks]
+
+or as the nn_test target of the host build in CMakeLists.txt, which runs it
+under ctest.
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define TIMING_RUNS 50
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+struct LayerSpec
+{
+  int type, relu, kernel, stride, padding, channels;
+};
+
+static unsigned gSeed = 1;
+
+static int randomInt(int lo, int hi)
+{
+  gSeed = gSeed*1103515245 + 12345;
+  return lo + (int)((gSeed >> 8) % (unsigned)(hi - lo + 1));
+}
+
+// Appends size bytes at a 16 byte aligned offset and returns the offset
+static uint32_t append(std::vector<BYTE> *file, const void *data, size_t size)
+{
+  file->resize((file->size() + 15) & ~(size_t)15);
+  uint32_t offset = file->size();
+  file->insert(file->end(), (const BYTE*)data, (const BYTE*)data + size);
+  return offset;
+}
+
+/*
+Writes a network file with random weights and biases for the given layers.
+Multipliers and shifts are chosen so that outputs spread over the int8
+range rather than saturating.
+*/
+static std::vector<BYTE> buildNetwork(int width, int height, int channels, const LayerSpec *specs, int count)
+{
+  std::vector<BYTE> file(sizeof(NNHeader) + count*sizeof(NNLayer));
+  NNHeader header = {{'E', 'B', 'N', 'N'}, NN_VERSION, (uint16_t)count,
+                     (uint16_t)width, (uint16_t)height, (uint16_t)channels, 0};
+  memcpy(file.data(), &header, sizeof(header));
+
+  int w = width, h = height, c = channels;
+
+  for (int i = 0; i < count; i++)
+  {
+    const LayerSpec &spec = specs[i];
+    NNLayer layer = {};
+    layer.type = spec.type;
+    layer.relu = spec.relu;
+    layer.kernel = spec.kernel;
+    layer.stride = spec.stride;
+    layer.padding = spec.padding;
+    layer.channels = spec.channels;
+
+    int weights = 0, biases = 0, fanIn = 1;
+    switch (spec.type)
+    {
+      case NN_CONV2D: weights = spec.channels*spec.kernel*spec.kernel*c; biases = spec.channels; fanIn = spec.kernel*spec.kernel*c; break;
+      case NN_DEPTHWISE: weights = spec.kernel*spec.kernel*c; biases = c; fanIn = spec.kernel*spec.kernel; break;
+      case NN_DENSE: weights = spec.channels*w*h*c; biases = spec.channels; fanIn = w*h*c; break;
+    }
+
+    if (weights)
+    {
+      std::vector<int8_t> values(weights);
+      for (auto &v : values)
+        v = randomInt(-128, 127);
+      layer.weights = append(&file, values.data(), values.size());
+
+      std::vector<int32_t> bias(biases);
+      for (auto &b : bias)
+        b = randomInt(-4000, 4000);
+      layer.bias = append(&file, bias.data(), bias.size()*sizeof(int32_t));
+
+      // The accumulator spreads roughly as 64*64*sqrt(fanIn)
+      int bits = 0;
+      while ((1 << bits) < 64*64*fanIn / 8)
+        bits += 2;
+      layer.shift = 20 + bits / 2;
+      layer.multiplier = randomInt(1 << 19, 1 << 21);
+    }
+
+    memcpy(file.data() + sizeof(NNHeader) + i*sizeof(NNLayer), &layer, sizeof(layer));
+
+    switch (spec.type)
+    {
+      case NN_CONV2D:
+      case NN_DEPTHWISE:
+      case NN_MAXPOOL:
+      case NN_AVGPOOL:
+        w = (w + 2*spec.padding - spec.kernel) / spec.stride + 1;
+        h = (h + 2*spec.padding - spec.kernel) / spec.stride + 1;
+        if (spec.type == NN_CONV2D)
+          c = spec.channels;
+        break;
+      case NN_DENSE:
+        w = h = 1;
+        c = spec.channels;
+        break;
+    }
+  }
+
+  // Pad the end so the file can be copied into an aligned buffer as a whole
+  file.resize((file.size() + 15) & ~(size_t)15);
+  return file;
+}
+
+// Copies a file into 16 byte aligned memory, as it would be in flash
+static BYTE *alignedCopy(const std::vector<BYTE> &file)
+{
+  BYTE *data = (BYTE*)aligned_alloc(16, file.size());
+  memcpy(data, file.data(), file.size());
+  return data;
+}
+
+static LayerSpec randomLayer(int w, int h)
+{
+  static const int channelChoices[] = {1, 3, 8, 16, 17, 32};
+  LayerSpec spec = {};
+  int small = MIN(w, h);
+
+  spec.type = randomInt(NN_CONV2D, NN_RELU);
+  spec.relu = randomInt(0, 1);
+  spec.kernel = randomInt(1, MIN(small, 5));
+  spec.stride = randomInt(1, 2);
+  spec.padding = randomInt(0, spec.kernel - 1);
+  spec.channels = channelChoices[randomInt(0, 5)];
+  return spec;
+}
+
+static int testRandomNetworks(int networks)
+{
+  int failures = 0;
+
+  for (int n = 0; n < networks; n++)
+  {
+    int width = randomInt(4, 40), height = randomInt(4, 30);
+    int channels = randomInt(0, 1) ? 1 : 3;
+    int count = randomInt(1, 6);
+    LayerSpec specs[8];
+
+    // Track the shape so every layer fits its input
+    int w = width, h = height;
+    for (int i = 0; i < count; i++)
+    {
+      specs[i] = randomLayer(w, h);
+      if (specs[i].type != NN_RELU)
+      {
+        w = (w + 2*specs[i].padding - specs[i].kernel) / specs[i].stride + 1;
+        h = (h + 2*specs[i].padding - specs[i].kernel) / specs[i].stride + 1;
+      }
+    }
+    if (randomInt(0, 1))
+    {
+      specs[count] = LayerSpec{NN_DENSE, randomInt(0, 1), 0, 0, 0, randomInt(1, 20)};
+      count++;
+    }
+
+    std::vector<BYTE> file = buildNetwork(width, height, channels, specs, count);
+    BYTE *data = alignedCopy(file);
+    NNModel model;
+
+    if (NNLoad(&model, data, file.size()) != 0)
+    {
+      printf("FAIL network %d: NNLoad() rejected a valid network\n", n);
+      failures++;
+      free(data);
+      continue;
+    }
+
+    std::vector<BYTE> gray(width*3*height*2);
+    for (auto &v : gray)
+      v = randomInt(0, 255);
+    NNInputGray(&model, gray.data(), width*3, height*2);
+
+    int outputs = model.outWidth*model.outHeight*model.outChannels;
+    NNRun(&model);
+    std::vector<int8_t> optimised(model.output, model.output + outputs);
+    NNRunReference(&model);
+
+    if (memcmp(optimised.data(), model.output, outputs) != 0)
+    {
+      printf("FAIL network %d: NNRun() and NNRunReference() differ\n", n);
+      failures++;
+    }
+
+    NNRelease(&model);
+    free(data);
+  }
+
+  printf("test=random_networks networks=%d failures=%d\n", networks, failures);
+  return failures;
+}
+
+static int testMalformed()
+{
+  int failures = 0;
+  LayerSpec specs[] = {{NN_CONV2D, 1, 3, 1, 1, 16}, {NN_DENSE, 0, 0, 0, 0, 4}};
+  std::vector<BYTE> file = buildNetwork(16, 12, 1, specs, 2);
+  NNModel model;
+
+  // Truncated anywhere up to the end of the weights
+  for (size_t size = 0; size + 16 < file.size(); size += 7)
+  {
+    BYTE *data = alignedCopy(file);
+    if (NNLoad(&model, data, size) == 0)
+    {
+      printf("FAIL malformed: NNLoad() accepted a file truncated to %zu bytes\n", size);
+      failures++;
+      NNRelease(&model);
+    }
+    free(data);
+  }
+
+  // Wrong magic, version and a kernel larger than the input
+  for (int corruption = 0; corruption < 3; corruption++)
+  {
+    std::vector<BYTE> bad = file;
+    if (corruption == 0)
+      bad[0] = 'X';
+    else if (corruption == 1)
+      bad[4] = NN_VERSION + 1;
+    else
+      ((NNLayer*)(bad.data() + sizeof(NNHeader)))->kernel = 40;
+
+    BYTE *data = alignedCopy(bad);
+    if (NNLoad(&model, data, bad.size()) == 0)
+    {
+      printf("FAIL malformed: NNLoad() accepted corruption %d\n", corruption);
+      failures++;
+      NNRelease(&model);
+    }
+    free(data);
+  }
+
+  printf("test=malformed failures=%d\n", failures);
+  return failures;
+}
+
+static const char *layerName(int type)
+{
+  static const char *names[] = {"conv2d", "depthwise", "maxpool", "avgpool", "relu", "dense"};
+  return type >= 0 && type <= NN_DENSE ? names[type] : "unknown";
+}
+
+/*
+A lane network on an 80x60 gray input, in the style of a small MobileNet:
+a strided convolution followed by depthwise separable blocks, ending in a
+steering classifier over 9 bins.
+*/
+static int reportLatency()
+{
+  LayerSpec specs[] = {
+    {NN_CONV2D, 1, 3, 2, 1, 16},
+    {NN_DEPTHWISE, 1, 3, 1, 1, 0},
+    {NN_CONV2D, 1, 1, 1, 0, 32},
+    {NN_MAXPOOL, 0, 2, 2, 0, 0},
+    {NN_DEPTHWISE, 1, 3, 1, 1, 0},
+    {NN_CONV2D, 1, 1, 1, 0, 32},
+    {NN_AVGPOOL, 0, 2, 2, 0, 0},
+    {NN_CONV2D, 1, 3, 2, 1, 32},
+    {NN_DENSE, 0, 0, 0, 0, 9}
+  };
+  int count = sizeof(specs) / sizeof(specs[0]);
+
+  std::vector<BYTE> file = buildNetwork(80, 60, 1, specs, count);
+  BYTE *data = alignedCopy(file);
+  NNModel model;
+
+  if (NNLoad(&model, data, file.size()) != 0)
+  {
+    printf("FAIL latency: NNLoad() rejected the lane network\n");
+    free(data);
+    return 1;
+  }
+
+  std::vector<BYTE> gray(160*120);
+  for (auto &v : gray)
+    v = randomInt(0, 255);
+  NNInputGray(&model, gray.data(), 160, 120);
+
+  for (int reference = 0; reference < 2; reference++)
+  {
+    uint64_t totals[NN_MAX_LAYERS] = {};
+
+    for (int run = 0; run < TIMING_RUNS; run++)
+    {
+      reference ? NNRunReference(&model) : NNRun(&model);
+      for (int i = 0; i < count; i++)
+        totals[i] += model.layerMicros[i];
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+      printf("kernels=%s layer=%d type=%s us_avg=%.1f\n", reference ? "reference" : "optimised",
+             i, layerName(model.layers[i].type), totals[i] / (double)TIMING_RUNS);
+      sum += totals[i];
+    }
+    printf("kernels=%s layer=total us_avg=%.1f steering=%.2f\n", reference ? "reference" : "optimised",
+           sum / (double)TIMING_RUNS, NNSteering(&model));
+  }
+
+  NNRelease(&model);
+  free(data);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int networks = argc > 1 ? atoi(argv[1]) : 500;
+  int failures = testRandomNetworks(networks) + testMalformed() + reportLatency();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/*
+Host tests for IPParallelFor() and the IP functions built on it.
+
+Every row range and halo must be covered by the bands exactly once, and each
+banded IP function must give the same image in any number of bands as it
+does serially. Finally the functions are timed in every number of bands
+with BENCHRun(), printed as one BENCHPrint() line each, to show how they
+scale on the host's cores.
+
+Build and run from the repository root as the parallel_test target of the
+host build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/parallel_test [repeats]
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ROWS 480
+#define TIMING_RUNS 200
+
+typedef struct {
+  const char *name;
+  void (*fn)(void *arg);
+} Kernel;
+
+static COLOR gColImg[QQVGA_PIXELS];
+static BYTE gGrayImg[QQVGA_PIXELS];
+static BYTE gSerial[5][QQVGA_PIXELS];
+static BYTE gBanded[5][QQVGA_PIXELS];
+static std::atomic<int> gRowVisits[MAX_ROWS];
+
+static void countRows(int first, int last, void *arg)
+{
+  for (int y = first; y < last; y++)
+    gRowVisits[y]++;
+}
+
+static void runKernels(BYTE out[5][QQVGA_PIXELS])
+{
+  memset(out, 0, 5*QQVGA_PIXELS);
+  IPCol2Gray((BYTE*)gColImg, out[0]);
+  IPLaplace(gGrayImg, out[1]);
+  IPSobel(gGrayImg, out[2]);
+  IPThresholdAdaptive(gGrayImg, 7, 5, out[3]);
+  // Only the intensity plane is compared, the others are scratch
+  IPCol2HSI((BYTE*)gColImg, out[4], out[4], out[4]);
+}
+
+static int testCoverage(void)
+{
+  int failures = 0;
+
+  for (int bands = 1; bands <= IP_MAX_BANDS; bands++)
+  {
+    IPSetBands(bands);
+
+    for (int rows = 0; rows <= MAX_ROWS; rows += 7)
+    for (int halo = 0; halo <= 9; halo += 3)
+    {
+      for (int y = 0; y < rows; y++)
+        gRowVisits[y] = 0;
+
+      IPParallelFor(rows, halo, countRows, NULL);
+
+      for (int y = 0; y < rows; y++)
+      {
+        if (gRowVisits[y] != 1)
+        {
+          printf("coverage bands=%d rows=%d halo=%d: row %d run %d times\n", bands, rows, halo, y, (int)gRowVisits[y]);
+          failures++;
+          break;
+        }
+      }
+    }
+  }
+
+  if (IPSetBands(0) == 0 || IPSetBands(IP_MAX_BANDS + 1) == 0 || IPParallelFor(-1, 0, countRows, NULL) == 0)
+  {
+    printf("invalid arguments accepted\n");
+    failures++;
+  }
+
+  IPSetBands(1);
+  return failures;
+}
+
+static int testKernels(int repeats)
+{
+  const char *names[] = {"IPCol2Gray", "IPLaplace", "IPSobel", "IPThresholdAdaptive", "IPCol2HSI"};
+  int failures = 0;
+
+  IPSetBands(1);
+  runKernels(gSerial);
+
+  for (int bands = 2; bands <= IP_MAX_BANDS; bands++)
+  {
+    IPSetBands(bands);
+
+    for (int r = 0; r < repeats; r++)
+    {
+      runKernels(gBanded);
+
+      for (int k = 0; k < 5; k++)
+      {
+        if (memcmp(gSerial[k], gBanded[k], QQVGA_PIXELS) != 0)
+        {
+          printf("%s bands=%d differs from serial\n", names[k], bands);
+          failures++;
+        }
+      }
+    }
+  }
+
+  IPSetBands(1);
+  return failures;
+}
+
+static void benchCol2Gray(void *arg) { IPCol2Gray((BYTE*)gColImg, gBanded[0]); }
+static void benchLaplace(void *arg) { IPLaplace(gGrayImg, gBanded[1]); }
+static void benchSobel(void *arg) { IPSobel(gGrayImg, gBanded[2]); }
+static void benchThresholdAdaptive(void *arg) { IPThresholdAdaptive(gGrayImg, 7, 5, gBanded[3]); }
+static void benchCol2HSI(void *arg) { IPCol2HSI((BYTE*)gColImg, gBanded[4], gBanded[4], gBanded[4]); }
+
+static void reportScaling(void)
+{
+  const Kernel kernels[] = {
+    {"IPCol2Gray", benchCol2Gray},
+    {"IPLaplace", benchLaplace},
+    {"IPSobel", benchSobel},
+    {"IPThresholdAdaptive", benchThresholdAdaptive},
+    {"IPCol2HSI", benchCol2HSI}
+  };
+  char labels[96];
+  BENCHStats stats;
+
+  for (unsigned k = 0; k < sizeof(kernels)/sizeof(Kernel); k++)
+  for (int bands = 1; bands <= IP_MAX_BANDS; bands++)
+  {
+    IPSetBands(bands);
+    if (BENCHRun(kernels[k].fn, NULL, TIMING_RUNS, &stats) != 0)
+      continue;
+
+    snprintf(labels, sizeof(labels), "bench=%s res=160x120 bands=%d", kernels[k].name, bands);
+    BENCHPrint(labels, &stats);
+  }
+
+  IPSetBands(1);
+}
+
+int main(int argc, char **argv)
+{
+  int repeats = argc > 1 ? atoi(argv[1]) : 20;
+
+  srand(1);
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+  {
+    gColImg[i] = rand() & 0xFFFFFF;
+    gGrayImg[i] = rand();
+  }
+
+  int failures = testCoverage() + testKernels(repeats);
+  reportScaling();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+/*
+Host tests for the task slots of the PROF*() functions.
+
+Tasks far beyond the profiler's 16 slots, one after another, must each have
+their runs recorded, as a task gives its slot back once it has ended every
+stage it began. A task holding a slot must keep timing in it while slots
+before it are given back, so that a stage it began before is still ended.
+
+Build and run from the repository root as the prof_test target of the host
+build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/prof_test
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_hal.h"
+#include <atomic>
+#include <stdio.h>
+
+// Tasks timing a stage one after another, more than the profiler has slots
+#define SERIAL_TASKS 40
+
+static int gTaskStage, gOtherStage;
+static std::atomic<int> gStep(0);
+
+static void serialTask(void *arg)
+{
+  PROFBegin(gTaskStage);
+  PROFEnd(gTaskStage);
+  gStep++;
+}
+
+// Holds the first slot until the main task has taken the next
+static void otherTask(void *arg)
+{
+  PROFBegin(gOtherStage);
+  gStep = 1;
+  while (gStep != 2)
+    halYield();
+  PROFEnd(gOtherStage);
+  gStep = 3;
+}
+
+static int runs(int stage)
+{
+  PROFStats stats;
+  return PROFGet(stage, &stats) == 0 ? stats.count : -1;
+}
+
+static int testSerial(void)
+{
+  int failures = 0;
+
+  gTaskStage = PROFStage("task");
+  for (int i = 0; i < SERIAL_TASKS; i++)
+  {
+    halTaskCreate(serialTask, NULL, 0, "serial");
+    while (gStep != i + 1)
+      halYield();
+  }
+
+  if (runs(gTaskStage) != SERIAL_TASKS)
+  {
+    printf("%d of %d tasks recorded\n", runs(gTaskStage), SERIAL_TASKS);
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testReleased(void)
+{
+  int failures = 0;
+  int outer = PROFStage("outer"), inner = PROFStage("inner");
+  gOtherStage = PROFStage("other");
+
+  gStep = 0;
+  halTaskCreate(otherTask, NULL, 0, "other");
+  while (gStep != 1)
+    halYield();
+
+  PROFBegin(outer);
+  gStep = 2;
+  while (gStep != 3)
+    halYield();
+
+  // The other task's slot is free again, but this task keeps its own
+  PROFBegin(inner);
+  PROFEnd(inner);
+  PROFEnd(outer);
+
+  if (runs(outer) != 1 || runs(inner) != 1 || runs(gOtherStage) != 1)
+  {
+    printf("runs outer=%d inner=%d other=%d\n", runs(outer), runs(inner), runs(gOtherStage));
+    failures++;
+  }
+
+  return failures;
+}
+
+int main(void)
+{
+  int failures = testSerial();
+  failures += testReleased();
+
+  PROFPrint();
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
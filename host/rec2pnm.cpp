@@ -0,0 +1,56 @@
+/*
+Converts a recording of RECStart() into one PPM or PGM file per frame, and
+prints the time and VW pose of every frame as CSV to the standard output.
+
+Run from the build directory of the host build in CMakeLists.txt with:
+
+  ./rec2pnm /drive.rec /drive_ > poses.csv
+
+Paths are on the simulated flash file system, below EYEBOT_FATFS or the
+working directory, and the frame files are numbered from 0000.
+*/
+#include "eyebot.h"
+#include <stdio.h>
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s <recording> <output prefix>\n", argv[0]);
+    return 2;
+  }
+
+  int format = RECOpen(argv[1]);
+  if (format < 0)
+  {
+    fprintf(stderr, "%s: not a recording\n", argv[1]);
+    return 1;
+  }
+
+  static COLOR img[QQVGA_PIXELS];
+  RECInfo info;
+  char path[256];
+  int frames = 0;
+
+  printf("frame,time_us,x,y,phi\n");
+
+  while (RECRead((BYTE*)img, &info) == 0)
+  {
+    snprintf(path, sizeof(path), "%s%04d.%s", argv[2], frames, format == REC_COLOR ? "ppm" : "pgm");
+
+    int result = format == REC_COLOR ? IPWriteFile(path, (BYTE*)img) : IPWriteFileGray(path, (BYTE*)img);
+    if (result != 0)
+    {
+      fprintf(stderr, "%s: cannot write\n", path);
+      return 1;
+    }
+
+    printf("%d,%u,%d,%d,%d\n", frames, (unsigned)info.time, info.x, info.y, info.phi);
+    frames++;
+  }
+
+  RECClose();
+  fprintf(stderr, "%d frames\n", frames);
+
+  return frames > 0 ? 0 : 1;
+}
@@ -0,0 +1,354 @@
+/*
+Host tests for the REC*() recorder, the PNM files of IPReadFile() and
+IPWriteFile(), and the camera sources of CAMSetSource() that play them.
+
+Colour and gray frames of noise, gradients, flat areas and the simulated
+camera are recorded and must read back bit for bit, along with their
+poses, and the size of each recording is printed against the raw frames.
+PNM files written by the library must read back unchanged, and files of
+other sizes, black and white files and malformed files must be filled,
+cropped or rejected. CAMGet() and CAMGetGray() must play recordings and
+numbered files in order, starting over at their end and at the recorded
+times when paced, and the synthetic scene must be the same every time.
+
+Build and run from the repository root as the rec_test target of the host
+build in CMakeLists.txt, which runs it under ctest in the build directory:
+
+  ./build/rec_test [frames]
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static COLOR gImg[QQVGA_PIXELS];
+
+// Frame k of a sequence cycling through noise, gradients, flat areas and the camera
+static void makeFrame(int k, COLOR *img)
+{
+  if (k % 4 == 3)
+  {
+    CAMGet((BYTE*)img);
+    return;
+  }
+
+  for (int i = 0; i < QQVGA_PIXELS; i++)
+  {
+    int x = i % 160, y = i / 160;
+
+    if (k % 4 == 0)
+      img[i] = rand() & 0xFFFFFF;
+    else if (k % 4 == 1)
+      img[i] = IPPRGB2Col(x + k, y*2, (x + y) / 2);
+    else
+      img[i] = x < 80 ? 0x204060 : IPPRGB2Col(200, 200, y);
+  }
+}
+
+static void toGray(const COLOR *img, BYTE *gray)
+{
+  IPCol2Gray((BYTE*)img, gray);
+}
+
+static int testRecording(int format, int frames)
+{
+  const char *path = format == REC_COLOR ? "/rec_test_color.rec" : "/rec_test_gray.rec";
+  int size = format == REC_COLOR ? QQVGA_PIXELS*sizeof(COLOR) : QQVGA_PIXELS;
+  std::vector<std::vector<BYTE>> expected;
+  int failures = 0, retries = 0;
+
+  if (RECStart(path, format) != 0)
+  {
+    printf("RECStart %s failed\n", path);
+    return 1;
+  }
+
+  for (int k = 0; k < frames; k++)
+  {
+    makeFrame(k, gImg);
+
+    // Colour frames keep only the RGB bytes of each COLOR
+    for (int i = 0; i < QQVGA_PIXELS; i++)
+      gImg[i] &= 0xFFFFFF;
+
+    BYTE *img = (BYTE*)gImg;
+    static BYTE gray[QQVGA_PIXELS];
+    if (format == REC_GRAY)
+    {
+      toGray(gImg, gray);
+      img = gray;
+    }
+
+    expected.push_back(std::vector<BYTE>(img, img + size));
+    VWSetPosition(k, -k, k*3);
+
+    // A dropped frame is retried, so that every frame is in the file
+    while (RECFrame(img) != 0)
+    {
+      retries++;
+      halDelay(1);
+    }
+  }
+
+  int recorded, drops, bytes;
+  RECStop();
+  RECGetStats(&recorded, &drops, &bytes);
+  printf("rec=%s frames=%d bytes=%d ratio=%.2f\n", format == REC_COLOR ? "color" : "gray",
+         recorded, bytes, (double)bytes / ((double)recorded*(format == REC_COLOR ? 3 : 1)*QQVGA_PIXELS));
+
+  if (drops != retries)
+  {
+    printf("%s: %d drops for %d retries\n", path, drops, retries);
+    failures++;
+  }
+
+  if (RECOpen(path) != format)
+  {
+    printf("RECOpen %s failed\n", path);
+    return 1;
+  }
+
+  RECInfo info;
+  int k = 0;
+
+  while (k < frames && RECRead((BYTE*)gImg, &info) == 0)
+  {
+    if (memcmp(expected[k].data(), gImg, size) != 0)
+    {
+      printf("%s frame %d differs\n", path, k);
+      failures++;
+    }
+
+    if (info.x != k || info.y != -k)
+    {
+      printf("%s frame %d pose %d,%d\n", path, k, info.x, info.y);
+      failures++;
+    }
+    k++;
+  }
+
+  RECClose();
+
+  if (k != frames || recorded != frames)
+  {
+    printf("%s: read %d of %d frames\n", path, k, frames);
+    failures++;
+  }
+
+  return failures;
+}
+
+static int writeRaw(const char *path, const char *data, int size)
+{
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+  fwrite(data, 1, size, file);
+  fclose(file);
+  return 0;
+}
+
+static int testPNM(void)
+{
+  static COLOR col[QQVGA_PIXELS];
+  static BYTE gray[QQVGA_PIXELS], back[QQVGA_PIXELS];
+  int failures = 0;
+
+  makeFrame(1, col);
+  if (IPWriteFile((char*)"/rec_test.ppm", (BYTE*)col) != 0 || IPReadFile((char*)"/rec_test.ppm", (BYTE*)gImg) != 3 ||
+      memcmp(col, gImg, sizeof(gImg)) != 0)
+  {
+    printf("PPM round trip failed\n");
+    failures++;
+  }
+
+  toGray(col, gray);
+  if (IPWriteFileGray((char*)"/rec_test.pgm", gray) != 0 || IPReadFile((char*)"/rec_test.pgm", back) != 2 ||
+      memcmp(gray, back, sizeof(gray)) != 0)
+  {
+    printf("PGM round trip failed\n");
+    failures++;
+  }
+
+  // A 2x2 gray file with a comment fills the rest of the image with black
+  const char small[] = "P5\n# comment\n2 2\n255\n\x10\x20\x30\x40";
+  writeRaw("rec_test_small.pgm", small, sizeof(small) - 1);
+  memset(back, 0xAA, sizeof(back));
+  if (IPReadFile((char*)"/rec_test_small.pgm", back) != 2 || back[0] != 0x10 || back[1] != 0x20 ||
+      back[160] != 0x30 || back[161] != 0x40 || back[2] != 0 || back[QQVGA_PIXELS - 1] != 0)
+  {
+    printf("small PGM not filled\n");
+    failures++;
+  }
+
+  // A 200 pixel wide black and white file is cropped; 1 bits are black
+  char pbm[64 + 25*2];
+  int len = snprintf(pbm, 64, "P4\n200 2\n");
+  memset(pbm + len, 0, 25*2);
+  pbm[len] = (char)0x80;
+  writeRaw("rec_test.pbm", pbm, len + 25*2);
+  if (IPReadFile((char*)"/rec_test.pbm", back) != 1 || back[0] != 0 || back[1] != 0xFF || back[160] != 0xFF)
+  {
+    printf("PBM not read\n");
+    failures++;
+  }
+
+  writeRaw("rec_test_bad.pgm", "P2\n2 2\n255\n1 2 3 4\n", 19);
+  writeRaw("rec_test_short.pgm", "P5\n4 4\n255\n\x01\x02", 13);
+  if (IPReadFile((char*)"/rec_test_bad.pgm", back) != -1 || IPReadFile((char*)"/rec_test_short.pgm", back) != -1 ||
+      IPReadFile((char*)"/rec_test_missing.pgm", back) != -1)
+  {
+    printf("malformed PNM accepted\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testSource(void)
+{
+  const char *path = "/rec_test_source.rec";
+  static BYTE gray[5][QQVGA_PIXELS], back[QQVGA_PIXELS];
+  static COLOR col[3][QQVGA_PIXELS], first[QQVGA_PIXELS];
+  int failures = 0;
+
+  // Five gray frames 40 ms apart, replayed in real time and then again
+  RECStart(path, REC_GRAY);
+  for (int k = 0; k < 5; k++)
+  {
+    makeFrame(k, gImg);
+    toGray(gImg, gray[k]);
+    while (RECFrame(gray[k]) != 0)
+      halDelay(1);
+    halDelay(40);
+  }
+  RECStop();
+
+  if (CAMSetSource(CAM_RECORDING, path, CAM_PACE_REALTIME) != 0)
+  {
+    printf("CAMSetSource %s failed\n", path);
+    return 1;
+  }
+
+  uint32_t start = halMicros(), span = 0;
+  RECInfo info, firstInfo;
+  RECOpen(path);
+  RECRead(back, &firstInfo);
+  while (RECRead(back, &info) == 0)
+    span = info.time - firstInfo.time;
+  RECClose();
+
+  for (int k = 0; k < 7; k++)
+  {
+    if (CAMGetGray(back) != 0 || memcmp(back, gray[k % 5], QQVGA_PIXELS) != 0)
+    {
+      printf("replayed gray frame %d differs\n", k);
+      failures++;
+    }
+
+    uint32_t elapsed = halMicros() - start;
+    if (k == 4 && (elapsed < span || elapsed > span + 5000))
+    {
+      printf("replay took %u us for %u us recorded\n", (unsigned)elapsed, (unsigned)span);
+      failures++;
+    }
+  }
+
+  // Gray frames widen to color
+  CAMSetSource(CAM_RECORDING, path, CAM_PACE_FAST);
+  CAMGet((BYTE*)gImg);
+  if (gImg[0] != gray[0][0]*0x010101u || gImg[QQVGA_PIXELS - 1] != gray[0][QQVGA_PIXELS - 1]*0x010101u)
+  {
+    printf("replayed color frame differs\n");
+    failures++;
+  }
+
+  char name[64];
+  for (int k = 0; k < 3; k++)
+  {
+    makeFrame(4*k + 1, col[k]);
+    snprintf(name, sizeof(name), "/rec_test_f%d.ppm", k);
+    IPWriteFile(name, (BYTE*)col[k]);
+  }
+
+  if (CAMSetSource(CAM_FILES, "/rec_test_f%d.ppm", CAM_PACE_FAST) != 0)
+  {
+    printf("CAMSetSource files failed\n");
+    failures++;
+  }
+
+  for (int k = 0; k < 4; k++)
+  {
+    if (CAMGet((BYTE*)gImg) != 0 || memcmp(gImg, col[k % 3], sizeof(gImg)) != 0)
+    {
+      printf("file frame %d differs\n", k);
+      failures++;
+    }
+  }
+
+  CAMSetSource(CAM_SYNTHETIC, NULL, CAM_PACE_FAST);
+  CAMGet((BYTE*)first);
+  CAMSetSource(CAM_SYNTHETIC, NULL, CAM_PACE_FAST);
+  CAMGet((BYTE*)gImg);
+  if (memcmp(first, gImg, sizeof(gImg)) != 0)
+  {
+    printf("synthetic scene differs between runs\n");
+    failures++;
+  }
+
+  CAMGet((BYTE*)gImg);
+  if (memcmp(first, gImg, sizeof(gImg)) == 0)
+  {
+    printf("synthetic scene does not move\n");
+    failures++;
+  }
+
+  if (CAMSetSource(CAM_FILES, "/rec_test_missing%d.ppm", CAM_PACE_FAST) == 0 ||
+      CAMSetSource(CAM_RECORDING, "/rec_test_f0.ppm", CAM_PACE_FAST) == 0 ||
+      CAMSetSource(CAM_SYNTHETIC + 1, NULL, CAM_PACE_FAST) == 0)
+  {
+    printf("invalid source accepted\n");
+    failures++;
+  }
+
+  // Patterns that are not one integer conversion, which would read arguments that are not there
+  const char *patterns[] = {"/rec_test_f.ppm", "/rec_test_f%s.ppm", "/rec_test_f%d%d.ppm", "/rec_test_f%ld.ppm",
+                            "/rec_test_f%*d.ppm", "/rec_test_f%n.ppm", "/rec_test_f%"};
+  for (const char *pattern : patterns)
+  {
+    if (CAMSetSource(CAM_FILES, pattern, CAM_PACE_FAST) == 0)
+    {
+      printf("file pattern %s accepted\n", pattern);
+      failures++;
+    }
+  }
+
+  if (CAMSetSource(CAM_FILES, "/rec_test_f%-1.1d.ppm", CAM_PACE_FAST) != 0)
+  {
+    printf("valid file pattern refused\n");
+    failures++;
+  }
+
+  CAMSetSource(CAM_LIVE, NULL, CAM_PACE_FAST);
+  return failures;
+}
+
+int main(int argc, char **argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 40;
+
+  hostClockVirtual(1);
+  EYEBOTInit();
+
+  srand(1);
+  int failures = testRecording(REC_COLOR, frames) + testRecording(REC_GRAY, frames);
+  failures += testPNM();
+  failures += testSource();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,410 @@
+/*
+Closed-loop simulation of an EyeBot driving on a floor map, for the
+simulated board of host/hal_linux.cpp.
+
+The robot is a differential drive whose wheel speeds follow the direction
+pins and PWM duty cycles that the library sets, full duty being
+SIM_WHEEL_SPEED. Between motor changes the speeds are constant, so the pose
+is integrated exactly along arcs, in steps of SIM_STEP_US to check the
+wheels and walls on the way. The board brings the robot up to date before
+every motor change and sensor read.
+
+The camera view is rendered from the floor map as seen by a pinhole camera
+mounted SIM_CAM_HEIGHT above the floor and tilted down by SIM_CAM_TILT, the
+floor point of every pixel being computed once. Rays above the horizon see
+the lab walls. The PSD is a ray along the robot's heading, converted to a
+raw value with the calibration of PSDGet(). Map pixels of pure red are
+walls, as are the edges of the map.
+
+The built-in circuit is an oval lane of white markings on a gray floor, in
+place of the photograph of the UWA test circuit, which is not a top-down
+map. Any other binary PPM or PGM can be driven on at a given scale.
+
+A lap is counted whenever the robot comes back to its starting point after
+leaving it by more than SIM_LAP_LEAVE, and a lane departure whenever a
+wheel runs onto a light marking. Both are printed with the distance driven
+when the program ends, as one line of key=value pairs.
+*/
+#include "eyebot_host.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define SIM_WHEEL_SPEED 500.0// mm/s at full duty, the library's MAX_LIN_SPEED
+#define SIM_AXLE 127.3// mm between the wheels, for MAX_ANG_SPEED pivoting on one wheel
+#define SIM_STEP_US 1000
+#define SIM_CAM_HEIGHT 200.0// mm
+#define SIM_CAM_FORWARD 60.0// mm ahead of the axle
+#define SIM_CAM_TILT 25.0// degrees below level
+#define SIM_CAM_HFOV 60.0// degrees
+#define SIM_PSD_FORWARD 50.0// mm ahead of the axle
+#define SIM_PSD_RANGE 1000.0// mm
+#define SIM_BUMPER 80.0// mm ahead of the axle
+#define SIM_LAP_LEAVE 1000.0// mm
+#define SIM_LAP_RETURN 150.0// mm
+#define SIM_MARKING_LEVEL 160// Mean RGB above which the floor is a marking
+#define SIM_DEFAULT_SCALE 5// mm per map pixel
+
+// The built-in circuit: an oval of straights joined by half circles, its
+// lane SIM_LANE_WIDTH wide between markings SIM_LINE_WIDTH wide
+#define SIM_FLOOR_WIDTH 4000
+#define SIM_FLOOR_HEIGHT 2600
+#define SIM_STRAIGHT 1500.0
+#define SIM_RADIUS 800.0
+#define SIM_LANE_WIDTH 300.0
+#define SIM_LINE_WIDTH 25.0
+#define SIM_LINE_BLUR 10.0
+#define SIM_LINE_LEVEL 200
+
+#define QQVGA_WIDTH 160
+#define QQVGA_HEIGHT 120
+
+// Floor point of a camera pixel relative to the axle centre, in mm
+typedef struct {
+  float forward, right;
+  bool floor;
+} SimRay;
+
+static bool gSimActive = false;
+static std::vector<uint8_t> gMap;// RGB, row 0 at the top, the far end of the y axis
+static int gMapWidth = 0, gMapHeight = 0;
+static double gScale = SIM_DEFAULT_SCALE;
+static SimRay gRays[QQVGA_WIDTH*QQVGA_HEIGHT];
+
+static double gX = 0, gY = 0, gPhi = 0;// mm, mm, radians clockwise from the y axis
+static double gStartX = 0, gStartY = 0;
+static uint64_t gSimTime = 0;
+static HostSimStats gStats;
+static bool gLeftStart = false, gOnMarking = false, gBlocked = false;
+static uint64_t gLapStart = 0;
+static FILE *gLog = NULL;
+
+// Distance from the centre line of the built-in circuit's lane
+static double laneOffset(double x, double y)
+{
+  double cx = SIM_FLOOR_WIDTH/2.0, cy = SIM_FLOOR_HEIGHT/2.0;
+  double end = SIM_STRAIGHT/2;
+
+  if (fabs(x - cx) <= end)
+    return fabs(fabs(y - cy) - SIM_RADIUS);
+
+  double dx = x - cx - (x > cx ? end : -end), dy = y - cy;
+  return fabs(sqrt(dx*dx + dy*dy) - SIM_RADIUS);
+}
+
+static void buildCircuit(void)
+{
+  gScale = SIM_DEFAULT_SCALE;
+  gMapWidth = SIM_FLOOR_WIDTH / SIM_DEFAULT_SCALE;
+  gMapHeight = SIM_FLOOR_HEIGHT / SIM_DEFAULT_SCALE;
+  gMap.assign((size_t)gMapWidth*gMapHeight*3, 0);
+
+  for (int row = 0; row < gMapHeight; row++)
+  for (int col = 0; col < gMapWidth; col++)
+  {
+    double x = (col + 0.5)*gScale, y = (gMapHeight - row - 0.5)*gScale;
+    double edge = fabs(laneOffset(x, y) - SIM_LANE_WIDTH/2) - SIM_LINE_WIDTH/2;
+    // Markings fade into the floor over a few millimetres, as seen through
+    // a lens, and the floor has a little texture for edge detection to reject
+    double marking = edge < 0 ? 1 : edge < SIM_LINE_BLUR ? 1 - edge/SIM_LINE_BLUR : 0;
+    int v = 100 + ((col*7 + row*13) % 9) + marking*(SIM_LINE_LEVEL - 100);
+
+    uint8_t *p = &gMap[((size_t)row*gMapWidth + col)*3];
+    p[0] = p[1] = p[2] = v;
+  }
+
+  gX = SIM_FLOOR_WIDTH/2.0;
+  gY = SIM_FLOOR_HEIGHT/2.0 - SIM_RADIUS;
+  gPhi = M_PI/2;
+}
+
+static bool readMap(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  char magic[3] = {};
+  int width, height, maxval;
+  if (fscanf(file, "%2s %d %d %d", magic, &width, &height, &maxval) != 4 || maxval != 255 ||
+      (strcmp(magic, "P6") && strcmp(magic, "P5")) || width <= 0 || height <= 0)
+  {
+    fclose(file);
+    return false;
+  }
+  fgetc(file);
+
+  int channels = magic[1] == '6' ? 3 : 1;
+  std::vector<uint8_t> data((size_t)width*height*channels);
+  bool complete = fread(data.data(), 1, data.size(), file) == data.size();
+  fclose(file);
+  if (!complete)
+    return false;
+
+  gMapWidth = width;
+  gMapHeight = height;
+  gMap.resize((size_t)width*height*3);
+  for (size_t i = 0; i < (size_t)width*height; i++)
+  for (int c = 0; c < 3; c++)
+    gMap[i*3 + c] = data[i*channels + (channels == 3 ? c : 0)];
+
+  gX = width*gScale/2;
+  gY = height*gScale/2;
+  gPhi = 0;
+
+  return true;
+}
+
+// Map pixel under a floor point, NULL beyond the edges
+static const uint8_t* mapPixel(double x, double y)
+{
+  int col = (int)floor(x / gScale), row = gMapHeight - 1 - (int)floor(y / gScale);
+  if (col < 0 || col >= gMapWidth || row < 0 || row >= gMapHeight)
+    return NULL;
+
+  return &gMap[((size_t)row*gMapWidth + col)*3];
+}
+
+static bool isWall(double x, double y)
+{
+  const uint8_t *p = mapPixel(x, y);
+  return !p || (p[0] == 255 && p[1] == 0 && p[2] == 0);
+}
+
+static bool isMarking(double x, double y)
+{
+  const uint8_t *p = mapPixel(x, y);
+  return p && (p[0] + p[1] + p[2]) / 3 > SIM_MARKING_LEVEL;
+}
+
+static void buildRays(void)
+{
+  double focal = (QQVGA_WIDTH/2) / tan(SIM_CAM_HFOV/2 * M_PI/180);
+  double tilt = SIM_CAM_TILT * M_PI/180;
+
+  for (int v = 0; v < QQVGA_HEIGHT; v++)
+  for (int u = 0; u < QQVGA_WIDTH; u++)
+  {
+    double right = (u + 0.5 - QQVGA_WIDTH/2) / focal, down = (v + 0.5 - QQVGA_HEIGHT/2) / focal;
+    double rayForward = cos(tilt) - down*sin(tilt), rayDown = sin(tilt) + down*cos(tilt);
+    SimRay *ray = &gRays[v*QQVGA_WIDTH + u];
+
+    ray->floor = rayDown > 1e-6;
+    if (ray->floor)
+    {
+      double t = SIM_CAM_HEIGHT / rayDown;
+      ray->forward = SIM_CAM_FORWARD + t*rayForward;
+      ray->right = t*right;
+    }
+  }
+}
+
+// Inverse of the calibration table of PSDGet(), raw value by distance in mm
+static int psdRaw(double distance)
+{
+  static const int raws[] = {4000, 3700, 3240, 2980, 2740, 2520, 2340, 2150, 2030, 1880, 1780, 1640, 1570,
+                             1480, 1430, 1330, 1260, 1190, 1175, 1100, 1050, 1000, 970, 930, 870};
+  const int count = sizeof(raws)/sizeof(raws[0]);
+
+  if (distance >= 300)
+    return 800;
+
+  // Rounded down to the table's 10 mm steps, as PSDGet() reads them back
+  int i = distance <= 60 ? 0 : (int)((distance - 60) / 10);
+  return raws[i < count ? i : count - 1];
+}
+
+static double psdDistance(void)
+{
+  double sx = gX + SIM_PSD_FORWARD*sin(gPhi), sy = gY + SIM_PSD_FORWARD*cos(gPhi);
+
+  for (double d = 0; d < SIM_PSD_RANGE; d += gScale)
+    if (isWall(sx + d*sin(gPhi), sy + d*cos(gPhi)))
+      return d;
+
+  return SIM_PSD_RANGE;
+}
+
+// Wheel speeds in mm/s from the motor driver, forward being a high left
+// and a low right direction pin
+static void wheelSpeeds(double *left, double *right)
+{
+  int level, duty;
+
+  hostGetMotor(HAL_MOTOR_LEFT, &level, &duty);
+  *left = (level ? 1 : -1) * duty * SIM_WHEEL_SPEED / 255;
+  hostGetMotor(HAL_MOTOR_RIGHT, &level, &duty);
+  *right = (level ? -1 : 1) * duty * SIM_WHEEL_SPEED / 255;
+}
+
+static void step(double v, double w, double dt, uint64_t time)
+{
+  double phi = gPhi + w*dt, x, y;
+
+  if (fabs(w) < 1e-9)
+  {
+    x = gX + v*dt*sin(gPhi);
+    y = gY + v*dt*cos(gPhi);
+  }
+  else
+  {
+    x = gX + v/w*(cos(gPhi) - cos(phi));
+    y = gY + v/w*(sin(phi) - sin(gPhi));
+  }
+
+  gPhi = phi;
+
+  // The robot stops against a wall, turning on the spot still works
+  bool blocked = isWall(x, y) || isWall(x + SIM_BUMPER*sin(phi), y + SIM_BUMPER*cos(phi)) ||
+                 isWall(x - SIM_BUMPER*sin(phi), y - SIM_BUMPER*cos(phi));
+  if (blocked && !gBlocked)
+    gStats.collisions++;
+  gBlocked = blocked;
+
+  if (!blocked)
+  {
+    gStats.distance += hypot(x - gX, y - gY);
+    gX = x;
+    gY = y;
+  }
+
+  double half = SIM_AXLE/2;
+  bool onMarking = isMarking(gX + half*cos(gPhi), gY - half*sin(gPhi)) ||
+                   isMarking(gX - half*cos(gPhi), gY + half*sin(gPhi));
+  if (onMarking && !gOnMarking)
+    gStats.departures++;
+  gOnMarking = onMarking;
+
+  double fromStart = hypot(gX - gStartX, gY - gStartY);
+  if (fromStart > SIM_LAP_LEAVE)
+    gLeftStart = true;
+  else if (gLeftStart && fromStart < SIM_LAP_RETURN)
+  {
+    gLeftStart = false;
+    gStats.laps++;
+    gStats.lastLapMs = (time - gLapStart) / 1000;
+    if (!gStats.bestLapMs || gStats.lastLapMs < gStats.bestLapMs)
+      gStats.bestLapMs = gStats.lastLapMs;
+    gLapStart = time;
+  }
+}
+
+static void simScene(RGB565 *frame, int index, void *arg)
+{
+  hostSimUpdate();
+
+  double s = sin(gPhi), c = cos(gPhi);
+
+  for (int i = 0; i < QQVGA_WIDTH*QQVGA_HEIGHT; i++)
+  {
+    const SimRay &ray = gRays[i];
+    int r = 150, g = 160, b = 170;
+
+    if (ray.floor)
+    {
+      const uint8_t *p = mapPixel(gX + ray.forward*s + ray.right*c, gY + ray.forward*c - ray.right*s);
+      if (p)
+      {
+        r = p[0];
+        g = p[1];
+        b = p[2];
+      }
+    }
+
+    frame[i] = (r & 0xF8) << 8 | (g & 0xFC) << 3 | b >> 3;
+  }
+
+  if (gLog)
+    fprintf(gLog, "%llu,%.0f,%.0f,%.1f,%d,%d\n", (unsigned long long)(gSimTime / 1000), gX, gY,
+            remainder(gPhi*180/M_PI, 360), gStats.departures, gStats.laps);
+}
+
+int hostSimStart(const char *path, double scale)
+{
+  if (scale > 0)
+    gScale = scale;
+
+  if (!path || !*path || !strcmp(path, "circuit"))
+    buildCircuit();
+  else if (!readMap(path))
+  {
+    fprintf(stderr, "eyebot: cannot read simulator map %s\n", path);
+    return -1;
+  }
+
+  buildRays();
+  memset(&gStats, 0, sizeof(gStats));
+  gSimTime = gLapStart = hostClockMicros();
+  gStartX = gX;
+  gStartY = gY;
+  gLeftStart = gOnMarking = gBlocked = false;
+  gSimActive = true;
+
+  hostCamSetSource(simScene, NULL);
+  hostSetPSDRaw(psdRaw(psdDistance()));
+
+  const char *log = getenv("EYEBOT_SIM_LOG");
+  if (log && *log && !gLog && (gLog = fopen(log, "w")))
+    fprintf(gLog, "time_ms,x,y,phi,departures,laps\n");
+
+  return 0;
+}
+
+void hostSimSetPose(double x, double y, double phi)
+{
+  gX = gStartX = x;
+  gY = gStartY = y;
+  gPhi = phi * M_PI/180;
+  gLeftStart = false;
+  hostSetPSDRaw(psdRaw(psdDistance()));
+}
+
+void hostSimGetPose(double *x, double *y, double *phi)
+{
+  *x = gX;
+  *y = gY;
+  *phi = remainder(gPhi*180/M_PI, 360);
+}
+
+void hostSimUpdate(void)
+{
+  if (!gSimActive)
+    return;
+
+  uint64_t time = hostClockMicros();
+  if (time <= gSimTime)
+    return;
+
+  double left, right;
+  wheelSpeeds(&left, &right);
+  double v = (left + right)/2, w = (left - right)/SIM_AXLE;
+
+  while (gSimTime < time)
+  {
+    uint64_t dt = time - gSimTime < SIM_STEP_US ? time - gSimTime : SIM_STEP_US;
+    gSimTime += dt;
+    step(v, w, dt / 1e6, gSimTime);
+  }
+
+  hostSetPSDRaw(psdRaw(psdDistance()));
+}
+
+void hostSimGetStats(HostSimStats *stats)
+{
+  *stats = gStats;
+}
+
+void hostSimPrint(void)
+{
+  if (!gSimActive)
+    return;
+
+  printf("sim=drive time_ms=%llu distance_mm=%.0f laps=%d last_lap_ms=%u best_lap_ms=%u departures=%d collisions=%d\n",
+         (unsigned long long)(gSimTime / 1000), gStats.distance, gStats.laps, (unsigned)gStats.lastLapMs,
+         (unsigned)gStats.bestLapMs, gStats.departures, gStats.collisions);
+
+  if (gLog)
+    fflush(gLog);
+}
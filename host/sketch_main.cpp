@@ -0,0 +1,20 @@
+/*
+Entry point of the example sketches built as host programs: the Arduino
+core's setup() and loop() sequence, on the simulated board.
+*/
+#include "eyebot_host.h"
+
+void setup();
+void loop();
+
+int main()
+{
+  hostInit();
+  setup();
+
+  while (true)
+  {
+    loop();
+    hostPoll();
+  }
+}
@@ -0,0 +1,206 @@
+/*
+Host tests for the timer service of OSAttachTimer() and the system clock of
+OSGetCount(), OSGetTime() and OSWait().
+
+Timers of different scales attached together must be called at their rates
+on the virtual clock, on time, and no more once detached. A callback that
+runs longer than its period must lose the calls it misses as overruns
+rather than have them made up, and timers beyond OS_MAX_TIMERS, of no
+scale or no function must be refused. A callback must be able to detach
+its own timer, and the slot be taken again afterwards. The statistics of
+each timer are printed as one line of key=value pairs.
+
+Build and run from the repository root as the timer_test target of the host
+build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/timer_test
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_host.h"
+#include <stdio.h>
+
+static int gFast, gSlow, gLong, gOnce;
+static TIMER gOnceTimer;
+static uint32_t gSlowLast, gSlowGap;
+
+static void onFast(void) { gFast++; }
+
+static void onSlow(void)
+{
+  uint32_t now = halMillis();
+  if (gSlow > 0 && now - gSlowLast > gSlowGap)
+    gSlowGap = now - gSlowLast;
+  gSlowLast = now;
+  gSlow++;
+}
+
+// Takes 12 ms of a period of 5
+static void onLong(void)
+{
+  gLong++;
+  halDelay(12);
+}
+
+// Detaches its own timer
+static void onOnce(void)
+{
+  gOnce++;
+  OSDetachTimer(gOnceTimer);
+}
+
+static void printStats(const char *name, TIMER t)
+{
+  OSTimerStats stats;
+  if (OSGetTimerStats(t, &stats) == 0)
+    printf("timer=%s calls=%d overruns=%d jitter_mean=%.1f jitter_max=%.1f run_max=%.1f\n", name, stats.calls,
+           stats.overruns, stats.jitter_mean, stats.jitter_max, stats.run_max);
+}
+
+static int testClock(void)
+{
+  int failures = 0, hrs, mins, secs, ticks;
+
+  // 1 h 2 min 3.456 s after start-up
+  hostClockAdvance((3723456 - (uint64_t)halMillis())*1000);
+  OSGetTime(&hrs, &mins, &secs, &ticks);
+  if (hrs != 1 || mins != 2 || secs != 3 || ticks != 456 || OSGetCount() != 3723456)
+  {
+    printf("OSGetTime gave %d:%d:%d.%d, count %d\n", hrs, mins, secs, ticks, OSGetCount());
+    failures++;
+  }
+
+  int start = OSGetCount();
+  if (OSWait(50) != 0 || OSGetCount() - start != 50 || OSWait(-1) != -1)
+  {
+    printf("OSWait(50) took %d ms\n", OSGetCount() - start);
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testRates(void)
+{
+  int failures = 0;
+  TIMER fast = OSAttachTimer(1, onFast), slow = OSAttachTimer(10, onSlow);
+  OSTimerStats stats;
+
+  halDelay(1000);
+
+  if (gFast < 999 || gFast > 1001 || gSlow < 99 || gSlow > 101 || gSlowGap != 10)
+  {
+    printf("%d fast and %d slow calls in 1 s, slow %u ms apart at most\n", gFast, gSlow, (unsigned)gSlowGap);
+    failures++;
+  }
+
+  if (OSGetTimerStats(slow, &stats) != 0 || stats.calls != gSlow || stats.overruns != 0 || stats.jitter_max > 100)
+  {
+    printf("slow timer statistics wrong\n");
+    failures++;
+  }
+
+  printStats("fast", fast);
+  printStats("slow", slow);
+
+  int calls = gFast;
+  if (OSDetachTimer(fast) != 0 || OSDetachTimer(fast) != -1)
+  {
+    printf("fast timer not detached\n");
+    failures++;
+  }
+  halDelay(100);
+
+  if (gFast != calls || gSlow < 109 || OSGetTimerStats(fast, &stats) != -1)
+  {
+    printf("detached timer called %d times\n", gFast - calls);
+    failures++;
+  }
+
+  OSDetachTimer(slow);
+  return failures;
+}
+
+static int testOverrun(void)
+{
+  int failures = 0;
+  TIMER t = OSAttachTimer(5, onLong);
+  OSTimerStats stats;
+
+  halDelay(300);
+
+  // Each call takes over two periods, so more calls are lost than made
+  if (OSGetTimerStats(t, &stats) != 0 || stats.calls != gLong || stats.overruns <= stats.calls ||
+      stats.calls + stats.overruns < 55 || stats.calls + stats.overruns > 61 || stats.run_max < 12000)
+  {
+    printf("%d calls with %d overruns in 300 ms\n", stats.calls, stats.overruns);
+    failures++;
+  }
+
+  printStats("long", t);
+  OSDetachTimer(t);
+
+  return failures;
+}
+
+static int testLimits(void)
+{
+  int failures = 0;
+  TIMER timers[OS_MAX_TIMERS];
+
+  for (int k = 0; k < OS_MAX_TIMERS; k++)
+    timers[k] = OSAttachTimer(1000, onFast);
+
+  if (timers[OS_MAX_TIMERS - 1] < 0 || OSAttachTimer(1000, onFast) != -1 || OSAttachTimer(0, onFast) != -1 ||
+      OSAttachTimer(1, NULL) != -1 || OSDetachTimer(-1) != -1 || OSDetachTimer(OS_MAX_TIMERS) != -1)
+  {
+    printf("timer limits not kept\n");
+    failures++;
+  }
+
+  for (int k = 0; k < OS_MAX_TIMERS; k++)
+    OSDetachTimer(timers[k]);
+
+  if (OSAttachTimer(1000, onFast) < 0)
+  {
+    printf("no timer free after detaching all\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+static int testSelfDetach(void)
+{
+  int failures = 0;
+
+  gOnceTimer = OSAttachTimer(1, onOnce);
+  halDelay(20);
+
+  // Its slot, the first, is free again
+  TIMER t = OSAttachTimer(1, onFast);
+  if (gOnce != 1 || t != gOnceTimer)
+  {
+    printf("self-detaching timer called %d times, slot %d taken for %d\n", gOnce, t, gOnceTimer);
+    failures++;
+  }
+
+  OSDetachTimer(t);
+  return failures;
+}
+
+int main(void)
+{
+  hostClockVirtual(1);
+  EYEBOTInit();
+
+  int failures = testClock();
+  failures += testRates();
+  failures += testOverrun();
+  failures += testSelfDetach();
+  failures += testLimits();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}
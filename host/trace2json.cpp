@@ -0,0 +1,194 @@
+/*
+Converts a binary EyeBot trace from TRACEWrite() or TRACEStream() into the
+Chrome trace event JSON format, for viewing in Perfetto (ui.perfetto.dev)
+or chrome://tracing.
+
+Build and run from the repository root with:
+
+  g++ -O2 host/trace2json.cpp -o trace2json
+  ./trace2json trace.bin [trace.json]
+
+or as the trace2json target of the host build in CMakeLists.txt. The input
+may also be a capture of the serial console, in which case the trace is
+found by its magic among the rest of the output. Each core becomes a process
+and each task recorded on it a thread of that process, so the stages of
+tasks sharing a core keep their own tracks. Traces of the older format
+without tasks show one thread per core. The 32-bit microsecond timestamps
+are unwrapped, so traces of more than 71 minutes keep their order.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The magic of each version without its last digit, and its event size
+static const char MAGIC[] = "EBTRACE";
+static const int EVENT_SIZE[] = {0, 8, 10};
+
+enum {
+  TRACE_BEGIN,
+  TRACE_END,
+  TRACE_INSTANT
+};
+
+static uint32_t get16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return get16(p) | get16(p + 2) << 16;
+}
+
+static void writeString(FILE *out, const std::string &str)
+{
+  fputc('"', out);
+  for (unsigned char c : str)
+  {
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2 || argc > 3)
+  {
+    fprintf(stderr, "usage: %s <trace.bin> [trace.json]\n", argv[0]);
+    return 2;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  if (!in)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    data.insert(data.end(), chunk, chunk + n);
+  fclose(in);
+
+  // The last trace in the input wins, as a serial capture may hold several
+  size_t pos = std::string::npos;
+  int version = 0;
+  for (size_t i = 0; i + 8 <= data.size(); i++)
+  {
+    if (memcmp(&data[i], MAGIC, 7) == 0 && (data[i + 7] == '1' || data[i + 7] == '2'))
+    {
+      pos = i;
+      version = data[i + 7] - '0';
+    }
+  }
+  int size = EVENT_SIZE[version];
+
+  if (pos == std::string::npos || pos + 14 > data.size())
+  {
+    fprintf(stderr, "%s: no trace found\n", argv[1]);
+    return 1;
+  }
+
+  const uint8_t *p = &data[pos + 8], *end = data.data() + data.size();
+  int name_count = get16(p);
+  uint32_t event_count = get32(p + 2);
+  p += 6;
+
+  std::vector<std::string> names;
+  for (int i = 0; i < name_count; i++)
+  {
+    if (p >= end || p + 1 + *p > end)
+    {
+      fprintf(stderr, "%s: truncated string table\n", argv[1]);
+      return 1;
+    }
+
+    names.push_back(std::string((const char*)p + 1, *p));
+    p += 1 + *p;
+  }
+
+  if ((size_t)(end - p) < size*(size_t)event_count)
+  {
+    fprintf(stderr, "%s: truncated trace, %u of %u events\n", argv[1],
+            (unsigned)((end - p) / size), (unsigned)event_count);
+    event_count = (end - p) / size;
+  }
+
+  FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+  if (!out)
+  {
+    perror(argv[2]);
+    return 1;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  // Tasks seen on each core
+  std::set<std::pair<unsigned, unsigned>> threads;
+  uint64_t time = 0;
+  uint32_t last = 0;
+
+  for (uint32_t i = 0; i < event_count; i++, p += size)
+  {
+    uint32_t stamp = get32(p);
+    unsigned name = get16(p + 4), type = p[6], core = p[7];
+    unsigned task = version >= 2 ? get16(p + 8) : core;
+
+    // Events of both cores may be slightly out of order, so only a large
+    // step backwards is taken as the counter wrapping around
+    if (i == 0)
+      time = stamp;
+    else
+      time += (int32_t)(stamp - last);
+    last = stamp;
+
+    const char *phase = type == TRACE_BEGIN ? "B" : type == TRACE_END ? "E" : "i";
+    threads.insert(std::make_pair(core, task));
+
+    fprintf(out, "{\"name\":");
+    writeString(out, name < names.size() ? names[name] : "?");
+    fprintf(out, ",\"ph\":\"%s\",\"ts\":%llu,\"pid\":%u,\"tid\":%u%s},\n", phase,
+            (unsigned long long)time, core, task, type == TRACE_INSTANT ? ",\"s\":\"t\"" : "");
+  }
+
+  // Names of the cores and tasks, the last without the comma JSON does not allow
+  unsigned core = 256;
+  size_t left = threads.size();
+  for (const std::pair<unsigned, unsigned> &thread : threads)
+  {
+    if (thread.first != core)
+    {
+      core = thread.first;
+      fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"EyeBot core %u\"}},\n",
+              core, core);
+    }
+
+    if (version >= 2)
+      fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"task %u\"}}",
+              core, thread.second, thread.second);
+    else
+      fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"core %u\"}}",
+              core, thread.second, core);
+    fprintf(out, --left ? ",\n" : "\n");
+  }
+
+  fprintf(out, "]}\n");
+
+  if (out != stdout)
+    fclose(out);
+
+  fprintf(stderr, "%u events\n", (unsigned)event_count);
+
+  return event_count > 0 ? 0 : 1;
+}
@@ -0,0 +1,419 @@
+/*
+Host tests for the touch and button events of KEYReadEvent(), the keys of
+KEYGet() and KEYWait(), and the touch widgets of the UI*() functions and
+LCDMenu().
+
+Each change of the simulated touch screen must queue one event, in order,
+with a lift reported where the finger last was. KEYReadXY() must not read
+the controller, and KEYGetXY() and KEYGetEvent() must wait for a scripted
+touch to fall due. A scripted press must end KEYGet() as it falls due and
+queue a press, a long press and a release, while a key held from before
+must not end it, and KEYGet() and KEYWait() must give up after their time.
+
+Touches are given to the simulated touch screen and UIUpdate() must act on
+each once, when it begins, for the topmost widget under it: buttons count
+their touches, steppers step within their range by their outer thirds, and
+labels ignore them. A touched widget must be drawn highlighted at once, and
+plainly again by the first UIUpdate() after UI_FLASH_MS, with its callback
+called once, and a stepper held down must step again at UI_REPEAT_MS after
+UI_REPEAT_DELAY_MS. Entries of LCDMenu() touched for UIUpdate() must be read
+as keys by KEYRead(), which must leave the touch to UIUpdate(), and an
+UIUpdate() with nothing to do is timed against redrawing every widget.
+
+Build and run from the repository root as the ui_test target of the host
+build in CMakeLists.txt, which runs it under ctest:
+
+  ./build/ui_test
+
+The exit status is non-zero if any test fails.
+*/
+#include "eyebot.h"
+#include "eyebot_host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int gCallId, gCallValue;
+
+static void onEvent(int id, int value, void *arg)
+{
+  gCallId = id;
+  gCallValue = value;
+  *(int*)arg += 1;
+}
+
+// Touches the screen for one UIUpdate() and releases it for the next
+static int tap(int x, int y)
+{
+  hostSetTouch(x, y);
+  int id = UIUpdate();
+  hostSetTouch(-1, -1);
+  UIUpdate();
+  return id;
+}
+
+// The scripted touch of main() is due at 300 ms, and held for 50 ms
+static int testWait(void)
+{
+  int failures = 0, x, y;
+  KEYEvent event;
+
+  if (KEYGetXY(&x, &y) != 0 || x != 30 || y != 40 || halMillis() < 300 || halMillis() > 310)
+  {
+    printf("KEYGetXY gave %d,%d at %u ms\n", x, y, (unsigned)halMillis());
+    failures++;
+  }
+
+  if (KEYGetEvent(&event) != 0 || event.type != KEY_TOUCH_DOWN || event.x != 30 || event.time < 300 ||
+      KEYGetEvent(&event) != 0 || event.type != KEY_TOUCH_UP || event.y != 40 || event.time < 350)
+  {
+    printf("scripted touch events wrong\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+// The scripted press of key1 of main() is due at 400 ms, and held for 1000 ms
+static int testKeys(void)
+{
+  int failures = 0, key = KEYGet();
+  uint32_t pressed = halMillis();
+  KEYEvent event;
+
+  if (key != KEY1 || pressed < 400 || pressed > 410 || KEYRead() != KEY1)
+  {
+    printf("KEYGet gave %d at %u ms\n", key, (unsigned)pressed);
+    failures++;
+  }
+
+  // Held from before, key1 is not pressed again
+  key = KEYGet(100);
+  if (key != NOKEY || halMillis() - pressed < 100 || halMillis() - pressed > 110 || KEYWait(KEY2, 50) != -1)
+  {
+    printf("held key gave %d after %u ms\n", key, (unsigned)(halMillis() - pressed));
+    failures++;
+  }
+
+  const int types[] = {KEY_PRESS, KEY_LONG_PRESS, KEY_RELEASE};
+  const uint32_t times[] = {400, 400 + KEY_LONG_PRESS_MS, 1400};
+
+  for (int k = 0; k < 3; k++)
+  {
+    if (KEYGetEvent(&event) != 0 || event.type != types[k] || event.key != KEY1 || event.x != -1 ||
+        event.time < times[k] || event.time > times[k] + 10)
+    {
+      printf("key event %d wrong at %u ms\n", k, (unsigned)event.time);
+      failures++;
+    }
+  }
+
+  // Without going to the pins, reading the keys costs next to nothing
+  hostSetButton(HAL_BUTTON_RIGHT, 1);
+  uint64_t start = hostClockMicros();
+  for (int k = 0; k < 100; k++)
+    key = KEYRead();
+  uint64_t elapsed = hostClockMicros() - start;
+  hostSetButton(HAL_BUTTON_RIGHT, 0);
+
+  if (key != KEY2 || elapsed >= 200 || KEYRead() != NOKEY)
+  {
+    printf("KEYRead gave %d in %u us for 100 reads\n", key, (unsigned)elapsed);
+    failures++;
+  }
+
+  while (KEYReadEvent(&event) == 0)
+    ;
+
+  return failures;
+}
+
+static int testEvents(void)
+{
+  int failures = 0, x, y;
+  KEYEvent event;
+
+  while (KEYReadEvent(&event) == 0)
+    ;
+
+  hostSetTouch(10, 20);
+  hostSetTouch(12, 25);
+  hostSetTouch(12, 25);
+  halDelay(5);
+  hostSetTouch(-1, -1);
+
+  const int types[] = {KEY_TOUCH_DOWN, KEY_TOUCH_MOVE, KEY_TOUCH_UP};
+  const int xs[] = {10, 12, 12};
+  uint32_t last = 0;
+
+  for (int k = 0; k < 3; k++)
+  {
+    if (KEYReadEvent(&event) != 0 || event.type != types[k] || event.x != xs[k] || event.time < last)
+    {
+      printf("touch event %d wrong\n", k);
+      failures++;
+    }
+    last = event.time;
+  }
+
+  if (KEYReadEvent(&event) != -1 || KEYReadEvent(NULL) != -1)
+  {
+    printf("touch events left over\n");
+    failures++;
+  }
+
+  // Without going to the controller, reading the touch screen costs next to nothing
+  hostSetTouch(50, 60);
+  uint64_t start = hostClockMicros();
+  for (int k = 0; k < 100; k++)
+    KEYReadXY(&x, &y);
+  uint64_t elapsed = hostClockMicros() - start;
+  hostSetTouch(-1, -1);
+
+  if (x != 50 || y != 60 || elapsed >= 200)
+  {
+    printf("KEYReadXY gave %d,%d in %u us for 100 reads\n", x, y, (unsigned)elapsed);
+    failures++;
+  }
+
+  while (KEYReadEvent(&event) == 0)
+    ;
+
+  return failures;
+}
+
+static int testButtons(void)
+{
+  int failures = 0, count = 0;
+
+  LCDClear();
+  int button = UIButton(10, 10, 80, 30, "GO", BLACK, WHITE);
+  int label = UILabel(10, 50, 80, 20, "label", WHITE, BLUE);
+  UISetCallback(button, onEvent, &count);
+
+  // Held down, a touch acts once
+  hostSetTouch(20, 20);
+  int first = UIUpdate(), second = UIUpdate();
+  if (first != button || second != -1 || UIGetValue(button) != 1 || count != 1 || gCallId != button || gCallValue != 1)
+  {
+    printf("held touch gave %d then %d, value %d, %d calls\n", first, second, UIGetValue(button), count);
+    failures++;
+  }
+
+  if (LCDGetPixel(10, 10) != BLACK)
+  {
+    printf("touched button not highlighted\n");
+    failures++;
+  }
+
+  hostSetTouch(-1, -1);
+  halDelay(UI_FLASH_MS);
+  UIUpdate();
+  if (LCDGetPixel(10, 10) != WHITE)
+  {
+    printf("button still highlighted after %d ms\n", UI_FLASH_MS);
+    failures++;
+  }
+
+  if (tap(20, 55) != -1 || tap(200, 200) != -1 || UIGetValue(label) != 0)
+  {
+    printf("label or empty space touched\n");
+    failures++;
+  }
+
+  // The last widget added is on top where two overlap
+  int top = UIButton(50, 20, 40, 20, "TOP", WHITE, RED);
+  if (tap(60, 25) != top || tap(20, 20) != button || UIGetValue(button) != 2)
+  {
+    printf("overlapping buttons hit wrongly\n");
+    failures++;
+  }
+
+  // New text is drawn by the next update within the label's box
+  UISetText(label, "other");
+  UIUpdate();
+  if (LCDGetPixel(10, 50) != BLUE)
+  {
+    printf("label background changed\n");
+    failures++;
+  }
+
+  UIRemove(top);
+  if (tap(60, 25) != button || UIRemove(top) != -1 || UISetText(top, "x") != -1)
+  {
+    printf("removed button still there\n");
+    failures++;
+  }
+
+  UIClear();
+  if (tap(20, 20) != -1 || UIButton(0, 0, 0, 10, "", WHITE, BLACK) != -1)
+  {
+    printf("cleared or empty button touched\n");
+    failures++;
+  }
+
+  int ids = 0;
+  while (UIButton(ids % 10 * 17, ids / 10 * 20, 16, 19, "", WHITE, BLACK) >= 0)
+    ids++;
+  if (ids != UI_MAX_WIDGETS)
+  {
+    printf("%d widgets for %d\n", ids, UI_MAX_WIDGETS);
+    failures++;
+  }
+  UIClear();
+
+  return failures;
+}
+
+static int testStepper(void)
+{
+  int failures = 0, count = 0;
+
+  LCDClear();
+  int stepper = UIStepper(0, 100, 150, 30, 15, 0, 30, 10, WHITE, BLACK);
+  UISetCallback(stepper, onEvent, &count);
+
+  tap(10, 110);
+  tap(10, 110);
+  tap(10, 110);
+  int low = UIGetValue(stepper);
+  tap(140, 110);
+  int up = UIGetValue(stepper);
+  tap(75, 110);
+  int centre = UIGetValue(stepper);
+  for (int k = 0; k < 5; k++)
+    tap(140, 110);
+
+  if (low != 0 || up != 10 || centre != 10 || UIGetValue(stepper) != 30 || count != 9)
+  {
+    printf("stepper gave %d, %d, %d, %d with %d calls\n", low, up, centre, UIGetValue(stepper), count);
+    failures++;
+  }
+
+  // Held on its minus third for 1 s from 30: a step at once, another after
+  // UI_REPEAT_DELAY_MS and then one every UI_REPEAT_MS, held at the minimum
+  count = 0;
+  UISetValue(stepper, 30);
+  int values[2];
+  hostSetTouch(10, 110);
+  for (int t = 0; t <= 1000; t += 10)
+  {
+    UIUpdate();
+    if (t == UI_REPEAT_DELAY_MS - 50 || t == UI_REPEAT_DELAY_MS + 50)
+      values[t > UI_REPEAT_DELAY_MS] = UIGetValue(stepper);
+    halDelay(10);
+  }
+  hostSetTouch(-1, -1);
+  UIUpdate();
+
+  if (values[0] != 20 || values[1] != 10 || UIGetValue(stepper) != 0 ||
+      count < 1 + (1000 - UI_REPEAT_DELAY_MS)/UI_REPEAT_MS || count > 2 + (1000 - UI_REPEAT_DELAY_MS)/UI_REPEAT_MS)
+  {
+    printf("held stepper gave %d, %d, %d with %d calls\n", values[0], values[1], UIGetValue(stepper), count);
+    failures++;
+  }
+
+  UISetValue(stepper, -5);
+  if (UIGetValue(stepper) != 0 || UIStepper(0, 0, 30, 30, 0, 5, 1, 1, WHITE, BLACK) != -1)
+  {
+    printf("stepper range not kept\n");
+    failures++;
+  }
+
+  UIClear();
+  return failures;
+}
+
+static int testMenu(void)
+{
+  int failures = 0;
+
+  LCDClear();
+  LCDMenu((char*)"A", (char*)"B", (char*)"", (char*)"D");
+  LCDMenuI(2, (char*)"b", WHITE, BLACK);
+
+  int keys[4], released = NOKEY;
+  for (int k = 0; k < 4; k++)
+  {
+    hostSetTouch(k*LCD_WIDTH/4 + 5, LCD_HEIGHT - 5);
+    UIUpdate();
+    keys[k] = KEYRead();
+    hostSetTouch(-1, -1);
+    UIUpdate();
+    released |= KEYRead();
+  }
+
+  if (keys[0] != KEY1 || keys[1] != KEY2 || keys[2] != NOKEY || keys[3] != KEY4 || released != NOKEY)
+  {
+    printf("menu keys %d %d %d %d, %d released\n", keys[0], keys[1], keys[2], keys[3], released);
+    failures++;
+  }
+
+  // KEYRead() leaves the touch to the program's UIUpdate()
+  hostSetTouch(5, LCD_HEIGHT - 5);
+  int before = KEYRead(), id = UIUpdate();
+  hostSetTouch(-1, -1);
+  UIUpdate();
+  if (before != NOKEY || id < 0)
+  {
+    printf("KEYRead took the touch of UIUpdate\n");
+    failures++;
+  }
+
+  halDelay(UI_FLASH_MS);
+  UIUpdate();
+
+  if (LCDGetPixel(LCD_WIDTH/4, LCD_HEIGHT - 1) != BLACK || LCDGetPixel(0, LCD_HEIGHT - 1) != WHITE || LCDMenuI(5, (char*)"E", WHITE, BLACK) != -1)
+  {
+    printf("menu entry 2 not replaced\n");
+    failures++;
+  }
+
+  UIClear();
+  hostSetTouch(5, LCD_HEIGHT - 5);
+  UIUpdate();
+  if (KEYRead() != NOKEY)
+  {
+    printf("cleared menu still read\n");
+    failures++;
+  }
+  hostSetTouch(-1, -1);
+
+  return failures;
+}
+
+static void benchIdle(void *arg) { UIUpdate(); }
+static void benchRedraw(void *arg) { UIRedraw(); }
+
+static void benchUpdate(void)
+{
+  LCDClear();
+  for (int k = 0; k < 8; k++)
+    UIButton(k % 4 * 40, k / 4 * 40, 38, 38, "BTN", WHITE, BLUE);
+
+  BENCHStats stats;
+  if (BENCHRun(benchIdle, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=UIUpdate widgets=8 changed=0", &stats);
+  if (BENCHRun(benchRedraw, NULL, 200, &stats) == 0)
+    BENCHPrint("bench=UIRedraw widgets=8", &stats);
+
+  UIClear();
+}
+
+int main(void)
+{
+  setenv("EYEBOT_SCRIPT", "300 touch 30 40 50;400 key1 1000", 1);
+  hostClockVirtual(1);
+  EYEBOTInit();
+
+  int failures = testWait();
+  failures += testKeys();
+  failures += testEvents();
+  failures += testButtons();
+  failures += testStepper();
+  failures += testMenu();
+  benchUpdate();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? 1 : 0;
+}